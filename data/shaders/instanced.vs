@@ -1,32 +1,44 @@
-attribute vec3 a_vertex;
-attribute vec3 a_normal;
-attribute vec2 a_uv;
+#version 330 core
 
+in vec3 a_vertex;
+in vec3 a_normal;
+in vec2 a_coord;
+in vec4 a_color;
+in vec4 a_tangent; //(0,0,0,1) when the mesh doesn't have tangents
 
-attribute mat4 u_model;
+//the model comes from the instances buffer (one per instance) instead of a uniform
+in mat4 u_model;
 
 uniform vec3 u_camera_pos;
 
 uniform mat4 u_viewprojection;
 
 //this will store the color for the pixel shader
-varying vec3 v_position;
-varying vec3 v_world_position;
-varying vec3 v_normal;
-varying vec2 v_uv;
+out vec3 v_position;
+out vec3 v_world_position;
+out vec3 v_normal;
+out vec2 v_uv;
+out vec4 v_color;
+out vec4 v_tangent;
+
+uniform float u_time;
 
 void main()
 {	
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
 	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_tangent = vec4( (u_model * vec4( a_tangent.xyz, 0.0) ).xyz, a_tangent.w );
 	
 	//calcule the vertex in object space
 	v_position = a_vertex;
-	v_world_position = (u_model * vec4( a_vertex, 1.0) ).xyz;
+	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
 	
+	//store the color in the varying var to use it from the pixel shader
+	v_color = a_color;
+
 	//store the texture coordinates
-	v_uv = a_uv;
+	v_uv = a_coord;
 
 	//calcule the position of the vertex using the matrices
 	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
-}
\ No newline at end of file
+}
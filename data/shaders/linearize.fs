@@ -6,8 +6,7 @@ in vec2 v_uv;
 //Uniforms
 uniform vec2 u_camera_nearfar;
 uniform sampler2D u_texture; //depth map
-uniform float u_shadow_index;
-uniform float u_num_shadows;
+uniform vec4 u_shadow_tile; //Region of the shadow atlas: x, y, width, height
 
 //Output
 out vec4 FragColor;
@@ -16,7 +15,7 @@ void main()
 {
 	//Shadow atlas coordinates
 	vec2 shadow_uv = v_uv;
-	shadow_uv.x = (shadow_uv.x + u_shadow_index)/u_num_shadows;
+	shadow_uv = u_shadow_tile.xy + shadow_uv * u_shadow_tile.zw;
 
 	float n = u_camera_nearfar.x;
 	float f = u_camera_nearfar.y;
@@ -4,6 +4,7 @@
 in vec3 v_world_position;
 in vec3 v_normal;
 in vec2 v_uv;
+in vec4 v_tangent;
 
 //Material factors
 uniform vec3 u_albedo_factor;
@@ -33,26 +34,38 @@ uniform bool u_last_iteration;
 uniform vec4 u_color;
 uniform float u_alpha_cutoff;
 
-//Global light uniforms
-uniform vec3 u_light_position;
-uniform vec3 u_light_color;
-uniform float u_light_intensity;
-uniform float u_light_max_distance;
-uniform int u_light_type;
-
-//Spot light uniforms
-uniform vec3 u_spot_direction;
-uniform vec2 u_spot_cone;
+//Lights buffer: filled once per frame by the renderer, every light takes 10 texels laid out as sLightData in renderer.h
+struct Light
+{
+	vec4 position;	//xyz: position, w: intensity
+	vec4 color;		//xyz: color, w: max distance
+	vec4 direction;	//xyz: spot direction or directional front, w: light type
+	vec4 cone;		//x: cone exponent, y: cosine of the cone angle, z: cast shadows
+	vec4 shadow;	//x: shadow bias
+	vec4 shadow_tile;	//Region of the shadow atlas: x, y, width, height
+	mat4 shadow_vp;
+};
+
+uniform samplerBuffer u_lights;
+
+Light getLight(in int index)
+{
+	int base = index * 10;
+	Light light;
+	light.position = texelFetch(u_lights, base);
+	light.color = texelFetch(u_lights, base + 1);
+	light.direction = texelFetch(u_lights, base + 2);
+	light.cone = texelFetch(u_lights, base + 3);
+	light.shadow = texelFetch(u_lights, base + 4);
+	light.shadow_tile = texelFetch(u_lights, base + 5);
+	light.shadow_vp = mat4(texelFetch(u_lights, base + 6), texelFetch(u_lights, base + 7), texelFetch(u_lights, base + 8), texelFetch(u_lights, base + 9));
+	return light;
+}
 
-//Directional light uniforms
-uniform vec3 u_directional_front;
+//Light rendered in this pass
+uniform int u_light_index;
+Light light_data;
 
-//Shadows
-uniform bool u_cast_shadows;
-uniform float u_shadow_index;
-uniform float u_shadow_bias;
-uniform mat4 u_shadow_vp;
-uniform float u_num_shadows;
 
 //Output
 out vec4 FragColor;
@@ -79,11 +92,18 @@ mat3 cotangent_frame(in vec3 N, in vec3 p, in vec2 uv)
 vec3 perturbNormal(in vec3 N, in vec3 WP, in vec2 uv, in vec3 normal_pixel)
 {
 	normal_pixel = normal_pixel * 255./127. - 128./127.;
-	mat3 TBN = cotangent_frame(N, WP, uv);
+	mat3 TBN;
+	if( dot(v_tangent.xyz, v_tangent.xyz) > 0.0 ) //tangents of the mesh, w is the handedness
+	{
+		vec3 T = normalize(v_tangent.xyz - N * dot(N, v_tangent.xyz));
+		TBN = mat3( T, cross(N, T) * v_tangent.w, N );
+	}
+	else
+		TBN = cotangent_frame(N, WP, uv);
 	return normalize(TBN * normal_pixel);
 }
 
-float testShadowMap(in float shadow_index, in float num_shadows,in float shadows_bias, in vec3 world_position, in mat4 shadow_vp, in sampler2D shadow_atlas){
+float testShadowMap(in vec4 shadow_tile, in float shadows_bias, in vec3 world_position, in mat4 shadow_vp, in sampler2D shadow_atlas){
 	//project our 3D position to the shadowmap
 	vec4 proj_pos = shadow_vp * vec4(world_position,1.0);
 
@@ -97,7 +117,7 @@ float testShadowMap(in float shadow_index, in float num_shadows,in float shadows
 	if( shadow_uv.x < 0.0 || shadow_uv.x > 1.0 || shadow_uv.y < 0.0 || shadow_uv.y > 1.0 ) return 1.0;
 
 	//Shadow atlas coordinates
-	shadow_uv.x = (shadow_uv.x + shadow_index)/num_shadows;
+	shadow_uv = shadow_tile.xy + shadow_uv * shadow_tile.zw;
 
 	//read depth from depth buffer in [0..+1] non-linear
 	float shadow_depth = texture2D( shadow_atlas, shadow_uv).x;
@@ -137,13 +157,13 @@ vec3 PhongEquation(in vec3 light_vector, in float light_intensity, in float ligh
 
     //Shadow factor
 	float shadow_factor = 1.0;
-	if(u_cast_shadows) shadow_factor = testShadowMap(u_shadow_index, u_num_shadows,u_shadow_bias, v_world_position, u_shadow_vp, u_shadow_atlas);
+	if(light_data.cone.z > 0.0) shadow_factor = testShadowMap(light_data.shadow_tile, light_data.shadow.x, v_world_position, light_data.shadow_vp, u_shadow_atlas);
 
     //Compute attenuation factor
     float attenuation_factor = 1.0;
     if(light_attenuation)
     {
-	    float light_max_distance = max(u_light_max_distance,0.0);
+	    float light_max_distance = max(light_data.color.w,0.0);
 	    attenuation_factor =  light_max_distance - light_distance;
 		attenuation_factor /= light_max_distance;
 		attenuation_factor = pow(max( attenuation_factor, 0.0 ),2.0);
@@ -175,7 +195,7 @@ vec3 PhongEquation(in vec3 light_vector, in float light_intensity, in float ligh
 	}
 
     //Phong equation
-	vec3 light = attenuation_factor *(diffuse_factor + specular_factor) * u_light_color * light_intensity * shadow_factor;
+	vec3 light = attenuation_factor *(diffuse_factor + specular_factor) * light_data.color.xyz * light_intensity * shadow_factor;
 
 	//Return light
 	return light;
@@ -187,6 +207,9 @@ void main()
 	if(u_color.a < u_alpha_cutoff)
 		discard;
 
+	//Light of this pass
+	light_data = getLight(u_light_index);
+
 	//Albedo value
 	vec4 color;
 	if(u_textures[0] == 1) color = texture2D(u_albedo_texture, v_uv );
@@ -214,12 +237,12 @@ void main()
 	vec3 phong_light = ambient_factor * u_ambient_light;
 
 	//Light intesity
-	float light_intensity = u_light_intensity;
+	float light_intensity = light_data.position.w;
 
-	if(u_light_type == 0) //point light
+	if(int(light_data.direction.w) == 0) //point light
 	{
 		//Light vector
-		vec3 light_vector = u_light_position - v_world_position;
+		vec3 light_vector = light_data.position.xyz - v_world_position;
 
 		//Light distance
 		float light_distance = length(light_vector);
@@ -230,10 +253,10 @@ void main()
 		//Phong Equation
 		phong_light += PhongEquation(light_vector,light_intensity,light_distance, normal_vector, true);
 	}
-	else if(u_light_type == 1)//spot light
+	else if(int(light_data.direction.w) == 1)//spot light
 	{
 		//Light vector
-		vec3 light_vector = u_light_position - v_world_position;
+		vec3 light_vector = light_data.position.xyz - v_world_position;
 
 		//Light distance
 		float light_distance = length(light_vector);
@@ -242,25 +265,25 @@ void main()
 		light_vector /= light_distance;
 
 		//Orient spot vector
-		vec3 spot_vector = -u_spot_direction;
+		vec3 spot_vector = -light_data.direction.xyz;
 
 		//Compute the cosine of the angle between previous vectors
 		float spot_cosine = dot(light_vector,spot_vector);
 
 		//Check if the pixel is within the cone
-		if(spot_cosine >= u_spot_cone.y)
+		if(spot_cosine >= light_data.cone.y)
 		{
 			//Light intesity
-			light_intensity *= pow(spot_cosine,max(u_spot_cone.x,0.0));
+			light_intensity *= pow(spot_cosine,max(light_data.cone.x,0.0));
 
 			//Phong Equation
 			phong_light += PhongEquation(light_vector,light_intensity,light_distance, normal_vector, true);
 		} 
 	}
-	else if(u_light_type == 2) //directional light
+	else if(int(light_data.direction.w) == 2) //directional light
 	{
 		//Light vector
-		vec3 light_vector = u_directional_front;
+		vec3 light_vector = light_data.direction.xyz;
 
 		//Light distance
 		float light_distance = length(light_vector);
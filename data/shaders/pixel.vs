@@ -4,6 +4,7 @@ in vec3 a_vertex;
 in vec3 a_normal;
 in vec2 a_coord;
 in vec4 a_color;
+in vec4 a_tangent; //(0,0,0,1) when the mesh doesn't have tangents
 
 uniform vec3 u_camera_pos;
 
@@ -16,6 +17,7 @@ out vec3 v_world_position;
 out vec3 v_normal;
 out vec2 v_uv;
 out vec4 v_color;
+out vec4 v_tangent;
 
 uniform float u_time;
 
@@ -23,6 +25,7 @@ void main()
 {	
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
 	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_tangent = vec4( (u_model * vec4( a_tangent.xyz, 0.0) ).xyz, a_tangent.w );
 	
 	//calcule the vertex in object space
 	v_position = a_vertex;
@@ -4,6 +4,7 @@
 in vec3 v_world_position;
 in vec3 v_normal;
 in vec2 v_uv;
+in vec4 v_tangent;
 
 //Material factors
 uniform vec3 u_albedo_factor;
@@ -33,30 +34,47 @@ uniform bool u_last_iteration;
 uniform vec4 u_color;
 uniform float u_alpha_cutoff;
 
-//Single pass maximum number of lights to render
-const int MAX_LIGHTS = 5;
+//Lights buffer: filled once per frame by the renderer, every light takes 10 texels laid out as sLightData in renderer.h
+struct Light
+{
+	vec4 position;	//xyz: position, w: intensity
+	vec4 color;		//xyz: color, w: max distance
+	vec4 direction;	//xyz: spot direction or directional front, w: light type
+	vec4 cone;		//x: cone exponent, y: cosine of the cone angle, z: cast shadows
+	vec4 shadow;	//x: shadow bias
+	vec4 shadow_tile;	//Region of the shadow atlas: x, y, width, height
+	mat4 shadow_vp;
+};
+
+uniform samplerBuffer u_lights;
+
+Light getLight(in int index)
+{
+	int base = index * 10;
+	Light light;
+	light.position = texelFetch(u_lights, base);
+	light.color = texelFetch(u_lights, base + 1);
+	light.direction = texelFetch(u_lights, base + 2);
+	light.cone = texelFetch(u_lights, base + 3);
+	light.shadow = texelFetch(u_lights, base + 4);
+	light.shadow_tile = texelFetch(u_lights, base + 5);
+	light.shadow_vp = mat4(texelFetch(u_lights, base + 6), texelFetch(u_lights, base + 7), texelFetch(u_lights, base + 8), texelFetch(u_lights, base + 9));
+	return light;
+}
 
-//Global lights uniforms
-uniform vec3 u_lights_position[MAX_LIGHTS];
-uniform vec3 u_lights_color[MAX_LIGHTS];
-uniform float u_lights_intensity[MAX_LIGHTS];
-uniform float u_lights_max_distance[MAX_LIGHTS];
-uniform int u_lights_type[MAX_LIGHTS];
+//Lights rendered in this pass
+uniform int u_lights_offset;
 uniform int u_num_lights;
 
-//Spot lights uniforms
-uniform vec3 u_spots_direction[MAX_LIGHTS];
-uniform vec2 u_spots_cone[MAX_LIGHTS];
+//Light clusters: each fragment only evaluates the lights assigned to its cluster of the view frustum
+uniform bool u_clustered;
+uniform usamplerBuffer u_cluster_grid;		//Offset and count in u_cluster_lights of each cluster
+uniform usamplerBuffer u_cluster_lights;	//Light indices of every cluster
+uniform ivec3 u_cluster_dims;
+uniform vec2 u_cluster_depth;				//Scale and bias from log(view depth) to depth slice
+uniform vec2 u_cluster_viewport;
+uniform vec3 u_camera_front;
 
-//Directional lights uniforms
-uniform vec3 u_directionals_front[MAX_LIGHTS];
-
-//Shadows
-uniform bool u_cast_shadows[MAX_LIGHTS];
-uniform float u_shadows_index[MAX_LIGHTS];
-uniform float u_shadows_bias[MAX_LIGHTS];
-uniform mat4 u_shadows_vp[MAX_LIGHTS];
-uniform float u_num_shadows;
 
 //Output
 out vec4 FragColor;
@@ -83,11 +101,18 @@ mat3 cotangent_frame(in vec3 N, in vec3 p, in vec2 uv)
 vec3 perturbNormal(in vec3 N, in vec3 WP, in vec2 uv, in vec3 normal_pixel)
 {
 	normal_pixel = normal_pixel * 255./127. - 128./127.;
-	mat3 TBN = cotangent_frame(N, WP, uv);
+	mat3 TBN;
+	if( dot(v_tangent.xyz, v_tangent.xyz) > 0.0 ) //tangents of the mesh, w is the handedness
+	{
+		vec3 T = normalize(v_tangent.xyz - N * dot(N, v_tangent.xyz));
+		TBN = mat3( T, cross(N, T) * v_tangent.w, N );
+	}
+	else
+		TBN = cotangent_frame(N, WP, uv);
 	return normalize(TBN * normal_pixel);
 }
 
-float testShadowMap(in float shadow_index, in float num_shadows,in float shadows_bias, in vec3 world_position, in mat4 shadow_vp, in sampler2D shadow_atlas){
+float testShadowMap(in vec4 shadow_tile, in float shadows_bias, in vec3 world_position, in mat4 shadow_vp, in sampler2D shadow_atlas){
 	//project our 3D position to the shadowmap
 	vec4 proj_pos = shadow_vp * vec4(world_position,1.0);
 
@@ -101,7 +126,7 @@ float testShadowMap(in float shadow_index, in float num_shadows,in float shadows
 	if( shadow_uv.x < 0.0 || shadow_uv.x > 1.0 || shadow_uv.y < 0.0 || shadow_uv.y > 1.0 ) return 1.0;
 
 	//Shadow atlas coordinates
-	shadow_uv.x = (shadow_uv.x + shadow_index)/num_shadows;
+	shadow_uv = shadow_tile.xy + shadow_uv * shadow_tile.zw;
 
 	//read depth from depth buffer in [0..+1] non-linear
 	float shadow_depth = texture2D( shadow_atlas, shadow_uv).x;
@@ -125,7 +150,7 @@ float testShadowMap(in float shadow_index, in float num_shadows,in float shadows
 	return shadow_factor;
 }
 
-vec3 PhongEquation(in int index, in vec3 light_vector, in float light_intensity, in float light_distance, in vec3 normal_vector, in bool light_attenuation)
+vec3 PhongEquation(in Light light_data, in vec3 light_vector, in float light_intensity, in float light_distance, in vec3 normal_vector, in bool light_attenuation)
 {
 	//Compute vectors
 	vec3 L = light_vector;
@@ -141,14 +166,14 @@ vec3 PhongEquation(in int index, in vec3 light_vector, in float light_intensity,
 
 	//Shadow factor
 	float shadow_factor = 1.0;
-	if(u_cast_shadows[index]) shadow_factor = testShadowMap(u_shadows_index[index], u_num_shadows,u_shadows_bias[index], v_world_position, u_shadows_vp[index], u_shadow_atlas);
+	if(light_data.cone.z > 0.0) shadow_factor = testShadowMap(light_data.shadow_tile, light_data.shadow.x, v_world_position, light_data.shadow_vp, u_shadow_atlas);
 
     //Compute attenuation factor
     float attenuation_factor = 1.0;
     if(light_attenuation)
     {
-	    attenuation_factor =  u_lights_max_distance[index] - light_distance;
-		attenuation_factor /= u_lights_max_distance[index];
+	    attenuation_factor =  light_data.color.w - light_distance;
+		attenuation_factor /= light_data.color.w;
 		attenuation_factor = pow(max( attenuation_factor, 0.0 ),2.0);
 	}
 
@@ -178,12 +203,80 @@ vec3 PhongEquation(in int index, in vec3 light_vector, in float light_intensity,
 	}
 
     //Phong equation
-	vec3 light = attenuation_factor * (diffuse_factor + specular_factor) * u_lights_color[index] * light_intensity * shadow_factor;
+	vec3 light = attenuation_factor * (diffuse_factor + specular_factor) * light_data.color.xyz * light_intensity * shadow_factor;
 
 	//Return light
 	return light;
 }
 
+vec3 LightEquation(in int index, in vec3 normal_vector)
+{
+	//Light data
+	Light light_data = getLight(index);
+
+	//Light intensisty
+	float light_intensity = light_data.position.w;
+
+	if(int(light_data.direction.w) == 0) //point light
+	{
+		//Light vector
+		vec3 light_vector = light_data.position.xyz - v_world_position;
+
+		//Light distance
+		float light_distance = length(light_vector);
+
+		//Normalize light vector
+		light_vector /= light_distance;
+
+		//Phong Equation
+		return PhongEquation(light_data, light_vector, light_intensity, light_distance, normal_vector, true);
+	}
+	else if(int(light_data.direction.w) == 1)//spot light
+	{
+		//Light vector
+		vec3 light_vector = light_data.position.xyz - v_world_position;
+
+		//Light distance
+		float light_distance = length(light_vector);
+
+		//Normalize light vector
+		light_vector /= light_distance;
+
+		//Orient spot vector
+		vec3 spot_vector = -light_data.direction.xyz;
+
+		//Compute the cosine of the angle between previous vectors
+		float spot_cosine = dot(light_vector,spot_vector);
+
+		//Check if the pixel is within the cone
+		if(spot_cosine >= light_data.cone.y)
+		{
+			//Light intesity
+			light_intensity *= pow(spot_cosine,max(light_data.cone.x,0.0));
+
+			//Phong Equation
+			return PhongEquation(light_data, light_vector, light_intensity, light_distance, normal_vector, true);
+		}
+
+	}
+	else if(int(light_data.direction.w) == 2) //directional light
+	{
+		//Light vector
+		vec3 light_vector = light_data.direction.xyz;
+
+		//Light distance
+		float light_distance = length(light_vector);
+
+		//Normalize light vector
+		light_vector /= light_distance;
+
+		//Phong Equation
+		return PhongEquation(light_data, light_vector, light_intensity, light_distance, normal_vector, false);
+	}
+
+	return vec3(0.0);
+}
+
 void main()
 {
 	//Alpha mask
@@ -216,72 +309,30 @@ void main()
 	//Set ambient light to phong light
 	vec3 phong_light = ambient_factor * u_ambient_light;
 
-	//Single pass for loop
-	for( int i = 0; i < MAX_LIGHTS; ++i )
+	if(u_clustered)
 	{
-		if(i < u_num_lights)
+		//Cluster of the fragment
+		float view_depth = dot(v_world_position - u_camera_position, u_camera_front);
+		ivec3 cluster;
+		cluster.xy = ivec2(gl_FragCoord.xy / u_cluster_viewport * vec2(u_cluster_dims.xy));
+		cluster.z = int(floor(log(max(view_depth, 0.0001)) * u_cluster_depth.x + u_cluster_depth.y));
+		cluster = clamp(cluster, ivec3(0), u_cluster_dims - 1);
+		int cluster_index = cluster.x + u_cluster_dims.x * (cluster.y + u_cluster_dims.y * cluster.z);
+
+		//Lights of the cluster
+		uvec2 cluster_data = texelFetch(u_cluster_grid, cluster_index).xy;
+		for( int i = 0; i < int(cluster_data.y); ++i )
 		{
-			//Light intensisty
-			float light_intensity = u_lights_intensity[i];
-
-			if(u_lights_type[i] == 0) //point light
-			{
-				//Light vector
-				vec3 light_vector = u_lights_position[i] - v_world_position;
-
-				//Light distance
-				float light_distance = length(light_vector);
-
-				//Normalize light vector
-				light_vector /= light_distance;
-
-				//Phong Equation
-				phong_light += PhongEquation(i, light_vector, light_intensity, light_distance, normal_vector, true);
-			}
-			else if(u_lights_type[i] == 1)//spot light
-			{
-				//Light vector
-				vec3 light_vector = u_lights_position[i] - v_world_position;
-
-				//Light distance
-				float light_distance = length(light_vector);
-
-				//Normalize light vector
-				light_vector /= light_distance;
-
-				//Orient spot vector
-				vec3 spot_vector = -u_spots_direction[i];
-
-				//Compute the cosine of the angle between previous vectors
-				float spot_cosine = dot(light_vector,spot_vector);
-
-				//Check if the pixel is within the cone
-				if(spot_cosine >= u_spots_cone[i].y)
-				{
-					//Light intesity
-					light_intensity *= pow(spot_cosine,max(u_spots_cone[i].x,0.0));
-
-					//Phong Equation
-					phong_light += PhongEquation(i, light_vector, light_intensity, light_distance, normal_vector, true);
-				}
-
-			}
-			else if(u_lights_type[i] == 2) //directional light
-			{
-				//Light vector
-				vec3 light_vector = u_directionals_front[i];
-
-				//Light distance
-				float light_distance = length(light_vector);
-
-				//Normalize light vector
-				light_vector /= light_distance;
-
-				//Phong Equation
-				phong_light += PhongEquation(i, light_vector, light_intensity, light_distance, normal_vector, false);
-			}			
+			int index = int(texelFetch(u_cluster_lights, int(cluster_data.x) + i).x);
+			phong_light += LightEquation(index, normal_vector);
 		}
 	}
+	else
+	{
+		//Single pass for loop
+		for( int i = 0; i < u_num_lights; ++i )
+			phong_light += LightEquation(u_lights_offset + i, normal_vector);
+	}
 
 	//Final color
 	color.rgb *= phong_light;
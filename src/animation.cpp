@@ -6,6 +6,7 @@
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
+#include "assetcache.h"
 
 #include <sys/stat.h>
 
@@ -236,7 +237,9 @@ bool Animation::load(const char* filename)
 	}
 	else //not a bin
 	{
-		std::string binfilename = name + ".abin";
+		//the binary is in the asset cache, named by the hash of the source, so a stale one is never read
+		std::string binstem = AssetCache::enabled ? AssetCache::getEntry(name, ANIM_BIN_VERSION) : name;
+		std::string binfilename = binstem + ".abin";
 		if (!loadABIN(binfilename.c_str())) //not found
 		{
 			//try to load in ASCII
@@ -247,7 +250,8 @@ bool Animation::load(const char* filename)
 			}
 
 			std::cout << "[Writing .ABIN] ... ";
-			writeABIN( filename );
+			if (binstem.size())
+				writeABIN( binstem.c_str() );
 		}
 	}
 
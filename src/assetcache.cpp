@@ -0,0 +1,210 @@
+#include "assetcache.h"
+#include "mesh.h"
+#include "animation.h"
+#include "utils.h"
+#include <filesystem>
+#include <algorithm>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+bool AssetCache::enabled = true;
+string AssetCache::directory = "data/cache/";
+mutex AssetCache::mutex;
+map<string, uint64_t> AssetCache::file_hashes;
+
+//FNV-1a over 8 bytes at a time, it only has to notice changes
+static uint64_t hashBytes64(const char* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t k;
+		memcpy(&k, data + i, 8);
+		k *= 0x9E3779B97F4A7C15ULL;
+		k ^= k >> 32;
+		hash = (hash ^ k) * 1099511628211ULL;
+	}
+	for (; i < size; ++i)
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+	return hash;
+}
+
+static string getExtension(const string& filename)
+{
+	size_t dot = filename.find_last_of(".");
+	string ext = dot == string::npos ? "" : filename.substr(dot + 1);
+	transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext;
+}
+
+static string normalizePath(const string& filename)
+{
+	return filesystem::path(filename).lexically_normal().generic_string();
+}
+
+uint64_t AssetCache::hashFile(const string& filename)
+{
+	string path = normalizePath(filename);
+	{
+		lock_guard<std::mutex> lock(mutex);
+		auto it = file_hashes.find(path);
+		if (it != file_hashes.end())
+			return it->second;
+	}
+
+	//hashed outside of the lock, two threads hashing the same file get the same result
+	uint64_t hash = 0;
+	sMappedFile file;
+	if (mapFile(path, file))
+	{
+		hash = hashBytes64(file.data, file.size, 14695981039346656037ULL ^ file.size);
+		if (!hash)
+			hash = 1;
+		unmapFile(file);
+	}
+
+	lock_guard<std::mutex> lock(mutex);
+	file_hashes[path] = hash;
+	return hash;
+}
+
+void AssetCache::invalidate()
+{
+	lock_guard<std::mutex> lock(mutex);
+	file_hashes.clear();
+}
+
+vector<string> AssetCache::getDependencies(const string& filename)
+{
+	vector<string> dependencies;
+	string ext = getExtension(filename);
+	if (ext != "obj" && ext != "mtl")
+		return dependencies;
+
+	string content;
+	if (!readFile(filename, content))
+		return dependencies;
+	filesystem::path folder = filesystem::path(filename).parent_path();
+
+	//obj: mtllib <file>, mtl: map_Kd [options] <file>, also bump, disp, decal and refl. The file is the last word
+	vector<string> lines = split(content, '\n');
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		vector<string> words = tokenize(lines[i], " \t\r");
+		if (words.size() < 2)
+			continue;
+		string& key = words[0];
+		bool is_dependency = ext == "obj" ? key == "mtllib" :
+			key.compare(0, 4, "map_") == 0 || key == "bump" || key == "disp" || key == "decal" || key == "refl";
+		if (!is_dependency)
+			continue;
+
+		string path = words.back();
+		replace(path.begin(), path.end(), '\\', '/');
+		dependencies.push_back(normalizePath((folder / path).string()));
+	}
+	return dependencies;
+}
+
+string AssetCache::getEntry(const string& filename, int importer_version)
+{
+	uint64_t source_hash = hashFile(filename);
+	if (!source_hash)
+		return "";
+
+	//the source and everything it depends on, once each. A missing dependency also counts, so it changes the entry when it appears
+	uint64_t hash = hashBytes64((const char*)&importer_version, sizeof(int), source_hash);
+	set<string> visited;
+	vector<string> pending = getDependencies(filename);
+	while (pending.size())
+	{
+		string dependency = pending.back();
+		pending.pop_back();
+		if (!visited.insert(dependency).second)
+			continue;
+		uint64_t dependency_hash = hashFile(dependency);
+		hash = hashBytes64((const char*)&dependency_hash, sizeof(uint64_t), hashBytes64(dependency.c_str(), dependency.size(), hash));
+		vector<string> children = getDependencies(dependency);
+		pending.insert(pending.end(), children.begin(), children.end());
+	}
+
+	error_code error;
+	filesystem::create_directories(directory, error);
+
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	return directory + filesystem::path(filename).filename().string() + "." + hex;
+}
+
+int AssetCache::cook(const string& assets_directory, int num_threads)
+{
+	long start_time = getTime();
+
+	//the binaries are written by the loaders, they only need to be told to use them
+	Mesh::use_binary = true;
+	enabled = true;
+
+	vector<string> files;
+	error_code error;
+	for (auto it = filesystem::recursive_directory_iterator(assets_directory, error); !error && it != filesystem::recursive_directory_iterator(); it.increment(error))
+	{
+		if (!it->is_regular_file())
+			continue;
+		string ext = getExtension(it->path().filename().string());
+		if (ext == "obj" || ext == "ase" || ext == "mesh" || ext == "skanim")
+			files.push_back(it->path().generic_string());
+	}
+	if (error)
+		cout << "[ERROR] cooking: cannot read the directory " << assets_directory << endl;
+	sort(files.begin(), files.end());
+
+	//every thread takes the next file until there are no more
+	atomic<int> next_file(0), num_cooked(0), num_cached(0), num_failed(0);
+	auto worker = [&]() {
+		for (int i = next_file++; i < (int)files.size(); i = next_file++)
+		{
+			const string& filename = files[i];
+			bool is_animation = getExtension(filename) == "skanim";
+			string entry = getEntry(filename, is_animation ? ANIM_BIN_VERSION : MESH_BIN_VERSION);
+			if (entry.size() && filesystem::exists(entry + (is_animation ? ".abin" : ".mbin")))
+			{
+				num_cached++;
+				continue;
+			}
+
+			bool loaded;
+			if (is_animation)
+			{
+				Animation animation;
+				loaded = animation.load(filename.c_str());
+			}
+			else
+			{
+				Mesh mesh;
+				loaded = mesh.load(filename.c_str());
+			}
+			if (loaded)
+				num_cooked++;
+			else
+				num_failed++;
+		}
+	};
+
+	if (num_threads <= 0)
+		num_threads = max(1, (int)thread::hardware_concurrency());
+	vector<thread> threads;
+	for (int i = 1; i < num_threads; ++i)
+		threads.push_back(thread(worker));
+	worker();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	cout << "Cooked " << num_cooked << " assets, " << num_cached << " up to date, " << num_failed << " failed, into " << directory << " Time: " << (getTime() - start_time) * 0.001 << "sec" << endl;
+	return num_failed;
+}
@@ -0,0 +1,39 @@
+#ifndef ASSETCACHE_H
+#define ASSETCACHE_H
+
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+//Directory with the binaries of the imported assets. Every entry is named by a hash of the content of its source, the
+//content of the files the source depends on (obj -> mtl -> textures) and the version of the importer, so an edited
+//source gets a new entry instead of loading a stale binary, and the binaries don't pollute the assets tree.
+//The entries can be built beforehand with the cooker: main --cook [directory]
+class AssetCache
+{
+public:
+	static bool enabled; //when disabled the binaries are stored next to their sources
+	static std::string directory;
+
+	//Path of the entry of a source, without extension (the importer adds its own). Empty if the source can't be read
+	static std::string getEntry(const std::string& filename, int importer_version);
+
+	//Files a source refers to: the material libraries of an obj and the textures of a mtl
+	static std::vector<std::string> getDependencies(const std::string& filename);
+
+	//Hash of the content of a file, 0 if it can't be read. It is computed once, call invalidate if the files change while running
+	static uint64_t hashFile(const std::string& filename);
+	static void invalidate();
+
+	//Import every mesh and animation of a directory into the cache with a pool of threads, returns the number of failures
+	static int cook(const std::string& assets_directory, int num_threads = 0);
+
+private:
+	static std::mutex mutex;
+	static std::map<std::string, uint64_t> file_hashes;
+};
+
+#endif
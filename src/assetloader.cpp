@@ -0,0 +1,199 @@
+#include "assetloader.h"
+#include "mesh.h"
+#include "texture.h"
+#include "material.h"
+#include "utils.h"
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+void (*AssetLoader::progress_callback)(float progress) = NULL;
+long AssetLoader::upload_budget = 8;
+
+AssetLoader::AssetLoader(int num_threads)
+{
+	this->num_threads = num_threads > 0 ? num_threads : max(1, (int)thread::hardware_concurrency());
+	this->load_ms = 0;
+	this->num_loaded = 0;
+}
+
+void AssetLoader::addMesh(const string& filename)
+{
+	if (Mesh::Get(filename.c_str(), false, true))
+		return;
+	for (size_t i = 0; i < assets.size(); ++i)
+		if (assets[i].type == MESH && assets[i].filename == filename)
+			return;
+
+	sAsset asset = { MESH, filename, NULL, NULL };
+	assets.push_back(asset);
+}
+
+void AssetLoader::addTexture(const string& filename)
+{
+	if (Texture::Find(filename.c_str()))
+		return;
+	for (size_t i = 0; i < assets.size(); ++i)
+		if (assets[i].type == TEXTURE && assets[i].filename == filename)
+			return;
+
+	sAsset asset = { TEXTURE, filename, NULL, NULL };
+	assets.push_back(asset);
+}
+
+void AssetLoader::addSceneAssets(cJSON* scene_json)
+{
+	addEntityAssets(cJSON_GetObjectItemCaseSensitive(scene_json, "main_character"));
+	addEntityAssets(cJSON_GetObjectItemCaseSensitive(scene_json, "monster"));
+
+	cJSON* objects_json = cJSON_GetObjectItemCaseSensitive(scene_json, "objects");
+	cJSON* object_json;
+	cJSON_ArrayForEach(object_json, objects_json)
+	{
+		if (readJSONNumber(object_json, "units", 0))
+			addEntityAssets(object_json);
+	}
+}
+
+//Same mesh and textures the entity will ask for in its load
+void AssetLoader::addEntityAssets(cJSON* entity_json)
+{
+	if (!entity_json)
+		return;
+
+	string mesh_path = readJSONString(entity_json, "mesh", "");
+	if (mesh_path.empty())
+		return;
+	addMesh(mesh_path);
+
+	string collision_mesh_path = readJSONString(entity_json, "collision_mesh", "");
+	if (!collision_mesh_path.empty())
+		addMesh(collision_mesh_path);
+
+	//the textures are only read the first time the material is created
+	cJSON* material_json = cJSON_GetObjectItemCaseSensitive(entity_json, "material");
+	if (!material_json || Material::Get(mesh_path.c_str()))
+		return;
+
+	const char* texture_properties[] = { "albedo_texture", "specular_texture", "normal_texture", "occlusion_texture", "metalness_texture", "roughness_texture", "omr_texture", "emissive_texture" };
+	for (int i = 0; i < 8; ++i)
+	{
+		string texture_path = readJSONString(material_json, texture_properties[i], "");
+		if (!texture_path.empty())
+			addTexture(texture_path);
+	}
+}
+
+void AssetLoader::load()
+{
+	long start_time = getTime();
+	num_loaded = 0;
+	if (assets.empty())
+		return;
+
+	//Decode stage: the workers take the assets one by one
+	atomic<int> next_asset(0);
+	int num_workers = min(num_threads, (int)assets.size());
+	vector<thread> workers;
+	for (int i = 0; i < num_workers; ++i)
+		workers.push_back(thread([this, &next_asset]() {
+			for (int index = next_asset++; index < (int)assets.size(); index = next_asset++)
+			{
+				decode(assets[index]);
+				{
+					lock_guard<std::mutex> lock(mutex);
+					decoded.push_back(index);
+				}
+				decoded_condition.notify_one();
+			}
+		}));
+
+	//Upload stage: the main thread uploads what is ready until the budget of the slice is spent
+	int num_uploaded = 0;
+	while (num_uploaded < (int)assets.size())
+	{
+		vector<int> ready;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			decoded_condition.wait_for(lock, chrono::milliseconds(upload_budget), [this]() { return !decoded.empty(); });
+			ready.swap(decoded);
+		}
+
+		long slice_start = getTime();
+		for (size_t i = 0; i < ready.size(); ++i)
+		{
+			upload(assets[ready[i]]);
+			num_uploaded++;
+
+			//the rest waits for the next slice
+			if (getTime() - slice_start >= upload_budget && i + 1 < ready.size())
+			{
+				lock_guard<std::mutex> lock(mutex);
+				decoded.insert(decoded.begin(), ready.begin() + i + 1, ready.end());
+				break;
+			}
+		}
+
+		if (progress_callback)
+			progress_callback(num_uploaded / (float)assets.size());
+	}
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	load_ms = getTime() - start_time;
+	cout << "Assets loaded: " << num_loaded << "/" << assets.size() << " Threads: " << num_workers << " Time: " << load_ms * 0.001 << "sec" << endl;
+	assets.clear();
+}
+
+//Worker thread: only CPU work
+void AssetLoader::decode(sAsset& asset)
+{
+	if (asset.type == MESH)
+	{
+		asset.mesh = new Mesh();
+		if (!asset.mesh->load(asset.filename.c_str()))
+		{
+			delete asset.mesh;
+			asset.mesh = NULL;
+		}
+	}
+	else
+	{
+		asset.image = new Image();
+		if (!asset.image->load(asset.filename.c_str()))
+		{
+			delete asset.image;
+			asset.image = NULL;
+		}
+	}
+}
+
+//Main thread: GL calls and registration in the managers
+void AssetLoader::upload(sAsset& asset)
+{
+	if (asset.type == MESH)
+	{
+		if (!asset.mesh) //Mesh::Get will try again and report the error
+			return;
+		if (Mesh::auto_upload_to_vram)
+		{
+			asset.mesh->uploadToVRAM();
+			if (!Mesh::keep_cpu_copies)
+				asset.mesh->releaseCPUCopies();
+		}
+		asset.mesh->registerMesh(asset.filename);
+	}
+	else
+	{
+		if (!asset.image)
+			return;
+		Texture* texture = new Texture();
+		texture->load(asset.filename.c_str(), asset.image);
+		delete asset.image;
+		asset.image = NULL;
+	}
+	num_loaded++;
+}
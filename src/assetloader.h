@@ -0,0 +1,62 @@
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#pragma once
+#include "extra/cJSON.h"
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+
+class Mesh;
+class Image;
+
+//Loads the meshes and textures of a scene before its entities are created.
+//The files are decoded by a pool of threads and the main thread, which owns the OpenGL context, uploads them in slices
+//of a few milliseconds, calling the progress callback between slices so the loading screen keeps updating.
+//The loaded assets are registered in the managers, so Mesh::Get and Texture::Get return them right away.
+class AssetLoader
+{
+public:
+
+	enum eAssetType { MESH, TEXTURE };
+
+	struct sAsset {
+		eAssetType type;
+		std::string filename;
+		Mesh* mesh; //decoded by a worker
+		Image* image;
+	};
+
+	static void (*progress_callback)(float progress); //progress from 0 to 1
+	static long upload_budget; //milliseconds of uploads between calls to the progress callback
+
+	std::vector<sAsset> assets;
+	int num_threads;
+
+	//Stats of the last load
+	long load_ms;
+	int num_loaded;
+
+	//Constructor
+	AssetLoader(int num_threads = 0);
+
+	//Add assets, the ones already loaded or added are skipped
+	void addMesh(const std::string& filename);
+	void addTexture(const std::string& filename);
+	void addSceneAssets(cJSON* scene_json);
+
+	//Decode and upload every asset, it returns when all of them are ready
+	void load();
+
+private:
+	std::mutex mutex;
+	std::condition_variable decoded_condition;
+	std::vector<int> decoded; //assets decoded and waiting to be uploaded
+
+	void addEntityAssets(cJSON* entity_json);
+	void decode(sAsset& asset);
+	void upload(sAsset& asset);
+};
+
+#endif
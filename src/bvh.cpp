@@ -0,0 +1,338 @@
+#include "bvh.h"
+#include <algorithm>
+
+using namespace std;
+
+static inline float surfaceArea(const Vector3& min, const Vector3& max)
+{
+	Vector3 size = max - min;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static inline Vector3 minVector(const Vector3& a, const Vector3& b) { return Vector3(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z)); }
+static inline Vector3 maxVector(const Vector3& a, const Vector3& b) { return Vector3(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z)); }
+
+static inline bool overlap(const Vector3& min_a, const Vector3& max_a, const Vector3& min_b, const Vector3& max_b)
+{
+	return min_a.x <= max_b.x && max_a.x >= min_b.x && min_a.y <= max_b.y && max_a.y >= min_b.y && min_a.z <= max_b.z && max_a.z >= min_b.z;
+}
+
+//slabs test, returns the distance where the ray enters the box or -1 if it misses it
+static inline float rayBoxDistance(const Vector3& origin, const Vector3& inv_direction, const Vector3& min, const Vector3& max, float max_dist)
+{
+	float t_near = 0.0f;
+	float t_far = max_dist;
+	for (int i = 0; i < 3; ++i)
+	{
+		float t0 = (min.v[i] - origin.v[i]) * inv_direction.v[i];
+		float t1 = (max.v[i] - origin.v[i]) * inv_direction.v[i];
+		if (t0 > t1)
+			swap(t0, t1);
+		//a NaN appears when the origin is on the plane of a slab parallel to the ray, the comparisons ignore it
+		if (t0 > t_near)
+			t_near = t0;
+		if (t1 < t_far)
+			t_far = t1;
+		if (t_near > t_far)
+			return -1.0f;
+	}
+	return t_near;
+}
+
+DynamicBVH::DynamicBVH()
+{
+	margin = 10.0f;
+	clear();
+}
+
+void DynamicBVH::clear()
+{
+	nodes.clear();
+	root = -1;
+	free_list = -1;
+	num_leaves = 0;
+}
+
+int DynamicBVH::allocateNode()
+{
+	int node;
+	if (free_list != -1)
+	{
+		node = free_list;
+		free_list = nodes[node].parent;
+	}
+	else
+	{
+		node = (int)nodes.size();
+		nodes.push_back(sNode());
+	}
+
+	sNode& n = nodes[node];
+	n.data = NULL;
+	n.parent = n.left = n.right = -1;
+	n.height = 0;
+	return node;
+}
+
+void DynamicBVH::freeNode(int node)
+{
+	nodes[node].parent = free_list;
+	nodes[node].height = -1;
+	free_list = node;
+}
+
+int DynamicBVH::insert(const BoundingBox& box, void* data)
+{
+	int leaf = allocateNode();
+	sNode& n = nodes[leaf];
+	n.min = box.center - box.halfsize - Vector3(margin);
+	n.max = box.center + box.halfsize + Vector3(margin);
+	n.data = data;
+	insertLeaf(leaf);
+	num_leaves++;
+	return leaf;
+}
+
+void DynamicBVH::remove(int proxy)
+{
+	if (proxy < 0 || proxy >= (int)nodes.size() || !nodes[proxy].isLeaf() || nodes[proxy].height != 0)
+		return;
+	removeLeaf(proxy);
+	freeNode(proxy);
+	num_leaves--;
+}
+
+bool DynamicBVH::update(int proxy, const BoundingBox& box)
+{
+	Vector3 box_min = box.center - box.halfsize;
+	Vector3 box_max = box.center + box.halfsize;
+	sNode& n = nodes[proxy];
+	if (n.min.x <= box_min.x && n.min.y <= box_min.y && n.min.z <= box_min.z && n.max.x >= box_max.x && n.max.y >= box_max.y && n.max.z >= box_max.z)
+		return false;
+
+	removeLeaf(proxy);
+	n.min = box_min - Vector3(margin);
+	n.max = box_max + Vector3(margin);
+	insertLeaf(proxy);
+	return true;
+}
+
+void DynamicBVH::insertLeaf(int leaf)
+{
+	if (root == -1)
+	{
+		root = leaf;
+		nodes[root].parent = -1;
+		return;
+	}
+
+	//walk down to the sibling that makes the tree grow the least (surface area heuristic)
+	Vector3 leaf_min = nodes[leaf].min;
+	Vector3 leaf_max = nodes[leaf].max;
+	int index = root;
+	while (!nodes[index].isLeaf())
+	{
+		sNode& n = nodes[index];
+		float area = surfaceArea(n.min, n.max);
+		float combined_area = surfaceArea(minVector(n.min, leaf_min), maxVector(n.max, leaf_max));
+
+		//cost of a new parent for this node and the leaf, and the minimum cost of pushing the leaf further down
+		float cost = 2.0f * combined_area;
+		float inheritance_cost = 2.0f * (combined_area - area);
+
+		float child_cost[2];
+		int children[2] = { n.left, n.right };
+		for (int i = 0; i < 2; ++i)
+		{
+			sNode& child = nodes[children[i]];
+			float child_area = surfaceArea(minVector(child.min, leaf_min), maxVector(child.max, leaf_max));
+			child_cost[i] = (child.isLeaf() ? child_area : child_area - surfaceArea(child.min, child.max)) + inheritance_cost;
+		}
+
+		if (cost < child_cost[0] && cost < child_cost[1])
+			break;
+		index = child_cost[0] < child_cost[1] ? children[0] : children[1];
+	}
+
+	//new parent of the sibling and the leaf
+	int sibling = index;
+	int old_parent = nodes[sibling].parent;
+	int new_parent = allocateNode();
+	sNode& p = nodes[new_parent];
+	p.parent = old_parent;
+	p.min = minVector(nodes[sibling].min, leaf_min);
+	p.max = maxVector(nodes[sibling].max, leaf_max);
+	p.height = nodes[sibling].height + 1;
+	p.left = sibling;
+	p.right = leaf;
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+
+	if (old_parent == -1)
+		root = new_parent;
+	else if (nodes[old_parent].left == sibling)
+		nodes[old_parent].left = new_parent;
+	else
+		nodes[old_parent].right = new_parent;
+
+	refit(nodes[leaf].parent);
+}
+
+void DynamicBVH::removeLeaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = -1;
+		return;
+	}
+
+	//the sibling takes the place of the parent
+	int parent = nodes[leaf].parent;
+	int grand_parent = nodes[parent].parent;
+	int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+	freeNode(parent);
+
+	if (grand_parent == -1)
+	{
+		root = sibling;
+		nodes[sibling].parent = -1;
+		return;
+	}
+
+	if (nodes[grand_parent].left == parent)
+		nodes[grand_parent].left = sibling;
+	else
+		nodes[grand_parent].right = sibling;
+	nodes[sibling].parent = grand_parent;
+	refit(grand_parent);
+}
+
+void DynamicBVH::refit(int node)
+{
+	while (node != -1)
+	{
+		node = balance(node);
+		sNode& n = nodes[node];
+		sNode& left = nodes[n.left];
+		sNode& right = nodes[n.right];
+		n.height = 1 + max(left.height, right.height);
+		n.min = minVector(left.min, right.min);
+		n.max = maxVector(left.max, right.max);
+		node = n.parent;
+	}
+}
+
+//Rotates the taller child up if the children heights differ more than one, returns the node now in its place
+int DynamicBVH::balance(int a)
+{
+	sNode& A = nodes[a];
+	if (A.isLeaf() || A.height < 2)
+		return a;
+
+	int b = A.left;
+	int c = A.right;
+	int balance = nodes[c].height - nodes[b].height;
+	if (balance >= -1 && balance <= 1)
+		return a;
+
+	//the taller child goes up and A takes the place of its taller grandchild
+	int up = balance > 1 ? c : b;
+	int other = balance > 1 ? b : c;
+	sNode& U = nodes[up];
+	int f = U.left;
+	int g = U.right;
+
+	U.left = a;
+	U.parent = A.parent;
+	A.parent = up;
+	if (U.parent == -1)
+		root = up;
+	else if (nodes[U.parent].left == a)
+		nodes[U.parent].left = up;
+	else
+		nodes[U.parent].right = up;
+
+	int taller = nodes[f].height > nodes[g].height ? f : g;
+	int shorter = taller == f ? g : f;
+	U.right = taller;
+	if (balance > 1)
+		A.right = shorter;
+	else
+		A.left = shorter;
+	nodes[shorter].parent = a;
+
+	A.min = minVector(nodes[other].min, nodes[shorter].min);
+	A.max = maxVector(nodes[other].max, nodes[shorter].max);
+	A.height = 1 + max(nodes[other].height, nodes[shorter].height);
+	U.min = minVector(A.min, nodes[taller].min);
+	U.max = maxVector(A.max, nodes[taller].max);
+	U.height = 1 + max(A.height, nodes[taller].height);
+	return up;
+}
+
+void DynamicBVH::queryBox(const Vector3& min, const Vector3& max, std::vector<void*>& result)
+{
+	if (root == -1)
+		return;
+
+	int stack[64];
+	int stack_size = 0;
+	stack[stack_size++] = root;
+	while (stack_size)
+	{
+		sNode& n = nodes[stack[--stack_size]];
+		if (!overlap(n.min, n.max, min, max))
+			continue;
+		if (n.isLeaf())
+			result.push_back(n.data);
+		else
+		{
+			stack[stack_size++] = n.left;
+			stack[stack_size++] = n.right;
+		}
+	}
+}
+
+void DynamicBVH::raycast(const Vector3& origin, const Vector3& direction, float max_dist, std::function<float(void* data, float max_dist)> callback)
+{
+	if (root == -1)
+		return;
+
+	Vector3 inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	//nodes with the distance where the ray enters them, the nearest child is pushed last so it is visited first
+	struct sEntry { int node; float distance; };
+	sEntry stack[64];
+	int stack_size = 0;
+	float root_distance = rayBoxDistance(origin, inv_direction, nodes[root].min, nodes[root].max, max_dist);
+	if (root_distance < 0.0f)
+		return;
+	stack[stack_size++] = { root, root_distance };
+
+	while (stack_size)
+	{
+		sEntry entry = stack[--stack_size];
+		if (entry.distance > max_dist)
+			continue;
+
+		sNode& n = nodes[entry.node];
+		if (n.isLeaf())
+		{
+			max_dist = min(max_dist, callback(n.data, max_dist));
+			if (max_dist <= 0.0f)
+				return;
+			continue;
+		}
+
+		float left_distance = rayBoxDistance(origin, inv_direction, nodes[n.left].min, nodes[n.left].max, max_dist);
+		float right_distance = rayBoxDistance(origin, inv_direction, nodes[n.right].min, nodes[n.right].max, max_dist);
+		sEntry left = { n.left, left_distance };
+		sEntry right = { n.right, right_distance };
+		if (left_distance > right_distance)
+			swap(left, right);
+		if (right.distance >= 0.0f)
+			stack[stack_size++] = right;
+		if (left.distance >= 0.0f)
+			stack[stack_size++] = left;
+	}
+}
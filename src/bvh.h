@@ -0,0 +1,63 @@
+#ifndef BVH_H
+#define BVH_H
+
+#pragma once
+#include "framework.h"
+#include <vector>
+#include <functional>
+
+//Dynamic bounding volume hierarchy of AABBs, every leaf is a proxy that points to the user data (an entity).
+//The leaves are enlarged by a margin so the small movements don't change the tree, the ones that leave their enlarged box
+//are reinserted, and the tree is kept balanced with rotations while the boxes of the ancestors are refitted.
+class DynamicBVH
+{
+public:
+
+	struct sNode {
+		Vector3 min;
+		Vector3 max;
+		void* data; //only in the leaves
+		int parent;
+		int left; //-1 in the leaves
+		int right;
+		int height; //0 in the leaves, -1 in the free nodes
+		bool isLeaf() const { return left == -1; }
+	};
+
+	float margin; //units the leaves are enlarged on every side
+
+	DynamicBVH();
+
+	//Returns the proxy of the new leaf, keep it to update or remove it
+	int insert(const BoundingBox& box, void* data);
+	void remove(int proxy);
+	//The leaf is only reinserted if the box left its enlarged one, returns true in that case
+	bool update(int proxy, const BoundingBox& box);
+	void clear();
+
+	void* getData(int proxy) { return nodes[proxy].data; }
+	int getNumLeaves() { return num_leaves; }
+	int getHeight() { return root == -1 ? 0 : nodes[root].height; }
+
+	//Data of the leaves that overlap the box
+	void queryBox(const Vector3& min, const Vector3& max, std::vector<void*>& result);
+
+	//Visits the leaves the ray crosses, the nearest first. The callback tests the leaf and returns the distance of its hit,
+	//or max_dist if it wasn't hit. The nodes further than the nearest hit are skipped, return 0 to stop the traversal
+	void raycast(const Vector3& origin, const Vector3& direction, float max_dist, std::function<float(void* data, float max_dist)> callback);
+
+private:
+	std::vector<sNode> nodes;
+	int root;
+	int free_list; //the free nodes are chained through their parent index
+	int num_leaves;
+
+	int allocateNode();
+	void freeNode(int node);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	void refit(int node); //from the node to the root, balancing on the way
+	int balance(int node);
+};
+
+#endif
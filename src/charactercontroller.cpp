@@ -0,0 +1,108 @@
+#include "charactercontroller.h"
+#include "scene.h"
+#include <cmath>
+
+using namespace std;
+
+CharacterController::CharacterController(float radius, float height)
+{
+	this->radius = radius;
+	this->height = height;
+	skin = 0.5f;
+	max_iterations = 4;
+	planar = true;
+	num_contacts = 0;
+}
+
+bool CharacterController::sweep(const Vector3& position, const Vector3& delta, float& toi, Vector3& normal)
+{
+	Scene* scene = Scene::instance;
+	if (!scene)
+		return false;
+
+	//broad phase: the box the capsule covers along the whole move
+	Vector3 end = position + delta;
+	Vector3 box_min = position;
+	Vector3 box_max = position;
+	box_min.setMin(end);
+	box_max.setMax(end);
+	float r = radius + skin;
+	box_min = box_min - Vector3(r, height + r, r);
+	box_max = box_max + Vector3(r, r, r);
+	vector<void*> candidates;
+	scene->bvh.queryBox(box_min, box_max, candidates);
+	if (candidates.empty())
+		return false;
+
+	int num_spheres = max(1, (int)ceil(height / radius)) + 1;
+	float step = height / (num_spheres - 1);
+
+	bool found = false;
+	toi = 1.0f;
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		ObjectEntity* object = (ObjectEntity*)candidates[i];
+		Mesh* collision_mesh = object->getCollisionMesh();
+		if (!collision_mesh)
+			continue;
+
+		for (int k = 0; k < num_spheres; ++k)
+		{
+			Vector3 center = position - Vector3(0.0f, k * step, 0.0f);
+			float t;
+			Vector3 collision;
+			Vector3 collision_normal;
+			if (!collision_mesh->testSweptSphereCollision(object->model, center, r, delta, t, collision, collision_normal, &object->inverse_model) || t > toi)
+				continue;
+			toi = t;
+			normal = collision_normal;
+			found = true;
+		}
+	}
+	return found;
+}
+
+Vector3 CharacterController::move(const Vector3& position, const Vector3& delta)
+{
+	Vector3 current = position;
+	Vector3 remaining = delta;
+	if (planar)
+		remaining.y = 0.0f;
+	num_contacts = 0;
+
+	for (int i = 0; i < max_iterations; ++i)
+	{
+		if (remaining.length() < 1e-4)
+			break;
+
+		float toi;
+		Vector3 normal;
+		if (!sweep(current, remaining, toi, normal))
+		{
+			current = current + remaining;
+			break;
+		}
+
+		//up to the contact, the skin keeps the capsule out of the surface
+		num_contacts++;
+		last_normal = normal;
+		current = current + remaining * toi;
+		remaining = remaining * (1.0f - toi);
+
+		//what is left slides along the surface
+		if (planar)
+		{
+			normal.y = 0.0f;
+			if (normal.length() < 1e-3)
+				break;
+			normal.normalize();
+		}
+		float into = remaining.dot(normal);
+		if (into < 0.0f)
+			remaining = remaining - normal * into;
+	}
+
+	if (planar)
+		current.y = position.y;
+	return current;
+}
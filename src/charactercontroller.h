@@ -0,0 +1,32 @@
+#ifndef CHARACTERCONTROLLER_H
+#define CHARACTERCONTROLLER_H
+
+#pragma once
+#include "framework.h"
+
+//Vertical capsule that moves through the objects of the scene. Every move is swept until the first contact, what is left
+//slides along the surface and is swept again, so fast moves don't cross thin objects and the character doesn't stick
+//to the walls. The capsule is tested as spheres along its axis, no more than one radius apart.
+class CharacterController
+{
+public:
+	float radius;
+	float height; //from the center of the top sphere, at the position, down to the center of the bottom one
+	float skin; //gap kept between the capsule and the surfaces
+	int max_iterations; //slides per move
+	bool planar; //the moves stay in the XZ plane
+
+	//Last move
+	int num_contacts;
+	Vector3 last_normal;
+
+	CharacterController(float radius = 20.0f, float height = 150.0f);
+
+	//Position reached from position trying to move by delta
+	Vector3 move(const Vector3& position, const Vector3& delta);
+
+	//First contact of the capsule moving by delta: toi is the fraction of delta it moves, normal points out of the surface
+	bool sweep(const Vector3& position, const Vector3& delta, float& toi, Vector3& normal);
+};
+
+#endif
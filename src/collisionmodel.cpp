@@ -0,0 +1,813 @@
+#include "collisionmodel.h"
+#include "mesh.h"
+#include "extra/coldet/coldet.h"
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+//SIMD wrappers, the kernels are written once over them. Without SIMD the lanes are plain floats and the masks bools
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 vfloat;
+typedef __m256 vmask;
+static inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+static inline vfloat vset(float v) { return _mm256_set1_ps(v); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+static inline vfloat vabs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+static inline vmask vlt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vmask vle(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline vmask vand(vmask a, vmask b) { return _mm256_and_ps(a, b); }
+static inline int vbits(vmask a) { return _mm256_movemask_ps(a); }
+static inline void vstore(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 vfloat;
+typedef __m128 vmask;
+static inline vfloat vload(const float* p) { return _mm_loadu_ps(p); }
+static inline vfloat vset(float v) { return _mm_set1_ps(v); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+static inline vfloat vabs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline vmask vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+static inline vmask vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+static inline vmask vand(vmask a, vmask b) { return _mm_and_ps(a, b); }
+static inline int vbits(vmask a) { return _mm_movemask_ps(a); }
+static inline void vstore(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+#else
+#define SIMD_WIDTH 1
+typedef float vfloat;
+typedef bool vmask;
+static inline vfloat vload(const float* p) { return *p; }
+static inline vfloat vset(float v) { return v; }
+static inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+static inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+static inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+static inline vfloat vdiv(vfloat a, vfloat b) { return a / b; }
+static inline vfloat vabs(vfloat a) { return fabsf(a); }
+static inline vmask vlt(vfloat a, vfloat b) { return a < b; }
+static inline vmask vle(vfloat a, vfloat b) { return a <= b; }
+static inline vmask vand(vmask a, vmask b) { return a && b; }
+static inline int vbits(vmask a) { return a ? 1 : 0; }
+static inline void vstore(float* p, vfloat a) { *p = a; }
+#endif
+
+//Kernels
+
+//Moller-Trumbore over a packet, returns the lane of the nearest hit closer than max_dist or -1
+static int rayPacket(const CollisionModel::sPacket& p, const Vector3& o, const Vector3& d, float max_dist, float& t_hit)
+{
+	int lane = -1;
+	vfloat dx = vset(d.x), dy = vset(d.y), dz = vset(d.z);
+	vfloat zero = vset(0.0f), one = vset(1.0f), epsilon = vset(1e-12f);
+	for (int base = 0; base < COLLISION_PACKET_SIZE; base += SIMD_WIDTH)
+	{
+		vfloat e1x = vload(&p.e1[0][base]), e1y = vload(&p.e1[1][base]), e1z = vload(&p.e1[2][base]);
+		vfloat e2x = vload(&p.e2[0][base]), e2y = vload(&p.e2[1][base]), e2z = vload(&p.e2[2][base]);
+
+		//p = d x e2, det = e1 . p
+		vfloat px = vsub(vmul(dy, e2z), vmul(dz, e2y));
+		vfloat py = vsub(vmul(dz, e2x), vmul(dx, e2z));
+		vfloat pz = vsub(vmul(dx, e2y), vmul(dy, e2x));
+		vfloat det = vadd(vadd(vmul(e1x, px), vmul(e1y, py)), vmul(e1z, pz));
+		vmask mask = vlt(epsilon, vabs(det)); //parallel to the ray, degenerated or padding
+		if (!vbits(mask))
+			continue;
+		vfloat inv_det = vdiv(one, det);
+
+		vfloat sx = vsub(vset(o.x), vload(&p.v0[0][base]));
+		vfloat sy = vsub(vset(o.y), vload(&p.v0[1][base]));
+		vfloat sz = vsub(vset(o.z), vload(&p.v0[2][base]));
+		vfloat u = vmul(vadd(vadd(vmul(sx, px), vmul(sy, py)), vmul(sz, pz)), inv_det);
+
+		//q = s x e1
+		vfloat qx = vsub(vmul(sy, e1z), vmul(sz, e1y));
+		vfloat qy = vsub(vmul(sz, e1x), vmul(sx, e1z));
+		vfloat qz = vsub(vmul(sx, e1y), vmul(sy, e1x));
+		vfloat v = vmul(vadd(vadd(vmul(dx, qx), vmul(dy, qy)), vmul(dz, qz)), inv_det);
+		vfloat t = vmul(vadd(vadd(vmul(e2x, qx), vmul(e2y, qy)), vmul(e2z, qz)), inv_det);
+
+		mask = vand(mask, vand(vle(zero, u), vle(zero, v)));
+		mask = vand(mask, vle(vadd(u, v), one));
+		mask = vand(mask, vand(vlt(zero, t), vle(t, vset(max_dist))));
+		int bits = vbits(mask);
+		if (!bits)
+			continue;
+
+		float ts[SIMD_WIDTH];
+		vstore(ts, t);
+		for (int i = 0; i < SIMD_WIDTH; ++i)
+			if ((bits & (1 << i)) && ts[i] <= max_dist)
+			{
+				max_dist = ts[i];
+				lane = base + i;
+			}
+	}
+	t_hit = max_dist;
+	return lane;
+}
+
+//Nearest point of the edges of a triangle to a point, for the spheres that only touch an edge or a corner
+static Vector3 closestPointOnEdges(const Vector3& c, const Vector3& a, const Vector3& e1, const Vector3& e2)
+{
+	Vector3 corners[3] = { a, a + e1, a + e2 };
+	Vector3 closest = a;
+	float min_distance = 3.4e+38F;
+	for (int i = 0; i < 3; ++i)
+	{
+		Vector3 start = corners[i];
+		Vector3 edge = corners[(i + 1) % 3] - start;
+		float length = edge.dot(edge);
+		float s = length > 0.0f ? clamp((c - start).dot(edge) / length, 0.0f, 1.0f) : 0.0f;
+		Vector3 point = start + edge * s;
+		Vector3 delta = c - point;
+		float distance = delta.dot(delta);
+		if (distance < min_distance)
+		{
+			min_distance = distance;
+			closest = point;
+		}
+	}
+	return closest;
+}
+
+//First lane of a packet the sphere touches, or -1. The plane distance and the inside test run in SIMD, the edges only for the lanes near the plane
+static int spherePacket(const CollisionModel::sPacket& p, const Vector3& c, float radius, Vector3& point)
+{
+	vfloat zero = vset(0.0f), r2 = vset(radius * radius);
+	for (int base = 0; base < COLLISION_PACKET_SIZE; base += SIMD_WIDTH)
+	{
+		vfloat e1x = vload(&p.e1[0][base]), e1y = vload(&p.e1[1][base]), e1z = vload(&p.e1[2][base]);
+		vfloat e2x = vload(&p.e2[0][base]), e2y = vload(&p.e2[1][base]), e2z = vload(&p.e2[2][base]);
+		vfloat px = vsub(vset(c.x), vload(&p.v0[0][base]));
+		vfloat py = vsub(vset(c.y), vload(&p.v0[1][base]));
+		vfloat pz = vsub(vset(c.z), vload(&p.v0[2][base]));
+
+		//n = e1 x e2, not normalized: the distance to the plane is (p . n) / |n|
+		vfloat nx = vsub(vmul(e1y, e2z), vmul(e1z, e2y));
+		vfloat ny = vsub(vmul(e1z, e2x), vmul(e1x, e2z));
+		vfloat nz = vsub(vmul(e1x, e2y), vmul(e1y, e2x));
+		vfloat nn = vadd(vadd(vmul(nx, nx), vmul(ny, ny)), vmul(nz, nz));
+		vfloat pn = vadd(vadd(vmul(px, nx), vmul(py, ny)), vmul(pz, nz));
+		vmask near_plane = vand(vlt(zero, nn), vle(vmul(pn, pn), vmul(r2, nn)));
+		int near_bits = vbits(near_plane);
+		if (!near_bits)
+			continue;
+
+		//barycentrics of the projection scaled by d00 * d11 - d01 * d01. The slivers lose the precision here, they go to the edges test
+		vfloat d00 = vadd(vadd(vmul(e1x, e1x), vmul(e1y, e1y)), vmul(e1z, e1z));
+		vfloat d01 = vadd(vadd(vmul(e1x, e2x), vmul(e1y, e2y)), vmul(e1z, e2z));
+		vfloat d11 = vadd(vadd(vmul(e2x, e2x), vmul(e2y, e2y)), vmul(e2z, e2z));
+		vfloat d20 = vadd(vadd(vmul(px, e1x), vmul(py, e1y)), vmul(pz, e1z));
+		vfloat d21 = vadd(vadd(vmul(px, e2x), vmul(py, e2y)), vmul(pz, e2z));
+		vfloat denom = vsub(vmul(d00, d11), vmul(d01, d01));
+		vfloat v = vsub(vmul(d11, d20), vmul(d01, d21));
+		vfloat w = vsub(vmul(d00, d21), vmul(d01, d20));
+		vmask inside = vand(near_plane, vlt(vmul(vmul(d00, d11), vset(1e-6f)), denom));
+		inside = vand(inside, vand(vle(zero, v), vle(zero, w)));
+		inside = vand(inside, vle(vadd(v, w), denom));
+		int inside_bits = vbits(inside);
+
+		for (int i = 0; i < SIMD_WIDTH; ++i)
+		{
+			if (!(near_bits & (1 << i)))
+				continue;
+			int lane = base + i;
+			Vector3 v0(p.v0[0][lane], p.v0[1][lane], p.v0[2][lane]);
+			Vector3 e1(p.e1[0][lane], p.e1[1][lane], p.e1[2][lane]);
+			Vector3 e2(p.e2[0][lane], p.e2[1][lane], p.e2[2][lane]);
+			if (inside_bits & (1 << i))
+			{
+				Vector3 n = e1.cross(e2);
+				point = c - n * ((c - v0).dot(n) / n.dot(n));
+				return lane;
+			}
+			Vector3 closest = closestPointOnEdges(c, v0, e1, e2);
+			Vector3 delta = c - closest;
+			if (delta.dot(delta) < radius * radius)
+			{
+				point = closest;
+				return lane;
+			}
+		}
+	}
+	return -1;
+}
+
+//Build
+
+struct sBuildTriangle {
+	Vector3 min;
+	Vector3 max;
+	Vector3 centroid;
+	int index;
+};
+
+static inline float surfaceArea(const Vector3& min, const Vector3& max)
+{
+	Vector3 size = max - min;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+#define SAH_BINS 12
+#define MAX_SAH_DEPTH 48 //deeper than this the nodes are split in halves, so the traversal stacks can't overflow
+
+static void buildNode(CollisionModel& model, vector<sBuildTriangle>& triangles, int begin, int end, int node, int depth, const Vector3* vertices, const unsigned int* indices)
+{
+	Vector3 box_min(3.4e+38F), box_max(-3.4e+38F), centroid_min(3.4e+38F), centroid_max(-3.4e+38F);
+	for (int i = begin; i < end; ++i)
+	{
+		box_min.setMin(triangles[i].min);
+		box_max.setMax(triangles[i].max);
+		centroid_min.setMin(triangles[i].centroid);
+		centroid_max.setMax(triangles[i].centroid);
+	}
+	model.nodes[node].min = box_min;
+	model.nodes[node].max = box_max;
+	int count = end - begin;
+
+	//a packet is tested at once, so the nodes are split until they fit in one. Along the longest axis of the centroids,
+	//where the surface area heuristic finds the cheapest plane
+	Vector3 extent = centroid_max - centroid_min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	int middle = -1;
+	if (count > COLLISION_PACKET_SIZE)
+	{
+		if (extent.v[axis] > 0.0f && depth < MAX_SAH_DEPTH)
+		{
+			struct sBin { Vector3 min = Vector3(3.4e+38F); Vector3 max = Vector3(-3.4e+38F); int count = 0; } bins[SAH_BINS];
+			float scale = SAH_BINS / extent.v[axis];
+			auto getBin = [&](const sBuildTriangle& t) { return min(SAH_BINS - 1, (int)((t.centroid.v[axis] - centroid_min.v[axis]) * scale)); };
+			for (int i = begin; i < end; ++i)
+			{
+				sBin& bin = bins[getBin(triangles[i])];
+				bin.min.setMin(triangles[i].min);
+				bin.max.setMax(triangles[i].max);
+				bin.count++;
+			}
+
+			//cost of every plane between bins, sweeping from the left and from the right
+			float left_cost[SAH_BINS - 1];
+			Vector3 sweep_min(3.4e+38F), sweep_max(-3.4e+38F);
+			int sweep_count = 0;
+			for (int i = 0; i < SAH_BINS - 1; ++i)
+			{
+				sweep_count += bins[i].count;
+				sweep_min.setMin(bins[i].min);
+				sweep_max.setMax(bins[i].max);
+				left_cost[i] = sweep_count ? sweep_count * surfaceArea(sweep_min, sweep_max) : 0.0f;
+			}
+			float best_cost = 3.4e+38F;
+			int best_plane = -1;
+			sweep_min = Vector3(3.4e+38F);
+			sweep_max = Vector3(-3.4e+38F);
+			sweep_count = 0;
+			for (int i = SAH_BINS - 1; i > 0; --i)
+			{
+				sweep_count += bins[i].count;
+				sweep_min.setMin(bins[i].min);
+				sweep_max.setMax(bins[i].max);
+				float cost = left_cost[i - 1] + (sweep_count ? sweep_count * surfaceArea(sweep_min, sweep_max) : 0.0f);
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_plane = i;
+				}
+			}
+
+			if (best_plane != -1)
+			{
+				middle = (int)(partition(triangles.begin() + begin, triangles.begin() + end, [&](const sBuildTriangle& t) { return getBin(t) < best_plane; }) - triangles.begin());
+				if (middle == begin || middle == end)
+					middle = -1;
+			}
+		}
+
+		//all the centroids in the same place, or too deep: halves
+		if (middle == -1)
+		{
+			middle = (begin + end) / 2;
+			nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+				[&](const sBuildTriangle& a, const sBuildTriangle& b) { return a.centroid.v[axis] < b.centroid.v[axis]; });
+		}
+	}
+
+	if (middle == -1)
+	{
+		//leaf: one packet, the lanes left are degenerated triangles that are never hit
+		CollisionModel::sPacket packet;
+		memset(&packet, 0, sizeof(packet));
+		for (int lane = 0; lane < COLLISION_PACKET_SIZE; ++lane)
+		{
+			packet.triangles[lane] = -1;
+			if (lane >= count)
+				continue;
+			int index = triangles[begin + lane].index;
+			const Vector3& v0 = vertices[indices ? indices[index * 3] : index * 3];
+			const Vector3& v1 = vertices[indices ? indices[index * 3 + 1] : index * 3 + 1];
+			const Vector3& v2 = vertices[indices ? indices[index * 3 + 2] : index * 3 + 2];
+			for (int k = 0; k < 3; ++k)
+			{
+				packet.v0[k][lane] = v0.v[k];
+				packet.e1[k][lane] = v1.v[k] - v0.v[k];
+				packet.e2[k][lane] = v2.v[k] - v0.v[k];
+			}
+			packet.triangles[lane] = index;
+		}
+		model.nodes[node].first = (int)model.packets.size();
+		model.nodes[node].count = count;
+		model.packets.push_back(packet);
+		return;
+	}
+
+	//the children are allocated together
+	int first = (int)model.nodes.size();
+	model.nodes.resize(first + 2);
+	model.nodes[node].first = first;
+	model.nodes[node].count = 0;
+	buildNode(model, triangles, begin, middle, first, depth + 1, vertices, indices);
+	buildNode(model, triangles, middle, end, first + 1, depth + 1, vertices, indices);
+}
+
+CollisionModel::CollisionModel()
+{
+}
+
+bool CollisionModel::build(const Vector3* vertices, const unsigned int* indices, int num_triangles)
+{
+	nodes.clear();
+	packets.clear();
+	if (!vertices || num_triangles <= 0)
+		return false;
+
+	vector<sBuildTriangle> triangles(num_triangles);
+	for (int i = 0; i < num_triangles; ++i)
+	{
+		sBuildTriangle& t = triangles[i];
+		const Vector3& v0 = vertices[indices ? indices[i * 3] : i * 3];
+		const Vector3& v1 = vertices[indices ? indices[i * 3 + 1] : i * 3 + 1];
+		const Vector3& v2 = vertices[indices ? indices[i * 3 + 2] : i * 3 + 2];
+		t.min = v0;
+		t.min.setMin(v1);
+		t.min.setMin(v2);
+		t.max = v0;
+		t.max.setMax(v1);
+		t.max.setMax(v2);
+		t.centroid = (v0 + v1 + v2) * (1.0f / 3.0f);
+		t.index = i;
+	}
+
+	nodes.reserve(2 * (num_triangles / COLLISION_PACKET_SIZE + 1));
+	packets.reserve(num_triangles / COLLISION_PACKET_SIZE + 1);
+	nodes.resize(1);
+	buildNode(*this, triangles, 0, num_triangles, 0, 0, vertices, indices);
+	return true;
+}
+
+//Queries
+
+//slabs test, returns the distance where the ray enters the box or -1 if it misses it before max_dist
+static inline float rayBoxDistance(const Vector3& origin, const Vector3& inv_direction, const Vector3& min, const Vector3& max, float max_dist)
+{
+	float t_near = 0.0f;
+	float t_far = max_dist;
+	for (int i = 0; i < 3; ++i)
+	{
+		float t0 = (min.v[i] - origin.v[i]) * inv_direction.v[i];
+		float t1 = (max.v[i] - origin.v[i]) * inv_direction.v[i];
+		if (t0 > t1)
+			swap(t0, t1);
+		if (t0 > t_near)
+			t_near = t0;
+		if (t1 < t_far)
+			t_far = t1;
+		if (t_near > t_far)
+			return -1.0f;
+	}
+	return t_near;
+}
+
+static void fillHit(const CollisionModel::sPacket& packet, int lane, CollisionModel::sHit& hit)
+{
+	hit.edge1 = Vector3(packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane]);
+	hit.edge2 = Vector3(packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane]);
+	hit.triangle = packet.triangles[lane];
+}
+
+bool CollisionModel::rayCollision(const Vector3& origin, const Vector3& direction, float max_dist, sHit& hit)
+{
+	if (nodes.empty())
+		return false;
+
+	Vector3 inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	struct sEntry { int node; float distance; };
+	sEntry stack[128];
+	int stack_size = 0;
+	float root_distance = rayBoxDistance(origin, inv_direction, nodes[0].min, nodes[0].max, max_dist);
+	if (root_distance < 0.0f)
+		return false;
+	stack[stack_size++] = { 0, root_distance };
+
+	//nearest child first, and the nodes further than the nearest hit are skipped
+	const sPacket* hit_packet = NULL;
+	int hit_lane = -1;
+	while (stack_size)
+	{
+		sEntry entry = stack[--stack_size];
+		if (entry.distance > max_dist)
+			continue;
+
+		const sNode& node = nodes[entry.node];
+		if (node.count)
+		{
+			float t;
+			int lane = rayPacket(packets[node.first], origin, direction, max_dist, t);
+			if (lane != -1)
+			{
+				max_dist = t;
+				hit_packet = &packets[node.first];
+				hit_lane = lane;
+			}
+			continue;
+		}
+
+		sEntry near_child = { node.first, rayBoxDistance(origin, inv_direction, nodes[node.first].min, nodes[node.first].max, max_dist) };
+		sEntry far_child = { node.first + 1, rayBoxDistance(origin, inv_direction, nodes[node.first + 1].min, nodes[node.first + 1].max, max_dist) };
+		if (far_child.distance >= 0.0f && (near_child.distance < 0.0f || far_child.distance < near_child.distance))
+			swap(near_child, far_child);
+		if (far_child.distance >= 0.0f)
+			stack[stack_size++] = far_child;
+		if (near_child.distance >= 0.0f)
+			stack[stack_size++] = near_child;
+	}
+
+	if (!hit_packet)
+		return false;
+	fillHit(*hit_packet, hit_lane, hit);
+	hit.t = max_dist;
+	hit.point = origin + direction * max_dist;
+	return true;
+}
+
+bool CollisionModel::sphereCollision(const Vector3& center, float radius, sHit& hit)
+{
+	if (nodes.empty())
+		return false;
+
+	int stack[128];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	float radius2 = radius * radius;
+	while (stack_size)
+	{
+		const sNode& node = nodes[stack[--stack_size]];
+
+		//squared distance from the center to the box
+		float distance = 0.0f;
+		for (int i = 0; i < 3; ++i)
+		{
+			float d = center.v[i] < node.min.v[i] ? node.min.v[i] - center.v[i] : (center.v[i] > node.max.v[i] ? center.v[i] - node.max.v[i] : 0.0f);
+			distance += d * d;
+		}
+		if (distance > radius2)
+			continue;
+
+		if (node.count)
+		{
+			int lane = spherePacket(packets[node.first], center, radius, hit.point);
+			if (lane == -1)
+				continue;
+			fillHit(packets[node.first], lane, hit);
+			hit.t = 0.0f;
+			return true;
+		}
+		stack[stack_size++] = node.first + 1;
+		stack[stack_size++] = node.first;
+	}
+	return false;
+}
+
+//Nearest point of the triangle to p (Ericson, Real-Time Collision Detection 5.1.5)
+static Vector3 closestPointOnTriangle(const Vector3& p, const Vector3& a, const Vector3& ab, const Vector3& ac)
+{
+	Vector3 ap = p - a;
+	float d1 = ab.dot(ap), d2 = ac.dot(ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	Vector3 bp = ap - ab;
+	float d3 = ab.dot(bp), d4 = ac.dot(bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return a + ab;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1 / (d1 - d3));
+
+	Vector3 cp = ap - ac;
+	float d5 = ab.dot(cp), d6 = ac.dot(cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return a + ac;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+		return a + ab + (ac - ab) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+//First t in [0, max_t] where the sphere moving along d touches the triangle: its face, then the cylinders around
+//the edges and the spheres around the corners. A sphere already touching it only collides if it moves into it
+static bool sweepTriangle(const Vector3& c, float r, const Vector3& d, const Vector3& v0, const Vector3& e1, const Vector3& e2, float max_t, float& toi, Vector3& contact)
+{
+	Vector3 closest = closestPointOnTriangle(c, v0, e1, e2);
+	Vector3 away = c - closest;
+	float away2 = away.dot(away);
+	if (away2 <= r * r)
+	{
+		if (away.dot(d) >= -1e-4f * sqrt(away2 * d.dot(d)))
+			return false;
+		toi = 0.0f;
+		contact = closest;
+		return true;
+	}
+
+	//face: the sphere touches the plane at the distance r, the point must be inside the triangle
+	Vector3 n = e1.cross(e2);
+	float n2 = n.dot(n);
+	if (n2 > 0.0f)
+	{
+		n = n * (1.0f / sqrt(n2));
+		float distance = (c - v0).dot(n);
+		if (distance < 0.0f)
+		{
+			n = n * -1.0f;
+			distance = -distance;
+		}
+		float speed = d.dot(n);
+		if (speed < 0.0f)
+		{
+			float t = (distance - r) / -speed;
+			if (t >= 0.0f && t <= max_t)
+			{
+				Vector3 p = c + d * t - n * r - v0;
+				float d00 = e1.dot(e1), d01 = e1.dot(e2), d11 = e2.dot(e2);
+				float d20 = p.dot(e1), d21 = p.dot(e2);
+				float denom = d00 * d11 - d01 * d01;
+				float v = d11 * d20 - d01 * d21;
+				float w = d00 * d21 - d01 * d20;
+				//the face contact is the first one, the edges and corners are only reached outside it
+				if (denom > 1e-6f * d00 * d11 && v >= 0.0f && w >= 0.0f && v + w <= denom)
+				{
+					toi = t;
+					contact = p + v0;
+					return true;
+				}
+			}
+		}
+	}
+
+	bool found = false;
+	float dd = d.dot(d);
+	if (dd <= 0.0f)
+		return false;
+
+	//edges: the center against the infinite cylinder, the contact must fall on the segment
+	Vector3 corners[3] = { v0, v0 + e1, v0 + e2 };
+	for (int i = 0; i < 3; ++i)
+	{
+		const Vector3& a = corners[i];
+		Vector3 e = corners[(i + 1) % 3] - a;
+		Vector3 m = c - a;
+		float ee = e.dot(e), ed = e.dot(d), em = e.dot(m);
+		float A = ee * dd - ed * ed;
+		float B = ee * m.dot(d) - em * ed;
+		float C = ee * (m.dot(m) - r * r) - em * em;
+		float discriminant = B * B - A * C;
+		if (A <= 1e-12f * ee * dd || discriminant < 0.0f)
+			continue;
+		float t = (-B - sqrt(discriminant)) / A;
+		if (t < 0.0f || t > max_t)
+			continue;
+		float s = (em + t * ed) / ee;
+		if (s < 0.0f || s > 1.0f)
+			continue;
+		max_t = t;
+		contact = a + e * s;
+		found = true;
+	}
+
+	//corners
+	for (int i = 0; i < 3; ++i)
+	{
+		Vector3 m = c - corners[i];
+		float B = m.dot(d);
+		float discriminant = B * B - dd * (m.dot(m) - r * r);
+		if (discriminant < 0.0f)
+			continue;
+		float t = (-B - sqrt(discriminant)) / dd;
+		if (t < 0.0f || t > max_t)
+			continue;
+		max_t = t;
+		contact = corners[i];
+		found = true;
+	}
+
+	toi = max_t;
+	return found;
+}
+
+bool CollisionModel::sphereSweep(const Vector3& center, float radius, const Vector3& delta, sHit& hit)
+{
+	if (nodes.empty())
+		return false;
+
+	//the segment of the center against the boxes grown by the radius
+	Vector3 inv_delta(1.0f / delta.x, 1.0f / delta.y, 1.0f / delta.z);
+	Vector3 grow(radius, radius, radius);
+	int stack[128];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	float max_t = 1.0f;
+	const sPacket* hit_packet = NULL;
+	int hit_lane = -1;
+	while (stack_size)
+	{
+		const sNode& node = nodes[stack[--stack_size]];
+		if (rayBoxDistance(center, inv_delta, node.min - grow, node.max + grow, max_t) < 0.0f)
+			continue;
+
+		if (!node.count)
+		{
+			stack[stack_size++] = node.first + 1;
+			stack[stack_size++] = node.first;
+			continue;
+		}
+
+		const sPacket& packet = packets[node.first];
+		for (int lane = 0; lane < node.count; ++lane)
+		{
+			Vector3 v0(packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]);
+			Vector3 e1(packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane]);
+			Vector3 e2(packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane]);
+			float t;
+			Vector3 contact;
+			if (!sweepTriangle(center, radius, delta, v0, e1, e2, max_t, t, contact))
+				continue;
+			max_t = t;
+			hit.point = contact;
+			hit_packet = &packet;
+			hit_lane = lane;
+		}
+	}
+
+	if (!hit_packet)
+		return false;
+	fillHit(*hit_packet, hit_lane, hit);
+	hit.t = max_t;
+	return true;
+}
+
+//Benchmark
+
+static double getMicroseconds()
+{
+	return (double)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static float randomRange(float min, float max)
+{
+	return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+int CollisionModel::benchmark(const std::vector<std::string>& filenames)
+{
+	int num_failed = 0;
+	const int num_rays = 20000;
+	const int num_spheres = 20000;
+	srand(7);
+
+	for (size_t f = 0; f < filenames.size(); ++f)
+	{
+		Mesh mesh;
+		if (!mesh.load(filenames[f].c_str()) || mesh.vertices.empty())
+		{
+			cout << "[ERROR] benchmark: cannot load " << filenames[f] << endl;
+			num_failed++;
+			continue;
+		}
+		const unsigned int* indices = mesh.m_indices.size() ? &mesh.m_indices[0] : NULL;
+		int num_triangles = (int)(indices ? mesh.m_indices.size() : mesh.vertices.size()) / 3;
+
+		//both models
+		double time = getMicroseconds();
+		CollisionModel3D* coldet = newCollisionModel3D(true);
+		coldet->setTriangleNumber(num_triangles);
+		for (int i = 0; i < num_triangles; ++i)
+		{
+			Vector3 v1 = mesh.vertices[indices ? indices[i * 3] : i * 3];
+			Vector3 v2 = mesh.vertices[indices ? indices[i * 3 + 1] : i * 3 + 1];
+			Vector3 v3 = mesh.vertices[indices ? indices[i * 3 + 2] : i * 3 + 2];
+			coldet->addTriangle(v1.v, v2.v, v3.v);
+		}
+		coldet->finalize();
+		double coldet_build = getMicroseconds() - time;
+
+		time = getMicroseconds();
+		CollisionModel model;
+		model.build(&mesh.vertices[0], indices, num_triangles);
+		double model_build = getMicroseconds() - time;
+
+		//rays from a sphere around the mesh to points inside its box, spheres inside the box
+		Vector3 box_min = mesh.aabb_min, box_max = mesh.aabb_max;
+		Vector3 center = (box_min + box_max) * 0.5f;
+		float size = (float)(box_max - box_min).length();
+		vector<Vector3> origins(num_rays), directions(num_rays), centers(num_spheres);
+		for (int i = 0; i < num_rays; ++i)
+		{
+			Vector3 target(randomRange(box_min.x, box_max.x), randomRange(box_min.y, box_max.y), randomRange(box_min.z, box_max.z));
+			Vector3 offset(randomRange(-1, 1), randomRange(-1, 1), randomRange(-1, 1));
+			origins[i] = center + offset.normalize() * size;
+			directions[i] = (target - origins[i]).normalize();
+		}
+		for (int i = 0; i < num_spheres; ++i)
+			centers[i] = Vector3(randomRange(box_min.x, box_max.x), randomRange(box_min.y, box_max.y), randomRange(box_min.z, box_max.z));
+		float radius = size * 0.02f;
+
+		Matrix44 identity;
+		coldet->setTransform(identity.m);
+		int coldet_hits = 0, model_hits = 0, mismatches = 0;
+		vector<float> coldet_distances(num_rays);
+		time = getMicroseconds();
+		for (int i = 0; i < num_rays; ++i)
+		{
+			coldet_distances[i] = -1.0f;
+			if (coldet->rayCollision(origins[i].v, directions[i].v, true, 0.0f, size * 2.0f))
+			{
+				Vector3 point;
+				coldet->getCollisionPoint(point.v, true);
+				coldet_distances[i] = (float)(point - origins[i]).length();
+				coldet_hits++;
+			}
+		}
+		double coldet_rays = getMicroseconds() - time;
+
+		time = getMicroseconds();
+		sHit hit;
+		vector<float> model_distances(num_rays);
+		for (int i = 0; i < num_rays; ++i)
+		{
+			model_distances[i] = -1.0f;
+			if (model.rayCollision(origins[i], directions[i], size * 2.0f, hit))
+			{
+				model_distances[i] = hit.t;
+				model_hits++;
+			}
+		}
+		double model_rays = getMicroseconds() - time;
+		for (int i = 0; i < num_rays; ++i)
+			if ((coldet_distances[i] < 0.0f) != (model_distances[i] < 0.0f) || fabs(coldet_distances[i] - model_distances[i]) > size * 1e-4f)
+				mismatches++;
+
+		int coldet_sphere_hits = 0, model_sphere_hits = 0, sphere_mismatches = 0;
+		vector<bool> coldet_touches(num_spheres);
+		time = getMicroseconds();
+		for (int i = 0; i < num_spheres; ++i)
+		{
+			coldet_touches[i] = coldet->sphereCollision(centers[i].v, radius);
+			coldet_sphere_hits += coldet_touches[i];
+		}
+		double coldet_sphere_time = getMicroseconds() - time;
+
+		time = getMicroseconds();
+		for (int i = 0; i < num_spheres; ++i)
+		{
+			bool touches = model.sphereCollision(centers[i], radius, hit);
+			model_sphere_hits += touches;
+			sphere_mismatches += touches != coldet_touches[i];
+		}
+		double model_sphere_time = getMicroseconds() - time;
+		delete coldet;
+
+		cout << filenames[f] << ": " << num_triangles << " triangles, " << model.nodes.size() << " nodes, " << model.packets.size() << " packets of " << COLLISION_PACKET_SIZE << " (SIMD width " << SIMD_WIDTH << ")" << endl;
+		cout << "\tBuild:   coldet " << coldet_build * 0.001 << "ms, BVH " << model_build * 0.001 << "ms" << endl;
+		cout << "\tRays:    coldet " << coldet_rays / num_rays << "us, BVH " << model_rays / num_rays << "us per ray, hits " << coldet_hits << "/" << model_hits << ", mismatches " << mismatches << endl;
+		cout << "\tSpheres: coldet " << coldet_sphere_time / num_spheres << "us, BVH " << model_sphere_time / num_spheres << "us per sphere, hits " << coldet_sphere_hits << "/" << model_sphere_hits << ", mismatches " << sphere_mismatches << endl;
+	}
+	return num_failed;
+}
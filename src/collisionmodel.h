@@ -0,0 +1,63 @@
+#ifndef COLLISIONMODEL_H
+#define COLLISIONMODEL_H
+
+#pragma once
+#include "framework.h"
+#include <vector>
+#include <string>
+
+//Triangles in every leaf of the BVH, they are tested at once: AVX in one step, SSE in two, or one by one without SIMD
+#define COLLISION_PACKET_SIZE 8
+
+//Collision model of a mesh: a BVH over its triangles built with the surface area heuristic. Every leaf is a packet of
+//triangles in SoA layout (the x of all of them, then the y...) so the ray and sphere tests run over the whole packet.
+//The queries are in object space, the entities keep the inverse of their model so it isn't computed for every query.
+class CollisionModel
+{
+public:
+
+	struct sNode {
+		Vector3 min;
+		Vector3 max;
+		int first; //first child (the second one follows it), or packet of the leaf
+		int count; //triangles of the leaf, 0 in the inner nodes
+	};
+
+	struct sPacket {
+		float v0[3][COLLISION_PACKET_SIZE]; //first vertex
+		float e1[3][COLLISION_PACKET_SIZE]; //second vertex - first
+		float e2[3][COLLISION_PACKET_SIZE]; //third vertex - first
+		int triangles[COLLISION_PACKET_SIZE]; //index of the triangle in the mesh, -1 in the padding
+	};
+
+	//Result of a query, in object space
+	struct sHit {
+		float t; //rays: distance in units of the direction, sweeps: fraction of the move
+		Vector3 point;
+		Vector3 edge1; //of the triangle hit, to compute the normal in any space
+		Vector3 edge2;
+		int triangle;
+	};
+
+	std::vector<sNode> nodes;
+	std::vector<sPacket> packets;
+
+	CollisionModel();
+
+	//indices can be NULL for a non indexed mesh
+	bool build(const Vector3* vertices, const unsigned int* indices, int num_triangles);
+
+	//Nearest hit of the ray in (0, max_dist]
+	bool rayCollision(const Vector3& origin, const Vector3& direction, float max_dist, sHit& hit);
+	//First triangle the sphere touches
+	bool sphereCollision(const Vector3& center, float radius, sHit& hit);
+	//First triangle the sphere touches moving by delta, t is the fraction of delta it moves before
+	bool sphereSweep(const Vector3& center, float radius, const Vector3& delta, sHit& hit);
+
+	size_t getBytes() { return nodes.capacity() * sizeof(sNode) + packets.capacity() * sizeof(sPacket); }
+
+	//Times the queries against coldet on some meshes, for main --bench-collisions
+	static int benchmark(const std::vector<std::string>& filenames);
+};
+
+#endif
@@ -560,6 +560,8 @@ void Editor3D::addEntity()
 
 			//Update object bounding box
 			object->updateBoundingBox();
+			scene->updateBVH(object);
+			scene->updateGrid(object);
 		}
 
 		//Feedback
@@ -748,6 +750,12 @@ void Editor3D::editEntity(Entity* entity)
 		break;
 	}
 
+	//Refit the object in the scene BVH, it only changes if the object left its leaf
+	if (entity->entity_type == Entity::EntityType::OBJECT && (current_action == Actions::TRANSLATE || current_action == Actions::ROTATE || current_action == Actions::SCALE))
+		scene->updateBVH((ObjectEntity*)entity);
+	if (current_action == Actions::TRANSLATE || current_action == Actions::ROTATE || current_action == Actions::SCALE)
+		scene->updateGrid(entity);
+
 	//Color change
 	bool color_change = Input::wasKeyPressed(SDL_SCANCODE_Q) || Input::wasKeyPressed(SDL_SCANCODE_A) || Input::wasKeyPressed(SDL_SCANCODE_W) || Input::wasKeyPressed(SDL_SCANCODE_S) || Input::wasKeyPressed(SDL_SCANCODE_E) || Input::wasKeyPressed(SDL_SCANCODE_D);
 
@@ -847,27 +855,28 @@ ObjectEntity* Editor3D::selectEntity() {
 	Vector3 ray_direction = camera->getRayDirection(mouse.x, mouse.y, game->window_width, game->window_height);
 	Vector3 ray_origin = camera->eye;
 
-	//Search for the object with a Ray Collision in the scene and then return it
-	for (size_t i = 0; i < scene->objects.size(); i++)
-	{
+	//Search for the nearest object with a Ray Collision in the scene and then return it
+	scene->bvh.raycast(ray_origin, ray_direction, ray_max_distance, [&](void* data, float max_dist) {
 		//Current object entity
-		ObjectEntity* object = scene->objects[i];
+		ObjectEntity* object = (ObjectEntity*)data;
 
 		//Entity properties
 		Vector3 object_position;
 		Vector3 object_normal;
 
 		//Ray collision test
-		if (object->mesh->testRayCollision(object->model, ray_origin, ray_direction, object_position, object_normal, ray_max_distance))
+		if (object->mesh->testRayCollision(object->model, ray_origin, ray_direction, object_position, object_normal, max_dist, false, &object->inverse_model))
 		{
 			float object_distance = (object_position - ray_origin).length();
 			if (object_distance < object_min_distance)
 			{
 				object_min_distance = object_distance;
 				selected_object = object;
+				return object_distance;
 			}
 		}
-	}
+		return max_dist;
+	});
 	return selected_object;
 }
 
@@ -9,6 +9,8 @@ Entity::Entity() {
 	name = "";
 	visible = true;
 	model = Matrix44();
+	lod = 0;
+	grid_proxy = -1;
 }
 
 Vector3 Entity::getPosition()
@@ -74,6 +76,16 @@ void MainCharacterEntity::load(cJSON* main_json)
 			this->material->registerMaterial(mesh_path.c_str());
 		}
 	}
+
+	//Resource references, released by the destructor
+	ResourceManager::addReference(mesh);
+	ResourceManager::addReference(material);
+}
+
+MainCharacterEntity::~MainCharacterEntity()
+{
+	ResourceManager::releaseReference(mesh);
+	ResourceManager::releaseReference(material);
 }
 
 void MainCharacterEntity::save(cJSON* main_json)
@@ -121,11 +133,12 @@ void MainCharacterEntity::updateMainCamera(double seconds_elapsed, float mouse_s
 	if (!Input::isKeyPressed(SDL_SCANCODE_LCTRL) && Input::isKeyPressed(SDL_SCANCODE_S)) position_delta = position_delta + camera_front * -speed;
 	if (Input::isKeyPressed(SDL_SCANCODE_D)) position_delta = position_delta + camera_side * speed;
 
-	//Check collisions
-	Vector3 next_position = Scene::instance->testCollisions(camera->eye, position_delta, seconds_elapsed);
+	//Move against the objects of the scene
+	Vector3 next_position = controller.move(camera->eye, position_delta);
 
 	//Assign new position
 	camera->lookAt(next_position, next_position + (camera->center - camera->eye), camera->up);
+	Scene::instance->updateGrid(this);
 
 	//Update flashlight position
 	if(!Game::instance->render_editor)
@@ -223,6 +236,7 @@ void MainCharacterEntity::print()
 MonsterEntity::MonsterEntity()
 {
 	this->name = "";
+	this->entity_type = EntityType::MONSTER;
 	this->visible = true;
 	this->mesh = new Mesh();
 	this->material = new Material();
@@ -292,6 +306,16 @@ void MonsterEntity::load(cJSON* monster_json)
 			this->material->registerMaterial(mesh_path.c_str());
 		}
 	}
+
+	//Resource references, released by the destructor
+	ResourceManager::addReference(mesh);
+	ResourceManager::addReference(material);
+}
+
+MonsterEntity::~MonsterEntity()
+{
+	ResourceManager::releaseReference(mesh);
+	ResourceManager::releaseReference(material);
 }
 
 void MonsterEntity::save(cJSON* monster_json)
@@ -325,17 +349,15 @@ void MonsterEntity::print()
 
 bool MonsterEntity::isInFollowRange(MainCharacterEntity* mainCharacter)
 {
-	Vector3 side = model.rotateVector(Vector3(1, 0, 0)).normalize();
-	Vector3 forward = model.rotateVector(Vector3(0, 0, -1)).normalize();
-	Vector3 toTarget = model.getTranslation() - mainCharacter->camera->eye;
+	//The monster looks along +Z, the scene grid gives what is inside its vision cone
+	Vector3 sight = model.rotateVector(Vector3(0, 0, 1)).normalize();
+	vector<Entity*> seen;
+	Scene::instance->grid.queryCone(model.getTranslation(), sight, 0.30f, 1900.0f, seen, EntityType::MAIN);
 
-	float dist = toTarget.length();
-	toTarget.normalize();
-
-	float forwardDot = forward.dot(toTarget);
+	float dist = (model.getTranslation() - mainCharacter->camera->eye).length();
 
 	//If the player is in vision range of the monster then should start following
-	if (1900.0f > dist && forwardDot > 0.30f) {
+	if (find(seen.begin(), seen.end(), mainCharacter) != seen.end()) {
 		if (300.0f >= dist && !mainCharacter->isHitted) {
 			mainCharacter->health = max(0, mainCharacter->health - 25);
 			mainCharacter->isHitted = true;
@@ -365,7 +387,7 @@ void MonsterEntity::updateFollow(float elapsed_time, Camera* camera) //Running a
 	if (dist > 300) {
 		Vector3 translate = forward * -runSpeed * elapsed_time;
 		Vector3 monsterPos = Vector3(model.getTranslation().x, 231, model.getTranslation().z);
-		Vector3 nextPos = Scene::instance->testCollisions(monsterPos, translate, elapsed_time);
+		Vector3 nextPos = controller.move(monsterPos, translate);
 		Vector3 translation = nextPos - model.getTranslation();
 		model.translateGlobal(translation.x, 0, translation.z);
 	}
@@ -443,12 +465,22 @@ ObjectEntity::ObjectEntity() {
 	this->material = new Material();
 	this->bounding_box_trigger = true; //Set it to true for the first iteration
 	this->type = RENDER_OBJECT;
+	this->collides = true;
+	this->collision_mesh = NULL;
+	this->bvh_proxy = -1;
 
 	//Object tree
 	this->node_id = -1;
 	parent = NULL;
 }
 
+ObjectEntity::~ObjectEntity()
+{
+	ResourceManager::releaseReference(mesh);
+	ResourceManager::releaseReference(material);
+	ResourceManager::releaseReference(collision_mesh);
+}
+
 Matrix44 ObjectEntity::computeGlobalModel()
 {
 	if (parent)
@@ -502,6 +534,21 @@ void ObjectEntity::load(cJSON* object_json, int object_index)
 		}
 	}
 
+	//Collisions
+	collides = readJSONBoolean(object_json, "collides", collides);
+	string collision_mesh_path = readJSONString(object_json, "collision_mesh", "");
+	if (!collision_mesh_path.empty())
+	{
+		collision_mesh = Mesh::Get(collision_mesh_path.c_str());
+		if (!collision_mesh)
+			cout << "ERROR: " << name << " collision mesh hasn't been found at: " << collision_mesh_path << endl;
+	}
+
+	//Resource references, released by the destructor
+	ResourceManager::addReference(mesh);
+	ResourceManager::addReference(material);
+	ResourceManager::addReference(collision_mesh);
+
 	//Node ID
 	cJSON* node_ID_json = readJSONArrayItem(object_json, "node_ID", object_index);
 	if (node_ID_json) node_id = node_ID_json->valueint;
@@ -552,6 +599,10 @@ void ObjectEntity::save(vector<cJSON*> json)
 	//Material
 	if (material)material->save(object_json);
 
+	//Collisions
+	writeJSONBoolean(object_json, "collides", collides);
+	if (collision_mesh) writeJSONString(object_json, "collision_mesh", collision_mesh->filename);
+
 	//Node ID
 	cJSON_AddItemToObject(object_json, "node_ID", node_IDs_array);
 	cJSON_AddNumberToArray(node_IDs_array, node_id);
@@ -637,9 +688,14 @@ LightEntity::LightEntity()
 	this->area_size = 1000;
 
 	//Shadows
+	this->shadow_index = -1;
+	this->shadow_requested_size = 0;
 	this->cast_shadows = false;
 	this->shadow_bias = 0.001;
 	this->shadow_camera = NULL;
+	this->shadow_dirty = true;
+	this->shadow_signature = 0;
+	this->shadow_has_dynamic = false;
 }
 
 void LightEntity::load(cJSON* light_json, int light_index)
@@ -765,6 +821,40 @@ void LightEntity::updateJSON(vector<cJSON*> json)
 	cJSON_AddFloatVectorToArray(models_array, model.m, 16);
 }
 
+void LightEntity::computeBoundingSphere(Vector3& center, float& radius)
+{
+	Vector3 position = model.getTranslation();
+
+	switch (light_type)
+	{
+	case(LightType::POINT_LIGHT):
+		center = position;
+		radius = max_distance;
+		break;
+	case(LightType::SPOT_LIGHT):
+	{
+		//Tightest sphere around the cone: wide cones are bounded by their base, narrow ones by apex and base rim
+		Vector3 direction = model.rotateVector(Vector3(0, 0, -1)).normalize();
+		float angle = clamp(cone_angle, 0.0f, 89.0f) * DEG2RAD;
+		if (angle > PI / 4)
+		{
+			center = position + direction * (cos(angle) * max_distance);
+			radius = sin(angle) * max_distance;
+		}
+		else
+		{
+			radius = max_distance / (2.0f * cos(angle));
+			center = position + direction * radius;
+		}
+		break;
+	}
+	default:
+		center = position;
+		radius = -1.0f;
+		break;
+	}
+}
+
 void LightEntity::update(float elapsed_time)
 {
 
@@ -828,6 +918,8 @@ void SoundEntity::changeVolume(float volume)
 void SoundEntity::changeArea(float area)
 {
 	this->radius = area;
+	if (Scene::instance)
+		Scene::instance->updateGrid(this);
 }
 
 void SoundEntity::load(cJSON* sound_json, int sound_index)
@@ -12,6 +12,7 @@
 #include "animation.h"
 #include "audio.h"
 #include "path.h"
+#include "charactercontroller.h"
 
 using namespace std;
 
@@ -37,6 +38,8 @@ public:
 	bool visible;
 	Matrix44 model;
 	EntityType entity_type;
+	int lod; //Level of detail drawn in the last frame, the renderer keeps it unless the change is clear
+	int grid_proxy; //Entry of the scene spatial grid, -1 if it isn't in it
 
 	//Methods overwritten by derived classes 
 	virtual void update(float elapsed_time) {};
@@ -69,11 +72,15 @@ public:
 	bool isHitted = false;
 	float playerHittedTime = 0.0f;
 
+	//Collisions, the capsule hangs from the eye of the camera
+	CharacterController controller;
+
 	//Triggers
 	bool bounding_box_trigger;
 
 	//Constructor
 	MainCharacterEntity();
+	~MainCharacterEntity(); //releases the references of its assets
 
 	//Methods
 	void updateMainCamera(double seconds_elapsed, float mouse_speed, bool mouse_locked);
@@ -109,6 +116,9 @@ public:
 	float bounding = 7.0f;
 	int idx;
 
+	//Collisions
+	CharacterController controller;
+
 	//Triggers
 	bool bounding_box_trigger;
 
@@ -117,6 +127,7 @@ public:
 
 	//Constructor
 	MonsterEntity();
+	~MonsterEntity(); //releases the references of its assets
 
 	//Methods
 	bool isInFollowRange(MainCharacterEntity* mainCharacter);
@@ -161,8 +172,18 @@ public:
 	//Triggers
 	bool bounding_box_trigger;
 
+	//Collisions
+	bool collides; //Decoration the character walks through doesn't collide, so its collision model is never built
+	Mesh* collision_mesh; //Simplified proxy used for the collisions instead of the mesh, NULL to use the mesh
+	int bvh_proxy; //Leaf of the scene BVH, -1 if it isn't in it
+	Matrix44 inverse_model; //Inverse of the model for the collision queries, updated with the BVH leaf
+
 	//Constructor
 	ObjectEntity();
+	~ObjectEntity(); //releases the references of its assets
+
+	//Mesh used by the collision tests, NULL if the object doesn't collide
+	Mesh* getCollisionMesh() { return collides ? (collision_mesh ? collision_mesh : mesh) : NULL; }
 
 	//Children methods
 	Matrix44 computeGlobalModel();
@@ -203,11 +224,18 @@ public:
 	float area_size;
 
 	//Shadows
-	int shadow_index;
+	int shadow_index; //Order of the light in the shadow atlas, -1 if it has no tile
+	Vector4 shadow_tile; //Region of the shadow atlas in pixels: x, y, width, height
+	int shadow_requested_size; //Tile size the light asked for, the granted one (shadow_tile.z) is smaller when the atlas is full
 	bool cast_shadows;
 	float shadow_bias;
 	Camera* shadow_camera;
 
+	//Shadow cache: the static casters are kept in a separate atlas and only redrawn when the light or one of them changes
+	bool shadow_dirty; //The cached static shadow map has to be redrawn
+	uint64_t shadow_signature; //Hash of the light camera and the static casters of the cached shadow map
+	bool shadow_has_dynamic; //The atlas region has dynamic casters drawn over the cached shadow map
+
 	//Constructor
 	LightEntity();
 
@@ -216,6 +244,9 @@ public:
 	void save(vector<cJSON*> json);
 	void updateJSON(vector<cJSON*> json);
 
+	//Lit volume: sphere bounding the light range (negative radius for directional lights, which reach everything)
+	void computeBoundingSphere(Vector3& center, float& radius);
+
 	//Inherited methods
 	virtual void update(float elapsed_time) override;
 	virtual void print() override;
@@ -1,6 +1,7 @@
 #include "fbo.h"
 #include <cassert>
 #include "utils.h"
+#include "renderbackend.h"
 
 FBO::FBO()
 {
@@ -19,12 +20,7 @@ FBO::FBO()
 FBO::~FBO()
 {
 	freeTextures();
-	if (fbo_id)
-		glDeleteFramebuffers(1, &fbo_id);
-	if (renderbuffer_color)
-		glDeleteRenderbuffersEXT(1, &renderbuffer_color);
-	if (renderbuffer_depth)
-		glDeleteRenderbuffersEXT(1, &renderbuffer_depth);
+	RenderBackend::current->releaseFramebuffer(this);
 }
 
 void FBO::freeTextures()
@@ -41,10 +37,7 @@ void FBO::freeTextures()
 		delete depth_texture;
 	depth_texture = NULL;
 
-	if (renderbuffer_color)
-		glDeleteRenderbuffers(1, &renderbuffer_color);
-	if (renderbuffer_depth)
-		glDeleteRenderbuffers(1, &renderbuffer_depth);
+	RenderBackend::current->releaseRenderbuffers(this);
 
 	renderbuffer_color = renderbuffer_depth = 0;
 	width = height = 0;
@@ -53,7 +46,7 @@ void FBO::freeTextures()
 
 bool FBO::create( int width, int height, int num_textures, int format, int type, bool use_depth_texture)
 {
-	assert(glGetError() == GL_NO_ERROR);
+	assert(RenderBackend::current->checkErrors());
 	assert(width && height);
 	assert(num_textures < 5); //too many
 	freeTextures();
@@ -64,11 +57,8 @@ bool FBO::create( int width, int height, int num_textures, int format, int type,
 	for (int i = 0; i < num_textures; ++i)
 	{
 		Texture* colortex = textures[i] = new Texture(width, height, format, type, false); //,NULL, format == GL_RGBA ? GL_RGBA8 : GL_RGB8 
-		glBindTexture(colortex->texture_type, colortex->texture_id);	//we activate this id to tell opengl we are going to use this texture
-		glTexParameteri(colortex->texture_type, GL_TEXTURE_MAG_FILTER, GL_NEAREST);	//set the min filter
-		glTexParameteri(colortex->texture_type, GL_TEXTURE_MIN_FILTER, GL_NEAREST);   //set the mag filter
-		glTexParameteri(colortex->texture_type, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(colortex->texture_type, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		RenderBackend::current->setTextureFilter(colortex, GL_NEAREST, GL_NEAREST);
+		RenderBackend::current->setTextureWrap(colortex, GL_CLAMP_TO_EDGE);
 	}
 
 	//is using a depth_texture slower than using a renderbuffer?
@@ -96,7 +86,7 @@ bool FBO::setTexture(Texture* texture, int cubemap_face )
 bool FBO::setTextures(std::vector<Texture*> textures, Texture* depth_texture, int cubemap_face)
 {
 	assert(textures.size() >= 0 && textures.size() <= 4);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(RenderBackend::current->checkErrors());
 	assert(textures.size() || depth_texture ); //at least one texture
 	int format = 0; //RGB,RGBA
 	int type = 0;//UNSIGNED_BYTE
@@ -113,26 +103,8 @@ bool FBO::setTextures(std::vector<Texture*> textures, Texture* depth_texture, in
 		height = depth_texture->height;
 	}
 
-	//create and bind FBO
-	if(fbo_id == 0)
-		glGenFramebuffersEXT(1, &fbo_id);
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo_id);
-	checkGLErrors();
-
 	if (depth_texture)
-	{
-		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture->texture_id, 0);
 		this->depth_texture = depth_texture;
-	}
-	else
-	{
-		if (!renderbuffer_depth)
-			glGenRenderbuffers(1, &renderbuffer_depth);
-		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer_depth);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
-		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffer_depth);
-	}
-	checkGLErrors();
 
 	//reset the buffer to store color attachments
 	memset(bufs, 0, sizeof(bufs));
@@ -140,54 +112,24 @@ bool FBO::setTextures(std::vector<Texture*> textures, Texture* depth_texture, in
 	num_color_textures = 0;
 	for (int i = 0; i < 4; ++i)
 	{
-		Texture* texture = i < textures.size() ? textures[i] : NULL;
+		Texture* texture = i < (int)textures.size() ? textures[i] : NULL;
 		assert(!texture || (texture->width == width && texture->height == height)); //incorrect size, textures must have same size
 		assert(!texture || (texture->type == type && texture->format == format)); //incorrect texture format
 
-		if (texture && texture->texture_type == GL_TEXTURE_CUBE_MAP)
-		{
-			assert(cubemap_face != -1); //MUST SPECIFY CUBEMAP FACE
-			glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT + i, GL_TEXTURE_CUBE_MAP_POSITIVE_X + cubemap_face, texture ? texture->texture_id : NULL, 0);
-		}
+		if(texture)
+			bufs[i] = GL_COLOR_ATTACHMENT0_EXT + i;
 		else
-        {
-            glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT + i, GL_TEXTURE_2D, texture ? texture->texture_id : NULL, 0);
-        }
-        if(texture)
-            bufs[i] = GL_COLOR_ATTACHMENT0_EXT + i;
-        else
-            bufs[i] = GL_NONE;
+			bufs[i] = GL_NONE;
 		color_textures[i] = texture;
 		if (texture)
 			num_color_textures++;
 	}
 
-	//add a render buffer for the color
+	//a render buffer is added for the color
 	if (num_color_textures == 0)
-	{
-		if(!renderbuffer_color)
-			glGenRenderbuffersEXT(1, &renderbuffer_color);
-		glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffer_color);
-		glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGB, width, height);
-		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER_EXT, renderbuffer_color);
 		bufs[0] = GL_COLOR_ATTACHMENT0_EXT;
-	}
-    
-    glDrawBuffers(4, bufs);
-
-	checkGLErrors();
-
-	GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
-	if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
-	{
-		std::cout << "Error: Framebuffer object is not completed: " << status << std::endl;
-		assert(0);
-		return false;
-	}
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 
-	checkGLErrors();
-	return true;
+	return RenderBackend::current->createFramebuffer(this, depth_texture, cubemap_face);
 }
 
 bool FBO::setDepthOnly(int width, int height)
@@ -195,67 +137,36 @@ bool FBO::setDepthOnly(int width, int height)
 	owns_textures = true;
 	memset(bufs, 0, sizeof(bufs));
 	num_color_textures = 0;
-
-	glGenFramebuffersEXT(1, &fbo_id);
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo_id);
-
-	glGenRenderbuffersEXT(1, &renderbuffer_color);
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffer_color);
-
-	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA, width, height);
-	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER_EXT, renderbuffer_color);
+	this->width = width;
+	this->height = height;
 
 	//create texture
 	depth_texture = new Texture(width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false);
-	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture->texture_id, 0);
 
-	GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
-	if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
-	{
-		std::cout << "Error: Framebuffer object is not completed" << std::endl;
-		return false;
-	}
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	return true;
+	return RenderBackend::current->createDepthFramebuffer(this);
 }
 
 void FBO::bind()
 {
-	assert(glGetError() == GL_NO_ERROR);
-	Texture* tex = color_textures[0] ? color_textures[0] : depth_texture;
-	assert(tex && "framebuffer without texture");
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo_id);
-	checkGLErrors();
-	glPushAttrib(GL_VIEWPORT_BIT);
-	glDrawBuffers(4, bufs);
-	glViewport(0, 0, (int)tex->width, (int)tex->height);
-	assert(glGetError() == GL_NO_ERROR);
+	RenderBackend::current->enableFramebuffer(this);
 }
 
-GLenum one_buffer = GL_BACK;
-
 void FBO::unbind()
 {
-	// output goes to the FBO and its attached buffers
-	glPopAttrib();
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	//glDrawBuffers(1, &one_buffer);
-	assert(glGetError() == GL_NO_ERROR);
+	// output goes to the FBO and it's attached buffers
+	RenderBackend::current->disableFramebuffer(this);
 }
 
 void FBO::enableSingleBuffer(int num)
 {
 	assert(num < this->num_color_textures);
-    GLenum DrawBuffers[1] = {static_cast<GLenum>( (int)GL_COLOR_ATTACHMENT0) + num };
-	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
+	RenderBackend::current->setDrawBuffers(this, num);
 }
 
 void FBO::enableAllBuffers()
 {
-	glDrawBuffers(4, bufs);
+	RenderBackend::current->setDrawBuffers(this, -1);
 }
-
-
 /*
  glGenFramebuffers(1, &FramebufferName);
  glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
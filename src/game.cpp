@@ -8,6 +8,7 @@
 #include "animation.h"
 #include "entity.h"
 #include "scene.h"
+#include "renderbackend.h"
 
 
 #include <cmath>
@@ -45,14 +46,17 @@ Game::Game(int window_width, int window_height, SDL_Window* window)
 	current_stage = STAGE_ID::INTRO;
 
 	//OpenGL flags
-	glEnable(GL_CULL_FACE); //render both sides of every triangle
-	glEnable(GL_DEPTH_TEST); //check the occlusions using the Z buffer
+	RenderBackend::current->setScreenSize(window_width, window_height);
+	RenderBackend::current->setCullFace(true); //render both sides of every triangle
+	RenderBackend::current->setDepthTest(true); //check the occlusions using the Z buffer
 
 	//Create the scene
 	scene = new Scene();
+	scene->shader = Shader::Get("data/shaders/pixel.vs", "data/shaders/single.fs"); //Select shader to render the render calls
 
 	//Create the main camera
 	main_camera = new Camera();
+	main_camera->aspect = window_width / (float)window_height;
 	scene->main_camera = main_camera;
 
 	//Load the scene JSON
@@ -100,6 +104,16 @@ void Game::render(void)
 		break;
 	}
 
+	//frame requested with F3, read before the swap
+	if (save_frame)
+	{
+		Image frame;
+		frame.fromScreen(window_width, window_height);
+		if (frame.saveTGA("data/frame.tga", true))
+			cout << "Frame saved at data/frame.tga, compare it with a golden image of --render" << endl;
+		save_frame = false;
+	}
+
 	//swap between front buffer and back buffer
 	SDL_GL_SwapWindow(window);
 }
@@ -136,6 +150,11 @@ void Game::onKeyDown(SDL_KeyboardEvent event)
 			must_exit = true; //ESC key, kill the app
 		break;
 	case SDLK_F1: Shader::ReloadAll(); break;
+	case SDLK_F2: 
+		renderer->clustered_lighting = !renderer->clustered_lighting;
+		cout << "Clustered lighting " << (renderer->clustered_lighting ? "enabled" : "disabled") << endl;
+		break;
+	case SDLK_F3: save_frame = true; break;
 	case SDLK_r: 
 		scene->clear();
 		scene->load("data/scene.json");
@@ -204,7 +223,8 @@ void Game::onMouseWheel(SDL_MouseWheelEvent event)
 void Game::onResize(int width, int height)
 {
     std::cout << "window resized: " << width << "," << height << std::endl;
-	glViewport( 0,0, width, height );
+	RenderBackend::current->setViewport(0, 0, width, height);
+	RenderBackend::current->setScreenSize(width, height);
 	main_camera->aspect =  width / (float)height;
 	entity_editor->camera->aspect = width / (float)height;
 	window_width = width;
@@ -34,6 +34,7 @@ public:
 	bool must_exit;
 	bool render_editor;
 	bool scene_saved = false;
+	bool save_frame = false; //the next frame is saved, to compare it with the golden image of the software rasterizer
 	float mouse_speed = 100.0f;
 
 	//some vars
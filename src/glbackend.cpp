@@ -0,0 +1,935 @@
+#include "glbackend.h"
+#include "shader.h"
+#include "mesh.h"
+#include "texture.h"
+#include "fbo.h"
+#include "utils.h"
+#include <cassert>
+#include <iostream>
+
+//OpenGL is the default backend
+static GLBackend gl_backend;
+RenderBackend* RenderBackend::current = &gl_backend;
+
+//name of every eVertexAttribute in the shaders
+static const char* attribute_names[VERTEX_NUM_ATTRIBUTES] = { "a_vertex", "a_normal", "a_coord", "a_coord1", "a_tangent", "a_color", "a_bones", "a_weights" };
+
+bool GLBackend::checkErrors()
+{
+	return checkGLErrors();
+}
+
+int GLBackend::getMaxTextureBufferSize()
+{
+	GLint max_texels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	return max_texels;
+}
+
+// SHADERS ******************************************
+
+bool GLBackend::compileShader(Shader* shader, const std::string& vsm, const std::string& psm)
+{
+	if (glCreateProgram == 0)
+	{
+		std::cout << "Error: your graphics cards dont support shaders. Sorry." << std::endl;
+		exit(0);
+	}
+
+	shader->program = glCreateProgram();
+	assert (glGetError() == GL_NO_ERROR);
+
+	if (!createShaderObject(shader, GL_VERTEX_SHADER, shader->vs, vsm))
+	{
+		printf("Vertex shader compilation failed\n");
+		return false;
+	}
+
+	if (!createShaderObject(shader, GL_FRAGMENT_SHADER, shader->fs, psm))
+	{
+		printf("Fragment shader compilation failed\n");
+		return false;
+	}
+
+	glLinkProgram(shader->program);
+	assert (glGetError() == GL_NO_ERROR);
+
+	GLint linked=0;
+
+	glGetProgramiv(shader->program,GL_LINK_STATUS,&linked);
+	assert(glGetError() == GL_NO_ERROR);
+
+	if (!linked)
+	{
+		saveProgramInfoLog(shader, shader->program);
+		shader->release();
+		return false;
+	}
+
+#ifdef _DEBUG
+	validate(shader);
+#endif
+
+	createUniformValues(shader);
+	return true;
+}
+
+bool GLBackend::validate(Shader* shader)
+{
+	glValidateProgram(shader->program);
+	assert ( glGetError() == GL_NO_ERROR );
+
+	GLint validated = 0;
+	glGetProgramiv(shader->program,GL_LINK_STATUS,&validated);
+	assert(glGetError() == GL_NO_ERROR);
+
+	if (!validated)
+	{
+		printf("Shader validation failed\n");
+		saveProgramInfoLog(shader, shader->program);
+		return false;
+	}
+
+	return true;
+}
+
+bool GLBackend::createShaderObject(Shader* shader, unsigned int type, GLuint& handle, const std::string& code)
+{
+	handle = glCreateShader(type);
+	assert( glGetError() == GL_NO_ERROR );
+
+	std::string prefix = "";//"#define DESKTOP\n";
+
+	std::string fullcode = prefix + code;
+	const char* ptr = fullcode.c_str();
+	glShaderSource(handle, 1, &ptr, NULL);
+	assert( glGetError() == GL_NO_ERROR );
+
+	glCompileShader(handle);
+	assert( glGetError() == GL_NO_ERROR );
+
+	GLint compile=0;
+	glGetShaderiv(handle,GL_COMPILE_STATUS,&compile);
+	assert( glGetError() == GL_NO_ERROR );
+
+	//we want to see the compile log if we are in debug (to check warnings)
+	if (!compile)
+	{
+		saveShaderInfoLog(shader, handle);
+		std::cout << "Shader code:\n " << std::endl;
+		std::vector<std::string> lines = split( fullcode, '\n' );
+		for( size_t i = 0; i < lines.size(); ++i)
+			std::cout << i << "  " << lines[i] << std::endl;
+
+		return false;
+	}
+
+	glAttachShader(shader->program,handle);
+	assert( glGetError() == GL_NO_ERROR );
+
+	return true;
+}
+
+void GLBackend::saveShaderInfoLog(Shader* shader, GLuint obj)
+{
+	int len = 0;
+	assert(glGetError() == GL_NO_ERROR);
+	glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &len);
+	assert(glGetError() == GL_NO_ERROR);
+
+	if (len > 0)
+	{
+		char* ptr = new char[len+1];
+		GLsizei written=0;
+		glGetShaderInfoLog(obj, len, &written, ptr);
+		ptr[written-1]='\0';
+		assert(glGetError() == GL_NO_ERROR);
+		shader->log.append(ptr);
+		delete[] ptr;
+
+		printf("LOG **********************************************\n%s\n",shader->log.c_str());
+	}
+}
+
+void GLBackend::saveProgramInfoLog(Shader* shader, GLuint obj)
+{
+	int len = 0;
+	assert(glGetError() == GL_NO_ERROR);
+	glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &len);
+	assert(glGetError() == GL_NO_ERROR);
+
+	if (len > 0)
+	{
+		char* ptr = new char[len+1];
+		GLsizei written=0;
+		glGetProgramInfoLog(obj, len, &written, ptr);
+		ptr[written-1]='\0';
+		assert(glGetError() == GL_NO_ERROR);
+		shader->log.append(ptr);
+		delete[] ptr;
+
+		printf("LOG **********************************************\n%s\n",shader->log.c_str());
+	}
+}
+
+//One shadow value per location of the active uniforms. The elements of an array can be set one by one or all at once
+//from the first one, so their locations are never shadowed
+void GLBackend::createUniformValues(Shader* shader)
+{
+	GLuint program = shader->program;
+	std::vector<Shader::sUniformValue>& uniform_values = shader->uniform_values;
+	uniform_values.clear();
+
+	GLint num_uniforms = 0;
+	GLint max_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &num_uniforms);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::vector<char> name(max_length + 1);
+
+	std::vector<GLint> array_locations;
+	GLint max_location = -1;
+	for (GLint i = 0; i < num_uniforms; ++i)
+	{
+		GLint size = 0;
+		GLenum type;
+		glGetActiveUniform(program, i, (GLsizei)name.size(), NULL, &size, &type, name.data());
+		GLint loc = glGetUniformLocation(program, name.data());
+		if (loc < 0)
+			continue; //inside a uniform block
+		max_location = std::max(max_location, loc);
+		if (size < 2)
+			continue;
+
+		std::string base = name.data();
+		base = base.substr(0, base.find('['));
+		for (GLint j = 0; j < size; ++j)
+		{
+			GLint element = glGetUniformLocation(program, (base + "[" + std::to_string(j) + "]").c_str());
+			if (element < 0)
+				continue;
+			array_locations.push_back(element);
+			max_location = std::max(max_location, element);
+		}
+	}
+	assert(glGetError() == GL_NO_ERROR);
+
+	uniform_values.resize(max_location + 1);
+	for (size_t i = 0; i < uniform_values.size(); ++i)
+		uniform_values[i].size = 0;
+	for (size_t i = 0; i < array_locations.size(); ++i)
+		uniform_values[array_locations[i]].size = -1;
+}
+
+void GLBackend::releaseShader(Shader* shader)
+{
+	if (shader->vs)
+	{
+		glDeleteShader(shader->vs);
+		assert (glGetError() == GL_NO_ERROR);
+		shader->vs = 0;
+	}
+
+	if (shader->fs)
+	{
+		glDeleteShader(shader->fs);
+		assert (glGetError() == GL_NO_ERROR);
+		shader->fs = 0;
+	}
+
+	if (shader->program)
+	{
+		glDeleteProgram(shader->program);
+		assert (glGetError() == GL_NO_ERROR);
+		shader->program = 0;
+	}
+}
+
+void GLBackend::useShader(Shader* shader)
+{
+	glUseProgram(shader ? shader->program : 0);
+	assert (glGetError() == GL_NO_ERROR);
+}
+
+int GLBackend::getUniformLocation(Shader* shader, const char* varname)
+{
+	return glGetUniformLocation(shader->program, varname);
+}
+
+int GLBackend::getAttribLocation(Shader* shader, const char* varname)
+{
+	int loc = glGetAttribLocation(shader->program, varname);
+	assert(glGetError() == GL_NO_ERROR);
+	return loc;
+}
+
+void GLBackend::setUniform(int location, unsigned int type, int count, const void* data)
+{
+	switch (type)
+	{
+	case GL_INT: glUniform1iv(location, count, (const GLint*)data); break;
+	case GL_INT_VEC2: glUniform2iv(location, count, (const GLint*)data); break;
+	case GL_INT_VEC3: glUniform3iv(location, count, (const GLint*)data); break;
+	case GL_INT_VEC4: glUniform4iv(location, count, (const GLint*)data); break;
+	case GL_FLOAT: glUniform1fv(location, count, (const GLfloat*)data); break;
+	case GL_FLOAT_VEC2: glUniform2fv(location, count, (const GLfloat*)data); break;
+	case GL_FLOAT_VEC3: glUniform3fv(location, count, (const GLfloat*)data); break;
+	case GL_FLOAT_VEC4: glUniform4fv(location, count, (const GLfloat*)data); break;
+	case GL_FLOAT_MAT4: glUniformMatrix4fv(location, count, GL_FALSE, (const GLfloat*)data); break;
+	default: assert(0 && "unsupported uniform type");
+	}
+	assert (glGetError() == GL_NO_ERROR);
+}
+
+void GLBackend::setUniformBlock(Shader* shader, const char* varname, int binding)
+{
+	GLuint index = glGetUniformBlockIndex(shader->program, varname);
+	if (index == GL_INVALID_INDEX)
+		return;
+	glUniformBlockBinding(shader->program, index, binding);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void GLBackend::bindTexture(int slot, unsigned int texture_type, unsigned int texture_id)
+{
+	glActiveTexture(GL_TEXTURE0 + slot);
+	glBindTexture(texture_type, texture_id);
+}
+
+// MESHES ******************************************
+
+void GLBackend::uploadMesh(Mesh* mesh)
+{
+	//the buffers may change, so the VAOs are recorded again
+	releaseVertexArrays(mesh);
+
+	//the element buffer binding below would be recorded in a bound VAO
+	if (bound_vertex_array)
+	{
+		glBindVertexArray(0);
+		bound_vertex_array = 0;
+	}
+
+	if (glGenBuffers == nullptr)
+	{
+		std::cout << "Error: your graphics cards dont support VBOs. Sorry." << std::endl;
+		exit(0);
+	}
+
+	// Interleaved attributes
+	std::vector<char>& interleaved = mesh->interleaved;
+	if (interleaved.size())
+	{
+		if (mesh->interleaved_vbo_id == 0)
+			glGenBuffers(1, &mesh->interleaved_vbo_id);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh->interleaved_vbo_id);
+		glBufferData(GL_ARRAY_BUFFER, interleaved.size(), &interleaved[0], GL_STATIC_DRAW);
+		mesh->vram_bytes += interleaved.size();
+	}
+
+	// Every stream that isn't interleaved in its own buffer
+	for (int i = 0; i < VERTEX_NUM_ATTRIBUTES; ++i)
+	{
+		Mesh::sVertexStream stream = mesh->getVertexStream(i);
+		if (!stream.data || !stream.vbo_id || mesh->vertex_layout.has(i))
+			continue;
+		if (*stream.vbo_id == 0)
+			glGenBuffers(1, stream.vbo_id);
+		glBindBuffer(GL_ARRAY_BUFFER, *stream.vbo_id);
+		glBufferData(GL_ARRAY_BUFFER, stream.count * stream.size, stream.data, GL_STATIC_DRAW);
+		mesh->vram_bytes += stream.count * stream.size;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Indices
+	std::vector<unsigned int>& m_indices = mesh->m_indices;
+	std::vector<unsigned int>& lod_indices = mesh->lod_indices;
+	if (m_indices.size())
+	{
+		if (mesh->indices_vbo_id == 0)
+			glGenBuffers(1, &mesh->indices_vbo_id);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices_vbo_id);
+
+		//16 bits indices when possible, half the memory and bandwidth. The levels of detail go after the full mesh
+		if (mesh->getNumVertices() <= 65536)
+		{
+			std::vector<unsigned short> short_indices(m_indices.begin(), m_indices.end());
+			short_indices.insert(short_indices.end(), lod_indices.begin(), lod_indices.end());
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, short_indices.size() * sizeof(unsigned short), &short_indices[0], GL_STATIC_DRAW);
+			mesh->indices_format = GL_UNSIGNED_SHORT;
+			mesh->vram_bytes += short_indices.size() * sizeof(unsigned short);
+		}
+		else
+		{
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, (m_indices.size() + lod_indices.size()) * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, m_indices.size() * sizeof(unsigned int), &m_indices[0]);
+			if (lod_indices.size())
+				glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), lod_indices.size() * sizeof(unsigned int), &lod_indices[0]);
+			mesh->indices_format = GL_UNSIGNED_INT;
+			mesh->vram_bytes += (m_indices.size() + lod_indices.size()) * sizeof(unsigned int);
+		}
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	checkGLErrors();
+}
+
+void GLBackend::releaseVertexArrays(Mesh* mesh)
+{
+	for (auto it = mesh->vertex_arrays.begin(); it != mesh->vertex_arrays.end(); ++it)
+		glDeleteVertexArrays(1, &it->second.vao_id);
+	mesh->vertex_arrays.clear();
+}
+
+void GLBackend::releaseMesh(Mesh* mesh)
+{
+	//Free VAOs
+	releaseVertexArrays(mesh);
+
+	//Free VBOs
+	#ifdef USE_OPENGL_EXT
+		if (mesh->vertices_vbo_id)
+			glDeleteBuffersARB(1,&mesh->vertices_vbo_id);
+		if (mesh->uvs_vbo_id)
+			glDeleteBuffersARB(1,&mesh->uvs_vbo_id);
+		if (mesh->normals_vbo_id)
+			glDeleteBuffersARB(1,&mesh->normals_vbo_id);
+		if (mesh->colors_vbo_id)
+			glDeleteBuffersARB(1,&mesh->colors_vbo_id);
+		if (mesh->interleaved_vbo_id)
+			glDeleteBuffersARB(1, &mesh->interleaved_vbo_id);
+		if (mesh->indices_vbo_id)
+			glDeleteBuffersARB(1, &mesh->indices_vbo_id);
+		if (mesh->bones_vbo_id)
+			glDeleteBuffersARB(1, &mesh->bones_vbo_id);
+		if (mesh->weights_vbo_id)
+			glDeleteBuffersARB(1, &mesh->weights_vbo_id);
+		if (mesh->uvs1_vbo_id)
+			glDeleteBuffersARB(1, &mesh->uvs1_vbo_id);
+	#else
+	if (mesh->vertices_vbo_id)
+		glDeleteBuffers(1,&mesh->vertices_vbo_id);
+	if (mesh->uvs_vbo_id)
+		glDeleteBuffers(1,&mesh->uvs_vbo_id);
+	if (mesh->normals_vbo_id)
+		glDeleteBuffers(1,&mesh->normals_vbo_id);
+	if (mesh->colors_vbo_id)
+		glDeleteBuffers(1,&mesh->colors_vbo_id);
+	if (mesh->interleaved_vbo_id)
+		glDeleteBuffers(1, &mesh->interleaved_vbo_id);
+	if (mesh->indices_vbo_id)
+		glDeleteBuffers(1, &mesh->indices_vbo_id);
+	if (mesh->bones_vbo_id)
+		glDeleteBuffers(1, &mesh->bones_vbo_id);
+	if (mesh->weights_vbo_id)
+		glDeleteBuffers(1, &mesh->weights_vbo_id);
+	if (mesh->uvs1_vbo_id)
+		glDeleteBuffers(1, &mesh->uvs1_vbo_id);
+	#endif
+}
+
+void GLBackend::enableMeshBuffers(Mesh* mesh, Shader* sh)
+{
+	//meshes in VRAM keep their attribute setup in a VAO, so binding it is enough
+	if (mesh->vertices_vbo_id || mesh->interleaved_vbo_id)
+	{
+		Mesh::sVertexArray& vertex_array = mesh->vertex_arrays[sh];
+		if (vertex_array.vao_id && vertex_array.shader_revision == sh->revision)
+		{
+			glBindVertexArray(vertex_array.vao_id);
+			bound_vertex_array = vertex_array.vao_id;
+			return;
+		}
+
+		//first use with this shader (or it was recompiled): record the setup below in a new VAO
+		if (vertex_array.vao_id)
+			glDeleteVertexArrays(1, &vertex_array.vao_id);
+		glGenVertexArrays(1, &vertex_array.vao_id);
+		vertex_array.shader_revision = sh->revision;
+		glBindVertexArray(vertex_array.vao_id);
+		bound_vertex_array = vertex_array.vao_id;
+		if (mesh->indices_vbo_id)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices_vbo_id); //the index buffer binding is part of the VAO
+	}
+
+	//every attribute comes from the interleaved buffer if it is in the layout, or from its own stream
+	for (int i = 0; i < VERTEX_NUM_ATTRIBUTES; ++i)
+	{
+		attribute_locations[i] = -1;
+
+		sVertexLayout::sAttribute format;
+		const char* data = NULL;
+		unsigned int vbo_id = 0;
+		int stride = 0;
+		if (mesh->vertex_layout.has(i))
+		{
+			format = mesh->vertex_layout.attributes[i];
+			stride = mesh->vertex_layout.stride;
+			vbo_id = mesh->interleaved_vbo_id;
+			data = mesh->interleaved.data();
+		}
+		else
+		{
+			Mesh::sVertexStream stream = mesh->getVertexStream(i);
+			format = stream.format;
+			vbo_id = stream.vbo_id ? *stream.vbo_id : 0;
+			data = stream.data;
+		}
+		if (!vbo_id && !data)
+			continue;
+
+		int location = sh->getAttribLocation(attribute_names[i]);
+		if (location == -1)
+			continue;
+		glEnableVertexAttribArray(location);
+		if (vbo_id)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, vbo_id);
+			glVertexAttribPointer(location, format.components, format.type, format.normalized, stride, (void*)(size_t)format.offset);
+		}
+		else
+			glVertexAttribPointer(location, format.components, format.type, format.normalized, stride, data + format.offset);
+		attribute_locations[i] = location;
+		checkGLErrors();
+	}
+}
+
+void GLBackend::drawMesh(Mesh* mesh, unsigned int primitive, int start, int size, int lod_offset, int num_instances)
+{
+	unsigned int indices_format = mesh->indices_format;
+	unsigned int indices_vbo_id = mesh->indices_vbo_id;
+	int index_size = indices_format == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+	if (mesh->m_indices.size())
+	{
+		if (num_instances > 0)
+		{
+			assert(indices_vbo_id && "indices must be uploaded to the GPU");
+			if (!bound_vertex_array) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+			#ifdef OPENGL_ES3
+				glDrawElementsInstanced(primitive, size, indices_format, (void*)((lod_offset + start) * index_size), num_instances);
+			#else
+				assert(0 && "not supported in OpenGL ES2");
+			#endif
+			if (!bound_vertex_array) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+		else
+		{
+			if (indices_vbo_id)
+			{
+				if (!bound_vertex_array) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+				glDrawElements(primitive, size, indices_format, (void *) ((lod_offset + start) * index_size));
+				if (!bound_vertex_array) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+				checkGLErrors();
+			}
+			else
+				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)((lod_offset ? &mesh->lod_indices[0] : &mesh->m_indices[0]) + start));
+		}
+	}
+	else
+	{
+		if (num_instances > 0)
+		{
+			#ifdef OPENGL_ES3
+				glDrawArraysInstanced(primitive, start, size, num_instances);
+			#else
+				assert(0 && "not supported in OpenGL ES2");
+			#endif
+		}
+		else
+			glDrawArrays(primitive, start, size);
+	}
+}
+
+void GLBackend::disableMeshBuffers(Mesh* mesh, Shader* shader)
+{
+	if (bound_vertex_array)
+	{
+		glBindVertexArray(0);
+		bound_vertex_array = 0;
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+
+	for (int i = 0; i < VERTEX_NUM_ATTRIBUTES; ++i)
+		if (attribute_locations[i] != -1)
+			glDisableVertexAttribArray(attribute_locations[i]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);    //if crashes here, COMMENT THIS LINE ****************************
+	checkGLErrors();
+}
+
+bool GLBackend::enableInstanceBuffer(Mesh* mesh, Shader* shader, unsigned int buffer_id, int first_instance)
+{
+	#ifdef OPENGL_ES3
+		instance_location = shader->getAttribLocation("u_model");
+		assert(instance_location != -1 && "shader must have attribute mat4 u_model (not a uniform)");
+		if (instance_location == -1)
+			return false;
+
+		glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+
+		//mat4 count as 4 different attributes of vec4... (thanks opengl...)
+		for (int k = 0; k < 4; ++k)
+		{
+			glEnableVertexAttribArray(instance_location + k);
+			size_t offset = first_instance * sizeof(Matrix44) + sizeof(float) * 4 * k;
+			const Uint8* addr = (Uint8*) offset;
+			glVertexAttribPointer(instance_location + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr);
+			glVertexAttribDivisor(instance_location + k, 1); // This makes it instanced!
+		}
+		return true;
+	#else
+		assert(0 && "not supported");
+		return false;
+	#endif
+}
+
+void GLBackend::disableInstanceBuffer(Mesh* mesh, Shader* shader)
+{
+	if (instance_location == -1)
+		return;
+
+	//disable instanced attribs
+	for (int k = 0; k < 4; ++k)
+	{
+		glDisableVertexAttribArray(instance_location + k);
+		glVertexAttribDivisor(instance_location + k, 0);
+	}
+	instance_location = -1;
+}
+
+// BUFFERS ******************************************
+
+void GLBackend::uploadBuffer(unsigned int& buffer_id, const void* data, size_t size)
+{
+	if (!buffer_id)
+		glGenBuffers(1, &buffer_id);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+	glBufferData(GL_ARRAY_BUFFER, size, data, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GLBackend::uploadTextureBuffer(unsigned int& buffer_id, unsigned int& texture_id, unsigned int internal_format, const void* data, size_t size, int slot)
+{
+	//orphaning the data of the previous frame
+	if (!buffer_id)
+	{
+		glGenBuffers(1, &buffer_id);
+		glGenTextures(1, &texture_id);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer_id);
+	glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glActiveTexture(GL_TEXTURE0 + slot);
+	glBindTexture(GL_TEXTURE_BUFFER, texture_id);
+	glTexBuffer(GL_TEXTURE_BUFFER, internal_format, buffer_id);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// TEXTURES ******************************************
+
+void GLBackend::createTexture(Texture* texture)
+{
+	glGenTextures(1, &texture->texture_id); //we need to create an unique ID for the texture
+	assert(checkGLErrors() && "Error creating texture");
+}
+
+void GLBackend::uploadTexture(Texture* texture, unsigned int format, unsigned int type, const Uint8* data, unsigned int internal_format)
+{
+	unsigned int texture_type = texture->texture_type;
+	glBindTexture(texture_type, texture->texture_id);	//we activate this id to tell opengl we are going to use this texture
+
+	glTexImage2D(texture_type, 0, internal_format == 0 ? format : internal_format, texture->width, texture->height, 0, format, type, data);
+
+	glTexParameteri(texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
+	glTexParameteri(texture_type, GL_TEXTURE_MIN_FILTER, texture->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
+	glTexParameteri(texture_type, GL_TEXTURE_WRAP_S, texture->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(texture_type, GL_TEXTURE_WRAP_T, texture->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	//glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4); //better quality but takes more resources
+
+	if (data && texture->mipmaps)
+		generateMipmaps(texture); //glGenerateMipmapEXT(GL_TEXTURE_2D);
+
+	glBindTexture(texture_type, 0);
+	assert(checkGLErrors() && "Error uploading texture");
+}
+
+void GLBackend::generateMipmaps(Texture* texture)
+{
+	unsigned int texture_type = texture->texture_type;
+#ifdef OPENGL_ES3
+	if(!glGenerateMipmapEXT)
+		return;
+
+	glBindTexture(texture_type, texture->texture_id );	//enable the id of the texture we are going to use
+	glTexParameteri(texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter ); //set the mag filter
+	if (texture_type == GL_TEXTURE_CUBE_MAP)
+	{
+		glTexParameteri(texture_type, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); //set the mag filter
+		glTexParameteri(texture_type, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); //set the mag filter
+	}
+	glGenerateMipmapEXT(texture_type);
+#else
+	glBindTexture(texture_type, texture->texture_id);	//enable the id of the texture we are going to use
+	glTexParameteri(texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter);
+	glGenerateMipmap(texture_type);
+#endif
+}
+
+void GLBackend::setTextureFilter(Texture* texture, int min_filter, int mag_filter)
+{
+	glBindTexture(texture->texture_type, texture->texture_id);	//we activate this id to tell opengl we are going to use this texture
+	glTexParameteri(texture->texture_type, GL_TEXTURE_MAG_FILTER, mag_filter);
+	glTexParameteri(texture->texture_type, GL_TEXTURE_MIN_FILTER, min_filter);
+}
+
+void GLBackend::setTextureWrap(Texture* texture, int wrap)
+{
+	glBindTexture(texture->texture_type, texture->texture_id);	//we activate this id to tell opengl we are going to use this texture
+	glTexParameteri(texture->texture_type, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(texture->texture_type, GL_TEXTURE_WRAP_T, wrap);
+	glBindTexture(texture->texture_type, 0);
+}
+
+void GLBackend::releaseTexture(Texture* texture)
+{
+	glBindTexture(texture->texture_type, 0);
+
+	//external textures are handled by an outside system (like Android OS)
+	if (texture->texture_type != GL_TEXTURE_EXTERNAL_OES)
+		glDeleteTextures(1, &texture->texture_id);
+}
+
+// FRAMEBUFFERS ******************************************
+
+bool GLBackend::createFramebuffer(FBO* fbo, Texture* depth_texture, int cubemap_face)
+{
+	//create and bind FBO
+	if (fbo->fbo_id == 0)
+		glGenFramebuffersEXT(1, &fbo->fbo_id);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo->fbo_id);
+	checkGLErrors();
+
+	if (depth_texture)
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture->texture_id, 0);
+	else
+	{
+		if (!fbo->renderbuffer_depth)
+			glGenRenderbuffers(1, &fbo->renderbuffer_depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, fbo->renderbuffer_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, fbo->width, fbo->height);
+		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, fbo->renderbuffer_depth);
+	}
+	checkGLErrors();
+
+	for (int i = 0; i < 4; ++i)
+	{
+		Texture* texture = fbo->color_textures[i];
+		if (texture && texture->texture_type == GL_TEXTURE_CUBE_MAP)
+		{
+			assert(cubemap_face != -1); //MUST SPECIFY CUBEMAP FACE
+			glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT + i, GL_TEXTURE_CUBE_MAP_POSITIVE_X + cubemap_face, texture->texture_id, 0);
+		}
+		else
+			glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT + i, GL_TEXTURE_2D, texture ? texture->texture_id : 0, 0);
+	}
+
+	//add a render buffer for the color
+	if (fbo->num_color_textures == 0)
+	{
+		if(!fbo->renderbuffer_color)
+			glGenRenderbuffersEXT(1, &fbo->renderbuffer_color);
+		glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, fbo->renderbuffer_color);
+		glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGB, fbo->width, fbo->height);
+		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER_EXT, fbo->renderbuffer_color);
+	}
+
+	glDrawBuffers(4, fbo->bufs);
+
+	checkGLErrors();
+
+	GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+	if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+	{
+		std::cout << "Error: Framebuffer object is not completed: " << status << std::endl;
+		assert(0);
+		return false;
+	}
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+
+	checkGLErrors();
+	return true;
+}
+
+bool GLBackend::createDepthFramebuffer(FBO* fbo)
+{
+	glGenFramebuffersEXT(1, &fbo->fbo_id);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo->fbo_id);
+
+	Texture* depth_texture = fbo->depth_texture;
+	glGenRenderbuffersEXT(1, &fbo->renderbuffer_color);
+	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, fbo->renderbuffer_color);
+
+	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA, depth_texture->width, depth_texture->height);
+	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER_EXT, fbo->renderbuffer_color);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture->texture_id, 0);
+
+	GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+	if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+	{
+		std::cout << "Error: Framebuffer object is not completed" << std::endl;
+		return false;
+	}
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	return true;
+}
+
+void GLBackend::releaseFramebuffer(FBO* fbo)
+{
+	if (fbo->fbo_id)
+		glDeleteFramebuffers(1, &fbo->fbo_id);
+}
+
+void GLBackend::releaseRenderbuffers(FBO* fbo)
+{
+	if (fbo->renderbuffer_color)
+		glDeleteRenderbuffers(1, &fbo->renderbuffer_color);
+	if (fbo->renderbuffer_depth)
+		glDeleteRenderbuffers(1, &fbo->renderbuffer_depth);
+}
+
+void GLBackend::enableFramebuffer(FBO* fbo)
+{
+	assert(glGetError() == GL_NO_ERROR);
+	Texture* tex = fbo->color_textures[0] ? fbo->color_textures[0] : fbo->depth_texture;
+	assert(tex && "framebuffer without texture");
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo->fbo_id);
+	checkGLErrors();
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glDrawBuffers(4, fbo->bufs);
+	glViewport(0, 0, (int)tex->width, (int)tex->height);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void GLBackend::disableFramebuffer(FBO* fbo)
+{
+	// output goes to the FBO and its attached buffers
+	glPopAttrib();
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void GLBackend::bindFramebuffer(FBO* fbo)
+{
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo ? fbo->fbo_id : 0);
+}
+
+void GLBackend::setDrawBuffers(FBO* fbo, int num)
+{
+	if (num < 0)
+	{
+		glDrawBuffers(4, fbo->bufs);
+		return;
+	}
+	GLenum DrawBuffers[1] = {static_cast<GLenum>( (int)GL_COLOR_ATTACHMENT0) + num };
+	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
+}
+
+void GLBackend::blitDepth(FBO* source, FBO* destination, int x, int y, int width, int height)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, source->fbo_id);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, destination->fbo_id);
+	glBlitFramebuffer(x, y, x + width, y + height, x, y, x + width, y + height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, destination->fbo_id);
+}
+
+// RENDER STATE ******************************************
+
+void GLBackend::setClearColor(const Vector4& color)
+{
+	glClearColor(color.x, color.y, color.z, color.w);
+}
+
+void GLBackend::clear(unsigned int mask)
+{
+	glClear(mask);
+}
+
+void GLBackend::setBlend(bool enabled)
+{
+	if (enabled) glEnable(GL_BLEND);
+	else glDisable(GL_BLEND);
+}
+
+void GLBackend::setBlendFunc(unsigned int src, unsigned int dst)
+{
+	glBlendFunc(src, dst);
+}
+
+void GLBackend::setCullFace(bool enabled)
+{
+	if (enabled) glEnable(GL_CULL_FACE);
+	else glDisable(GL_CULL_FACE);
+}
+
+void GLBackend::setDepthTest(bool enabled)
+{
+	if (enabled) glEnable(GL_DEPTH_TEST);
+	else glDisable(GL_DEPTH_TEST);
+}
+
+void GLBackend::setDepthFunc(unsigned int func)
+{
+	glDepthFunc(func);
+}
+
+void GLBackend::setColorMask(bool enabled)
+{
+	glColorMask(enabled, enabled, enabled, enabled);
+}
+
+void GLBackend::setScissorTest(bool enabled)
+{
+	if (enabled) glEnable(GL_SCISSOR_TEST);
+	else glDisable(GL_SCISSOR_TEST);
+}
+
+void GLBackend::setScissor(int x, int y, int width, int height)
+{
+	glScissor(x, y, width, height);
+}
+
+void GLBackend::setViewport(int x, int y, int width, int height)
+{
+	glViewport(x, y, width, height);
+}
+
+// TIMER QUERIES ******************************************
+
+void GLBackend::createQueries(int num, unsigned int* queries)
+{
+	glGenQueries(num, queries);
+}
+
+void GLBackend::beginTimer(unsigned int query)
+{
+	glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void GLBackend::endTimer()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+bool GLBackend::getTimerResult(unsigned int query, uint64_t& nanoseconds)
+{
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return false;
+
+	GLuint64 elapsed_time;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_time);
+	nanoseconds = elapsed_time;
+	return true;
+}
@@ -0,0 +1,82 @@
+#ifndef GLBACKEND_H
+#define GLBACKEND_H
+
+#pragma once
+#include "renderbackend.h"
+#include "mesh.h"
+
+//OpenGL backend: the GL calls of the render path, they used to live in Shader, Mesh, Texture, FBO and the Renderer
+class GLBackend : public RenderBackend
+{
+public:
+	bool checkErrors();
+	int getMaxTextureBufferSize();
+
+	bool compileShader(Shader* shader, const std::string& vs_code, const std::string& fs_code);
+	void releaseShader(Shader* shader);
+	void useShader(Shader* shader);
+	int getUniformLocation(Shader* shader, const char* varname);
+	int getAttribLocation(Shader* shader, const char* varname);
+	void setUniform(int location, unsigned int type, int count, const void* data);
+	void setUniformBlock(Shader* shader, const char* varname, int binding);
+	void bindTexture(int slot, unsigned int texture_type, unsigned int texture_id);
+
+	void uploadMesh(Mesh* mesh);
+	void releaseMesh(Mesh* mesh);
+	void enableMeshBuffers(Mesh* mesh, Shader* shader);
+	void disableMeshBuffers(Mesh* mesh, Shader* shader);
+	bool enableInstanceBuffer(Mesh* mesh, Shader* shader, unsigned int buffer_id, int first_instance);
+	void disableInstanceBuffer(Mesh* mesh, Shader* shader);
+	void drawMesh(Mesh* mesh, unsigned int primitive, int start, int size, int lod_offset, int num_instances);
+
+	void uploadBuffer(unsigned int& buffer_id, const void* data, size_t size);
+	void uploadTextureBuffer(unsigned int& buffer_id, unsigned int& texture_id, unsigned int internal_format, const void* data, size_t size, int slot);
+
+	void createTexture(Texture* texture);
+	void uploadTexture(Texture* texture, unsigned int format, unsigned int type, const Uint8* data, unsigned int internal_format);
+	void generateMipmaps(Texture* texture);
+	void setTextureFilter(Texture* texture, int min_filter, int mag_filter);
+	void setTextureWrap(Texture* texture, int wrap);
+	void releaseTexture(Texture* texture);
+
+	bool createFramebuffer(FBO* fbo, Texture* depth_texture, int cubemap_face);
+	bool createDepthFramebuffer(FBO* fbo);
+	void releaseFramebuffer(FBO* fbo);
+	void releaseRenderbuffers(FBO* fbo);
+	void enableFramebuffer(FBO* fbo);
+	void disableFramebuffer(FBO* fbo);
+	void bindFramebuffer(FBO* fbo);
+	void setDrawBuffers(FBO* fbo, int num);
+	void blitDepth(FBO* source, FBO* destination, int x, int y, int width, int height);
+
+	void setClearColor(const Vector4& color);
+	void clear(unsigned int mask);
+	void setBlend(bool enabled);
+	void setBlendFunc(unsigned int src, unsigned int dst);
+	void setCullFace(bool enabled);
+	void setDepthTest(bool enabled);
+	void setDepthFunc(unsigned int func);
+	void setColorMask(bool enabled);
+	void setScissorTest(bool enabled);
+	void setScissor(int x, int y, int width, int height);
+	void setViewport(int x, int y, int width, int height);
+
+	void createQueries(int num, unsigned int* queries);
+	void beginTimer(unsigned int query);
+	void endTimer();
+	bool getTimerResult(unsigned int query, uint64_t& nanoseconds);
+
+private:
+	int attribute_locations[VERTEX_NUM_ATTRIBUTES] = { -1, -1, -1, -1, -1, -1, -1, -1 }; //enabled by enableMeshBuffers
+	unsigned int bound_vertex_array = 0; //VAO bound by enableMeshBuffers, 0 when the attributes were set one by one
+	int instance_location = -1; //first attribute of the mat4 u_model, enabled by enableInstanceBuffer
+
+	bool createShaderObject(Shader* shader, unsigned int type, GLuint& handle, const std::string& code);
+	void saveShaderInfoLog(Shader* shader, GLuint obj);
+	void saveProgramInfoLog(Shader* shader, GLuint obj);
+	bool validate(Shader* shader);
+	void createUniformValues(Shader* shader);
+	void releaseVertexArrays(Mesh* mesh);
+};
+
+#endif
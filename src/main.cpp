@@ -15,10 +15,15 @@
 #include "utils.h"
 #include "input.h"
 #include "game.h"
+#include "assetloader.h"
+#include "assetcache.h"
+#include "collisionmodel.h"
+#include "softrasterizer.h"
 
 #include <iostream> //to output
 
 long last_time = 0; //this is used to calcule the elapsed time between frames
+long launch_time = 0; //to report the time to the first frame
 
 Game* game = NULL;
 SDL_GLContext glcontext;
@@ -98,6 +103,8 @@ void mainLoop()
 
 		//render frame
 		game->render();
+		if (game->frame == 0)
+			std::cout << "Time to first frame: " << (SDL_GetTicks() - launch_time) * 0.001 << "sec" << std::endl;
 
 		//update events
 		while (SDL_PollEvent(&sdlEvent))
@@ -178,7 +185,7 @@ void mainLoop()
 	return;
 }
 
-void renderLoadingScreen(SDL_Window* window, int window_width, int window_height) {
+void renderLoadingScreen(SDL_Window* window, int window_width, int window_height, float progress = 0.0f) {
 	Shader* shader = Shader::Get("data/shaders/image.vs", "data/shaders/image.fs");
 	Texture* loading = Texture::Get("data/GUIs/loading.png");
 	//Set the clear color (the background color)
@@ -220,6 +227,16 @@ void renderLoadingScreen(SDL_Window* window, int window_width, int window_height
 	//Render the quad	
 	quad.render(GL_TRIANGLES);
 
+	//Progress bar along the bottom of the window
+	if (progress > 0.0f)
+	{
+		Mesh bar;
+		bar.createQuad(window_width * progress * 0.5f, window_height - 3, window_width * progress, 6, true);
+		shader->setUniform("u_color", Vector4(0.6f, 0.05f, 0.05f, 1));
+		shader->setUniform("u_texture", Texture::getWhiteTexture(), 0);
+		bar.render(GL_TRIANGLES);
+	}
+
 	//Disable the shader
 	shader->disable();
 
@@ -232,12 +249,49 @@ void renderLoadingScreen(SDL_Window* window, int window_width, int window_height
 	SDL_GL_SwapWindow(window);
 }
 
+//called by the asset loader between upload slices
+void renderLoadingProgress(float progress)
+{
+	Game* game = Game::instance;
+	SDL_PumpEvents(); //so the window keeps responding while loading
+	renderLoadingScreen(game->window, game->window_width, game->window_height, progress);
+}
+
 int main(int argc, char** argv)
 {
+	//cooker: imports the assets into the cache and exits, without a window
+	if (argc > 1 && std::string(argv[1]) == "--cook")
+		return AssetCache::cook(argc > 2 ? argv[2] : "data/assets") ? 1 : 0;
+
+	//collisions benchmark: times the BVH against coldet on the given meshes, or on the tree and the cottage
+	if (argc > 1 && std::string(argv[1]) == "--bench-collisions")
+	{
+		std::vector<std::string> filenames(argv + 2, argv + argc);
+		if (filenames.empty())
+			filenames = { "data/assets/tree/terrain_trees.ASE.mbin", "data/assets/cottage/cottage_obj.obj" };
+		return CollisionModel::benchmark(filenames) ? 1 : 0;
+	}
+
+	//headless render: the Renderer draws a scene with the software rasterizer into a TGA, without a window or an OpenGL context
+	//--render [scene] [output] [width height] [golden]: with a golden image it fails when the frame doesn't match it
+	if (argc > 1 && std::string(argv[1]) == "--render")
+	{
+		const char* scene_filename = argc > 2 ? argv[2] : "data/scene.json";
+		const char* output_filename = argc > 3 ? argv[3] : "data/software_frame.tga";
+		int width = argc > 5 ? atoi(argv[4]) : 800;
+		int height = argc > 5 ? atoi(argv[5]) : 600;
+		if (!SoftRasterizer::renderScene(scene_filename, output_filename, width, height))
+			return 1;
+		if (argc > 6 && !SoftRasterizer::compareImages(output_filename, argv[6]))
+			return 1;
+		return 0;
+	}
+
 	std::cout << "Initiating game..." << std::endl;
 
 	//prepare SDL
 	SDL_Init(SDL_INIT_EVERYTHING);
+	launch_time = SDL_GetTicks();
 
 	bool fullscreen = false; //change this to go fullscreen
 	Vector2 size(800, 600);
@@ -255,6 +309,7 @@ int main(int argc, char** argv)
 	Input::init(window);
 
 	renderLoadingScreen(window, window_width, window_height);
+	AssetLoader::progress_callback = renderLoadingProgress;
 	
 	//launch the game (game is a global variable)
 	game = new Game(window_width, window_height, window);
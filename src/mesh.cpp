@@ -4,22 +4,31 @@
 #include "shader.h"
 #include "includes.h"
 #include "framework.h"
+#include "assetcache.h"
 
 #include <cassert>
 #include <iostream>
 #include <limits>
+#include <thread>
 #include <sys/stat.h>
 
 #include "camera.h"
 #include "texture.h"
+#include "renderbackend.h"
 //#include "animation.h"
-#include "extra/coldet/coldet.h"
+#include "collisionmodel.h"
+#include "meshoptimizer.h"
 
 //#include "engine/application.h"
 
-bool Mesh::use_binary = false;			//checks if there is .wbin, it there is one tries to read it instead of the other file
+bool Mesh::use_binary = true;			//checks if there is a .mbin in the asset cache, if there is one tries to read it instead of the other file
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
+bool Mesh::keep_cpu_copies = false;		//once uploaded only the positions and indices stay in RAM, the CPU consumers load the rest through the ResourceManager
+bool Mesh::compress_bins = true;		//sections of the .mbin are stored compressed when it saves space
+bool Mesh::optimize_meshes = true;		//imported meshes are reordered for the vertex cache, overdraw and vertex fetch
+bool Mesh::generate_lods = true;		//imported meshes are simplified into levels of detail
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
+bool Mesh::generate_tangents = true;	//interleaved meshes with normals and uvs get a_tangent
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 long Mesh::num_meshes_rendered = 0;
@@ -30,10 +39,15 @@ long Mesh::num_triangles_rendered = 0;
 #define FORMAT_MBIN 3
 #define FORMAT_MESH 4
 
+#define LOD_MIN_TRIANGLES 64 //smaller meshes don't get levels of detail
+#define LOD_MAX_ERROR 0.05f //max error of a level, relative to the radius of the mesh
+#define LOD_MIN_REDUCTION 0.8f //a level must have at most this fraction of the triangles of the previous one
+
 Mesh::Mesh()
 {
 	radius = 0;
 	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
+	vram_bytes = 0;
 	collision_model = NULL;
 
 	clear();
@@ -45,52 +59,19 @@ Mesh::~Mesh()
 }
 
 
-void Mesh::clear()
+void Mesh::releaseVRAM()
 {
-	//Free VBOs
-	#ifdef USE_OPENGL_EXT
-		if (vertices_vbo_id)
-			glDeleteBuffersARB(1,&vertices_vbo_id);
-		if (uvs_vbo_id)
-			glDeleteBuffersARB(1,&uvs_vbo_id);
-		if (normals_vbo_id)
-			glDeleteBuffersARB(1,&normals_vbo_id);
-		if (colors_vbo_id)
-			glDeleteBuffersARB(1,&colors_vbo_id);
-		if (interleaved_vbo_id)
-			glDeleteBuffersARB(1, &interleaved_vbo_id);
-		if (indices_vbo_id)
-			glDeleteBuffersARB(1, &indices_vbo_id);
-		if (bones_vbo_id)
-			glDeleteBuffersARB(1, &bones_vbo_id);
-		if (weights_vbo_id)
-			glDeleteBuffersARB(1, &weights_vbo_id);
-		if (uvs1_vbo_id)
-			glDeleteBuffersARB(1, &uvs1_vbo_id);
-    #else
-	if (vertices_vbo_id)
-		glDeleteBuffers(1,&vertices_vbo_id);
-	if (uvs_vbo_id)
-		glDeleteBuffers(1,&uvs_vbo_id);
-	if (normals_vbo_id)
-		glDeleteBuffers(1,&normals_vbo_id);
-	if (colors_vbo_id)
-		glDeleteBuffers(1,&colors_vbo_id);
-	if (interleaved_vbo_id)
-		glDeleteBuffers(1, &interleaved_vbo_id);
-	if (indices_vbo_id)
-		glDeleteBuffers(1, &indices_vbo_id);
-	if (bones_vbo_id)
-		glDeleteBuffers(1, &bones_vbo_id);
-	if (weights_vbo_id)
-		glDeleteBuffers(1, &weights_vbo_id);
-	if (uvs1_vbo_id)
-		glDeleteBuffers(1, &uvs1_vbo_id);
-    #endif
-
+	RenderBackend::current->releaseMesh(this);
 
 	//VBOs ids
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
+	indices_format = GL_UNSIGNED_INT;
+	vram_bytes = 0;
+}
+
+void Mesh::clear()
+{
+	releaseVRAM();
 
 	//buffers
 	vertices.clear();
@@ -98,164 +79,88 @@ void Mesh::clear()
 	uvs.clear();
 	colors.clear();
 	interleaved.clear();
+	vertex_layout = sVertexLayout();
 	m_indices.clear();
+	lods.clear();
+	lod_indices.clear();
 	bones.clear();
 	weights.clear();
 	m_uvs1.clear();
 
+	//a background build can't be left writing into the cleared mesh
+	if (collision_task.valid())
+		collision_task.wait();
+	collision_task = std::future<bool>();
 	if (collision_model)
-		delete (CollisionModel3D*)collision_model;
+		delete collision_model;
+	collision_model = NULL;
 }
 
-int vertex_location = -1;
-int normal_location = -1;
-int uv_location = -1;
-int uv1_location = -1;
-int color_location = -1;
-int bones_location = -1;
-int weights_location = -1;
-
-void Mesh::enableBuffers(Shader* sh)
+template<typename T> static Mesh::sVertexStream makeVertexStream(const std::vector<T>& data, int components, unsigned int type, unsigned int* vbo_id)
 {
-	vertex_location = sh->getAttribLocation("a_vertex");
-	/*
-	assert(vertex_location != -1 && "No a_vertex found in shader");
-	if (vertex_location == -1)
-		return;
-	*/
-
-	int spacing = 0;
-	int offset_normal = 0;
-	int offset_uv = 0;
-
-	if (interleaved.size())
-	{
-		spacing = sizeof(tInterleaved);
-		offset_normal = sizeof(Vector3);
-		offset_uv = sizeof(Vector3) + sizeof(Vector3);
-	}
-
-	if (vertex_location != -1)
-	{
-		glEnableVertexAttribArray(vertex_location);
-		if (vertices_vbo_id || interleaved_vbo_id)
-		{
-			glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
-		}
-		else
-			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
-		checkGLErrors();
-	}
+	Mesh::sVertexStream stream;
+	stream.data = data.size() ? (const char*)data.data() : NULL;
+	stream.count = (unsigned int)data.size();
+	stream.size = sizeof(T);
+	stream.format.components = components;
+	stream.format.type = type;
+	stream.vbo_id = vbo_id;
+	return stream;
+}
 
-	normal_location = -1;
-	if (normals.size() || spacing)
+Mesh::sVertexStream Mesh::getVertexStream(int attribute)
+{
+	switch (attribute)
 	{
-		normal_location = sh->getAttribLocation("a_normal");
-		if (normal_location != -1)
-		{
-			glEnableVertexAttribArray(normal_location);
-			if (normals_vbo_id || interleaved_vbo_id)
-			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
-			}
-			else
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
-		}
-		checkGLErrors();
+	case VERTEX_POSITION: return makeVertexStream(vertices, 3, GL_FLOAT, &vertices_vbo_id);
+	case VERTEX_NORMAL: return makeVertexStream(normals, 3, GL_FLOAT, &normals_vbo_id);
+	case VERTEX_UV: return makeVertexStream(uvs, 2, GL_FLOAT, &uvs_vbo_id);
+	case VERTEX_UV1: return makeVertexStream(m_uvs1, 2, GL_FLOAT, &uvs1_vbo_id);
+	case VERTEX_COLOR: return makeVertexStream(colors, 4, GL_FLOAT, &colors_vbo_id);
+	case VERTEX_BONES: return makeVertexStream(bones, 4, GL_UNSIGNED_BYTE, &bones_vbo_id);
+	case VERTEX_WEIGHTS: return makeVertexStream(weights, 4, GL_FLOAT, &weights_vbo_id);
+	default: return sVertexStream(); //tangents only exist in the interleaved buffer
 	}
+}
 
-	uv_location = -1;
-	if (uvs.size() || spacing)
-	{
-		uv_location = sh->getAttribLocation("a_coord");
-		if (uv_location != -1)
-		{
-			glEnableVertexAttribArray(uv_location);
-			if (uvs_vbo_id || interleaved_vbo_id)
-			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
-			}
-			else
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
-		}
-		checkGLErrors();
-	}
+//used by the interleaved buffer and the .mbin sections
+#define MBIN_UV_MAX_ERROR (1.0f / 1024.0f) //max error allowed when storing the uvs as half floats
+static unsigned short floatToHalf(float f);
+static float halfToFloat(unsigned short h);
 
-	uv1_location = -1;
-	if (m_uvs1.size())
-	{
-		uv1_location = sh->getAttribLocation("a_coord1");
-		if (uv1_location != -1)
-		{
-			glEnableVertexAttribArray(uv1_location);
-			if (uvs1_vbo_id)
-			{
-				glBindBuffer(GL_ARRAY_BUFFER, uvs1_vbo_id);
-				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-			}
-			else
-				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, &m_uvs1[0]);
-		}
-		checkGLErrors();
-	}
+//signed normalized 10 bits per axis, it is read in the shader as a regular vec3
+static unsigned int packNormal1010102(const Vector3& n)
+{
+	unsigned int packed = 0;
+	for (int k = 0; k < 3; ++k)
+		packed |= ((unsigned int)(int)floor(clamp(n.v[k], -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3FF) << (k * 10);
+	return packed;
+}
 
-	color_location = -1;
-	if (colors.size())
-	{
-		color_location = sh->getAttribLocation("a_color");
-		if (color_location != -1)
-		{
-			glEnableVertexAttribArray(color_location);
-			if (colors_vbo_id)
-			{
-				glBindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-			}
-			else
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, &colors[0]);
-		}
-		checkGLErrors();
-	}
+static bool uvsFitInHalfs(const std::vector<Vector2>& uvs)
+{
+	for (unsigned int i = 0; i < uvs.size(); ++i)
+		if (fabs(halfToFloat(floatToHalf(uvs[i].x)) - uvs[i].x) > MBIN_UV_MAX_ERROR || fabs(halfToFloat(floatToHalf(uvs[i].y)) - uvs[i].y) > MBIN_UV_MAX_ERROR)
+			return false;
+	return true;
+}
 
-	bones_location = -1;
-	if (bones.size())
-	{
-		bones_location = sh->getAttribLocation("a_bones");
-		if (bones_location != -1)
-		{
-			glEnableVertexAttribArray(bones_location);
-			if (bones_vbo_id)
-			{
-				glBindBuffer(GL_ARRAY_BUFFER, bones_vbo_id);
-				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, NULL);
-			}
-			else
-				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, &bones[0]);
-		}
-	}
-	weights_location = -1;
-	if (weights.size())
-	{
-		weights_location = sh->getAttribLocation("a_weights");
-		if (weights_location != -1)
-		{
-			glEnableVertexAttribArray(weights_location);
-			if (weights_vbo_id)
-			{
-				glBindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-			}
-			else
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, &weights[0]);
-		}
-	}
+void sVertexLayout::add(int attribute, int components, unsigned int type, bool normalized, int size)
+{
+	sAttribute& a = attributes[attribute];
+	a.components = components;
+	a.type = type;
+	a.normalized = normalized;
+	a.offset = stride;
+	stride += (size + 3) & ~3; //every attribute starts 4 bytes aligned
+}
 
+void Mesh::enableBuffers(Shader* shader)
+{
+	RenderBackend::current->enableMeshBuffers(this, shader);
 }
 
-void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::render(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
     //return;
 
@@ -265,97 +170,53 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(vertices.size() && "No vertices in this mesh");
 
 	//bind buffers to attribute locations
 	enableBuffers(shader);
-	checkGLErrors();
+	RenderBackend::current->checkErrors();
 
 	//draw call
-	drawCall(primitive, submesh_id, num_instances);
-	checkGLErrors();
+	drawCall(primitive, submesh_id, num_instances, lod);
+	RenderBackend::current->checkErrors();
 
 	//unbind them
 	disableBuffers(shader);
-	checkGLErrors();
+	RenderBackend::current->checkErrors();
 }
 
-void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
-	int start = 0; //in primitives
+	int start = 0; //in vertices or indices
+	int lod_offset = 0; //the levels of detail are after m_indices in the indices VBO
 	int size = (int)vertices.size();
 	if (m_indices.size())
 		size = (int)m_indices.size();
-	else
-	if (interleaved.size())
-		size = (int)interleaved.size();
 
 	if (submesh_id > -1)
 	{
 		assert(submesh_id < submeshes.size() && "this mesh doesnt have as many submeshes");
 		sSubmeshInfo& submesh = submeshes[submesh_id];
 		start = submesh.start;
-		size = submesh.start + submesh.length;
+		size = submesh.length;
 	}
-
-	//DRAW
-	if (m_indices.size())
+	else if (lod > 0 && lod <= (int)lods.size() && m_indices.size())
 	{
-		if (num_instances > 0)
-		{
-			assert(indices_vbo_id && "indices must be uploaded to the GPU");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			#ifdef OPENGL_ES3
-				glDrawElementsInstanced(primitive, size, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3u)), num_instances);
-            #else
-				assert(0 && "not supported in OpenGL ES2");
-            #endif
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		}
-		else
-		{
-			if (indices_vbo_id)
-			{
-				/*if (size != 90)*/ {
-					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-					glDrawElements(primitive, size, GL_UNSIGNED_INT,(void *) (start * sizeof(Vector3u)));
-					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-				}
-				checkGLErrors();
-			}
-			else
-				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //no multiply, its a vector3u pointer)
-		}
-	}
-	else
-	{
-		if (num_instances > 0)
-		{
-			#ifdef OPENGL_ES3
-				glDrawArraysInstanced(primitive, start, size, num_instances);
-            #else
-				assert(0 && "not supported in OpenGL ES2");
-            #endif
-		}
-		else
-			glDrawArrays(primitive, start, size);
+		start = lods[lod - 1].start;
+		size = lods[lod - 1].length;
+		lod_offset = (int)m_indices.size();
 	}
 
+	//DRAW
+	RenderBackend::current->drawMesh(this, primitive, start, size, lod_offset, num_instances);
+
 	num_triangles_rendered += (size / 3) * (num_instances ? num_instances : 1);
 	num_meshes_rendered++;
 }
 
 void Mesh::disableBuffers(Shader* shader)
 {
-	if (vertex_location != -1) glDisableVertexAttribArray(vertex_location);
-	if (normal_location != -1) glDisableVertexAttribArray(normal_location);
-	if (uv_location != -1) glDisableVertexAttribArray(uv_location);
-	if (uv1_location != -1) glDisableVertexAttribArray(uv1_location);
-	if (color_location != -1) glDisableVertexAttribArray(color_location);
-	if (bones_location != -1) glDisableVertexAttribArray(bones_location);
-	if (weights_location != -1) glDisableVertexAttribArray(weights_location);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);    //if crashes here, COMMENT THIS LINE ****************************
-	checkGLErrors();
+	RenderBackend::current->disableMeshBuffers(this, shader);
 }
 
 GLuint instances_buffer_id = 0;
@@ -367,41 +228,47 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 		return;
 
 	#ifdef OPENGL_ES3
-		Shader* shader = Shader::current;
-		assert(shader && "shader must be enabled");
+		RenderBackend::current->uploadBuffer(instances_buffer_id, instanced_models, num_instances * sizeof(Matrix44));
 
-		if (instances_buffer_id == 0)
-			glGenBuffersARB(1, &instances_buffer_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
+		renderInstanced(primitive, instances_buffer_id, 0, num_instances);
+    #else
+		assert(0 && "not supported");
+    #endif
+}
 
-		int attribLocation = shader->getAttribLocation("u_model");
-		assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
-		if (attribLocation == -1)
-			return; //this shader doesnt support instanced model
+//same but the models are already in a buffer, so several meshes can share one upload
+void Mesh::renderInstanced(unsigned int primitive, unsigned int instances_buffer_id, int first_instance, int num_instances, int lod)
+{
+	if (!num_instances)
+		return;
 
-		//mat4 count as 4 different attributes of vec4... (thanks opengl...)
-		for (int k = 0; k < 4; ++k)
-		{
-			glEnableVertexAttribArray(attribLocation + k );
-			int offset = sizeof(float) * 4 * k;
-			const Uint8* addr = (Uint8*) offset;
-			glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr);
-			glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
-		}
+	Shader* shader = Shader::current;
+	assert(shader && "shader must be enabled");
 
-		//regular render
-		render(primitive, 0, num_instances);
+	//bind buffers to attribute locations
+	enableBuffers(shader);
+	if (!enableInstanceBuffer(shader, instances_buffer_id, first_instance))
+	{
+		disableBuffers(shader);
+		return; //this shader doesnt support instanced model
+	}
 
-		//disable instanced attribs
-		for (int k = 0; k < 4; ++k)
-		{
-			glDisableVertexAttribArray(attribLocation + k);
-			glVertexAttribDivisor(attribLocation + k, 0);
-		}
-    #else
-		assert(0 && "not supported");
-    #endif
+	//draw all the instances at once
+	drawCall(primitive, -1, num_instances, lod);
+
+	//unbind them
+	disableInstanceBuffer(shader);
+	disableBuffers(shader);
+}
+
+bool Mesh::enableInstanceBuffer(Shader* shader, unsigned int instances_buffer_id, int first_instance)
+{
+	return RenderBackend::current->enableInstanceBuffer(this, shader, instances_buffer_id, first_instance);
+}
+
+void Mesh::disableInstanceBuffer(Shader* shader)
+{
+	RenderBackend::current->disableInstanceBuffer(this, shader);
 }
 
 //super obsolete rendering method, do not use
@@ -493,248 +360,452 @@ void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 }
 */
 
-#define glGenBuffersARB glGenBuffers
-#define glBindBufferARB glBindBuffer
-#define glBufferDataARB glBufferData
-#define GL_ARRAY_BUFFER_ARB GL_ARRAY_BUFFER
-#define GL_STATIC_DRAW_ARB GL_STATIC_DRAW
-
 void Mesh::uploadToVRAM()
 {
-	assert(vertices.size() || interleaved.size());
+	assert(vertices.size());
 
-	if (glGenBuffersARB == nullptr)
-	{
-		std::cout << "Error: your graphics cards dont support VBOs. Sorry." << std::endl;
-		exit(0);
-	}
+	vram_bytes = 0;
 
-	if (interleaved.size())
-	{
-		// Vertex,Normal,UV
-		if (interleaved_vbo_id == 0)
-			glGenBuffersARB(1, &interleaved_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
-	}
-	else
+	//packed on the loading thread, or now if the streams changed since the last upload
+	if (interleave_meshes && interleaved.empty())
+		interleaveBuffers(vertex_layout.mask ? vertex_layout.mask : VERTEX_ALL_ATTRIBUTES);
+
+	RenderBackend::current->uploadMesh(this);
+
+	//clear buffers to save memory, the separated streams are kept for the CPU (collisions, bins)
+	if (interleaved_vbo_id)
+		std::vector<char>().swap(interleaved);
+}
+
+template<typename T> static size_t releaseStream(std::vector<T>& stream)
+{
+	size_t bytes = stream.capacity() * sizeof(T);
+	std::vector<T>().swap(stream);
+	return bytes;
+}
+
+//the positions and indices stay, the collisions and the draw calls need them
+size_t Mesh::releaseCPUCopies()
+{
+	if (!vertices_vbo_id && !interleaved_vbo_id)
+		return 0;
+	size_t bytes = releaseStream(interleaved);
+	bytes += releaseStream(normals);
+	bytes += releaseStream(uvs);
+	bytes += releaseStream(m_uvs1);
+	bytes += releaseStream(colors);
+	bytes += releaseStream(bones);
+	bytes += releaseStream(weights);
+	bytes += releaseStream(lod_indices);
+	if (bytes)
+		residency.cpu_copies_dropped = true; //ResourceManager::use loads them again for the CPU consumers
+	return bytes;
+}
+
+void Mesh::evict()
+{
+	//a background build of the collision model reads the vertices
+	if (collision_task.valid())
+		collision_task.wait();
+
+	releaseVRAM();
+	releaseCPUCopies();
+	releaseStream(vertices);
+	releaseStream(m_indices);
+	submeshes.clear();
+	lods.clear();
+	vertex_layout = sVertexLayout();
+}
+
+size_t Mesh::getRAMBytes()
+{
+	return vertices.capacity() * sizeof(Vector3) + normals.capacity() * sizeof(Vector3) + uvs.capacity() * sizeof(Vector2) + m_uvs1.capacity() * sizeof(Vector2) +
+		colors.capacity() * sizeof(Vector4) + bones.capacity() * sizeof(Vector4ub) + weights.capacity() * sizeof(Vector4) + interleaved.capacity() +
+		(m_indices.capacity() + lod_indices.capacity()) * sizeof(unsigned int);
+}
+
+//moves every element of the stream to its new index, several elements can go to the same one
+template<typename T> static void remapStream(std::vector<T>& stream, const std::vector<unsigned int>& remap, unsigned int num_vertices)
+{
+	if (stream.empty())
+		return;
+	std::vector<T> result(num_vertices);
+	for (unsigned int i = 0; i < stream.size(); ++i)
+		result[remap[i]] = stream[i];
+	stream.swap(result);
+}
+
+template<typename T> static void appendVertexKey(std::vector<char>& key, const std::vector<T>& stream, unsigned int index)
+{
+	if (stream.size())
+		key.insert(key.end(), (const char*)&stream[index], (const char*)&stream[index] + sizeof(T));
+}
+
+void Mesh::remapVertices(const std::vector<unsigned int>& remap, unsigned int num_vertices)
+{
+	remapStream(vertices, remap, num_vertices);
+	remapStream(normals, remap, num_vertices);
+	remapStream(uvs, remap, num_vertices);
+	remapStream(m_uvs1, remap, num_vertices);
+	remapStream(colors, remap, num_vertices);
+	remapStream(bones, remap, num_vertices);
+	remapStream(weights, remap, num_vertices);
+}
+
+void Mesh::optimize()
+{
+	unsigned int num_vertices = getNumVertices();
+	if (num_vertices < 3)
+		return;
+
+	//non indexed meshes are indexed first, welding the vertices that are equal in every stream
+	unsigned int original_vertices = num_vertices;
+	if (m_indices.empty())
 	{
-		// Vertices
-		if (vertices_vbo_id == 0)
-			glGenBuffersARB(1, &vertices_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(Vector3), &vertices[0], GL_STATIC_DRAW_ARB);
+		std::vector<unsigned int> remap(num_vertices);
+		std::vector<int> hash_table(1, -1);
+		while (hash_table.size() < num_vertices * 2)
+			hash_table.resize(hash_table.size() * 2);
+		hash_table.assign(hash_table.size(), -1);
+		unsigned int hash_mask = (unsigned int)hash_table.size() - 1;
 
-		// UVs
-		if (uvs.size())
+		std::vector<char> keys;
+		for (unsigned int i = 0; i < num_vertices; ++i)
 		{
-			if (uvs_vbo_id == 0)
-				glGenBuffersARB(1, &uvs_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs.size() * sizeof(Vector2), &uvs[0], GL_STATIC_DRAW_ARB);
+			appendVertexKey(keys, vertices, i);
+			appendVertexKey(keys, normals, i);
+			appendVertexKey(keys, uvs, i);
+			appendVertexKey(keys, m_uvs1, i);
+			appendVertexKey(keys, colors, i);
+			appendVertexKey(keys, bones, i);
+			appendVertexKey(keys, weights, i);
 		}
+		size_t stride = keys.size() / num_vertices;
 
-		// Normals
-		if (normals.size())
+		unsigned int num_unique = 0;
+		std::vector<unsigned int> first_vertex; //of every unique vertex
+		for (unsigned int i = 0; i < num_vertices; ++i)
 		{
-			if (normals_vbo_id == 0)
-				glGenBuffersARB(1, &normals_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size() * sizeof(Vector3), &normals[0], GL_STATIC_DRAW_ARB);
+			const char* key = &keys[i * stride];
+			unsigned int hash = 2166136261u; //FNV-1a
+			for (size_t k = 0; k < stride; ++k)
+				hash = (hash ^ (unsigned char)key[k]) * 16777619u;
+
+			unsigned int slot = hash & hash_mask;
+			while (hash_table[slot] != -1 && memcmp(&keys[first_vertex[hash_table[slot]] * stride], key, stride) != 0)
+				slot = (slot + 1) & hash_mask;
+			if (hash_table[slot] == -1)
+			{
+				hash_table[slot] = num_unique++;
+				first_vertex.push_back(i);
+			}
+			remap[i] = hash_table[slot];
 		}
-	}
 
-	// UVs
-	if (m_uvs1.size())
-	{
-		if (uvs1_vbo_id == 0)
-			glGenBuffersARB(1, &uvs1_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs1_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, m_uvs1.size() * sizeof(Vector2), &m_uvs1[0], GL_STATIC_DRAW_ARB);
+		m_indices = remap;
+		remapVertices(remap, num_unique);
+		num_vertices = num_unique;
 	}
 
-	// Colors
-	if (colors.size())
-	{
-		if (colors_vbo_id == 0)
-			glGenBuffersARB(1, &colors_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4), &colors[0], GL_STATIC_DRAW_ARB);
-	}
+	float acmr_before, atvr_before;
+	computeVertexCacheStats(&m_indices[0], (int)m_indices.size(), num_vertices, acmr_before, atvr_before);
 
-	if (bones.size())
-	{
-		if (bones_vbo_id == 0)
-			glGenBuffersARB(1, &bones_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, bones.size() * sizeof(Vector4ub), &bones[0], GL_STATIC_DRAW_ARB);
-	}
-	if (weights.size())
+	const std::vector<Vector3>& positions = vertices;
+
+	//the triangles are reordered inside each submesh, so the ranges stay valid
+	bool valid_submeshes = submeshes.size() > 0;
+	for (unsigned int i = 0; i < submeshes.size(); ++i)
+		if (submeshes[i].start < 0 || submeshes[i].length < 0 || submeshes[i].start + submeshes[i].length > (int)m_indices.size())
+			valid_submeshes = false;
+	int num_ranges = valid_submeshes ? (int)submeshes.size() : 1;
+	for (int i = 0; i < num_ranges; ++i)
 	{
-		if (weights_vbo_id == 0)
-			glGenBuffersARB(1, &weights_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4), &weights[0], GL_STATIC_DRAW_ARB);
+		int start = valid_submeshes ? submeshes[i].start : 0;
+		int length = valid_submeshes ? submeshes[i].length : (int)m_indices.size();
+		length -= length % 3;
+		if (length < 6)
+			continue;
+		optimizeVertexCache(&m_indices[start], length, num_vertices);
+		optimizeOverdraw(&m_indices[start], length, &positions[0], num_vertices);
 	}
 
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+	//vertices in the order they are used
+	std::vector<unsigned int> remap = optimizeVertexFetch(&m_indices[0], (int)m_indices.size(), num_vertices);
+	for (unsigned int i = 0; i < m_indices.size(); ++i)
+		m_indices[i] = remap[m_indices[i]];
+	remapVertices(remap, num_vertices);
 
-	// Indices
-	if (m_indices.size())
-	{
-		if (indices_vbo_id == 0)
-			glGenBuffersARB(1, &indices_vbo_id);
-		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW_ARB);
-	}
-	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
+	float acmr, atvr;
+	computeVertexCacheStats(&m_indices[0], (int)m_indices.size(), num_vertices, acmr, atvr);
+	std::cout << "\t\t Optimized " << filename << ": Vertices " << original_vertices << " -> " << num_vertices << " ACMR " << acmr_before << " -> " << acmr << " ATVR " << atvr_before << " -> " << atvr << std::endl;
+}
 
-	checkGLErrors();
-	//clear buffers to save memory
+void Mesh::createLods(int max_lods)
+{
+	lods.clear();
+	lod_indices.clear();
+	unsigned int num_vertices = getNumVertices();
+	if (m_indices.size() < LOD_MIN_TRIANGLES * 3)
+		return;
+
+	const std::vector<Vector3>& positions = vertices;
+	float max_error = (aabb_max - aabb_min).length() * 0.5f * LOD_MAX_ERROR;
+
+	//every level is simplified from the previous one, so its error is at most the sum of both
+	std::vector<unsigned int> source = m_indices;
+	std::vector<unsigned int> level(m_indices.size());
+	std::string faces = std::to_string(m_indices.size() / 3);
+	float error = 0.0f;
+	for (int i = 0; i < max_lods && error < max_error; ++i)
+	{
+		float level_error;
+		int target = (int)source.size() / 6 * 3;
+		int count = simplifyMesh(&level[0], &source[0], (int)source.size(), &positions[0], num_vertices, target, max_error - error, &level_error);
+		if (count == 0 || count > source.size() * LOD_MIN_REDUCTION)
+			break;
+		optimizeVertexCache(&level[0], count, num_vertices);
+
+		sLodInfo lod;
+		lod.start = (int)lod_indices.size();
+		lod.length = count;
+		error += level_error;
+		lod.error = error;
+		lods.push_back(lod);
+		lod_indices.insert(lod_indices.end(), level.begin(), level.begin() + count);
+		source.assign(level.begin(), level.begin() + count);
+		faces += " -> " + std::to_string(count / 3);
+	}
+	std::cout << "\t\t LODs " << filename << ": Faces " << faces << " Error " << error << std::endl;
 }
 
 bool Mesh::createCollisionModel(bool is_static)
 {
+	if (collision_task.valid())
+		collision_task.get();
 	if (collision_model)
 		return true;
+	if (residency.evicted && !ResourceManager::use(this))
+		return false;
+	return buildCollisionModel(is_static);
+}
 
-	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
-
-	if (m_indices.size()) //indexed
-	{
-		collision_model->setTriangleNumber((int)m_indices.size() / 3);
+//builds it in a thread, so the first query doesn't stall. The mesh must not change until it is done
+void Mesh::createCollisionModelAsync(bool is_static)
+{
+	if (collision_model || collision_task.valid())
+		return;
+	collision_task = std::async(std::launch::async, &Mesh::buildCollisionModel, this, is_static);
+}
 
-		if (interleaved.size())
-			for (unsigned int i = 0; i < m_indices.size(); i+=3)
-			{
-				auto v1 = interleaved[m_indices[i+0]];
-				auto v2 = interleaved[m_indices[i+1]];
-				auto v3 = interleaved[m_indices[i+2]];
-				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-			}
-		else
-		for (unsigned int i = 0; i < m_indices.size(); i+=3)
-		{
-			auto v1 = vertices[m_indices[i+0]];
-			auto v2 = vertices[m_indices[i+1]];
-			auto v3 = vertices[m_indices[i+2]];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
-		}
-	}
-	else if (interleaved.size()) //is interleaved
-	{
-		collision_model->setTriangleNumber(interleaved.size() / 3);
-		for (unsigned int i = 0; i < interleaved.size(); i+=3)
-		{
-			auto v1 = interleaved[i];
-			auto v2 = interleaved[i+1];
-			auto v3 = interleaved[i+2];
-			collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-		}
-	}
-	else if (vertices.size()) //non interleaved
-	{
-		collision_model->setTriangleNumber((int)vertices.size() / 3);
-		for (unsigned int i = 0; i < (int)vertices.size(); i+=3)
-		{
-			auto v1 = vertices[i];
-			auto v2 = vertices[i + 1];
-			auto v3 = vertices[i + 2];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
-		}
-	}
-	else
+bool Mesh::buildCollisionModel(bool is_static)
+{
+	if (!vertices.size())
 	{
 		assert(0 && "mesh without vertices, cannot create collision model");
 		return false;
 	}
-	collision_model->finalize();
+
+	CollisionModel* collision_model = new CollisionModel();
+	if (m_indices.size()) //indexed
+		collision_model->build(&vertices[0], &m_indices[0], (int)m_indices.size() / 3);
+	else //non indexed
+		collision_model->build(&vertices[0], NULL, (int)vertices.size() / 3);
 	this->collision_model = collision_model;
 	return true;
 }
 
+//the inverse kept by the caller, or the one of the model
+static Matrix44 getInverseModel(const Matrix44& model, const Matrix44* inverse_model)
+{
+	if (inverse_model)
+		return *inverse_model;
+	Matrix44 inverse = model;
+	inverse.inverse();
+	return inverse;
+}
+
 //help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
-bool Mesh::testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector3& collision, Vector3& normal, float max_ray_dist, bool in_object_space )
+bool Mesh::testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector3& collision, Vector3& normal, float max_ray_dist, bool in_object_space, const Matrix44* inverse_model )
 {
-	if (!this->collision_model)
-		if (!createCollisionModel())
-			return false;
+	if (!createCollisionModel())
+		return false;
 
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
+	assert(collision_model && "CollisionModel must be created before using it, call createCollisionModel");
 
-	collision_model->setTransform( model.m );
-	if (collision_model->rayCollision( start.v , front.v, true,0.0, max_ray_dist) == false)
+	//the ray goes to object space without normalizing the direction, so the distances are still in world units
+	Matrix44 inverse = getInverseModel(model, inverse_model);
+	CollisionModel::sHit hit;
+	if (!collision_model->rayCollision(inverse * start, inverse.rotateVector(front), max_ray_dist, hit))
 		return false;
 
-	collision_model->getCollisionPoint( collision.v, in_object_space);
+	if (in_object_space)
+	{
+		collision = hit.point;
+		normal = hit.edge1.cross(hit.edge2);
+	}
+	else
+	{
+		collision = start + front * hit.t;
+		normal = model.rotateVector(hit.edge1).cross(model.rotateVector(hit.edge2));
+	}
+	normal.normalize();
 
-	float t1[9],t2[9];
-	collision_model->getCollidingTriangles(t1,t2, in_object_space);
+	return true;
+}
+
+bool Mesh::testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal, const Matrix44* inverse_model)
+{
+	if (!createCollisionModel())
+		return false;
 
-	Vector3 v1;
-	Vector3 v2;
-	v1=Vector3(t1[3]-t1[0],t1[4]-t1[1],t1[5]-t1[2]);
-	v2=Vector3(t1[6]-t1[0],t1[7]-t1[1],t1[8]-t1[2]);
-	v1.normalize();
-	v2.normalize();
-	normal = v1.cross(v2);
+	assert(collision_model && "CollisionModel must be created before using it, call createCollisionModel");
+
+	//as coldet did, the radius is in object space
+	Matrix44 inverse = getInverseModel(model, inverse_model);
+	CollisionModel::sHit hit;
+	if (!collision_model->sphereCollision(inverse * center, radius, hit))
+		return false;
+
+	collision = model * hit.point;
+	normal = model.rotateVector(hit.edge1).cross(model.rotateVector(hit.edge2));
+	normal.normalize();
 
 	return true;
 }
 
-bool Mesh::testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal)
+bool Mesh::testSweptSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3 delta, float& toi, Vector3& collision, Vector3& normal, const Matrix44* inverse_model)
 {
-	if (!this->collision_model)
-		if (!createCollisionModel())
-			return false;
-
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
+	if (!createCollisionModel())
+		return false;
 
-	collision_model->setTransform(model.m);
-	if (collision_model->sphereCollision(center.v, radius) == false)
+	//with the smallest scale of the model the sphere in object space contains the one in world space
+	float scale = (float)std::min(model.rightVector().length(), std::min(model.topVector().length(), model.frontVector().length()));
+	if (scale <= 0.0f)
 		return false;
 
-	collision_model->getCollisionPoint(collision.v, false);
+	Matrix44 inverse = getInverseModel(model, inverse_model);
+	CollisionModel::sHit hit;
+	if (!collision_model->sphereSweep(inverse * center, radius / scale, inverse.rotateVector(delta), hit))
+		return false;
 
-	float t1[9], t2[9];
-	collision_model->getCollidingTriangles(t1, t2, false);
+	toi = hit.t;
+	collision = model * hit.point;
 
-	Vector3 v1;
-	Vector3 v2;
-	v1 = Vector3(t1[3] - t1[0], t1[4] - t1[1], t1[5] - t1[2]);
-	v2 = Vector3(t1[6] - t1[0], t1[7] - t1[1], t1[8] - t1[2]);
-	v1.normalize();
-	v2.normalize();
-	normal = v1.cross(v2);
+	//the sphere is pushed away from the contact point, the face normal when it is the face what it touches
+	normal = center + delta * toi - collision;
+	if (normal.length() < 1e-6)
+		normal = delta * -1.0f;
+	normal.normalize();
 
 	return true;
 }
 
-bool Mesh::interleaveBuffers()
+//per vertex tangent from the uv directions of its triangles, w is the sign of the bitangent (mirrored uvs)
+void Mesh::computeTangents(std::vector<Vector4>& tangents)
 {
-	if (!vertices.size() || !normals.size() || !uvs.size())
-		return false;
-
-	assert(vertices.size() == normals.size() && normals.size() == uvs.size());
+	unsigned int num_vertices = (unsigned int)vertices.size();
+	std::vector<Vector3> tan_u(num_vertices), tan_v(num_vertices);
+	unsigned int num_indices = m_indices.size() ? (unsigned int)m_indices.size() : num_vertices;
+	for (unsigned int i = 0; i + 2 < num_indices; i += 3)
+	{
+		unsigned int a = m_indices.size() ? m_indices[i] : i;
+		unsigned int b = m_indices.size() ? m_indices[i + 1] : i + 1;
+		unsigned int c = m_indices.size() ? m_indices[i + 2] : i + 2;
+		Vector3 e1 = vertices[b] - vertices[a];
+		Vector3 e2 = vertices[c] - vertices[a];
+		Vector2 d1 = uvs[b] - uvs[a];
+		Vector2 d2 = uvs[c] - uvs[a];
+		float det = d1.x * d2.y - d2.x * d1.y;
+		if (fabs(det) < 1e-12f)
+			continue; //degenerated uvs
+		float r = 1.0f / det;
+		Vector3 u = (e1 * d2.y - e2 * d1.y) * r;
+		Vector3 v = (e2 * d1.x - e1 * d2.x) * r;
+		tan_u[a] = tan_u[a] + u; tan_u[b] = tan_u[b] + u; tan_u[c] = tan_u[c] + u;
+		tan_v[a] = tan_v[a] + v; tan_v[b] = tan_v[b] + v; tan_v[c] = tan_v[c] + v;
+	}
+
+	tangents.resize(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		//orthogonal to the normal, any direction if the uvs didn't give one
+		const Vector3& n = normals[i];
+		Vector3 t = tan_u[i] - n * n.dot(tan_u[i]);
+		if (t.length() < 1e-6)
+			t = fabs(n.x) < 0.9f ? Vector3(1, 0, 0) - n * n.x : Vector3(0, 1, 0) - n * n.y;
+		t.normalize();
+		tangents[i] = Vector4(t, n.cross(t).dot(tan_v[i]) < 0.0f ? -1.0f : 1.0f);
+	}
+}
 
-	interleaved.resize(vertices.size());
+bool Mesh::interleaveBuffers(int attributes)
+{
+	unsigned int num_vertices = (unsigned int)vertices.size();
+	if (!num_vertices)
+		return false;
 
-	for (unsigned int i = 0; i < vertices.size(); ++i)
-	{
-		interleaved[i].vertex = vertices[i];
-		interleaved[i].normal = normals[i];
-		interleaved[i].uv = uvs[i];
+	//the tangents only make sense with normals and uvs, they are packed in 4 bytes like the normals
+	//the uvs go as half floats unless they are tiled too far from the origin for the half precision
+	std::vector<Vector4> tangents;
+	if (generate_tangents && (attributes & (1 << VERTEX_TANGENT)) && normals.size() && uvs.size())
+		computeTangents(tangents);
+
+	vertex_layout = sVertexLayout();
+	vertex_layout.mask = attributes;
+	sVertexStream streams[VERTEX_NUM_ATTRIBUTES];
+	for (int i = 0; i < VERTEX_NUM_ATTRIBUTES; ++i)
+	{
+		streams[i] = getVertexStream(i);
+		if (!(attributes & (1 << i)))
+			continue;
+		if (i == VERTEX_TANGENT && tangents.size())
+			vertex_layout.add(i, 4, GL_BYTE, true, 4);
+		else if (streams[i].data)
+		{
+			assert(streams[i].count == num_vertices && "every stream must have a value per vertex");
+			if (streams[i].count != num_vertices)
+				continue;
+			if (i == VERTEX_NORMAL)
+				vertex_layout.add(i, 4, GL_INT_2_10_10_10_REV, true, 4);
+			else if ((i == VERTEX_UV || i == VERTEX_UV1) && uvsFitInHalfs(i == VERTEX_UV ? uvs : m_uvs1))
+				vertex_layout.add(i, 2, GL_HALF_FLOAT, false, 4);
+			else
+				vertex_layout.add(i, streams[i].format.components, streams[i].format.type, streams[i].format.normalized, streams[i].size);
+		}
 	}
 
-	vertices.resize(0);
-	normals.resize(0);
-	uvs.resize(0);
+	interleaved.resize((size_t)num_vertices * vertex_layout.stride);
+	char* vertex = interleaved.data();
+	for (unsigned int i = 0; i < num_vertices; ++i, vertex += vertex_layout.stride)
+		for (int j = 0; j < VERTEX_NUM_ATTRIBUTES; ++j)
+		{
+			const sVertexLayout::sAttribute& attribute = vertex_layout.attributes[j];
+			if (!attribute.components)
+				continue;
+			if (j == VERTEX_TANGENT)
+			{
+				const Vector4& t = tangents[i];
+				signed char* packed = (signed char*)(vertex + attribute.offset);
+				for (int k = 0; k < 4; ++k)
+					packed[k] = (signed char)floor(clamp(t.v[k], -1.0f, 1.0f) * 127.0f + 0.5f);
+			}
+			else if (attribute.type == GL_INT_2_10_10_10_REV)
+				*(unsigned int*)(vertex + attribute.offset) = packNormal1010102(normals[i]);
+			else if (attribute.type == GL_HALF_FLOAT)
+			{
+				const Vector2& uv = j == VERTEX_UV ? uvs[i] : m_uvs1[i];
+				unsigned short* packed = (unsigned short*)(vertex + attribute.offset);
+				packed[0] = floatToHalf(uv.x);
+				packed[1] = floatToHalf(uv.y);
+			}
+			else
+				memcpy(vertex + attribute.offset, streams[j].data + (size_t)i * streams[j].size, streams[j].size);
+		}
 
 	return true;
 }
 
+//header of the v11 files, every stream stored as it is in memory
 typedef struct 
 {
 	int version;
@@ -753,128 +824,431 @@ typedef struct
 	char extra[32]; //unused
 } sMeshInfo;
 
+//v12: the header is followed by a table of sections, every section starts 16 bytes aligned
+#define MBIN_ALIGNMENT 16
+#define MBIN_INTERLEAVED 1 //the mesh was interleaved when it was saved, only informative: the layout is built when loading
+
+enum eMeshBinSection { MBIN_POSITIONS, MBIN_NORMALS, MBIN_UVS, MBIN_UVS1, MBIN_COLORS, MBIN_INDICES, MBIN_BONES, MBIN_WEIGHTS, MBIN_BONES_INFO, MBIN_SUBMESHES, MBIN_LODS, MBIN_LOD_INDICES };
+enum eMeshBinEncoding { MBIN_RAW, MBIN_QUANTIZED, MBIN_OCTAHEDRAL, MBIN_HALF, MBIN_SHORT };
+
+typedef struct
+{
+	int version;
+	int header_bytes;
+	int size;
+	int num_indices;
+	Vector3 aabb_min; //positions are quantized inside this box
+	Vector3	aabb_max;
+	Vector3	center;
+	Vector3	halfsize;
+	float radius;
+	int num_bones;
+	int num_submeshes;
+	int num_sections;
+	int flags;
+	Matrix44 bind_matrix;
+	char extra[8]; //watermark plus header fill 160 bytes so the section table is aligned
+} sMeshInfoV12;
+
+typedef struct
+{
+	int type; //eMeshBinSection
+	int encoding; //eMeshBinEncoding
+	int count; //num elements
+	int compressed; //LZ4 block
+	unsigned int offset; //from the start of the file
+	unsigned int size; //bytes in the file
+	unsigned int raw_size; //bytes once decompressed
+	int padding;
+} sMeshSection;
+
+static unsigned short floatToHalf(float f)
+{
+	unsigned int x;
+	memcpy(&x, &f, 4);
+	unsigned int sign = (x >> 16) & 0x8000;
+	int exponent = (int)((x >> 23) & 0xFF) - 127 + 15;
+	unsigned int mantissa = x & 0x7FFFFF;
+	if (exponent >= 31) //too big
+		return (unsigned short)(sign | 0x7C00);
+	if (exponent <= 0) //denormal
+	{
+		if (exponent < -10)
+			return (unsigned short)sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		unsigned int h = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			h++;
+		return (unsigned short)(sign | h);
+	}
+	unsigned int h = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) //round, a carry moves to the exponent
+		h++;
+	return (unsigned short)h;
+}
+
+static float halfToFloat(unsigned short h)
+{
+	unsigned int sign = (h & 0x8000) << 16;
+	int exponent = (h >> 10) & 0x1F;
+	unsigned int mantissa = h & 0x3FF;
+	unsigned int x;
+	if (exponent == 0) //zero or denormal
+	{
+		float f = mantissa / 16777216.0f;
+		return sign ? -f : f;
+	}
+	if (exponent == 31)
+		x = sign | 0x7F800000 | (mantissa << 13);
+	else
+		x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	float f;
+	memcpy(&f, &x, 4);
+	return f;
+}
+
+//normals are projected to an octahedron and unfolded in a square, two shorts per normal
+static void encodeOctahedral(const Vector3& n, short* out)
+{
+	float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	float x = l1 ? n.x / l1 : 0;
+	float y = l1 ? n.y / l1 : 0;
+	if (n.z < 0)
+	{
+		float ox = x;
+		x = (1.0f - fabs(y)) * (ox >= 0 ? 1.0f : -1.0f);
+		y = (1.0f - fabs(ox)) * (y >= 0 ? 1.0f : -1.0f);
+	}
+	out[0] = (short)floor(clamp(x, -1, 1) * 32767.0f + 0.5f);
+	out[1] = (short)floor(clamp(y, -1, 1) * 32767.0f + 0.5f);
+}
+
+static Vector3 decodeOctahedral(const short* in)
+{
+	float x = in[0] / 32767.0f;
+	float y = in[1] / 32767.0f;
+	Vector3 n(x, y, 1.0f - fabs(x) - fabs(y));
+	if (n.z < 0)
+	{
+		n.x = (1.0f - fabs(y)) * (x >= 0 ? 1.0f : -1.0f);
+		n.y = (1.0f - fabs(x)) * (y >= 0 ? 1.0f : -1.0f);
+	}
+	return n.normalize();
+}
+
+//copies a stream of the mapped file into a vector, checking that it fits in the file
+//vertex of the interleaved stream of the v11 files
+struct sInterleavedV11
+{
+	Vector3 vertex;
+	Vector3 normal;
+	Vector2 uv;
+};
+
+template<typename T> static bool readBinStream(const char*& pos, const char* end, std::vector<T>& stream, int count)
+{
+	if (count < 0 || (size_t)count > (size_t)(end - pos) / sizeof(T))
+		return false;
+	stream.resize(count);
+	if (count)
+		memcpy((void*)&stream[0], pos, sizeof(T) * count);
+	pos += sizeof(T) * count;
+	return true;
+}
+
 bool Mesh::readBin(const char* filename, bool bFromNetwork)
 {
-	FILE *f;
 	assert(filename);
 
-	struct stat stbuffer;
-
-	stat(filename,&stbuffer);
-	f = fopen(filename,"rb");
-	if (f == NULL)
+	//map the file instead of reading it into a temporal buffer, so every stream is copied just once
+	sMappedFile file;
+	if (!mapFile(filename, file))
 		return false;
 
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data,size,1,f);
-	fclose(f);
+	const char* end = file.data + file.size;
 
 	//watermark
-	if ( memcmp(data,"MBIN",4) != 0 )
+	if (file.size < 8 || memcmp(file.data, "MBIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+		unmapFile(file);
 		return false;
 	}
 
-	char* pos = data + 4;
-	sMeshInfo info;
-	memcpy(&info,pos,sizeof(sMeshInfo));
-	pos += sizeof(sMeshInfo);
-
-	if(info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo) )
+	int version;
+	memcpy(&version, file.data + 4, sizeof(int));
+	if (version != MESH_BIN_VERSION && version != MESH_BIN_VERSION_LEGACY)
 	{
 		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		unmapFile(file);
+		return false;
+	}
+
+	bool valid = version == MESH_BIN_VERSION ? readBinV12(file.data, end) : readBinV11(file.data, end);
+	unmapFile(file);
+
+	if (!valid)
+	{
+		std::cout << "[ERROR] loading BIN: corrupted file: " << filename << std::endl;
+		clear();
+		return false;
+	}
+
+	//the collision model is built when it is needed, most meshes are never queried
+	return true;
+}
+
+bool Mesh::readBinV11(const char* data, const char* end)
+{
+	const char* pos = data + 4;
+	if ((size_t)(end - pos) < sizeof(sMeshInfo))
+		return false;
+
+	//the header is validated in place
+	const sMeshInfo& info = *(const sMeshInfo*)pos;
+	pos += sizeof(sMeshInfo);
+	if (info.header_bytes != sizeof(sMeshInfo))
 		return false;
-	}
 
+	//streams, in the same order writeBin stored them
+	bool valid = true;
 	if (info.streams[0] == 'I')
 	{
-		interleaved.resize(info.size);
-		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
-		pos += sizeof(tInterleaved) * info.size;
+		std::vector<sInterleavedV11> legacy;
+		valid = valid && readBinStream(pos, end, legacy, info.size);
+		vertices.resize(legacy.size());
+		normals.resize(legacy.size());
+		uvs.resize(legacy.size());
+		for (size_t i = 0; i < legacy.size(); ++i)
+		{
+			vertices[i] = legacy[i].vertex;
+			normals[i] = legacy[i].normal;
+			uvs[i] = legacy[i].uv;
+		}
 	}
 	else if (info.streams[0] == 'V')
 	{
-		vertices.resize(info.size);
-		memcpy((void*)&vertices[0], pos, sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
-	if (info.streams[1] == 'N')
-	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0],pos,sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
-	if (info.streams[2] == 'U')
-	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0],pos,sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
+		valid = valid && readBinStream(pos, end, vertices, info.size);
+		if (info.streams[1] == 'N')
+			valid = valid && readBinStream(pos, end, normals, info.size);
+		if (info.streams[2] == 'U')
+			valid = valid && readBinStream(pos, end, uvs, info.size);
 	}
 
 	if (info.streams[3] == 'C')
-	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0],pos,sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
-	}
+		valid = valid && readBinStream(pos, end, colors, info.size);
 
 	if (info.streams[4] == 'I')
-	{
-		m_indices.resize(info.num_indices);
-		memcpy((void*)&m_indices[0], pos, sizeof(unsigned int) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
-	}
+		valid = valid && readBinStream(pos, end, m_indices, info.num_indices);
 
 	if (info.streams[5] == 'B')
-	{
-		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(Vector4ub) * info.size);
-		pos += sizeof(Vector4ub) * info.size;
-	}
+		valid = valid && readBinStream(pos, end, bones, info.size);
 
 	if (info.streams[6] == 'W')
-	{
-		weights.resize(info.size);
-		memcpy((void*)&weights[0], pos, sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
-	}
+		valid = valid && readBinStream(pos, end, weights, info.size);
+
+	if (info.num_bones)
+		valid = valid && readBinStream(pos, end, bones_info, info.num_bones);
 
 	if (info.streams[7] == 'u')
-	{
-		m_uvs1.resize(info.size);
-		memcpy((void*)&m_uvs1[0], pos, sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
-	}
+		valid = valid && readBinStream(pos, end, m_uvs1, info.size);
 
-	if (info.num_bones)
+	valid = valid && readBinStream(pos, end, submeshes, info.num_submeshes);
+	if (!valid)
+		return false;
+
+	aabb_max = info.aabb_max;
+	aabb_min = info.aabb_min;
+	box.center = info.center;
+	box.halfsize = info.halfsize;
+	radius = info.radius;
+	bind_matrix = info.bind_matrix;
+	return true;
+}
+
+bool Mesh::readBinV12(const char* data, const char* end)
+{
+	const char* pos = data + 4;
+	if ((size_t)(end - pos) < sizeof(sMeshInfoV12))
+		return false;
+
+	const sMeshInfoV12& info = *(const sMeshInfoV12*)pos;
+	pos += sizeof(sMeshInfoV12);
+	if (info.header_bytes != sizeof(sMeshInfoV12) || info.size < 0 || info.num_indices < 0 || info.num_sections < 0 ||
+		(size_t)info.num_sections > (size_t)(end - pos) / sizeof(sMeshSection))
+		return false;
+
+	const sMeshSection* sections = (const sMeshSection*)pos;
+	int num_vertices = info.size;
+	Vector3 quantization = (info.aabb_max - info.aabb_min) * (1.0f / 65535.0f);
+	std::vector<char> scratch; //for compressed sections
+
+	for (int i = 0; i < info.num_sections; ++i)
 	{
-		bones_info.resize(info.num_bones);
-		memcpy((void*)&bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
-		pos += sizeof(BoneInfo) * info.num_bones;
+		const sMeshSection& section = sections[i];
+		if (section.offset % MBIN_ALIGNMENT || section.offset > (size_t)(end - data) || section.size > (size_t)(end - data) - section.offset || section.count < 0)
+			return false;
+
+		const char* section_data = data + section.offset;
+		if (section.compressed)
+		{
+			scratch.resize(section.raw_size);
+			if (!decompressLZ(section_data, section.size, scratch.data(), section.raw_size))
+				return false;
+			section_data = scratch.data();
+		}
+		else if (section.raw_size != section.size)
+			return false;
+		const char* section_end = section_data + section.raw_size;
+
+		//per vertex sections must have the same number of elements
+		int count = section.count;
+		if (section.type <= MBIN_WEIGHTS && section.type != MBIN_INDICES && count != num_vertices)
+			return false;
+
+		bool valid = true;
+		switch (section.type)
+		{
+		case MBIN_POSITIONS:
+			if (section.encoding == MBIN_QUANTIZED)
+			{
+				if (section.raw_size != count * sizeof(unsigned short) * 3)
+					return false;
+				const unsigned short* q = (const unsigned short*)section_data;
+				vertices.resize(count);
+				for (int j = 0; j < count; ++j, q += 3)
+					vertices[j] = info.aabb_min + Vector3(q[0] * quantization.x, q[1] * quantization.y, q[2] * quantization.z);
+			}
+			else
+				valid = readBinStream(section_data, section_end, vertices, count);
+			break;
+		case MBIN_NORMALS:
+			if (section.encoding == MBIN_OCTAHEDRAL)
+			{
+				if (section.raw_size != count * sizeof(short) * 2)
+					return false;
+				const short* oct = (const short*)section_data;
+				normals.resize(count);
+				for (int j = 0; j < count; ++j, oct += 2)
+					normals[j] = decodeOctahedral(oct);
+			}
+			else
+				valid = readBinStream(section_data, section_end, normals, count);
+			break;
+		case MBIN_UVS:
+		case MBIN_UVS1:
+		{
+			std::vector<Vector2>& stream = section.type == MBIN_UVS ? uvs : m_uvs1;
+			if (section.encoding == MBIN_HALF)
+			{
+				if (section.raw_size != count * sizeof(unsigned short) * 2)
+					return false;
+				const unsigned short* h = (const unsigned short*)section_data;
+				stream.resize(count);
+				for (int j = 0; j < count; ++j, h += 2)
+					stream[j].set(halfToFloat(h[0]), halfToFloat(h[1]));
+			}
+			else
+				valid = readBinStream(section_data, section_end, stream, count);
+			break;
+		}
+		case MBIN_INDICES:
+			if (count != info.num_indices)
+				return false;
+			if (section.encoding == MBIN_SHORT)
+			{
+				if (section.raw_size != count * sizeof(unsigned short))
+					return false;
+				const unsigned short* s = (const unsigned short*)section_data;
+				m_indices.assign(s, s + count);
+			}
+			else
+				valid = readBinStream(section_data, section_end, m_indices, count);
+			break;
+		case MBIN_COLORS: valid = readBinStream(section_data, section_end, colors, count); break;
+		case MBIN_BONES: valid = readBinStream(section_data, section_end, bones, count); break;
+		case MBIN_WEIGHTS: valid = readBinStream(section_data, section_end, weights, count); break;
+		case MBIN_BONES_INFO: valid = readBinStream(section_data, section_end, bones_info, count); break;
+		case MBIN_SUBMESHES: valid = readBinStream(section_data, section_end, submeshes, count); break;
+		case MBIN_LODS: valid = readBinStream(section_data, section_end, lods, count); break;
+		case MBIN_LOD_INDICES:
+			if (section.encoding == MBIN_SHORT)
+			{
+				if (section.raw_size != count * sizeof(unsigned short))
+					return false;
+				const unsigned short* s = (const unsigned short*)section_data;
+				lod_indices.assign(s, s + count);
+			}
+			else
+				valid = readBinStream(section_data, section_end, lod_indices, count);
+			break;
+		default: break; //unknown sections are skipped
+		}
+		if (!valid)
+			return false;
 	}
 
+	if (!vertices.size() && num_vertices)
+		return false;
+	for (unsigned int i = 0; i < m_indices.size(); ++i)
+		if (m_indices[i] >= (unsigned int)num_vertices)
+			return false;
+	for (unsigned int i = 0; i < lod_indices.size(); ++i)
+		if (lod_indices[i] >= (unsigned int)num_vertices)
+			return false;
+	for (unsigned int i = 0; i < lods.size(); ++i)
+		if (lods[i].start < 0 || lods[i].length < 0 || lods[i].start + lods[i].length > (int)lod_indices.size() || !m_indices.size())
+			return false;
+
 	aabb_max = info.aabb_max;
 	aabb_min = info.aabb_min;
 	box.center = info.center;
 	box.halfsize = info.halfsize;
 	radius = info.radius;
 	bind_matrix = info.bind_matrix;
+	return true;
+}
 
-	submeshes.resize(info.num_submeshes);
-	memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
-	pos += sizeof(sSubmeshInfo) * info.num_submeshes;
+//appends a section to the file, aligned and compressed when it saves space
+static void addBinSection(std::vector<char>& content, std::vector<sMeshSection>& sections, int type, int encoding, int count, const void* data, size_t size)
+{
+	sMeshSection section;
+	memset(&section, 0, sizeof(section));
+	section.type = type;
+	section.encoding = encoding;
+	section.count = count;
+	section.raw_size = (unsigned int)size;
 
-	createCollisionModel();
-	return true;
+	content.resize((content.size() + MBIN_ALIGNMENT - 1) / MBIN_ALIGNMENT * MBIN_ALIGNMENT, 0);
+	section.offset = (unsigned int)content.size(); //relative to the first section until the table size is known
+
+	int compressed_size = 0;
+	if (Mesh::compress_bins && size > 64)
+	{
+		content.resize(section.offset + size); //compressing only makes sense if it fits in the raw size
+		compressed_size = compressLZ((const char*)data, (int)size, &content[section.offset], (int)size - (int)size / 8);
+	}
+
+	if (compressed_size)
+	{
+		section.compressed = 1;
+		section.size = compressed_size;
+		content.resize(section.offset + compressed_size);
+	}
+	else
+	{
+		section.size = (unsigned int)size;
+		content.resize(section.offset + size);
+		if (size)
+			memcpy(&content[section.offset], data, size);
+	}
+	sections.push_back(section);
 }
 
 bool Mesh::writeBin(const char* filename)
 {
-	assert( vertices.size() || interleaved.size() );
+	assert( vertices.size() );
 	std::string s_filename = filename;
 	s_filename += ".mbin";
 
@@ -885,64 +1259,122 @@ bool Mesh::writeBin(const char* filename)
 		return false;
 	}
 
-	//watermark
-	fwrite("MBIN",sizeof(char),4,f);
+	//the separated streams are encoded, the interleaved buffer is built again when loading
+	bool is_interleaved = vertex_layout.stride != 0;
+	int num_vertices = (int)vertices.size();
+	const std::vector<Vector3>& positions_stream = vertices;
+	const std::vector<Vector3>& normals_stream = normals;
+	const std::vector<Vector2>& uvs_stream = uvs;
 
-	sMeshInfo info;
-	memset(&info, 0, sizeof(info));
+	sMeshInfoV12 info = {};
 	info.version = MESH_BIN_VERSION;
-	info.header_bytes = sizeof(sMeshInfo);
-	info.size = interleaved.size() ? interleaved.size() : vertices.size();
-	info.num_indices = m_indices.size();
-	info.aabb_max = aabb_max;
-	info.aabb_min = aabb_min;
+	info.header_bytes = sizeof(sMeshInfoV12);
+	info.size = num_vertices;
+	info.num_indices = (int)m_indices.size();
 	info.center = box.center;
 	info.halfsize = box.halfsize;
 	info.radius = radius;
-	info.num_bones = bones_info.size();
+	info.num_bones = (int)bones_info.size();
 	info.bind_matrix = bind_matrix;
-	info.num_submeshes = submeshes.size();
-
-	info.streams[0] = interleaved.size() ? 'I' : 'V';
-	info.streams[1] = normals.size() ? 'N' : ' ';
-	info.streams[2] = uvs.size() ? 'U' : ' ';
-	info.streams[3] = colors.size() ? 'C' : ' ';
-	info.streams[4] = m_indices.size() ? 'I' : ' ';
-	info.streams[5] = bones.size() ? 'B' : ' ';
-	info.streams[6] = weights.size() ? 'W' : ' ';
-	info.streams[7] = m_uvs1.size() ? 'u' : ' '; //uv second set
-
-	//write info
-	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
-
-	//write streams
-	if (interleaved.size())
-		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
-	else
+	info.num_submeshes = (int)submeshes.size();
+	info.flags = is_interleaved ? MBIN_INTERLEAVED : 0;
+
+	//the quantization box is computed from the vertices, the stored aabb could be stale
+	info.aabb_min = info.aabb_max = num_vertices ? positions_stream[0] : Vector3();
+	for (int i = 0; i < num_vertices; ++i)
+	{
+		info.aabb_min.setMin(positions_stream[i]);
+		info.aabb_max.setMax(positions_stream[i]);
+	}
+
+	std::vector<char> content;
+	std::vector<sMeshSection> sections;
+
+	//positions quantized to 16 bits per axis inside the aabb
+	Vector3 range = info.aabb_max - info.aabb_min;
+	std::vector<unsigned short> quantized(num_vertices * 3);
+	for (int i = 0; i < num_vertices; ++i)
+		for (int j = 0; j < 3; ++j)
+			quantized[i * 3 + j] = range.v[j] > 0 ? (unsigned short)floor(clamp((positions_stream[i].v[j] - info.aabb_min.v[j]) / range.v[j]) * 65535.0f + 0.5f) : 0;
+	addBinSection(content, sections, MBIN_POSITIONS, MBIN_QUANTIZED, num_vertices, quantized.data(), quantized.size() * sizeof(unsigned short));
+
+	if (normals_stream.size())
+	{
+		std::vector<short> octahedral(num_vertices * 2);
+		for (int i = 0; i < num_vertices; ++i)
+			encodeOctahedral(normals_stream[i], &octahedral[i * 2]);
+		addBinSection(content, sections, MBIN_NORMALS, MBIN_OCTAHEDRAL, num_vertices, octahedral.data(), octahedral.size() * sizeof(short));
+	}
+
+	//uvs as half floats unless they are tiled too far from the origin for the half precision
+	for (int k = 0; k < 2; ++k)
 	{
-		fwrite((void*)&vertices[0], vertices.size() * sizeof(Vector3), 1, f);
-		if (normals.size())
-			fwrite((void*)&normals[0], normals.size() * sizeof(Vector3), 1, f);
-		if (uvs.size())
-			fwrite((void*)&uvs[0], uvs.size() * sizeof(Vector2), 1, f);
+		const std::vector<Vector2>& stream = k == 0 ? uvs_stream : m_uvs1;
+		if (!stream.size())
+			continue;
+		std::vector<unsigned short> halfs(stream.size() * 2);
+		bool fits = true;
+		for (unsigned int i = 0; i < halfs.size(); ++i)
+		{
+			float uv = i % 2 ? stream[i / 2].y : stream[i / 2].x;
+			halfs[i] = floatToHalf(uv);
+			fits = fits && fabs(halfToFloat(halfs[i]) - uv) <= MBIN_UV_MAX_ERROR;
+		}
+		int type = k == 0 ? MBIN_UVS : MBIN_UVS1;
+		if (fits)
+			addBinSection(content, sections, type, MBIN_HALF, (int)stream.size(), halfs.data(), halfs.size() * sizeof(unsigned short));
+		else
+			addBinSection(content, sections, type, MBIN_RAW, (int)stream.size(), stream.data(), stream.size() * sizeof(Vector2));
 	}
 
 	if (colors.size())
-		fwrite((void*)&colors[0], colors.size() * sizeof(Vector4), 1, f);
+		addBinSection(content, sections, MBIN_COLORS, MBIN_RAW, (int)colors.size(), colors.data(), colors.size() * sizeof(Vector4));
 
 	if (m_indices.size())
-		fwrite((void*)&m_indices[0], m_indices.size() * sizeof(unsigned int), 1, f);
+	{
+		if (num_vertices <= 65536)
+		{
+			std::vector<unsigned short> short_indices(m_indices.begin(), m_indices.end());
+			addBinSection(content, sections, MBIN_INDICES, MBIN_SHORT, (int)m_indices.size(), short_indices.data(), short_indices.size() * sizeof(unsigned short));
+		}
+		else
+			addBinSection(content, sections, MBIN_INDICES, MBIN_RAW, (int)m_indices.size(), m_indices.data(), m_indices.size() * sizeof(unsigned int));
+	}
+
+	if (lods.size())
+	{
+		addBinSection(content, sections, MBIN_LODS, MBIN_RAW, (int)lods.size(), lods.data(), lods.size() * sizeof(sLodInfo));
+		if (num_vertices <= 65536)
+		{
+			std::vector<unsigned short> short_indices(lod_indices.begin(), lod_indices.end());
+			addBinSection(content, sections, MBIN_LOD_INDICES, MBIN_SHORT, (int)lod_indices.size(), short_indices.data(), short_indices.size() * sizeof(unsigned short));
+		}
+		else
+			addBinSection(content, sections, MBIN_LOD_INDICES, MBIN_RAW, (int)lod_indices.size(), lod_indices.data(), lod_indices.size() * sizeof(unsigned int));
+	}
 
 	if (bones.size())
-		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
+		addBinSection(content, sections, MBIN_BONES, MBIN_RAW, (int)bones.size(), bones.data(), bones.size() * sizeof(Vector4ub));
 	if (weights.size())
-		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4), 1, f);
+		addBinSection(content, sections, MBIN_WEIGHTS, MBIN_RAW, (int)weights.size(), weights.data(), weights.size() * sizeof(Vector4));
 	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
-	if (m_uvs1.size())
-		fwrite((void*)&m_uvs1[0], m_uvs1.size() * sizeof(Vector2), 1, f);
-
-	fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
+		addBinSection(content, sections, MBIN_BONES_INFO, MBIN_RAW, (int)bones_info.size(), bones_info.data(), bones_info.size() * sizeof(BoneInfo));
+	addBinSection(content, sections, MBIN_SUBMESHES, MBIN_RAW, (int)submeshes.size(), submeshes.data(), submeshes.size() * sizeof(sSubmeshInfo));
+
+	//the sections start after the watermark, the header and the table
+	info.num_sections = (int)sections.size();
+	size_t table_end = 4 + sizeof(sMeshInfoV12) + sections.size() * sizeof(sMeshSection);
+	size_t content_start = (table_end + MBIN_ALIGNMENT - 1) / MBIN_ALIGNMENT * MBIN_ALIGNMENT;
+	for (unsigned int i = 0; i < sections.size(); ++i)
+		sections[i].offset += (unsigned int)content_start;
+	char padding[MBIN_ALIGNMENT] = { 0 };
+
+	fwrite("MBIN", sizeof(char), 4, f);
+	fwrite((void*)&info, sizeof(sMeshInfoV12), 1, f);
+	fwrite((void*)sections.data(), sizeof(sMeshSection), sections.size(), f);
+	fwrite(padding, 1, content_start - table_end, f);
+	if (content.size())
+		fwrite((void*)content.data(), content.size(), 1, f);
 
 	fclose(f);
 	return true;
@@ -1078,139 +1510,375 @@ bool Mesh::loadASE(const char* filename)
 	return true;
 }
 
+//OBJ parsing: the file is mapped and parsed in place, the lines are never copied
+#define OBJ_PARALLEL_MIN_BYTES (1 << 20) //smaller files are parsed by a single thread
+
+static const double obj_pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+
+static inline const char* skipOBJSpaces(const char* pos, const char* end)
+{
+	while (pos < end && (*pos == ' ' || *pos == '\t'))
+		pos++;
+	return pos;
+}
+
+static const char* parseOBJFloat(const char* pos, const char* end, float& value)
+{
+	pos = skipOBJSpaces(pos, end);
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		negative = *pos++ == '-';
+
+	double result = 0;
+	while (pos < end && *pos >= '0' && *pos <= '9')
+		result = result * 10.0 + (*pos++ - '0');
+
+	if (pos < end && *pos == '.')
+	{
+		pos++;
+		unsigned long long fraction = 0;
+		int digits = 0;
+		for (; pos < end && *pos >= '0' && *pos <= '9'; pos++)
+			if (digits < 18)
+			{
+				fraction = fraction * 10 + (*pos - '0');
+				digits++;
+			}
+		result += fraction / obj_pow10[digits];
+	}
+
+	if (pos < end && (*pos == 'e' || *pos == 'E'))
+	{
+		pos++;
+		bool negative_exponent = false;
+		if (pos < end && (*pos == '-' || *pos == '+'))
+			negative_exponent = *pos++ == '-';
+		int exponent = 0;
+		while (pos < end && *pos >= '0' && *pos <= '9')
+			exponent = exponent * 10 + (*pos++ - '0');
+		result *= pow(10.0, negative_exponent ? -exponent : exponent);
+	}
+
+	value = (float)(negative ? -result : result);
+	return pos;
+}
+
+//returns 0 if there is no index
+static const char* parseOBJIndex(const char* pos, const char* end, int& value)
+{
+	bool negative = false;
+	if (pos < end && *pos == '-')
+	{
+		negative = true;
+		pos++;
+	}
+	value = 0;
+	while (pos < end && *pos >= '0' && *pos <= '9')
+		value = value * 10 + (*pos++ - '0');
+	if (negative)
+		value = -value;
+	return pos;
+}
+
+//converts the 1-based or relative index of the file to a 0-based one, -1 if missing or out of range
+static inline int resolveOBJIndex(int index, int count)
+{
+	if (index > 0)
+		return index <= count ? index - 1 : -1;
+	if (index < 0)
+		return count + index >= 0 ? count + index : -1;
+	return -1;
+}
+
+//lines that need the attributes of the whole file, they are processed in order after the parsing
+struct sOBJCommand {
+	char type; //'f' face, 'g' group, 'u' usemtl
+	const char* start; //after the keyword
+	const char* end;
+	int num_positions; //attributes read in the chunk before this line, for relative indices
+	int num_uvs;
+	int num_normals;
+};
+
+struct sOBJChunk {
+	const char* start;
+	const char* end;
+	std::vector<Vector3> positions;
+	std::vector<Vector2> uvs;
+	std::vector<Vector3> normals;
+	std::vector<sOBJCommand> commands;
+};
+
+static void parseOBJChunk(sOBJChunk& chunk)
+{
+	const char* pos = chunk.start;
+	const char* end = chunk.end;
+	while (pos < end)
+	{
+		const char* line_end = (const char*)memchr(pos, '\n', end - pos);
+		if (!line_end)
+			line_end = end;
+		const char* next = line_end + 1;
+		if (line_end > pos && line_end[-1] == '\r')
+			line_end--;
+
+		pos = skipOBJSpaces(pos, line_end);
+		size_t length = line_end - pos;
+		if (length > 2 && pos[0] == 'v')
+		{
+			if (pos[1] == ' ' || pos[1] == '\t')
+			{
+				Vector3 v;
+				const char* p = parseOBJFloat(pos + 1, line_end, v.x);
+				p = parseOBJFloat(p, line_end, v.y);
+				parseOBJFloat(p, line_end, v.z);
+				chunk.positions.push_back(v);
+			}
+			else if (pos[1] == 't' && (pos[2] == ' ' || pos[2] == '\t'))
+			{
+				Vector2 v;
+				const char* p = parseOBJFloat(pos + 2, line_end, v.x);
+				parseOBJFloat(p, line_end, v.y);
+				v.y = 1.0f - v.y;
+				chunk.uvs.push_back(v);
+			}
+			else if (pos[1] == 'n' && (pos[2] == ' ' || pos[2] == '\t'))
+			{
+				Vector3 v;
+				const char* p = parseOBJFloat(pos + 2, line_end, v.x);
+				p = parseOBJFloat(p, line_end, v.y);
+				parseOBJFloat(p, line_end, v.z);
+				chunk.normals.push_back(v);
+			}
+		}
+		else if (length > 1 && (pos[0] == 'f' || pos[0] == 'g') && (pos[1] == ' ' || pos[1] == '\t'))
+		{
+			sOBJCommand command = { pos[0], pos + 1, line_end, (int)chunk.positions.size(), (int)chunk.uvs.size(), (int)chunk.normals.size() };
+			chunk.commands.push_back(command);
+		}
+		else if (length > 6 && memcmp(pos, "usemtl", 6) == 0 && (pos[6] == ' ' || pos[6] == '\t'))
+		{
+			sOBJCommand command = { 'u', pos + 6, line_end, 0, 0, 0 };
+			chunk.commands.push_back(command);
+		}
+		pos = next;
+	}
+}
+
+//first word of a command as a null terminated name
+static void copyOBJName(const sOBJCommand& command, char* name, int max_size)
+{
+	const char* pos = skipOBJSpaces(command.start, command.end);
+	int i = 0;
+	while (pos < command.end && *pos != ' ' && *pos != '\t' && i < max_size - 1)
+		name[i++] = *pos++;
+	name[i] = 0;
+}
+
 bool Mesh::loadOBJ(const char* filename)
 {
-	std::string data;
-	if(!readFile(filename,data))
+	sMappedFile file;
+	if (!mapFile(filename, file))
 		return false;
-	char* pos = &data[0];
-	char line[255];
-	int i = 0;
 
+	//split the file in chunks at line boundaries, every chunk is parsed by its own thread
+	int num_chunks = 1;
+	if (file.size >= OBJ_PARALLEL_MIN_BYTES)
+		num_chunks = clamp((float)std::thread::hardware_concurrency(), 1, 16);
+	std::vector<sOBJChunk> chunks(num_chunks);
+	const char* file_end = file.data + file.size;
+	const char* chunk_start = file.data;
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		const char* chunk_end = i == num_chunks - 1 ? file_end : file.data + file.size * (i + 1) / num_chunks;
+		if (chunk_end < chunk_start)
+			chunk_end = chunk_start;
+		const char* line_end = (const char*)memchr(chunk_end, '\n', file_end - chunk_end);
+		chunk_end = line_end ? line_end + 1 : file_end;
+		chunks[i].start = chunk_start;
+		chunks[i].end = chunk_end;
+		chunk_start = chunk_end;
+	}
+
+	if (num_chunks == 1)
+		parseOBJChunk(chunks[0]);
+	else
+	{
+		std::vector<std::thread> workers;
+		for (int i = 0; i < num_chunks; ++i)
+			workers.push_back(std::thread(parseOBJChunk, std::ref(chunks[i])));
+		for (int i = 0; i < num_chunks; ++i)
+			workers[i].join();
+	}
+
+	//join the attributes of all the chunks
 	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
 	std::vector<Vector2> indexed_uvs;
+	std::vector<Vector3> indexed_normals;
+	std::vector<int> positions_offset(num_chunks), uvs_offset(num_chunks), normals_offset(num_chunks);
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		positions_offset[i] = (int)indexed_positions.size();
+		uvs_offset[i] = (int)indexed_uvs.size();
+		normals_offset[i] = (int)indexed_normals.size();
+		indexed_positions.insert(indexed_positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+		indexed_uvs.insert(indexed_uvs.end(), chunks[i].uvs.begin(), chunks[i].uvs.end());
+		indexed_normals.insert(indexed_normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+		std::vector<Vector3>().swap(chunks[i].positions);
+		std::vector<Vector2>().swap(chunks[i].uvs);
+		std::vector<Vector3>().swap(chunks[i].normals);
+	}
 
 	const float max_float = 10000000;
 	const float min_float = -10000000;
 	aabb_min.set(max_float,max_float,max_float);
 	aabb_max.set(min_float,min_float,min_float);
+	for (unsigned int i = 0; i < indexed_positions.size(); ++i)
+	{
+		aabb_min.setMin(indexed_positions[i]);
+		aabb_max.setMax(indexed_positions[i]);
+	}
 
-	unsigned int vertex_i = 0;
+	//every different position/uv/normal triplet becomes a vertex, found with an open addressing hash table
+	struct sOBJVertex { int position, uv, normal; };
+	std::vector<sOBJVertex> unique_vertices;
+	std::vector<int> hash_table(1024, -1);
+	unsigned int hash_mask = (unsigned int)hash_table.size() - 1;
 
 	sSubmeshInfo submesh_info;
 	int last_submesh_vertex = 0;
 	memset(&submesh_info, 0, sizeof(submesh_info));
+	bool valid = true;
 
-	//parse file
-	while(*pos != 0)
+	//faces and submeshes, in the order of the file
+	for (int c = 0; c < num_chunks && valid; ++c)
 	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
-
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
-
-		if (tokens.empty()) continue;
-
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
-
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() >= 3)
-		{
-			Vector2 v((float)atof(tokens[1].c_str()), 1.0 - (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
-		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
-		{
-			//process mesh: ????
-			//if (uvs.size() == 0 && indexed_uvs.size() )
-			//	uvs.resize(1);
-		}
-		else if (tokens[0] == "usemtl") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
-			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy(submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
-			}
-			else
-				strcpy(submesh_info.material, tokens[1].c_str());
-		}
-		else if (tokens[0] == "g") //surface? it appears one time before the faces
+		for (unsigned int k = 0; k < chunks[c].commands.size() && valid; ++k)
 		{
-			if (last_submesh_vertex != vertices.size())
+			const sOBJCommand& command = chunks[c].commands[k];
+			if (command.type == 'g' || command.type == 'u')
 			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy( submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
+				if (last_submesh_vertex != (int)m_indices.size())
+				{
+					submesh_info.length = (int)m_indices.size() - submesh_info.start;
+					last_submesh_vertex = (int)m_indices.size();
+					submeshes.push_back(submesh_info);
+					memset(&submesh_info, 0, sizeof(submesh_info));
+					copyOBJName(command, submesh_info.name, sizeof(submesh_info.name));
+					submesh_info.start = last_submesh_vertex;
+				}
+				else if (command.type == 'u')
+					copyOBJName(command, submesh_info.material, sizeof(submesh_info.material));
+				continue;
 			}
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
-		{
-			Vector3 v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
 
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+			//face, triangulated as a fan
+			int num_positions = positions_offset[c] + command.num_positions;
+			int num_uvs = uvs_offset[c] + command.num_uvs;
+			int num_normals = normals_offset[c] + command.num_normals;
+			int first = -1, previous = -1, corner = 0;
+			const char* pos = command.start;
+			while (true)
 			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
+				pos = skipOBJSpaces(pos, command.end);
+				if (pos >= command.end)
+					break;
+
+				int p = 0, t = 0, n = 0;
+				pos = parseOBJIndex(pos, command.end, p);
+				if (pos < command.end && *pos == '/')
+				{
+					pos = parseOBJIndex(pos + 1, command.end, t);
+					if (pos < command.end && *pos == '/')
+						pos = parseOBJIndex(pos + 1, command.end, n);
+				}
+				while (pos < command.end && *pos != ' ' && *pos != '\t') //skip anything unexpected
+					pos++;
 
-				vertices.push_back( indexed_positions[ (unsigned int)(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v2.x) -1] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
+				sOBJVertex key = { resolveOBJIndex(p, num_positions), resolveOBJIndex(t, num_uvs), resolveOBJIndex(n, num_normals) };
+				if (key.position == -1)
+				{
+					valid = false;
+					break;
+				}
 
-				if (indexed_uvs.size() > 0)
+				//find or add the vertex
+				unsigned int hash = ((unsigned int)key.position * 73856093u) ^ ((unsigned int)key.uv * 19349663u) ^ ((unsigned int)key.normal * 83492791u);
+				unsigned int slot = hash & hash_mask;
+				while (hash_table[slot] != -1)
+				{
+					const sOBJVertex& other = unique_vertices[hash_table[slot]];
+					if (other.position == key.position && other.uv == key.uv && other.normal == key.normal)
+						break;
+					slot = (slot + 1) & hash_mask;
+				}
+				int index = hash_table[slot];
+				if (index == -1)
 				{
-					uvs.push_back( indexed_uvs[(unsigned int)(v1.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v2.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v3.y) -1] );
+					index = (int)unique_vertices.size();
+					unique_vertices.push_back(key);
+					hash_table[slot] = index;
+
+					//keep the table under half full
+					if (unique_vertices.size() * 2 > hash_table.size())
+					{
+						hash_table.assign(hash_table.size() * 2, -1);
+						hash_mask = (unsigned int)hash_table.size() - 1;
+						for (unsigned int i = 0; i < unique_vertices.size(); ++i)
+						{
+							const sOBJVertex& v = unique_vertices[i];
+							unsigned int h = (((unsigned int)v.position * 73856093u) ^ ((unsigned int)v.uv * 19349663u) ^ ((unsigned int)v.normal * 83492791u)) & hash_mask;
+							while (hash_table[h] != -1)
+								h = (h + 1) & hash_mask;
+							hash_table[h] = i;
+						}
+					}
 				}
 
-				if (indexed_normals.size() > 0)
+				if (corner == 0)
+					first = index;
+				else if (corner >= 2)
 				{
-					normals.push_back( indexed_normals[(unsigned int)(v1.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v2.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v3.z) -1] );
+					m_indices.push_back(first);
+					m_indices.push_back(previous);
+					m_indices.push_back(index);
 				}
+				previous = index;
+				corner++;
 			}
 		}
 	}
 
+	unmapFile(file);
+
+	if (!valid)
+	{
+		std::cout << "[ERROR] loading OBJ: invalid face index in " << filename << std::endl;
+		clear();
+		return false;
+	}
+
+	//build the vertex streams
+	vertices.resize(unique_vertices.size());
+	if (indexed_uvs.size())
+		uvs.resize(unique_vertices.size());
+	if (indexed_normals.size())
+		normals.resize(unique_vertices.size());
+	for (unsigned int i = 0; i < unique_vertices.size(); ++i)
+	{
+		const sOBJVertex& v = unique_vertices[i];
+		vertices[i] = indexed_positions[v.position];
+		if (indexed_uvs.size())
+			uvs[i] = v.uv != -1 ? indexed_uvs[v.uv] : Vector2();
+		if (indexed_normals.size())
+			normals[i] = v.normal != -1 ? indexed_normals[v.normal] : Vector3();
+	}
+
 	box.center = (aabb_max + aabb_min) * 0.5;
 	box.halfsize = (aabb_max - box.center);
 	radius = (float)fmax( aabb_max.length(), aabb_min.length() );
 
-	submesh_info.length = vertices.size() - last_submesh_vertex;
+	submesh_info.length = (int)m_indices.size() - last_submesh_vertex;
 	submeshes.push_back(submesh_info);
 	return true;
 }
@@ -1442,19 +2110,16 @@ void Mesh::displace(Image* heightmap, float altitude)
 	assert(heightmap && heightmap->data && "image without data");
 	assert(uvs.size() && "cannot displace without uvs");
 
-	bool is_interleaved = interleaved.size() != 0;
-	int num = is_interleaved ? interleaved.size() : vertices.size();
+	int num = (int)vertices.size();
 	assert(num && "no vertices found");
 
 	for (int i = 0; i < num; ++i)
 	{
 		Vector2& uv = uvs[i];
 		Color c = heightmap->getPixelInterpolated(uv.x * heightmap->width, uv.y * heightmap->height);
-		if (is_interleaved)
-			interleaved[i].vertex.y = (c.x / 255.0f) * altitude;
-		else
-			vertices[i].y = (c.x / 255.0f) * altitude;
+		vertices[i].y = (c.x / 255.0f) * altitude;
 	}
+	interleaved.clear(); //packed again from the streams when it is uploaded
 	box.center.y += altitude*0.5f;
 	box.halfsize.y += altitude*0.5f;
 	radius = box.halfsize.length();
@@ -1492,15 +2157,6 @@ void Mesh::updateBoundingBox()
 			aabb_max.setMax(vertices[i]);
 		}
 	}
-	else if (interleaved.size())
-	{
-		aabb_max = aabb_min = interleaved[0].vertex;
-		for (int i = 1; i < vertices.size(); ++i)
-		{
-			aabb_min.setMin(interleaved[i].vertex);
-			aabb_max.setMax(interleaved[i].vertex);
-		}
-	}
 	box.center = (aabb_max + aabb_min) * 0.5f;
 	box.halfsize = aabb_max - box.center;
 }
@@ -1567,9 +2223,28 @@ Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 		return NULL;
 
 	Mesh* m = new Mesh();
+	if (!m->load(filename, bFromNetwork))
+	{
+		delete m;
+		return NULL;
+	}
+
+	//and upload them to VRAM
+	if (auto_upload_to_vram)
+	{
+		m->uploadToVRAM();
+		if (!keep_cpu_copies)
+			m->releaseCPUCopies();
+	}
 
+	m->registerMesh(filename);
+	return m;
+}
+
+bool Mesh::load(const char* filename, bool bFromNetwork)
+{
 	//Name mesh
-	m->nameMesh(filename);
+	nameMesh(filename);
 
 	std::string name = filename;
 
@@ -1587,35 +2262,29 @@ Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 	else 
 	{
 		//if (ext.size()) std::cerr << "Unknown mesh format: " << filename << std::endl;
-		return NULL;
+		return false;
 	}
 
 	//stats
 	double time = getTime();
-	std::cout << " + Mesh loading: " << filename << " ... ";
 	std::string binfilename = filename;
 
+	//the binary of a source is in the asset cache, named by the hash of its content, so a stale one is never read
+	std::string binstem = filename;
+	if (file_format != FORMAT_MBIN && use_binary && AssetCache::enabled)
+		binstem = AssetCache::getEntry(filename, MESH_BIN_VERSION);
 	if (file_format != FORMAT_MBIN)
-		binfilename = binfilename + ".mbin";
+		binfilename = binstem + ".mbin";
 
 	//try loading the binary version
-	if (use_binary && m->readBin(binfilename.c_str(), bFromNetwork) )
+	if (use_binary && readBin(binfilename.c_str(), bFromNetwork) )
 	{
-		if (interleave_meshes && m->interleaved.size() == 0)
-		{
-			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
-		}
+		//packed here so the thread that uploads it only has to copy it
+		if (interleave_meshes)
+			interleaveBuffers();
 
-		if (auto_upload_to_vram)
-		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
-		}
-
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
-		return m;
+		std::cout << " + Mesh loading: " << filename << " ... [OK BIN]  Faces: " << (m_indices.size() ? m_indices.size() : getNumVertices()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
 	}
 
 	assert(!bFromNetwork);
@@ -1623,43 +2292,34 @@ Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 	//load the ascii version
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename);
+		loaded = loadOBJ(filename);
 	else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);
+		loaded = loadASE(filename);
 	else if (file_format == FORMAT_MESH)
-		loaded = m->loadMESH(filename);
+		loaded = loadMESH(filename);
 
 	if (!loaded)
 	{
-		delete m;
-		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
+		std::cout << " + Mesh loading: " << filename << " ... [ERROR]: Mesh not found" << std::endl;
+		return false;
 	}
 
-	//to optimize, interleave the meshes
-	if (interleave_meshes)
-	{
-		std::cout << "[INTERL] ";
-		m->interleaveBuffers();
-	}
+	//the optimized order is stored in the bin, so it is only done when importing
+	if (optimize_meshes)
+		optimize();
+	if (generate_lods && m_indices.size())
+		createLods();
 
-	//and upload them to VRAM
-	if (auto_upload_to_vram)
-	{
-		std::cout << "[VRAM] ";
-		m->uploadToVRAM();
-	}
+	//to optimize, interleave the meshes, once the vertices are in their final order
+	if (interleave_meshes)
+		interleaveBuffers();
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-	if (use_binary)
-	{
-		std::cout << "\t\t Writing .BIN ... ";
-		m->writeBin(filename);
-		std::cout << "[OK]" << std::endl;
-	}
+	//the whole line is printed at once, meshes can be loaded from several threads
+	std::cout << " + Mesh loading: " << filename << " ... [OK]  Faces: " << (m_indices.size() ? m_indices.size() : getNumVertices()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	if (use_binary && binstem.size())
+		writeBin(binstem.c_str());
 
-	m->registerMesh(name);
-	return m;
+	return true;
 }
 
 void Mesh::nameMesh(std::string filename)
@@ -6,15 +6,20 @@
 
 #include <map>
 #include <string>
+#include <future>
+#include "resourcemanager.h"
 
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
+class CollisionModel; //for the collision tests
 
 #define OPENGL_ES3 1
 
 //version from 11/5/2020
-#define MESH_BIN_VERSION 11 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION 12 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION_LEGACY 11 //still accepted by readBin
+#define MESH_MAX_LODS 3 //simplified levels generated for the imported meshes, besides the full one
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
@@ -25,17 +30,50 @@ struct sSubmeshInfo
 {
 	char name[64];
 	char material[64];
-	int start;//in primitive
-	int length;//in primitive
+	int start;//in vertices, or in indices if the mesh is indexed
+	int length;//in vertices, or in indices if the mesh is indexed
+};
+
+struct sLodInfo
+{
+	int start; //in lod_indices
+	int length; //in indices
+	float error; //approximate distance to the surface of the full mesh, in object units
+};
+
+//attributes a vertex can have, in the order they are packed in the interleaved buffer
+enum eVertexAttribute { VERTEX_POSITION, VERTEX_NORMAL, VERTEX_UV, VERTEX_UV1, VERTEX_TANGENT, VERTEX_COLOR, VERTEX_BONES, VERTEX_WEIGHTS, VERTEX_NUM_ATTRIBUTES };
+#define VERTEX_ALL_ATTRIBUTES ((1 << VERTEX_NUM_ATTRIBUTES) - 1)
+
+//where every attribute is inside an interleaved vertex
+struct sVertexLayout
+{
+	struct sAttribute {
+		int components = 0; //0 when the attribute isn't in the layout
+		unsigned int type = 0; //GL_FLOAT, GL_HALF_FLOAT, GL_BYTE, GL_UNSIGNED_BYTE, GL_INT_2_10_10_10_REV
+		bool normalized = false;
+		int offset = 0; //in bytes from the start of the vertex
+	};
+	sAttribute attributes[VERTEX_NUM_ATTRIBUTES];
+	int stride = 0; //bytes per vertex, multiple of 4
+	int mask = 0; //attributes requested when it was built
+
+	bool has(int attribute) const { return attributes[attribute].components != 0; }
+	void add(int attribute, int components, unsigned int type, bool normalized, int size);
 };
 
 class Mesh
 {
 public:
 	static std::map<std::string, Mesh*> sMeshesLoaded;
-	static bool use_binary; //always load the binary version of a mesh when possible
+	static bool use_binary; //always load the binary version of a mesh when possible, it is kept in the AssetCache
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
+	static bool generate_tangents; //interleaved meshes with normals and uvs get tangents for the normal maps
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+	static bool keep_cpu_copies; //the streams only the CPU reads stay in RAM after the upload
+	static bool compress_bins; //writeBin compresses the sections of the .mbin
+	static bool optimize_meshes; //imported meshes are indexed and reordered for the GPU caches
+	static bool generate_lods; //imported meshes get simplified levels of detail
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
 
@@ -49,16 +87,16 @@ public:
 	std::vector< Vector2 > m_uvs1; //secondary sets of uvs
 	std::vector< Vector4 > colors; //here we store the colors
 	
-	struct tInterleaved {
-		Vector3 vertex;
-		Vector3 normal;
-		Vector2 uv;
-	};
-
-	std::vector< tInterleaved > interleaved; //to render interleaved
+	//to render interleaved: the streams packed in one buffer, it is released once it is in the VRAM
+	sVertexLayout vertex_layout;
+	std::vector< char > interleaved;
 
 	std::vector<unsigned int> m_indices; //for indexed meshes
 
+	//levels of detail: every one is coarser than the previous and uses the vertices of the full mesh (level 0)
+	std::vector<sLodInfo> lods; //from level 1
+	std::vector<unsigned int> lod_indices; //stored after m_indices in the indices VBO
+
 	//for animated meshes
 	std::vector< Vector4ub > bones; //tells which bones afect the vertex (4 max)
 	std::vector< Vector4 > weights; //tells how much affect every bone
@@ -77,41 +115,78 @@ public:
 	unsigned int colors_vbo_id;
 
 	unsigned int indices_vbo_id;
+	unsigned int indices_format; //GL_UNSIGNED_SHORT in the VBO when every vertex can be indexed with 16 bits
 	unsigned int interleaved_vbo_id;
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
+	size_t vram_bytes; //in the VBOs
+
+	sResidency residency; //handled by the ResourceManager
+
+	//vertex array objects: the attribute setup of this mesh for each shader, created the first time they are used together
+	struct sVertexArray {
+		unsigned int vao_id = 0;
+		unsigned int shader_revision = 0;
+	};
+	std::map<Shader*, sVertexArray> vertex_arrays;
+
+	//a stream of the mesh seen as raw memory, so all of them are handled the same way
+	struct sVertexStream
+	{
+		const char* data = NULL; //NULL if the mesh doesn't have it
+		unsigned int count = 0; //elements
+		int size = 0; //bytes per element
+		sVertexLayout::sAttribute format;
+		unsigned int* vbo_id = NULL; //its own VBO when it isn't interleaved
+	};
+	sVertexStream getVertexStream(int attribute); //empty for the tangents, they only exist in the interleaved buffer
 
 	Mesh();
 	~Mesh();
 
 	void clear();
+	void releaseVRAM(); //VBOs and VAOs, the CPU data is kept
+	size_t releaseCPUCopies(); //streams only needed to upload it, once it is in the VRAM. Returns the bytes freed, ResourceManager::use with cpu_copies brings them back
+	void evict(); //releases the data but keeps the bounding and the collision model, load brings it back
+	size_t getRAMBytes();
 
-	void render( unsigned int primitive, int submesh_id = -1, int num_instances = 0 );
+	void render( unsigned int primitive, int submesh_id = -1, int num_instances = 0, int lod = 0 );
 	void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number);
+	void renderInstanced(unsigned int primitive, unsigned int instances_buffer_id, int first_instance, int number, int lod = 0); //models already uploaded to a buffer
 	void renderBounding( const Matrix44& model, bool world_bounding = true );
 	void renderFixedPipeline(int primitive); //sloooooooow
 	//void renderAnimated(unsigned int primitive, Skeleton *sk);
 
 	void enableBuffers(Shader* shader);
-	void drawCall(unsigned int primitive, int submesh_id, int num_instances);
+	void drawCall(unsigned int primitive, int submesh_id, int num_instances, int lod = 0); //the levels of detail are drawn whole, without submeshes
 	void disableBuffers(Shader* shader);
+	bool enableInstanceBuffer(Shader* shader, unsigned int instances_buffer_id, int first_instance); //binds the models to the mat4 attribute u_model
+	void disableInstanceBuffer(Shader* shader);
 
 	bool readBin(const char* filename, bool bFromNetwork);
 	bool writeBin(const char* filename);
 
 	unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
-	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
-
-	//collision testing
-	void* collision_model;
-	bool createCollisionModel(bool is_static = false); //is_static sets if the inv matrix should be computed after setTransform (true) or before rayCollision (false)
+	unsigned int getNumVertices() { return (unsigned int)vertices.size(); }
+	int getNumLods() { return 1 + (int)lods.size(); }
+	float getLodError(int lod) { return lod > 0 && lod <= (int)lods.size() ? lods[lod - 1].error : 0.0f; }
+
+	//collision testing: the model is built by the first query that needs it, or in the background with createCollisionModelAsync
+	CollisionModel* collision_model; //BVH of the triangles, shared by every entity that uses the mesh
+	std::future<bool> collision_task; //background build, the next query waits for it
+	bool createCollisionModel(bool is_static = false); //is_static is kept for compatibility, the entities keep the inverse of their model
+	void createCollisionModelAsync(bool is_static = false);
 	//help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
-	bool testRayCollision( Matrix44 model, Vector3 ray_origin, Vector3 ray_direction, Vector3& collision, Vector3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false );
-	bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
+	//inverse_model is the inverse of model if the caller keeps it, otherwise it is computed for the query
+	bool testRayCollision( Matrix44 model, Vector3 ray_origin, Vector3 ray_direction, Vector3& collision, Vector3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false, const Matrix44* inverse_model = NULL );
+	bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal, const Matrix44* inverse_model = NULL);
+	//sphere in world space moving by delta, toi is the fraction of delta it moves until it touches the mesh
+	bool testSweptSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3 delta, float& toi, Vector3& collision, Vector3& normal, const Matrix44* inverse_model = NULL);
 
 	//loader
 	static Mesh* Get(const char* filename, bool bFromNetwork = false, bool skip_load = false);
+	bool load(const char* filename, bool bFromNetwork = false); //only CPU work, it can be called from any thread
 	static void Release();
 	void registerMesh(std::string name);
 	void nameMesh(std::string filename);
@@ -130,9 +205,16 @@ public:
 
 	//optimize meshes
 	void uploadToVRAM();
-	bool interleaveBuffers();
+	bool interleaveBuffers(int attributes = VERTEX_ALL_ATTRIBUTES); //packs the streams in the mask (eVertexAttribute bits) that the mesh has
+	void optimize(); //indexes the mesh if needed, then reorders triangles for the vertex cache and overdraw and vertices for the fetch
+	void createLods(int max_lods = MESH_MAX_LODS); //halves the triangles of the previous level while the error stays small
 
 private:
+	bool buildCollisionModel(bool is_static);
+	void computeTangents(std::vector<Vector4>& tangents);
+	void remapVertices(const std::vector<unsigned int>& remap, unsigned int num_vertices);
+	bool readBinV11(const char* data, const char* end);
+	bool readBinV12(const char* data, const char* end);
 	bool loadASE(const char* filename);
 	bool loadOBJ(const char* filename);
 	bool loadMESH(const char* filename); //personal format used for animations
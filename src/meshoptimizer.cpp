@@ -0,0 +1,611 @@
+#include "meshoptimizer.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+//Forsyth scoring constants
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+static float vertexScore(int cache_position, int remaining_valence)
+{
+	if (remaining_valence == 0) //no triangles left, it doesnt help anymore
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cache_position >= 0)
+	{
+		if (cache_position < 3) //used by the last triangle, so the score is fixed to avoid picking the same strip direction
+			score = LAST_TRIANGLE_SCORE;
+		else
+			score = pow(1.0f - (cache_position - 3) / (float)(VERTEX_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+	}
+
+	//vertices with few triangles left are finished before they leave the cache
+	score += VALENCE_BOOST_SCALE * pow((float)remaining_valence, -VALENCE_BOOST_POWER);
+	return score;
+}
+
+void optimizeVertexCache(unsigned int* indices, int num_indices, int num_vertices)
+{
+	int num_triangles = num_indices / 3;
+	if (num_triangles < 2)
+		return;
+
+	//triangles of every vertex
+	vector<int> valence(num_vertices, 0);
+	for (int i = 0; i < num_triangles * 3; ++i)
+		valence[indices[i]]++;
+	vector<int> adjacency_offset(num_vertices + 1, 0);
+	for (int i = 0; i < num_vertices; ++i)
+		adjacency_offset[i + 1] = adjacency_offset[i] + valence[i];
+	vector<int> adjacency(num_triangles * 3);
+	vector<int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+	for (int i = 0; i < num_triangles * 3; ++i)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	vector<int> cache_position(num_vertices, -1);
+	vector<float> score(num_vertices);
+	for (int i = 0; i < num_vertices; ++i)
+		score[i] = vertexScore(-1, valence[i]);
+
+	vector<float> triangle_score(num_triangles);
+	vector<bool> emitted(num_triangles, false);
+	for (int i = 0; i < num_triangles; ++i)
+		triangle_score[i] = score[indices[i * 3]] + score[indices[i * 3 + 1]] + score[indices[i * 3 + 2]];
+
+	vector<unsigned int> result(num_triangles * 3);
+	int cache[VERTEX_CACHE_SIZE + 3];
+	int cache_size = 0;
+	int next_candidate = 0; //for when no triangle in the cache is left
+	int best = 0;
+	for (int i = 1; i < num_triangles; ++i)
+		if (triangle_score[i] > triangle_score[best])
+			best = i;
+
+	for (int t = 0; t < num_triangles; ++t)
+	{
+		if (best < 0)
+		{
+			while (emitted[next_candidate])
+				next_candidate++;
+			best = next_candidate;
+		}
+
+		//emit the triangle
+		const unsigned int* triangle = &indices[best * 3];
+		memcpy(&result[t * 3], triangle, sizeof(unsigned int) * 3);
+		emitted[best] = true;
+
+		//remove it from the adjacency of its vertices
+		for (int k = 0; k < 3; ++k)
+		{
+			int v = triangle[k];
+			int* begin = &adjacency[adjacency_offset[v]];
+			int* end = begin + valence[v];
+			*std::find(begin, end, best) = *(end - 1);
+			valence[v]--;
+		}
+
+		//move its vertices to the front of the LRU cache
+		int new_cache[VERTEX_CACHE_SIZE + 3];
+		int new_cache_size = 0;
+		for (int k = 0; k < 3; ++k)
+			new_cache[new_cache_size++] = triangle[k];
+		for (int k = 0; k < cache_size; ++k)
+			if (cache[k] != (int)triangle[0] && cache[k] != (int)triangle[1] && cache[k] != (int)triangle[2])
+				new_cache[new_cache_size++] = cache[k];
+
+		//update the scores of the vertices in the cache, and the ones pushed out of it
+		for (int k = 0; k < new_cache_size; ++k)
+		{
+			int v = new_cache[k];
+			cache_position[v] = k < VERTEX_CACHE_SIZE ? k : -1;
+			float new_score = vertexScore(cache_position[v], valence[v]);
+			float delta = new_score - score[v];
+			score[v] = new_score;
+			for (int j = 0; j < valence[v]; ++j)
+				triangle_score[adjacency[adjacency_offset[v] + j]] += delta;
+		}
+
+		//next triangle: the best one using a vertex of the cache
+		best = -1;
+		float best_score = -1.0f;
+		for (int k = 0; k < new_cache_size && k < VERTEX_CACHE_SIZE; ++k)
+		{
+			int v = new_cache[k];
+			for (int j = 0; j < valence[v]; ++j)
+			{
+				int adjacent = adjacency[adjacency_offset[v] + j];
+				if (triangle_score[adjacent] > best_score)
+				{
+					best_score = triangle_score[adjacent];
+					best = adjacent;
+				}
+			}
+		}
+
+		cache_size = min(new_cache_size, VERTEX_CACHE_SIZE);
+		memcpy(cache, new_cache, sizeof(int) * cache_size);
+	}
+
+	memcpy(indices, &result[0], sizeof(unsigned int) * num_triangles * 3);
+}
+
+void optimizeOverdraw(unsigned int* indices, int num_indices, const Vector3* positions, int num_vertices, float threshold)
+{
+	int num_triangles = num_indices / 3;
+	if (num_triangles < 2)
+		return;
+
+	float mesh_acmr, mesh_atvr;
+	computeVertexCacheStats(indices, num_indices, num_vertices, mesh_acmr, mesh_atvr);
+
+	//clusters start at triangles where the cache misses every vertex, merged while they keep a good ACMR
+	vector<int> cluster_start;
+	vector<int> timestamp(num_vertices, -VERTEX_CACHE_SIZE - 1);
+	int time = 0;
+	int cluster_misses = 0;
+	for (int i = 0; i < num_triangles; ++i)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = indices[i * 3 + k];
+			if (time - timestamp[v] > VERTEX_CACHE_SIZE)
+			{
+				timestamp[v] = time++;
+				misses++;
+			}
+		}
+
+		bool cluster_is_good = cluster_start.size() && cluster_misses <= threshold * mesh_acmr * (i - cluster_start.back());
+		if (cluster_start.empty() || (misses == 3 && cluster_is_good))
+		{
+			cluster_start.push_back(i);
+			cluster_misses = 0;
+		}
+		cluster_misses += misses;
+	}
+	cluster_start.push_back(num_triangles);
+
+	//center of the mesh
+	Vector3 mesh_center;
+	float mesh_area = 0.0f;
+	for (int i = 0; i < num_triangles; ++i)
+	{
+		const Vector3& a = positions[indices[i * 3]];
+		const Vector3& b = positions[indices[i * 3 + 1]];
+		const Vector3& c = positions[indices[i * 3 + 2]];
+		float area = (float)(b - a).cross(c - a).length();
+		mesh_center = mesh_center + (a + b + c) * (area / 3.0f);
+		mesh_area += area;
+	}
+	if (mesh_area > 0.0f)
+		mesh_center = mesh_center * (1.0f / mesh_area);
+
+	//sort key: how much the cluster faces away from the center, the outer surfaces occlude the inner ones
+	int num_clusters = (int)cluster_start.size() - 1;
+	vector<pair<float, int>> keys(num_clusters);
+	for (int c = 0; c < num_clusters; ++c)
+	{
+		Vector3 center;
+		Vector3 normal;
+		float area = 0.0f;
+		for (int i = cluster_start[c]; i < cluster_start[c + 1]; ++i)
+		{
+			const Vector3& a = positions[indices[i * 3]];
+			const Vector3& b = positions[indices[i * 3 + 1]];
+			const Vector3& c3 = positions[indices[i * 3 + 2]];
+			Vector3 n = (b - a).cross(c3 - a); //area weighted normal
+			float triangle_area = (float)n.length();
+			normal = normal + n;
+			center = center + (a + b + c3) * (triangle_area / 3.0f);
+			area += triangle_area;
+		}
+		if (area > 0.0f)
+			center = center * (1.0f / area);
+		float normal_length = (float)normal.length();
+		float key = normal_length > 0.0f ? (center - mesh_center).dot(normal) / normal_length : 0.0f;
+		keys[c] = make_pair(-key, c);
+	}
+	stable_sort(keys.begin(), keys.end());
+
+	vector<unsigned int> result;
+	result.reserve(num_triangles * 3);
+	for (int k = 0; k < num_clusters; ++k)
+	{
+		int c = keys[k].second;
+		result.insert(result.end(), indices + cluster_start[c] * 3, indices + cluster_start[c + 1] * 3);
+	}
+	memcpy(indices, &result[0], sizeof(unsigned int) * result.size());
+}
+
+vector<unsigned int> optimizeVertexFetch(const unsigned int* indices, int num_indices, int num_vertices)
+{
+	vector<unsigned int> remap(num_vertices, (unsigned int)-1);
+	unsigned int next = 0;
+	for (int i = 0; i < num_indices; ++i)
+		if (remap[indices[i]] == (unsigned int)-1)
+			remap[indices[i]] = next++;
+	for (int i = 0; i < num_vertices; ++i)
+		if (remap[i] == (unsigned int)-1)
+			remap[i] = next++;
+	return remap;
+}
+
+void computeVertexCacheStats(const unsigned int* indices, int num_indices, int num_vertices, float& acmr, float& atvr, int cache_size)
+{
+	//FIFO cache, a vertex is in it if less than cache_size vertices were transformed after it
+	vector<int> timestamp(num_vertices, -cache_size - 1);
+	vector<bool> used(num_vertices, false);
+	int misses = 0;
+	int unique = 0;
+	for (int i = 0; i < num_indices; ++i)
+	{
+		unsigned int v = indices[i];
+		if (misses - timestamp[v] > cache_size)
+			timestamp[v] = misses++;
+		if (!used[v])
+		{
+			used[v] = true;
+			unique++;
+		}
+	}
+	acmr = num_indices >= 3 ? misses / (float)(num_indices / 3) : 0.0f;
+	atvr = unique ? misses / (float)unique : 0.0f;
+}
+
+//Simplification
+
+#define SIMPLIFY_BORDER_WEIGHT 10.0f //the planes that keep the borders weigh more than the ones of the surface
+#define SIMPLIFY_MAX_PASSES 32
+#define SIMPLIFY_MIN_NORMAL_DOT 0.25f //a collapse can't turn a triangle more than ~75 degrees
+
+//how a point can move: manifold points collapse to any neighbour, borders and seams only along them and locked ones never
+enum eSimplifyKind { SIMPLIFY_MANIFOLD, SIMPLIFY_BORDER, SIMPLIFY_SEAM, SIMPLIFY_LOCKED };
+
+//sum of squared distances to planes, weighted by area: error(p) = (p^T A p + 2 b.p + c) / w
+struct sQuadric {
+	double a00, a11, a22, a10, a20, a21;
+	double b0, b1, b2, c;
+	double w;
+};
+
+struct sCollapse {
+	double cost;
+	unsigned int from; //points (first vertex of every position)
+	unsigned int to;
+	bool operator<(const sCollapse& other) const { return cost < other.cost; }
+};
+
+static void addPlaneQuadric(sQuadric& q, const Vector3& n, float d, float weight)
+{
+	q.a00 += weight * n.x * n.x;
+	q.a11 += weight * n.y * n.y;
+	q.a22 += weight * n.z * n.z;
+	q.a10 += weight * n.y * n.x;
+	q.a20 += weight * n.z * n.x;
+	q.a21 += weight * n.z * n.y;
+	q.b0 += weight * n.x * d;
+	q.b1 += weight * n.y * d;
+	q.b2 += weight * n.z * d;
+	q.c += weight * d * d;
+	q.w += weight;
+}
+
+static void addQuadric(sQuadric& q, const sQuadric& r)
+{
+	q.a00 += r.a00; q.a11 += r.a11; q.a22 += r.a22;
+	q.a10 += r.a10; q.a20 += r.a20; q.a21 += r.a21;
+	q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+	q.c += r.c;
+	q.w += r.w;
+}
+
+static double quadricError(const sQuadric& q, const Vector3& p)
+{
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z + 2 * (q.a10 * x * y + q.a20 * x * z + q.a21 * y * z) + 2 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+	return q.w > 0 ? fabs(e) / q.w : 0;
+}
+
+static inline unsigned long long edgeKey(unsigned int a, unsigned int b) { return ((unsigned long long)a << 32) | b; }
+
+int simplifyMesh(unsigned int* destination, const unsigned int* indices, int num_indices, const Vector3* positions, int num_vertices, int target_indices, float max_error, float* result_error)
+{
+	num_indices -= num_indices % 3;
+	if (result_error)
+		*result_error = 0.0f;
+	if (num_indices == 0)
+		return 0;
+	vector<unsigned int> result(indices, indices + num_indices);
+
+	//the used vertices with the same position are wedges of one point: remap goes to the first one and wedge links them in a ring
+	vector<unsigned char> used(num_vertices, 0);
+	for (int i = 0; i < num_indices; ++i)
+		used[indices[i]] = 1;
+	vector<unsigned int> remap(num_vertices), wedge(num_vertices);
+	vector<int> hash_table(1, -1);
+	while (hash_table.size() < (size_t)num_vertices * 2)
+		hash_table.resize(hash_table.size() * 2);
+	hash_table.assign(hash_table.size(), -1);
+	unsigned int hash_mask = (unsigned int)hash_table.size() - 1;
+	for (int i = 0; i < num_vertices; ++i)
+	{
+		remap[i] = wedge[i] = i;
+		if (!used[i])
+			continue;
+		unsigned int bits[3];
+		memcpy(bits, &positions[i], sizeof(bits));
+		unsigned int slot = ((bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u)) & hash_mask;
+		while (hash_table[slot] != -1 && memcmp(&positions[hash_table[slot]], &positions[i], sizeof(Vector3)) != 0)
+			slot = (slot + 1) & hash_mask;
+		if (hash_table[slot] == -1)
+			hash_table[slot] = i;
+		else
+		{
+			unsigned int first = hash_table[slot];
+			remap[i] = first;
+			wedge[i] = wedge[first];
+			wedge[first] = i;
+		}
+	}
+
+	//positions inside a unit box, so the errors don't depend on the size of the mesh
+	Vector3 box_min = positions[indices[0]], box_max = box_min;
+	for (int i = 0; i < num_indices; ++i)
+	{
+		box_min.setMin(positions[indices[i]]);
+		box_max.setMax(positions[indices[i]]);
+	}
+	Vector3 extent = box_max - box_min;
+	float scale = max(extent.x, max(extent.y, extent.z));
+	scale = scale > 0 ? 1.0f / scale : 1.0f;
+	vector<Vector3> points(num_vertices);
+	for (int i = 0; i < num_vertices; ++i)
+		points[i] = (positions[i] - box_min) * scale;
+
+	//open edges: borders have no opposite edge between the points, seams have it only between other wedges
+	vector<unsigned long long> vertex_edges, point_edges;
+	vertex_edges.reserve(num_indices);
+	point_edges.reserve(num_indices);
+	for (int i = 0; i < num_indices; ++i)
+	{
+		unsigned int a = indices[i], b = indices[i - i % 3 + (i + 1) % 3];
+		vertex_edges.push_back(edgeKey(a, b));
+		point_edges.push_back(edgeKey(remap[a], remap[b]));
+	}
+	sort(vertex_edges.begin(), vertex_edges.end());
+	sort(point_edges.begin(), point_edges.end());
+
+	vector<int> border_edges(num_vertices, 0), seam_edges(num_vertices, 0);
+	vector<unsigned int> loop(num_vertices, (unsigned int)-1), loopback(num_vertices, (unsigned int)-1); //next and previous vertex along a border or seam
+	vector<sQuadric> quadrics(num_vertices);
+	memset(&quadrics[0], 0, sizeof(sQuadric) * num_vertices);
+	for (int t = 0; t < num_indices / 3; ++t)
+	{
+		const unsigned int* tri = &indices[t * 3];
+		Vector3 normal = (points[tri[1]] - points[tri[0]]).cross(points[tri[2]] - points[tri[0]]);
+		float area = (float)normal.length();
+		if (area > 0)
+			normal = normal * (1.0f / area);
+		for (int k = 0; k < 3; ++k)
+			addPlaneQuadric(quadrics[remap[tri[k]]], normal, -normal.dot(points[tri[0]]), area * 0.5f);
+
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int a = tri[k], b = tri[(k + 1) % 3];
+			bool point_open = !binary_search(point_edges.begin(), point_edges.end(), edgeKey(remap[b], remap[a]));
+			bool vertex_open = !binary_search(vertex_edges.begin(), vertex_edges.end(), edgeKey(b, a));
+			if (!vertex_open)
+				continue;
+			loop[a] = b;
+			loopback[b] = a;
+			if (point_open)
+			{
+				border_edges[remap[a]]++;
+				border_edges[remap[b]]++;
+
+				//plane through the border, perpendicular to the triangle
+				Vector3 edge = points[b] - points[a];
+				Vector3 border_normal = edge.cross(normal);
+				float length = (float)border_normal.length();
+				if (length > 0)
+				{
+					border_normal = border_normal * (1.0f / length);
+					float weight = (float)edge.dot(edge) * SIMPLIFY_BORDER_WEIGHT;
+					addPlaneQuadric(quadrics[remap[a]], border_normal, -border_normal.dot(points[a]), weight);
+					addPlaneQuadric(quadrics[remap[b]], border_normal, -border_normal.dot(points[a]), weight);
+				}
+			}
+			else
+			{
+				seam_edges[a]++;
+				seam_edges[b]++;
+			}
+		}
+	}
+
+	vector<unsigned char> kind(num_vertices, SIMPLIFY_LOCKED);
+	for (unsigned int i = 0; i < (unsigned int)num_vertices; ++i)
+	{
+		if (!used[i] || remap[i] != i)
+			continue;
+		int num_wedges = 1;
+		for (unsigned int w = wedge[i]; w != i; w = wedge[w])
+			num_wedges++;
+		if (num_wedges == 1)
+			kind[i] = border_edges[i] == 0 ? SIMPLIFY_MANIFOLD : border_edges[i] == 2 ? SIMPLIFY_BORDER : SIMPLIFY_LOCKED;
+		else if (num_wedges == 2 && border_edges[i] == 0 && seam_edges[i] == 2 && seam_edges[wedge[i]] == 2)
+			kind[i] = SIMPLIFY_SEAM;
+	}
+
+	double error_limit = (double)max_error * scale * max_error * scale;
+	double max_cost = 0;
+	int num_triangles = num_indices / 3;
+	int target_triangles = target_indices / 3;
+	vector<unsigned int> collapse_target(num_vertices);
+	vector<unsigned char> touched(num_vertices);
+	vector<int> adjacency_offsets(num_vertices + 1), adjacency;
+	vector<sCollapse> collapses;
+	vector<unsigned int> wedge_targets;
+
+	for (int pass = 0; pass < SIMPLIFY_MAX_PASSES && num_triangles > target_triangles; ++pass)
+	{
+		//triangles around every point
+		adjacency_offsets.assign(num_vertices + 1, 0);
+		for (int i = 0; i < num_triangles * 3; ++i)
+			adjacency_offsets[remap[result[i]] + 1]++;
+		for (int i = 0; i < num_vertices; ++i)
+			adjacency_offsets[i + 1] += adjacency_offsets[i];
+		adjacency.resize(num_triangles * 3);
+		vector<int> next_slot(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (int i = 0; i < num_triangles * 3; ++i)
+			adjacency[next_slot[remap[result[i]]]++] = i / 3;
+
+		//every edge in the cheapest direction its kinds allow
+		collapses.clear();
+		for (int i = 0; i < num_triangles * 3; ++i)
+		{
+			unsigned int a = remap[result[i]], b = remap[result[i - i % 3 + (i + 1) % 3]];
+			if (a == b)
+				continue;
+			sCollapse best;
+			best.cost = -1;
+			for (int k = 0; k < 2; ++k)
+			{
+				unsigned int from = k ? b : a, to = k ? a : b;
+				if (kind[from] == SIMPLIFY_LOCKED)
+					continue;
+				if (kind[from] != SIMPLIFY_MANIFOLD && !(loop[from] != (unsigned int)-1 && remap[loop[from]] == to) && !(loopback[from] != (unsigned int)-1 && remap[loopback[from]] == to))
+					continue;
+				sQuadric q = quadrics[from];
+				addQuadric(q, quadrics[to]);
+				double cost = quadricError(q, points[to]);
+				if (best.cost < 0 || cost < best.cost)
+				{
+					best.cost = cost;
+					best.from = from;
+					best.to = to;
+				}
+			}
+			if (best.cost >= 0 && best.cost <= error_limit)
+				collapses.push_back(best);
+		}
+		sort(collapses.begin(), collapses.end());
+
+		for (int i = 0; i < num_vertices; ++i)
+			collapse_target[i] = i;
+		touched.assign(num_vertices, 0);
+		int triangles_to_remove = num_triangles - target_triangles;
+		int removed = 0;
+		int num_collapses = 0;
+		for (size_t c = 0; c < collapses.size() && removed < triangles_to_remove; ++c)
+		{
+			unsigned int from = collapses[c].from, to = collapses[c].to;
+			if (touched[from] || touched[to])
+				continue;
+
+			//the triangles that stay can't flip, and every wedge needs a wedge of the target on one of its triangles
+			bool valid = true;
+			int degenerate = 0;
+			wedge_targets.clear();
+			for (int k = adjacency_offsets[from]; k < adjacency_offsets[from + 1] && valid; ++k)
+			{
+				unsigned int tri[3];
+				bool has_to = false;
+				for (int j = 0; j < 3; ++j)
+				{
+					tri[j] = collapse_target[result[adjacency[k] * 3 + j]];
+					has_to = has_to || remap[tri[j]] == to;
+				}
+				if (has_to)
+				{
+					degenerate++;
+					continue;
+				}
+				Vector3 p[3], q[3];
+				for (int j = 0; j < 3; ++j)
+				{
+					p[j] = points[tri[j]];
+					q[j] = remap[tri[j]] == from ? points[to] : p[j];
+				}
+				Vector3 n0 = (p[1] - p[0]).cross(p[2] - p[0]);
+				Vector3 n1 = (q[1] - q[0]).cross(q[2] - q[0]);
+				double l0 = n0.length();
+				if (l0 > 0 && n0.dot(n1) <= SIMPLIFY_MIN_NORMAL_DOT * l0 * n1.length())
+					valid = false;
+			}
+			unsigned int w = from;
+			do
+			{
+				unsigned int target = (unsigned int)-1;
+				for (int k = adjacency_offsets[from]; k < adjacency_offsets[from + 1] && target == (unsigned int)-1; ++k)
+				{
+					const unsigned int* tri = &result[adjacency[k] * 3];
+					if (tri[0] != w && tri[1] != w && tri[2] != w)
+						continue;
+					for (int j = 0; j < 3; ++j)
+						if (remap[collapse_target[tri[j]]] == to)
+							target = collapse_target[tri[j]];
+				}
+				if (target == (unsigned int)-1)
+					valid = false;
+				wedge_targets.push_back(target);
+				w = wedge[w];
+			} while (w != from && valid);
+			if (!valid)
+				continue;
+
+			//collapse every wedge, the borders and seams continue from the target
+			w = from;
+			for (size_t k = 0; k < wedge_targets.size(); ++k, w = wedge[w])
+			{
+				unsigned int target = wedge_targets[k];
+				collapse_target[w] = target;
+				if (loop[w] == target)
+					loopback[target] = loopback[w];
+				if (loopback[w] == target)
+					loop[target] = loop[w];
+			}
+			addQuadric(quadrics[to], quadrics[from]);
+			touched[from] = touched[to] = 1;
+			removed += degenerate;
+			num_collapses++;
+			max_cost = max(max_cost, collapses[c].cost);
+		}
+		if (!num_collapses)
+			break;
+
+		//apply the collapses and remove the triangles that lost their area
+		int count = 0;
+		for (int t = 0; t < num_triangles; ++t)
+		{
+			unsigned int a = collapse_target[result[t * 3]], b = collapse_target[result[t * 3 + 1]], c = collapse_target[result[t * 3 + 2]];
+			if (remap[a] == remap[b] || remap[b] == remap[c] || remap[a] == remap[c])
+				continue;
+			result[count * 3] = a;
+			result[count * 3 + 1] = b;
+			result[count * 3 + 2] = c;
+			count++;
+		}
+		num_triangles = count;
+		for (int i = 0; i < num_vertices; ++i)
+		{
+			if (loop[i] != (unsigned int)-1)
+				loop[i] = collapse_target[loop[i]];
+			if (loopback[i] != (unsigned int)-1)
+				loopback[i] = collapse_target[loopback[i]];
+		}
+	}
+
+	memcpy(destination, result.data(), sizeof(unsigned int) * num_triangles * 3);
+	if (result_error)
+		*result_error = (float)sqrt(max_cost) / scale;
+	return num_triangles * 3;
+}
@@ -0,0 +1,31 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#pragma once
+#include "framework.h"
+#include <vector>
+
+//Import time optimizations for indexed triangle lists. All but the simplification only reorder, so the rendered result is the same
+
+#define VERTEX_CACHE_SIZE 32 //post transform cache modeled by the optimizer and the stats
+
+//Reorder the triangles to reuse the post transform cache (Forsyth's linear speed algorithm)
+void optimizeVertexCache(unsigned int* indices, int num_indices, int num_vertices);
+
+//Split the cache optimized triangles in clusters and sort them so the outer ones, that occlude more, are drawn first.
+//A cluster only ends where the cache would be cold anyway, unless its ACMR grows over threshold times the one of the mesh
+void optimizeOverdraw(unsigned int* indices, int num_indices, const Vector3* positions, int num_vertices, float threshold = 1.05f);
+
+//Returns for every vertex its new position in the order they are first used, so the vertex fetch is sequential.
+//Unused vertices go to the end
+std::vector<unsigned int> optimizeVertexFetch(const unsigned int* indices, int num_indices, int num_vertices);
+
+//Average cache miss ratio (transformed vertices per triangle) and average transform to vertex ratio of a FIFO cache
+void computeVertexCacheStats(const unsigned int* indices, int num_indices, int num_vertices, float& acmr, float& atvr, int cache_size = VERTEX_CACHE_SIZE);
+
+//Collapse edges onto one of their vertices, cheapest quadric error first, until there are target_indices or the next collapse
+//would move the surface more than max_error. Borders and uv seams only collapse along themselves, so the vertices are the same.
+//Writes the new indices to destination (it can be indices), returns how many and the error reached (in the units of positions)
+int simplifyMesh(unsigned int* destination, const unsigned int* indices, int num_indices, const Vector3* positions, int num_vertices, int target_indices, float max_error, float* result_error = NULL);
+
+#endif
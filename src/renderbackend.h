@@ -0,0 +1,96 @@
+#ifndef RENDERBACKEND_H
+#define RENDERBACKEND_H
+
+#pragma once
+#include "includes.h"
+#include "framework.h"
+#include <string>
+#include <cstdint>
+
+class Shader;
+class Mesh;
+class Texture;
+class FBO;
+
+//Render backend: the calls Shader, Mesh, Texture, FBO and the Renderer need to draw a frame.
+//The values (formats, primitives, blend factors, uniform types) are the OpenGL enums, GLBackend passes them along
+//and SoftRasterizer interprets them to draw the same frame on the CPU.
+class RenderBackend
+{
+public:
+	static RenderBackend* current; //GLBackend unless a tool sets another one before creating anything
+
+	//Size of the default framebuffer
+	int screen_width = 0;
+	int screen_height = 0;
+
+	virtual ~RenderBackend() {}
+
+	//Default framebuffer and errors
+	virtual void setScreenSize(int width, int height) { screen_width = width; screen_height = height; }
+	virtual bool checkErrors() = 0; //false if a previous call failed
+	virtual int getMaxTextureBufferSize() = 0; //in texels
+
+	//Shaders
+	virtual bool compileShader(Shader* shader, const std::string& vs_code, const std::string& fs_code) = 0;
+	virtual void releaseShader(Shader* shader) = 0;
+	virtual void useShader(Shader* shader) = 0; //NULL to disable them
+	virtual int getUniformLocation(Shader* shader, const char* varname) = 0; //-1 if the shader doesn't have it
+	virtual int getAttribLocation(Shader* shader, const char* varname) = 0;
+	virtual void setUniform(int location, unsigned int type, int count, const void* data) = 0; //of the shader in use, type is GL_INT, GL_FLOAT_VEC3, GL_FLOAT_MAT4...
+	virtual void setUniformBlock(Shader* shader, const char* varname, int binding) = 0;
+	virtual void bindTexture(int slot, unsigned int texture_type, unsigned int texture_id) = 0;
+
+	//Meshes
+	virtual void uploadMesh(Mesh* mesh) = 0; //interleaved buffer, separated streams and indices. It adds up vram_bytes
+	virtual void releaseMesh(Mesh* mesh) = 0; //the mesh resets its ids afterwards
+	virtual void enableMeshBuffers(Mesh* mesh, Shader* shader) = 0;
+	virtual void disableMeshBuffers(Mesh* mesh, Shader* shader) = 0;
+	virtual bool enableInstanceBuffer(Mesh* mesh, Shader* shader, unsigned int buffer_id, int first_instance) = 0; //false if the shader doesn't have the mat4 attribute u_model
+	virtual void disableInstanceBuffer(Mesh* mesh, Shader* shader) = 0;
+	virtual void drawMesh(Mesh* mesh, unsigned int primitive, int start, int size, int lod_offset, int num_instances) = 0; //in indices (vertices if it has none), the levels of detail start at lod_offset
+
+	//Buffers that change every frame, they are created the first time
+	virtual void uploadBuffer(unsigned int& buffer_id, const void* data, size_t size) = 0;
+	virtual void uploadTextureBuffer(unsigned int& buffer_id, unsigned int& texture_id, unsigned int internal_format, const void* data, size_t size, int slot) = 0; //GL_TEXTURE_BUFFER texture that reads the buffer, bound to the slot
+
+	//Textures
+	virtual void createTexture(Texture* texture) = 0; //sets the texture_id
+	virtual void uploadTexture(Texture* texture, unsigned int format, unsigned int type, const Uint8* data, unsigned int internal_format) = 0;
+	virtual void generateMipmaps(Texture* texture) = 0;
+	virtual void setTextureFilter(Texture* texture, int min_filter, int mag_filter) = 0;
+	virtual void setTextureWrap(Texture* texture, int wrap) = 0;
+	virtual void releaseTexture(Texture* texture) = 0;
+
+	//Framebuffers
+	virtual bool createFramebuffer(FBO* fbo, Texture* depth_texture, int cubemap_face) = 0; //attaches the color_textures and the depth texture (a renderbuffer if it is NULL)
+	virtual bool createDepthFramebuffer(FBO* fbo) = 0; //only the depth_texture is attached
+	virtual void releaseFramebuffer(FBO* fbo) = 0;
+	virtual void releaseRenderbuffers(FBO* fbo) = 0;
+	virtual void enableFramebuffer(FBO* fbo) = 0; //renders into it with a viewport of its size, disable brings back the former viewport and the screen
+	virtual void disableFramebuffer(FBO* fbo) = 0;
+	virtual void bindFramebuffer(FBO* fbo) = 0; //only changes where it renders, NULL for the screen
+	virtual void setDrawBuffers(FBO* fbo, int num) = 0; //-1 for every color texture
+	virtual void blitDepth(FBO* source, FBO* destination, int x, int y, int width, int height) = 0; //same region in both, the destination stays bound
+
+	//Render state
+	virtual void setClearColor(const Vector4& color) = 0;
+	virtual void clear(unsigned int mask) = 0; //GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT
+	virtual void setBlend(bool enabled) = 0;
+	virtual void setBlendFunc(unsigned int src, unsigned int dst) = 0;
+	virtual void setCullFace(bool enabled) = 0;
+	virtual void setDepthTest(bool enabled) = 0;
+	virtual void setDepthFunc(unsigned int func) = 0;
+	virtual void setColorMask(bool enabled) = 0;
+	virtual void setScissorTest(bool enabled) = 0;
+	virtual void setScissor(int x, int y, int width, int height) = 0;
+	virtual void setViewport(int x, int y, int width, int height) = 0;
+
+	//Timer queries, in nanoseconds
+	virtual void createQueries(int num, unsigned int* queries) = 0;
+	virtual void beginTimer(unsigned int query) = 0;
+	virtual void endTimer() = 0;
+	virtual bool getTimerResult(unsigned int query, uint64_t& nanoseconds) = 0; //false until it is available
+};
+
+#endif
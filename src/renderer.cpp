@@ -2,12 +2,89 @@
 #include "game.h"
 #include "framework.h"
 #include "extra/hdre.h"
+#include "resourcemanager.h"
+#include "renderbackend.h"
 
 constexpr int SHOW_ATLAS_RESOLUTION = 300;
-constexpr int SHADOW_MAP_RESOLUTION = 2048;
+constexpr int SHADOW_MAP_RESOLUTION = 2048; //Largest tile of the shadow atlas
+constexpr int MIN_SHADOW_MAP_RESOLUTION = 256; //Smallest tile of the shadow atlas
+constexpr int SHADOW_ATLAS_RESOLUTION = 4096; //Side of the square shadow atlas
+constexpr int MAX_RENDER_CALLS = 1 << 16;
+constexpr int MIN_INSTANCES = 2; //Smallest group of render calls drawn with instancing
+constexpr int MAX_LIGHTS_PER_PASS = 256; //Lights of a draw call without clusters, the rest are drawn in additive passes
+constexpr int LIGHT_TEXELS = sizeof(sLightData) / (4 * sizeof(float)); //RGBA32F texels of a light in the lights buffer
+constexpr int LIGHTS_SLOT = 11;
+constexpr int CLUSTERS_X = 16; //Clusters along the screen width
+constexpr int CLUSTERS_Y = 9; //Clusters along the screen height
+constexpr int CLUSTERS_Z = 24; //Depth slices, logarithmically distributed between the near and the far planes
+constexpr int CLUSTER_GRID_SLOT = 9;
+constexpr int CLUSTER_LIGHTS_SLOT = 10;
+constexpr float LOD_HYSTERESIS = 0.25f; //The error on screen must move this fraction past lod_max_error to change the level
 
 using namespace std;
 
+//Forget the tracked state
+void GLStateCache::invalidate()
+{
+	blend = -1;
+	blend_src = blend_dst = 0;
+	cull_face = -1;
+	depth_func = 0;
+	scissor_test = -1;
+	scissor[0] = scissor[1] = scissor[2] = scissor[3] = -1;
+	viewport[0] = viewport[1] = viewport[2] = viewport[3] = -1;
+}
+
+void GLStateCache::setBlend(bool enabled)
+{
+	if (blend == (int)enabled) { num_skipped_calls++; return; }
+	blend = enabled;
+	RenderBackend::current->setBlend(enabled);
+}
+
+void GLStateCache::setBlendFunc(GLenum src, GLenum dst)
+{
+	if (blend_src == src && blend_dst == dst) { num_skipped_calls++; return; }
+	blend_src = src;
+	blend_dst = dst;
+	RenderBackend::current->setBlendFunc(src, dst);
+}
+
+void GLStateCache::setCullFace(bool enabled)
+{
+	if (cull_face == (int)enabled) { num_skipped_calls++; return; }
+	cull_face = enabled;
+	RenderBackend::current->setCullFace(enabled);
+}
+
+void GLStateCache::setDepthFunc(GLenum func)
+{
+	if (depth_func == func) { num_skipped_calls++; return; }
+	depth_func = func;
+	RenderBackend::current->setDepthFunc(func);
+}
+
+void GLStateCache::setScissorTest(bool enabled)
+{
+	if (scissor_test == (int)enabled) { num_skipped_calls++; return; }
+	scissor_test = enabled;
+	RenderBackend::current->setScissorTest(enabled);
+}
+
+void GLStateCache::setScissor(int x, int y, int width, int height)
+{
+	if (scissor[0] == x && scissor[1] == y && scissor[2] == width && scissor[3] == height) { num_skipped_calls++; return; }
+	scissor[0] = x; scissor[1] = y; scissor[2] = width; scissor[3] = height;
+	RenderBackend::current->setScissor(x, y, width, height);
+}
+
+void GLStateCache::setViewport(int x, int y, int width, int height)
+{
+	if (viewport[0] == x && viewport[1] == y && viewport[2] == width && viewport[3] == height) { num_skipped_calls++; return; }
+	viewport[0] = x; viewport[1] = y; viewport[2] = width; viewport[3] = height;
+	RenderBackend::current->setViewport(x, y, width, height);
+}
+
 //Constructor
 Renderer::Renderer(Scene* scene, Camera* camera)
 {
@@ -19,20 +96,90 @@ Renderer::Renderer(Scene* scene, Camera* camera)
 	shaderGUI = Shader::Get("data/shaders/image.vs", "data/shaders/image.fs");
 	loadGUIs();
 
-	//Create Shadow Atlas: We create a dynamic atlas to be resizable
-	createShadowAtlas();
+	//Lights evaluated by each draw call
+	max_lights_per_pass = MAX_LIGHTS_PER_PASS;
+
+	//Lights that fit in the lights buffer texture, and whose indices fit in the 16 bits of the cluster lists
+	int max_texels = RenderBackend::current->getMaxTextureBufferSize();
+	max_lights = min(max(max_texels, LIGHT_TEXELS) / LIGHT_TEXELS, 1 << 16);
+
+	//The index of a render call has to fit in its sort key
+	render_calls.max_calls = MAX_RENDER_CALLS;
+
+	//Instancing shaders: if they can't be loaded every render call is drawn on its own
+	instanced_shader = Shader::Get("data/shaders/instanced.vs", "data/shaders/single.fs");
+	depth_instanced_shader = Shader::Get("data/shaders/depth_instanced.vs", "data/shaders/color.fs");
 }
 
-//Sort render calls by transparency and distance to camera
-bool sortRenderCall(const RenderCall* rc1, const RenderCall* rc2)
+//Small id used to group equal pointers inside a sort key. A collision only costs an extra state change
+uint64_t sortKeyId(const void* ptr, int bits)
 {
-	AlphaMode rc1_alpha = rc1->material->alpha_mode;
-	AlphaMode rc2_alpha = rc2->material->alpha_mode;
-	if (rc1_alpha == AlphaMode::BLEND && rc2_alpha != AlphaMode::BLEND) return false;
-	else if (rc1_alpha != AlphaMode::BLEND && rc2_alpha == AlphaMode::BLEND) return true;
-	else if (rc1_alpha == AlphaMode::BLEND && rc2_alpha == AlphaMode::BLEND) return rc1->distance_to_camera > rc2->distance_to_camera;
-	else if (rc1_alpha != AlphaMode::BLEND && rc2_alpha != AlphaMode::BLEND) return rc1->distance_to_camera < rc2->distance_to_camera;
-	else return true;
+	uint64_t hash = (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ull;
+	return hash >> (64 - bits);
+}
+
+//Sort key of a render call, from the most to the least significant bits:
+//Opaque: pass(1) | alpha mode(2) | two sided(1) | shader(8) | material(12) | mesh(12) | lod(2) | depth front to back(10) | index(16)
+//Blend:  pass(1) | alpha mode(2) | depth back to front(16) | two sided(1) | shader(8) | material(12) | mesh(8) | index(16)
+//Opaque calls are grouped by state and only use the depth to break ties, blended calls must keep their order
+uint64_t renderCallSortKey(const RenderCall& rc, Shader* shader, Camera* camera, uint32_t index)
+{
+	Material* material = rc.material;
+	bool blend = material->alpha_mode == AlphaMode::BLEND;
+	float depth = clamp(rc.distance_to_camera / camera->far_plane, 0.0f, 1.0f);
+
+	uint64_t key = ((uint64_t)blend << 63) | ((uint64_t)material->alpha_mode << 61);
+	if (!blend)
+	{
+		key |= (uint64_t)material->two_sided << 60;
+		key |= sortKeyId(shader, 8) << 52;
+		key |= sortKeyId(material, 12) << 40;
+		key |= sortKeyId(rc.mesh, 12) << 28;
+		key |= (uint64_t)min(rc.lod, 3) << 26;
+		key |= (uint64_t)(depth * 0x3FF) << 16;
+	}
+	else
+	{
+		key |= (uint64_t)((1.0f - depth) * 0xFFFF) << 45;
+		key |= (uint64_t)material->two_sided << 44;
+		key |= sortKeyId(shader, 8) << 36;
+		key |= sortKeyId(material, 12) << 24;
+		key |= sortKeyId(rc.mesh, 8) << 16;
+	}
+	return key | index;
+}
+
+//LSD radix sort of 64-bit keys, one byte per pass. Passes where every key has the same byte are skipped
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<uint64_t>& temp)
+{
+	size_t num_keys = keys.size();
+	if (num_keys < 2)
+		return;
+	temp.resize(num_keys);
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		//Histogram of the current byte
+		size_t offsets[256] = { 0 };
+		for (size_t i = 0; i < num_keys; ++i)
+			offsets[(keys[i] >> shift) & 0xFF]++;
+		if (offsets[(keys[0] >> shift) & 0xFF] == num_keys)
+			continue;
+
+		//Prefix sum
+		size_t offset = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			size_t count = offsets[i];
+			offsets[i] = offset;
+			offset += count;
+		}
+
+		//Scatter
+		for (size_t i = 0; i < num_keys; ++i)
+			temp[offsets[(keys[i] >> shift) & 0xFF]++] = keys[i];
+		keys.swap(temp);
+	}
 }
 
 //loads GUIs textures
@@ -125,18 +272,21 @@ void Renderer::renderGUIs() {
 //Intialize render calls vector
 void Renderer::createRenderCalls()
 {
-	//Clear the render calls vector
-	render_calls.clear();
+	//Reset the frame arena and the frame counters
+	render_calls.reset();
+	num_state_changes = 0;
+	num_state_changes_unsorted = 0;
 
 	//Main character render call
 	MainCharacterEntity* mc = scene->main_character;
-	if (mc->visible && mc->mesh && mc->material)
-		render_calls.push_back(new RenderCall(mc->mesh, mc->material, mc->model, &mc->world_bounding_box, camera));
+	RenderCall* rc;
+	if (mc->visible && mc->mesh && mc->material && (rc = render_calls.allocate()))
+		*rc = RenderCall(mc->mesh, mc->material, mc->model, &mc->world_bounding_box, camera, true, selectLod(mc->mesh, mc->model, &mc->world_bounding_box, mc->lod));
 
 	//Monster render call
 	MonsterEntity* monster = scene->monster;
-	if (monster->visible && monster->mesh && monster->material)
-		render_calls.push_back(new RenderCall(monster->mesh, monster->material, monster->model, &monster->world_bounding_box, camera));
+	if (monster->visible && monster->mesh && monster->material && (rc = render_calls.allocate()))
+		*rc = RenderCall(monster->mesh, monster->material, monster->model, &monster->world_bounding_box, camera, true, selectLod(monster->mesh, monster->model, &monster->world_bounding_box, monster->lod));
 
 	//Objects render calls	
 	for (int i = 0; i < scene->objects.size(); ++i)
@@ -144,15 +294,166 @@ void Renderer::createRenderCalls()
 		ObjectEntity* object = scene->objects[i];
 		if (object->visible && object->mesh && object->material)
 		{
-			Matrix44 global_matrix = object->computeGlobalModel();
-			render_calls.push_back(new RenderCall(object->mesh, object->material, global_matrix, &object->world_bounding_box, camera));
+			rc = render_calls.allocate();
+			if (!rc)
+				break;
+			Matrix44 model = object->computeGlobalModel();
+			*rc = RenderCall(object->mesh, object->material, model, &object->world_bounding_box, camera, false, selectLod(object->mesh, model, &object->world_bounding_box, object->lod));
+		}
+	}
+
+	//Now we sort the keys of the render calls instead of the render calls themselves
+	render_keys.resize(render_calls.size());
+	for (uint32_t i = 0; i < render_calls.size(); ++i)
+		render_keys[i] = renderCallSortKey(render_calls[i], scene->shader, camera, i);
+	radixSortKeys(render_keys, render_keys_temp);
+}
+
+//Level of detail of a mesh for the camera: the error of every level is projected to the screen at the distance of the object
+int Renderer::selectLod(Mesh* mesh, const Matrix44& model, BoundingBox* world_bounding_box, int& entity_lod)
+{
+	int num_lods = mesh->getNumLods();
+	if (!use_lods || num_lods < 2)
+		return entity_lod = 0;
+
+	//The errors are in object units, the largest axis scale of the model takes them to the world
+	float scale = (float)max(model.rotateVector(Vector3(1, 0, 0)).length(), max(model.rotateVector(Vector3(0, 1, 0)).length(), model.rotateVector(Vector3(0, 0, 1)).length()));
+	float pixels_per_unit = camera->getProjectedScale(world_bounding_box->center, scale);
+
+	//Finer while the current level is clearly too coarse, coarser while the next one is clearly good enough
+	int lod = clamp(entity_lod, 0, num_lods - 1);
+	while (lod > 0 && mesh->getLodError(lod) * pixels_per_unit > lod_max_error * (1.0f + LOD_HYSTERESIS))
+		lod--;
+	while (lod + 1 < num_lods && mesh->getLodError(lod + 1) * pixels_per_unit < lod_max_error * (1.0f - LOD_HYSTERESIS))
+		lod++;
+	return entity_lod = lod;
+}
+
+//Level of detail of a render call in the shadow maps
+int Renderer::getShadowLod(RenderCall* rc)
+{
+	if (!use_lods)
+		return 0;
+	return min(rc->lod + shadow_lod_bias, rc->mesh->getNumLods() - 1);
+}
+
+//Cull the render calls with a camera
+void Renderer::cullRenderCalls(Camera* camera)
+{
+	visible_calls.clear();
+	for (int i = 0; i < render_keys.size(); i++)
+	{
+		RenderCall* rc = &render_calls[render_keys[i] & 0xFFFF];
+		if (camera->testBoxInFrustum(rc->world_bounding_box->center, rc->world_bounding_box->halfsize))
+			visible_calls.push_back(rc);
+	}
+}
+
+//Hash of a block of memory (FNV-1a)
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+//Cone of a spot light against a bounding sphere: true if the sphere is completely outside
+static bool sphereOutsideCone(Vector3 center, float radius, Vector3 cone_origin, Vector3 cone_direction, float cone_angle, float cone_range)
+{
+	Vector3 v = center - cone_origin;
+	float v_length_sq = v.dot(v);
+	float v1_length = v.dot(cone_direction);
+	float distance_closest_point = cos(cone_angle) * sqrt(max(v_length_sq - v1_length * v1_length, 0.0f)) - v1_length * sin(cone_angle);
+
+	bool angle_cull = distance_closest_point > radius;
+	bool front_cull = v1_length > radius + cone_range;
+	bool back_cull = v1_length < -radius;
+	return angle_cull || front_cull || back_cull;
+}
+
+//Cull the static or dynamic shadow casters of a light, returns a hash of the casters that passed
+uint64_t Renderer::cullShadowCasters(LightEntity* light, bool dynamic_casters)
+{
+	Camera* shadow_camera = light->shadow_camera;
+	Vector3 light_position = light->model.getTranslation();
+	Vector3 light_direction = light->model.rotateVector(Vector3(0, 0, -1)).normalize();
+	float cone_angle = light->cone_angle * DEG2RAD;
+	bool cone_test = light->light_type == LightEntity::LightType::SPOT_LIGHT && light->cone_angle < 90;
+
+	//The order of the render calls depends on the main camera, so the hashes of the casters are added instead of chained
+	uint64_t signature = hashBytes(shadow_camera->viewprojection_matrix.m, sizeof(Matrix44));
+
+	visible_calls.clear();
+	for (int i = 0; i < render_keys.size(); i++)
+	{
+		RenderCall* rc = &render_calls[render_keys[i] & 0xFFFF];
+		if (rc->is_dynamic != dynamic_casters || rc->material->alpha_mode == AlphaMode::BLEND)
+			continue;
+
+		//The sphere-cone test is cheaper and tighter than the frustum test for spot lights
+		BoundingBox* box = rc->world_bounding_box;
+		if (cone_test && sphereOutsideCone(box->center, box->halfsize.length(), light_position, light_direction, cone_angle, light->max_distance))
+			continue;
+		if (!shadow_camera->testBoxInFrustum(box->center, box->halfsize))
+			continue;
+
+		visible_calls.push_back(rc);
+		int lod = getShadowLod(rc);
+		signature += hashBytes(rc->model.m, sizeof(Matrix44), hashBytes(&lod, sizeof(int), hashBytes(&rc->mesh, sizeof(Mesh*))));
+	}
+	return signature;
+}
+
+//Split the visible render calls in instance groups and single draw calls
+void Renderer::createDrawBatches(bool shadow_pass)
+{
+	instance_groups.clear();
+	instance_models.clear();
+	single_calls.clear();
+
+	//The sort key keeps render calls with the same material, mesh and level of detail together, blended ones must be drawn in order
+	bool instancing = shadow_pass ? depth_instanced_shader != NULL : instanced_shader != NULL;
+	int num_visible = visible_calls.size();
+	int i = 0;
+	while (i < num_visible)
+	{
+		RenderCall* rc = visible_calls[i];
+		int lod = shadow_pass ? getShadowLod(rc) : rc->lod;
+		int j = i + 1;
+
+		//the assets of the batch are brought back if they were evicted
+		ResourceManager::use(rc->mesh);
+		if (!shadow_pass)
+			ResourceManager::use(rc->material);
+		if (rc->material->alpha_mode != AlphaMode::BLEND)
+			while (j < num_visible && visible_calls[j]->mesh == rc->mesh && visible_calls[j]->material == rc->material && (shadow_pass ? getShadowLod(visible_calls[j]) : visible_calls[j]->lod) == lod)
+				j++;
+
+		if (instancing && j - i >= MIN_INSTANCES)
+		{
+			InstanceGroup group;
+			group.mesh = rc->mesh;
+			group.material = rc->material;
+			group.lod = lod;
+			group.first_instance = instance_models.size();
+			group.num_instances = j - i;
+			instance_groups.push_back(group);
+			for (int k = i; k < j; ++k)
+				instance_models.push_back(visible_calls[k]->model);
 		}
-			
-			
+		else
+		{
+			for (int k = i; k < j; ++k)
+				single_calls.push_back(visible_calls[k]);
+		}
+		i = j;
 	}
 
-	//Now we sort the RenderCalls vector according to the boolean method sortRenderCall
-	sort(render_calls.begin(), render_calls.end(), sortRenderCall);
+	//Upload the models of every group at once
+	if (instance_models.empty())
+		return;
+	RenderBackend::current->uploadBuffer(instances_vbo_id, &instance_models[0], instance_models.size() * sizeof(Matrix44));
 }
 
 //Renders several elements of the scene
@@ -162,6 +463,9 @@ void Renderer::renderScene(Scene* scene, Camera* camera)
 	this->scene = scene;
 	this->camera = camera;
 
+	//Keep the assets under their memory budgets
+	ResourceManager::update();
+
 	//Create render calls vector
 	createRenderCalls();
 
@@ -173,37 +477,82 @@ void Renderer::renderScene(Scene* scene, Camera* camera)
 	if (scene->lights.empty())
 		return;
 
+	//The GL state may have been changed outside of the renderer since the last frame
+	gl_state.invalidate();
+
 	//Set the clear color (the background color)
-	glClearColor(0.0, 0.0, 0.0, 1.0);
+	RenderBackend::current->setClearColor(Vector4(0.0, 0.0, 0.0, 1.0));
 
 	// Clear the window and the depth buffer
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	RenderBackend::current->clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	//Check gl errors before starting
-	checkGLErrors();
+	RenderBackend::current->checkErrors();
+
+	//Use global model for flashlight, the shadow map is seen from it too
+	Matrix44 local_model = scene->main_character->light->model;
+	scene->main_character->light->model = local_model * scene->main_character->model;
 
 	//Compute Shadow Atlas (only spot light are able to cast shadows so far)
 	computeShadowMap();
 
-	//Use global model for flashlight
-	Matrix44 local_model = scene->main_character->light->model;
-	scene->main_character->light->model = local_model * scene->main_character->model;
+	//Lights of the frame
+	uploadLights();
+	buildLightClusters(camera);
+
+	//Cull the render calls and group the repeated ones
+	cullRenderCalls(camera);
+	createDrawBatches(false);
+
+	//Blending support
+	gl_state.setDepthFunc(GL_LEQUAL);
+
+	//Instanced render: one draw call for each group of render calls sharing mesh and material
+	if (!instance_groups.empty())
+	{
+		instanced_shader->enable();
+		setSceneUniforms(instanced_shader);
+		bound_material = NULL;
+		bound_mesh = NULL;
+
+		for (int i = 0; i < instance_groups.size(); i++)
+			renderInstancedDrawCall(instanced_shader, &instance_groups[i]);
+
+		//Unbind the last mesh
+		if (bound_mesh)
+		{
+			bound_mesh->disableInstanceBuffer(instanced_shader);
+			bound_mesh->disableBuffers(instanced_shader);
+		}
+		instanced_shader->disable();
+	}
 
 	//Enable shader
 	scene->shader->enable();
 
+	//Nothing is bound yet
+	bound_material = NULL;
+	bound_mesh = NULL;
+
 	//Entity render
 	setSceneUniforms(scene->shader);
-	for (int i = 0; i < render_calls.size(); i++)
-	{
-		RenderCall* rc = render_calls[i];
-		if (camera->testBoxInFrustum(rc->world_bounding_box->center, rc->world_bounding_box->halfsize))
-			renderDrawCall(scene->shader, rc, camera);
-	}
+	for (int i = 0; i < single_calls.size(); i++)
+		renderDrawCall(scene->shader, single_calls[i], camera);
+
+	//Unbind the last mesh
+	if (bound_mesh)
+		bound_mesh->disableBuffers(scene->shader);
+	bound_mesh = NULL;
+	bound_material = NULL;
 
 	//Disable shader
 	scene->shader->disable();
 
+	//set the render state as it was before to avoid problems with future renders
+	gl_state.setBlend(false);
+	gl_state.setCullFace(true);
+	gl_state.setDepthFunc(GL_LESS);
+
 	//Reset flashlight local model
 	scene->main_character->light->model = local_model;
 
@@ -216,14 +565,14 @@ void Renderer::renderScene(Scene* scene, Camera* camera)
 void Renderer::renderImage(Texture* Image, int w, int h, int x, int y, Vector4 tex_range, Vector4 color, bool flipuv)
 {
 	//Check if there is an image
-	if (!Image)
+	if (!Image || !ResourceManager::use(Image))
 		return;
 
 	//Disable and enable OpenGL flags
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	RenderBackend::current->setDepthTest(false);
+	RenderBackend::current->setCullFace(false);
+	RenderBackend::current->setBlend(true);
+	RenderBackend::current->setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	//Local variables
 	Mesh quad;
@@ -253,9 +602,9 @@ void Renderer::renderImage(Texture* Image, int w, int h, int x, int y, Vector4 t
 	shaderGUI->disable();
 
 	//Reset OpenGL flags
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	glDisable(GL_BLEND);
+	RenderBackend::current->setDepthTest(true);
+	RenderBackend::current->setCullFace(true);
+	RenderBackend::current->setBlend(false);
 
 }
 
@@ -275,12 +624,11 @@ void Renderer::renderSoundSphere(SoundEntity* sound)
 	sphere_model.translate(sound_position.x, sound_position.y, sound_position.z);
 	sphere_model.scale(sound_area, sound_area, sound_area);
 
-	//Set flags
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
-	glFrontFace(GL_CCW);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	//Set flags (the front faces are the default counter clockwise ones)
+	RenderBackend::current->setDepthTest(true);
+	RenderBackend::current->setCullFace(false);
+	RenderBackend::current->setBlend(true);
+	RenderBackend::current->setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	//Enable shader
 	sphere_shader->enable();
@@ -300,12 +648,15 @@ void Renderer::renderSoundSphere(SoundEntity* sound)
 	sphere_shader->disable();
 
 	//Reset flags
-	glEnable(GL_CULL_FACE);
-	glDisable(GL_BLEND);
+	RenderBackend::current->setCullFace(true);
+	RenderBackend::current->setBlend(false);
 }
 
 void Renderer::setSceneUniforms(Shader* shader)
 {
+	//Lights buffer
+	shader->setTexture("u_lights", lights_texture, GL_TEXTURE_BUFFER, LIGHTS_SLOT);
+
 	//Shadow Atlas
 	if (scene->shadow_atlas)
 		shader->setTexture("u_shadow_atlas", scene->shadow_atlas, 8);
@@ -315,7 +666,200 @@ void Renderer::setSceneUniforms(Shader* shader)
 	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
 	shader->setUniform("u_camera_position", camera->eye);
 	shader->setUniform("u_time", (float)getTime());
-	shader->setUniform("u_num_shadows", (float)scene->num_shadows);
+
+	//Light clusters (the buffer textures are always bound so the samplers never alias a 2D texture)
+	shader->setUniform("u_clustered", clusters_ready);
+	shader->setTexture("u_cluster_grid", cluster_grid_texture, GL_TEXTURE_BUFFER, CLUSTER_GRID_SLOT);
+	shader->setTexture("u_cluster_lights", cluster_lights_texture, GL_TEXTURE_BUFFER, CLUSTER_LIGHTS_SLOT);
+	if (clusters_ready)
+	{
+		RenderBackend* backend = RenderBackend::current;
+		shader->setUniform3("u_cluster_dims", CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z);
+		shader->setUniform("u_cluster_depth", cluster_depth);
+		shader->setUniform("u_cluster_viewport", Vector2((float)backend->screen_width, (float)backend->screen_height));
+		shader->setUniform("u_camera_front", camera->getFrontVector());
+	}
+}
+
+//Number of GL state changes needed to bind a material: blend (and blend func), cull and one per texture
+int materialStateChanges(Material* material)
+{
+	int state_changes = 2 + (material->alpha_mode == AlphaMode::BLEND);
+	Sampler* samplers[8] = { &material->albedo_texture, &material->specular_texture, &material->normal_texture, &material->occlusion_texture,
+		&material->metalness_texture, &material->roughness_texture, &material->omr_texture, &material->emissive_texture };
+	for (int i = 0; i < 8; ++i)
+		state_changes += (samplers[i]->texture != NULL);
+	return state_changes;
+}
+
+//Pack the light and shadow data of the frame into the lights buffer, it grows with the number of visible lights
+void Renderer::uploadLights()
+{
+	lights_data.clear();
+	lights_spheres.clear();
+	for (int i = 0; i < scene->lights.size(); ++i)
+	{
+		//Current light
+		LightEntity* light = scene->lights[i];
+
+		//Check the visibility of the light
+		if (!light->visible)
+			continue;
+
+		//Only past the limits of the buffer textures the lights are not drawn
+		if ((int)lights_data.size() == max_lights)
+		{
+			if (!lights_overflowed)
+				cout << "[WARN] more than " << max_lights << " visible lights, the rest are not drawn" << endl;
+			lights_overflowed = true;
+			break;
+		}
+
+		//General light properties
+		sLightData data;
+		data.position = Vector4(light->model.getTranslation(), light->intensity);
+		data.color = Vector4(light->color, light->max_distance);
+		data.direction = Vector4(light->model.rotateVector(Vector3(0, 0, -1)), (float)light->light_type);
+		data.cone = Vector4(light->cone_exp, cos(light->cone_angle * DEG2RAD), 0.0f, 0.0f);
+
+		//Shadow properties
+		if (scene->shadow_atlas && light->cast_shadows && light->shadow_camera && light->shadow_index >= 0)
+		{
+			data.cone.z = 1.0f;
+			data.shadow.x = light->shadow_bias;
+			data.shadow_tile = light->shadow_tile * (1.0f / SHADOW_ATLAS_RESOLUTION);
+			data.shadow_vp = light->shadow_camera->viewprojection_matrix;
+		}
+
+		lights_data.push_back(data);
+
+		//Lit volume, used to assign the light to the clusters
+		Vector3 center;
+		float radius;
+		light->computeBoundingSphere(center, radius);
+		lights_spheres.push_back(Vector4(center, radius));
+	}
+
+	//Upload the buffer (orphaning the previous frame data), an empty buffer texture is incomplete so there is always one light
+	RenderBackend::current->uploadTextureBuffer(lights_tbo, lights_texture, GL_RGBA32F,
+		lights_data.empty() ? NULL : &lights_data[0], max(lights_data.size(), (size_t)1) * sizeof(sLightData), LIGHTS_SLOT);
+}
+
+//Slice of the light clusters that contains a view depth
+static int clusterSlice(float depth, Vector2 cluster_depth)
+{
+	return clamp((int)floor(log(depth) * cluster_depth.x + cluster_depth.y), 0, CLUSTERS_Z - 1);
+}
+
+//Cluster column or row of a point of the view plane (x / depth), scaled by the tangent of the half field of view
+static int clusterTile(float slope, float tan_half_fov, int num_tiles)
+{
+	float ndc = slope / tan_half_fov;
+	return clamp((int)floor((ndc * 0.5f + 0.5f) * num_tiles), 0, num_tiles - 1);
+}
+
+//Assign the visible lights to the clusters of the camera frustum and upload the lists
+void Renderer::buildLightClusters(Camera* camera)
+{
+	int const num_clusters = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+	int const num_lights = lights_data.size();
+	clusters_ready = clustered_lighting && camera->type == Camera::PERSPECTIVE;
+
+	cluster_grid.assign(num_clusters * 2, 0);
+	cluster_lights.clear();
+
+	if (clusters_ready)
+	{
+		//Frustum shape
+		float const near_plane = camera->near_plane;
+		float const far_plane = camera->far_plane;
+		float const tan_y = tan(camera->fov * 0.5f * DEG2RAD);
+		float const tan_x = tan_y * camera->aspect;
+		float const log_depth = log(far_plane / near_plane);
+		cluster_depth.set(CLUSTERS_Z / log_depth, -CLUSTERS_Z * log(near_plane) / log_depth);
+
+		//Cluster range of each light
+		lights_clusters.resize(num_lights * 6);
+		for (int i = 0; i < num_lights; ++i)
+		{
+			int* range = &lights_clusters[i * 6];
+			Vector4& sphere = lights_spheres[i];
+
+			//Directional lights reach every cluster
+			if (sphere.w < 0)
+			{
+				int full_range[6] = { 0, CLUSTERS_X - 1, 0, CLUSTERS_Y - 1, 0, CLUSTERS_Z - 1 };
+				memcpy(range, full_range, sizeof(full_range));
+				continue;
+			}
+
+			//Depth range of the sphere in view space (the camera looks down -Z)
+			Vector3 center = camera->view_matrix * sphere.xyz();
+			float const radius = sphere.w;
+			float min_depth = -center.z - radius;
+			float max_depth = -center.z + radius;
+			if (max_depth < near_plane || min_depth > far_plane)
+			{
+				range[0] = 0; range[1] = -1; //Empty range
+				continue;
+			}
+			min_depth = max(min_depth, near_plane);
+			max_depth = min(max_depth, far_plane);
+
+			//Screen extent of the box around the sphere, the widest projection is at one of the depth bounds
+			float const min_x = center.x - radius, max_x = center.x + radius;
+			float const min_y = center.y - radius, max_y = center.y + radius;
+			range[0] = clusterTile(min(min_x / min_depth, min_x / max_depth), tan_x, CLUSTERS_X);
+			range[1] = clusterTile(max(max_x / min_depth, max_x / max_depth), tan_x, CLUSTERS_X);
+			range[2] = clusterTile(min(min_y / min_depth, min_y / max_depth), tan_y, CLUSTERS_Y);
+			range[3] = clusterTile(max(max_y / min_depth, max_y / max_depth), tan_y, CLUSTERS_Y);
+			range[4] = clusterSlice(min_depth, cluster_depth);
+			range[5] = clusterSlice(max_depth, cluster_depth);
+		}
+
+		//Count the lights of each cluster
+		for (int i = 0; i < num_lights; ++i)
+		{
+			int* range = &lights_clusters[i * 6];
+			for (int z = range[4]; z <= range[5]; ++z)
+				for (int y = range[2]; y <= range[3]; ++y)
+					for (int x = range[0]; x <= range[1]; ++x)
+						cluster_grid[(x + CLUSTERS_X * (y + CLUSTERS_Y * z)) * 2 + 1]++;
+		}
+
+		//Offsets of the lists
+		unsigned int offset = 0;
+		for (int i = 0; i < num_clusters; ++i)
+		{
+			cluster_grid[i * 2] = offset;
+			offset += cluster_grid[i * 2 + 1];
+			cluster_grid[i * 2 + 1] = 0;
+		}
+		cluster_lights.resize(offset);
+
+		//Fill the lists
+		for (int i = 0; i < num_lights; ++i)
+		{
+			int* range = &lights_clusters[i * 6];
+			for (int z = range[4]; z <= range[5]; ++z)
+				for (int y = range[2]; y <= range[3]; ++y)
+					for (int x = range[0]; x <= range[1]; ++x)
+					{
+						unsigned int* cluster = &cluster_grid[(x + CLUSTERS_X * (y + CLUSTERS_Y * z)) * 2];
+						cluster_lights[cluster[0] + cluster[1]++] = i;
+					}
+		}
+	}
+
+	//An empty buffer texture is incomplete, so there is always at least one index
+	if (cluster_lights.empty())
+		cluster_lights.push_back(0);
+
+	//Upload the grid and the lists as buffer textures
+	RenderBackend::current->uploadTextureBuffer(cluster_grid_tbo, cluster_grid_texture, GL_RG32UI,
+		&cluster_grid[0], cluster_grid.size() * sizeof(unsigned int), CLUSTER_GRID_SLOT);
+	RenderBackend::current->uploadTextureBuffer(cluster_lights_tbo, cluster_lights_texture, GL_R16UI,
+		&cluster_lights[0], cluster_lights.size() * sizeof(unsigned short), CLUSTER_LIGHTS_SLOT);
 }
 
 //Render a draw call
@@ -324,23 +868,84 @@ void Renderer::renderDrawCall(Shader* shader, RenderCall* rc, Camera* camera)
 	//In case there is nothing to do
 	if (!rc->mesh || !rc->mesh->getNumVertices() || !rc->material)
 		return;
-	assert(glGetError() == GL_NO_ERROR);
+	assert(RenderBackend::current->checkErrors());
+
+	//Binding everything on every draw would cost the material state plus the vertex buffers
+	num_state_changes_unsorted += materialStateChanges(rc->material) + 1;
+
+	//Material state: consecutive calls with the same material keep it bound
+	if (rc->material != bound_material)
+		bindMaterial(shader, rc->material);
+
+	//Vertex buffers: consecutive calls with the same mesh keep them enabled
+	if (rc->mesh != bound_mesh)
+	{
+		if (bound_mesh) bound_mesh->disableBuffers(shader);
+		rc->mesh->enableBuffers(shader);
+		bound_mesh = rc->mesh;
+		num_state_changes++;
+	}
+
+	//Upload entity uniforms
+	shader->setMatrix44("u_model", rc->model);
+
+	//Single pass lighting
+	SinglePassLoop(shader, rc->mesh, 0, rc->lod);
+}
+
+//Render all the instances of a group with one draw call
+void Renderer::renderInstancedDrawCall(Shader* shader, InstanceGroup* group)
+{
+	//In case there is nothing to do
+	if (!group->mesh->getNumVertices())
+		return;
 
+	//Binding everything on every draw would cost the material state plus the vertex buffers of each instance
+	num_state_changes_unsorted += (materialStateChanges(group->material) + 1) * group->num_instances;
+
+	//Material state
+	if (group->material != bound_material)
+		bindMaterial(shader, group->material);
+
+	//Vertex buffers
+	if (group->mesh != bound_mesh)
+	{
+		if (bound_mesh)
+		{
+			bound_mesh->disableInstanceBuffer(shader);
+			bound_mesh->disableBuffers(shader);
+		}
+		group->mesh->enableBuffers(shader);
+		bound_mesh = group->mesh;
+		num_state_changes++;
+	}
+
+	//Models of this group inside the instances buffer
+	if (!group->mesh->enableInstanceBuffer(shader, instances_vbo_id, group->first_instance))
+		return;
+
+	//Single pass lighting
+	SinglePassLoop(shader, group->mesh, group->num_instances, group->lod);
+}
+
+//Bind the material state of a draw call
+void Renderer::bindMaterial(Shader* shader, Material* material)
+{
 	//Material factors
-	Vector3 albedo_factor = rc->material->albedo_factor;
-	Vector3 specular_factor = rc->material->specular_factor;
-	Vector3 occlusion_factor = rc->material->occlusion_factor;
-	Vector3 emissive_factor = rc->material->emissive_factor;
+	Vector3 albedo_factor = material->albedo_factor;
+	Vector3 specular_factor = material->specular_factor;
+	Vector3 occlusion_factor = material->occlusion_factor;
+	Vector3 emissive_factor = material->emissive_factor;
 
 	//Textures
-	Texture* albedo_texture = rc->material->albedo_texture.texture;
-	Texture* specular_texture = rc->material->specular_texture.texture;
-	Texture* normal_texture = rc->material->normal_texture.texture;
-	Texture* occlusion_texture = rc->material->occlusion_texture.texture;
-	Texture* metalness_texture = rc->material->metalness_texture.texture;
-	Texture* roughness_texture = rc->material->roughness_texture.texture;
-	Texture* omr_texture = rc->material->omr_texture.texture;
-	Texture* emissive_texture = rc->material->emissive_texture.texture;
+	Texture* albedo_texture = material->albedo_texture.texture;
+	Texture* specular_texture = material->specular_texture.texture;
+	Texture* normal_texture = material->normal_texture.texture;
+	Texture* occlusion_texture = material->occlusion_texture.texture;
+	Texture* metalness_texture = material->metalness_texture.texture;
+	Texture* roughness_texture = material->roughness_texture.texture;
+	Texture* omr_texture = material->omr_texture.texture;
+	Texture* emissive_texture = material->emissive_texture.texture;
 
 	//Texture booleans: Controls which texture are uploaded to the shader
 	int textures[8] =
@@ -356,22 +961,19 @@ void Renderer::renderDrawCall(Shader* shader, RenderCall* rc, Camera* camera)
 	};
 
 	//Select the blending mode
-	if (rc->material->alpha_mode == AlphaMode::BLEND)
+	if (material->alpha_mode == AlphaMode::BLEND)
 	{
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state.setBlend(true);
+		gl_state.setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	}
 	else
-		glDisable(GL_BLEND);
+		gl_state.setBlend(false);
 
 	//Select whether to render both sides of the triangles
-	if (rc->material->two_sided)
-		glDisable(GL_CULL_FACE);
-	else
-		glEnable(GL_CULL_FACE);
+	gl_state.setCullFace(!material->two_sided);
 
 	//Check gl errors
-	assert(glGetError() == GL_NO_ERROR);
+	assert(RenderBackend::current->checkErrors());
 
 	//Upload material factors
 	shader->setVector3("u_albedo_factor", albedo_factor);
@@ -392,220 +994,74 @@ void Renderer::renderDrawCall(Shader* shader, RenderCall* rc, Camera* camera)
 	//Upload the texture array of booleans
 	shader->setUniform1Array("u_textures", (int*)&textures[0], 8);
 
-	//Upload entity uniforms
-	shader->setMatrix44("u_model", rc->model);
-	shader->setUniform("u_color", rc->material->albedo_factor);
-	shader->setUniform("u_alpha_cutoff", rc->material->alpha_mode == AlphaMode::MASK ? rc->material->alpha_cutoff : 0); //this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
+	//Upload material uniforms
+	shader->setUniform("u_color", material->albedo_factor);
+	shader->setUniform("u_alpha_cutoff", material->alpha_mode == AlphaMode::MASK ? material->alpha_cutoff : 0); //this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
 
-	//Single pass lighting
-	SinglePassLoop(shader, rc->mesh);
+	num_state_changes += materialStateChanges(material);
+	bound_material = material;
 }
 
 //Singlepass lighting
-void Renderer::SinglePassLoop(Shader* shader, Mesh* mesh)
+void Renderer::SinglePassLoop(Shader* shader, Mesh* mesh, int num_instances, int lod)
 {
-	//Blending support
-	glDepthFunc(GL_LEQUAL);
-
-	//Loop variables
-	int const lights_size = scene->lights.size();
-	int const max_num_lights = 5; //Single pass lighting accepts at most 5 lights
+	//Loop variables: the light data is already in the lights buffer, each pass only says which lights to use
+	int const num_lights = lights_data.size();
+	int const lights_per_pass = clusters_ready ? max(num_lights, 1) : max(max_lights_per_pass, 1); //The clusters already limit the lights of each fragment
 	int starting_light = 0;
-	int final_light = min(max_num_lights - 1, lights_size - 1);
-
-	//Lights properties vectors
-	std::vector<Vector3> lights_position;
-	std::vector<Vector3> lights_color;
-	std::vector<float> lights_intensity;
-	std::vector<float> lights_max_distance;
-	std::vector<int> lights_type;
-
-	//Spot lights vectors
-	std::vector<Vector3> spots_direction;
-	std::vector<Vector2> spots_cone;
-
-	//Directional lights vectors
-	std::vector<Vector3> directionals_front;
-
-	//Shadows vectors
-	std::vector<int> cast_shadows;
-	std::vector<float> shadows_index;
-	std::vector<float> shadows_bias;
-	std::vector<Matrix44> shadows_vp;
-
-	//Reserve memory
-	lights_position.reserve(max_num_lights);
-	lights_color.reserve(max_num_lights);
-	lights_intensity.reserve(max_num_lights);
-	lights_max_distance.reserve(max_num_lights);
-	lights_type.reserve(max_num_lights);
-	spots_direction.reserve(max_num_lights);
-	spots_cone.reserve(max_num_lights);
-	directionals_front.reserve(max_num_lights);
-	cast_shadows.reserve(max_num_lights);
-	shadows_index.reserve(max_num_lights);
-	shadows_bias.reserve(max_num_lights);
-	shadows_vp.reserve(max_num_lights);
 
-	//Single pass lighting
-	while (starting_light < lights_size)
+	//Single pass lighting (at least one pass, for the ambient and emissive light)
+	do
 	{
-		if (starting_light == 5)
+		if (starting_light == lights_per_pass)
 		{
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+			gl_state.setBlend(true);
+			gl_state.setBlendFunc(GL_SRC_ALPHA, GL_ONE);
 			shader->setUniform("u_ambient_light", Vector3());
 		}
-		if (final_light == lights_size - 1) shader->setUniform("u_last_iteration", 1);
-		else shader->setUniform("u_last_iteration", 0);
-
-		//Support variables
-		int num_lights = final_light - starting_light + 1;
-		int j = 0;
-
-		for (int i = starting_light; i <= final_light; i++)
-		{
-			//Current Light
-			LightEntity* light = scene->lights[i];
-
-			//Check the visibility of the light
-			if (!light->visible)
-				continue;
-
-			//General light properties
-			lights_position[j] = light->model.getTranslation();
-			lights_color[j] = light->color;
-			lights_intensity[j] = light->intensity;
-			lights_max_distance[j] = light->max_distance;
-
-			//Specific light properties
-			switch (light->light_type)
-			{
-			case(LightEntity::LightType::POINT_LIGHT):
-				lights_type[j] = light->light_type;
-				break;
-			case (LightEntity::LightType::SPOT_LIGHT):
-				spots_direction[j] = light->model.rotateVector(Vector3(0, 0, -1));
-				spots_cone[j] = Vector2(light->cone_exp, cos(light->cone_angle * DEG2RAD));
-				lights_type[j] = light->light_type;
-				break;
-			case (LightEntity::LightType::DIRECTIONAL_LIGHT):
-				directionals_front[j] = light->model.rotateVector(Vector3(0, 0, -1));
-				lights_type[j] = light->light_type;
-				break;
-			}
-
-			//Shadow properties
-			if (scene->shadow_atlas && light->cast_shadows)
-			{
-				cast_shadows[j] = 1;
-				shadows_index[j] = (float)light->shadow_index;
-				shadows_bias[j] = light->shadow_bias;
-				shadows_vp[j] = light->shadow_camera->viewprojection_matrix;
-			}
-			else
-			{
-				cast_shadows[j] = 0;
-			}
-
-			//Update iterator
-			j++;
-		}
+		shader->setUniform("u_last_iteration", starting_light + lights_per_pass >= num_lights ? 1 : 0);
 
 		//Upload light uniforms
-		shader->setUniform3Array("u_lights_position", (float*)&lights_position[0], num_lights);
-		shader->setUniform3Array("u_lights_color", (float*)&lights_color[0], num_lights);
-		shader->setUniform1Array("u_lights_intensity", &lights_intensity[0], num_lights);
-		shader->setUniform1Array("u_lights_max_distance", &lights_max_distance[0], num_lights);
-		shader->setUniform1Array("u_lights_type", &lights_type[0], num_lights);
-		shader->setUniform3Array("u_spots_direction", (float*)&spots_direction[0], num_lights);
-		shader->setUniform2Array("u_spots_cone", (float*)&spots_cone[0], num_lights);
-		shader->setUniform3Array("u_directionals_front", (float*)&directionals_front[0], num_lights);
-		shader->setUniform("u_num_lights", num_lights);
-
-		//Upload shadow uniforms
-		shader->setUniform1Array("u_cast_shadows", &cast_shadows[0], num_lights);
-		shader->setUniform1Array("u_shadows_index", &shadows_index[0], num_lights);
-		shader->setUniform1Array("u_shadows_bias", &shadows_bias[0], num_lights);
-		shader->setMatrix44Array("u_shadows_vp", &shadows_vp[0], num_lights);
+		shader->setUniform("u_lights_offset", starting_light);
+		shader->setUniform("u_num_lights", min(lights_per_pass, num_lights - starting_light));
 
 		//do the draw call that renders the mesh into the screen
-		mesh->render(GL_TRIANGLES);
+		mesh->drawCall(GL_TRIANGLES, -1, num_instances, lod);
 
 		//Update variables
-		starting_light = final_light + 1;
-		final_light = min(max_num_lights + final_light, lights_size - 1);
+		starting_light += lights_per_pass;
 
-	}
+	} while (starting_light < num_lights);
 
-	//set the render state as it was before to avoid problems with future renders
-	glDisable(GL_BLEND);
-	glDepthFunc(GL_LESS);
+	//The additive passes changed the blending and the ambient light, so the next draw call has to bind its material again
+	if (num_lights > lights_per_pass)
+	{
+		shader->setVector3("u_ambient_light", scene->ambient_light);
+		bound_material = NULL;
+	}
 }
 
 //Multipass lighting
 void Renderer::MultiPassLoop(Shader* shader, Mesh* mesh)
 {
 	//Blending support
-	glDepthFunc(GL_LEQUAL);
+	RenderBackend::current->setDepthFunc(GL_LEQUAL);
 
 	//Multi pass lighting
-	for (int i = 0; i < scene->lights.size(); i++) {
+	for (int i = 0; i < lights_data.size(); i++) {
 
 		if (i == 0) shader->setUniform("u_last_iteration", 0);
 
 		if (i == 1)
 		{
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+			RenderBackend::current->setBlend(true);
+			RenderBackend::current->setBlendFunc(GL_SRC_ALPHA, GL_ONE);
 			shader->setUniform("u_ambient_light", Vector3());//reset the ambient light
 		}
-		if (i == scene->lights.size() - 1) shader->setUniform("u_last_iteration", 1);
-
-		//Current light
-		LightEntity* light = scene->lights[i];
-
-		//Check the visibility of the light
-		if (!light->visible)
-			continue;			
-
-		//Light uniforms
-		shader->setUniform("u_light_position", light->model.getTranslation());
-		shader->setUniform("u_light_color", light->color);
-		shader->setUniform("u_light_intensity", light->intensity);
-		shader->setUniform("u_light_max_distance", light->max_distance);
-
-		//Specific light uniforms
-		switch (light->light_type)
-		{
-		case(LightEntity::LightType::POINT_LIGHT):
-			shader->setUniform("u_light_type", 0);
-			break;
-		case (LightEntity::LightType::SPOT_LIGHT):
-			shader->setVector3("u_spot_direction", light->model.rotateVector(Vector3(0, 0, -1)));
-			shader->setUniform("u_spot_cone", Vector2(light->cone_exp, cos(light->cone_angle * DEG2RAD)));
-			shader->setUniform("u_light_type", 1);
-			break;
-		case (LightEntity::LightType::DIRECTIONAL_LIGHT):
-			shader->setVector3("u_directional_front", light->model.rotateVector(Vector3(0, 0, -1)));
-			shader->setUniform("u_area_size", light->area_size);
-			shader->setUniform("u_light_type", 2);
-			break;
-		}
+		if (i == lights_data.size() - 1) shader->setUniform("u_last_iteration", 1);
 
-		//Shadow uniforms
-		if (scene->shadow_atlas && light->cast_shadows)
-		{
-			shader->setUniform("u_cast_shadows", 1);
-			shader->setUniform("u_shadow_index", (float)light->shadow_index);
-			shader->setUniform("u_shadow_bias", light->shadow_bias);
-			shader->setMatrix44("u_shadow_vp", light->shadow_camera->viewprojection_matrix);
-			shader->setUniform("u_num_shadows", (float)scene->num_shadows);
-		}
-		else
-		{
-			shader->setUniform("u_cast_shadows", 0);
-		}
+		//Light inside the lights buffer
+		shader->setUniform("u_light_index", i);
 
 		//do the draw call that renders the mesh into the screen
 		mesh->render(GL_TRIANGLES);
@@ -615,8 +1071,8 @@ void Renderer::MultiPassLoop(Shader* shader, Mesh* mesh)
 	shader->disable();
 
 	//set the render state as it was before to avoid problems with future renders
-	glDisable(GL_BLEND);
-	glDepthFunc(GL_LESS);
+	RenderBackend::current->setBlend(false);
+	RenderBackend::current->setDepthFunc(GL_LESS);
 }
 
 //Render basic draw call
@@ -625,19 +1081,18 @@ void Renderer::renderDepthMap(RenderCall* rc, Camera* light_camera)
 	//In case there is nothing to do
 	if (!rc->mesh || !rc->mesh->getNumVertices() || !rc->material)
 		return;
-	assert(glGetError() == GL_NO_ERROR);
+	assert(RenderBackend::current->checkErrors());
 
 	//Define locals to simplify coding
 	Shader* shader = NULL;
 
 	//Select whether to render both sides of the triangles
-	if (rc->material->two_sided) glDisable(GL_CULL_FACE);
-	else glEnable(GL_CULL_FACE);
-	assert(glGetError() == GL_NO_ERROR);
+	gl_state.setCullFace(!rc->material->two_sided);
+	assert(RenderBackend::current->checkErrors());
 
 	//chose a shader
 	shader = Shader::Get("data/shaders/depth.vs", "data/shaders/color.fs");
-	assert(glGetError() == GL_NO_ERROR);
+	assert(RenderBackend::current->checkErrors());
 
 	//no shader? then nothing to render
 	if (!shader)
@@ -650,11 +1105,40 @@ void Renderer::renderDepthMap(RenderCall* rc, Camera* light_camera)
 	shader->setUniform("u_alpha_cutoff", rc->material->alpha_mode == AlphaMode::MASK ? rc->material->alpha_cutoff : 0); //this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
 
 	//Disable blending
-	glDepthFunc(GL_LESS);
-	glDisable(GL_BLEND);
+	gl_state.setDepthFunc(GL_LESS);
+	gl_state.setBlend(false);
 
-	//do the draw call that renders the mesh into the screen
-	rc->mesh->render(GL_TRIANGLES);
+	//do the draw call that renders the mesh into the depth map, usually with a coarser level of detail
+	rc->mesh->render(GL_TRIANGLES, -1, 0, getShadowLod(rc));
+
+	//disable shader
+	shader->disable();
+}
+
+//Render all the instances of a group into the depth map with one draw call
+void Renderer::renderDepthMapInstanced(InstanceGroup* group, Camera* light_camera)
+{
+	//In case there is nothing to do
+	if (!group->mesh->getNumVertices())
+		return;
+	assert(RenderBackend::current->checkErrors());
+
+	//Select whether to render both sides of the triangles
+	gl_state.setCullFace(!group->material->two_sided);
+
+	//The shader takes the model of each instance from the instances buffer
+	Shader* shader = depth_instanced_shader;
+	shader->enable();
+
+	//Upload scene uniforms
+	shader->setUniform("u_viewprojection", light_camera->viewprojection_matrix);
+
+	//Disable blending
+	gl_state.setDepthFunc(GL_LESS);
+	gl_state.setBlend(false);
+
+	//do the draw call that renders every instance into the depth map
+	group->mesh->renderInstanced(GL_TRIANGLES, instances_vbo_id, group->first_instance, group->num_instances, group->lod);
 
 	//disable shader
 	shader->disable();
@@ -663,49 +1147,176 @@ void Renderer::renderDepthMap(RenderCall* rc, Camera* light_camera)
 //Create a shadow atlas
 void Renderer::createShadowAtlas()
 {
-	//Compute the number of shadows of the scene and the shadow index of each light
-	int shadow_index = 0;
+	//The atlas has a fixed size, the tiles are what changes
+	if (scene->fbo)
+		return;
+
+	//New shadow atlas
+	scene->fbo = new FBO();
+	scene->fbo->setDepthOnly(SHADOW_ATLAS_RESOLUTION, SHADOW_ATLAS_RESOLUTION);
+	scene->shadow_atlas = scene->fbo->depth_texture;
+
+	//Cache of the static casters, with the same layout as the atlas
+	static_shadow_fbo = new FBO();
+	static_shadow_fbo->setDepthOnly(SHADOW_ATLAS_RESOLUTION, SHADOW_ATLAS_RESOLUTION);
+}
+
+//Shadow map resolution a light deserves: the fraction of the screen height covered by its lit volume
+static float shadowCoverageResolution(LightEntity* light, Camera* camera)
+{
+	Vector3 center;
+	float radius;
+	light->computeBoundingSphere(center, radius);
+
+	float distance = camera->eye.distance(center);
+	if (radius < 0 || distance <= radius)
+		return SHADOW_MAP_RESOLUTION;
+
+	float coverage = radius / (distance * tan(camera->fov * 0.5f * DEG2RAD));
+	return coverage * SHADOW_MAP_RESOLUTION;
+}
+
+//Position of a cell given its index along a Z-order curve
+static void mortonDecode(unsigned int index, int& x, int& y)
+{
+	x = y = 0;
+	for (int bit = 0; bit < 16; ++bit)
+	{
+		x |= ((index >> (2 * bit)) & 1) << bit;
+		y |= ((index >> (2 * bit + 1)) & 1) << bit;
+	}
+}
+
+//Assign a tile of the atlas to each shadow casting light, sized by its screen coverage
+void Renderer::packShadowAtlas()
+{
+	//Tile size of every visible shadow casting light
+	bool repack = false;
+	shadow_requests.clear();
 	for (int i = 0; i < scene->lights.size(); i++)
 	{
 		LightEntity* light = scene->lights[i];
-		if (light->cast_shadows)
-		{
-			//Assign a shadow slot for shadow atlas
-			light->shadow_index = shadow_index;
+		if (!light->cast_shadows || !light->visible)
+			continue;
+
+		//Power of two tiles, a tile only shrinks when the light clearly needs less (avoids repacking back and forth)
+		//The request is compared with the former request, not with the granted tile, which is smaller when the atlas is full
+		float resolution = shadowCoverageResolution(light, camera);
+		int size = MIN_SHADOW_MAP_RESOLUTION;
+		while (size < resolution && size < SHADOW_MAP_RESOLUTION)
+			size *= 2;
+		int requested_size = light->shadow_requested_size;
+		if (requested_size && size < requested_size && resolution > requested_size * 0.4f)
+			size = requested_size;
+
+		repack |= (size != requested_size);
+		light->shadow_requested_size = size;
+		shadow_requests.push_back(light);
+	}
+
+	//Lights added or removed since the last packing
+	if (!repack && shadow_requests == shadow_lights)
+		return;
 
-			//Update
-			scene->num_shadows++;
-			shadow_index++;
+	if (!shadow_requests.empty())
+		createShadowAtlas();
+
+	//Start from the requested sizes
+	for (int i = 0; i < shadow_requests.size(); i++)
+		shadow_requests[i]->shadow_tile.z = shadow_requests[i]->shadow_requested_size;
+
+	//The biggest tiles go first, so the cursor along the Z-order curve is always aligned to the next tile
+	stable_sort(shadow_requests.begin(), shadow_requests.end(), [](LightEntity* a, LightEntity* b) { return a->shadow_tile.z > b->shadow_tile.z; });
+
+	//Lower the resolution of the biggest tiles until everything fits
+	int const atlas_cells = (SHADOW_ATLAS_RESOLUTION / MIN_SHADOW_MAP_RESOLUTION) * (SHADOW_ATLAS_RESOLUTION / MIN_SHADOW_MAP_RESOLUTION);
+	while (true)
+	{
+		int used_cells = 0;
+		for (int i = 0; i < shadow_requests.size(); i++)
+		{
+			int side = shadow_requests[i]->shadow_tile.z / MIN_SHADOW_MAP_RESOLUTION;
+			used_cells += side * side;
 		}
+		if (used_cells <= atlas_cells || shadow_requests[0]->shadow_tile.z == MIN_SHADOW_MAP_RESOLUTION)
+			break;
+
+		int biggest = shadow_requests[0]->shadow_tile.z;
+		for (int i = 0; i < shadow_requests.size() && shadow_requests[i]->shadow_tile.z == biggest; i++)
+			shadow_requests[i]->shadow_tile.z /= 2;
 	}
 
-	//Delete the former atlas and continue
-	if (scene->fbo)
+	//Forget the former tiles
+	for (int i = 0; i < scene->lights.size(); i++)
+		scene->lights[i]->shadow_index = -1;
+
+	//Place the tiles
+	unsigned int cursor = 0;
+	bool atlas_full = false;
+	for (int i = 0; i < shadow_requests.size(); i++)
 	{
-		delete scene->fbo;
-		scene->fbo = NULL;
-		scene->shadow_atlas = NULL;
+		LightEntity* light = shadow_requests[i];
+		int size = light->shadow_tile.z;
+		int side = size / MIN_SHADOW_MAP_RESOLUTION;
+		if (cursor + side * side > atlas_cells)
+		{
+			if (!shadow_atlas_full)
+				cout << "ERROR: The shadow atlas is full, " << light->name << " won't cast shadows" << endl;
+			atlas_full = true;
+			light->shadow_tile = Vector4();
+			continue;
+		}
 
-		if (scene->num_shadows == 0)
-			return;
+		int x, y;
+		mortonDecode(cursor, x, y);
+		cursor += side * side;
 
+		Vector4 tile(x * MIN_SHADOW_MAP_RESOLUTION, y * MIN_SHADOW_MAP_RESOLUTION, size, size);
+		if (tile.x != light->shadow_tile.x || tile.y != light->shadow_tile.y || tile.w != light->shadow_tile.w)
+			light->shadow_dirty = true;
+		light->shadow_tile = tile;
 	}
+	shadow_atlas_full = atlas_full;
 
-	//New shadow atlas
-	scene->fbo = new FBO();
-	scene->fbo->setDepthOnly(SHADOW_MAP_RESOLUTION * scene->num_shadows, SHADOW_MAP_RESOLUTION); //We create it wide in order to save memory space and improve shadow map management
-	scene->shadow_atlas = scene->fbo->depth_texture;
+	//Order of the tiles for the debug view
+	shadow_lights.clear();
+	scene->num_shadows = 0;
+	for (int i = 0; i < scene->lights.size(); i++)
+	{
+		LightEntity* light = scene->lights[i];
+		if (!light->cast_shadows || !light->visible)
+			continue;
+		if (light->shadow_tile.z > 0)
+			light->shadow_index = scene->num_shadows++;
+		shadow_lights.push_back(light);
+	}
 }
 
 //Compute spot shadow maps into the shadow atlas
 void Renderer::computeShadowMap()
 {
+	//Assign the atlas tiles
+	packShadowAtlas();
+
 	//Compute Shadow Atlas
 	if (!scene->fbo || !scene->shadow_atlas)
 		return;
 
+	//Shadow pass GPU time: the query of the previous frame is read if it is ready, so the pipeline never stalls
+	RenderBackend* backend = RenderBackend::current;
+	if (!shadow_queries[0])
+		backend->createQueries(2, shadow_queries);
+	uint64_t elapsed_time;
+	if (shadow_query_frame > 0 && backend->getTimerResult(shadow_queries[(shadow_query_frame + 1) % 2], elapsed_time))
+		shadow_pass_ms = elapsed_time / 1000000.0f;
+	backend->beginTimer(shadow_queries[shadow_query_frame % 2]);
+	shadow_query_frame++;
+
+	num_shadow_updates = 0;
+	num_shadow_cached = 0;
+
 	//Boost performance
-	glColorMask(false, false, false, false);
+	backend->setColorMask(false);
 	//Bind the fbo
 	scene->fbo->bind();
 
@@ -715,26 +1326,22 @@ void Renderer::computeShadowMap()
 		//Current light
 		LightEntity* light = scene->lights[i];
 
+		//Only the visible lights that cast shadows and got a tile need a shadow map
+		if (!light->cast_shadows || !light->visible || light->shadow_index < 0)
+			continue;
+
 		//For the first render
 		if (!light->shadow_camera) light->shadow_camera = new Camera();
 
 		//Set the atlas region of the shadow map to work on
-		Vector4 shadow_region(light->shadow_index * SHADOW_MAP_RESOLUTION, 0, SHADOW_MAP_RESOLUTION, SHADOW_MAP_RESOLUTION);
-
-		//Activate flags on the shadow region
-		glViewport(shadow_region.x, shadow_region.y, shadow_region.z, shadow_region.w);
-		glScissor(shadow_region.x, shadow_region.y, shadow_region.z, shadow_region.w);
-		glEnable(GL_SCISSOR_TEST);
-
-		//Clear Depth Buffer on the shadow region
-		glClear(GL_DEPTH_BUFFER_BIT);
+		Vector4 shadow_region = light->shadow_tile;
 
 		//Light camera
 		Camera* shadow_camera = light->shadow_camera;
 
 		//Camera properties
 		float camera_fov = 2 * light->cone_angle;
-		float camera_aspect = SHADOW_MAP_RESOLUTION / SHADOW_MAP_RESOLUTION;
+		float camera_aspect = shadow_region.z / shadow_region.w;
 		float camera_near = 0.1f;
 		float camera_far = light->max_distance;
 		Vector3 camera_position = light->model.getTranslation();
@@ -744,34 +1351,78 @@ void Renderer::computeShadowMap()
 		//Set Perspective Matrix
 		shadow_camera->setPerspective(camera_fov, camera_aspect, camera_near, camera_far);
 
-		//Set View Matrix
+		//Set View Matrix (the shaders get the matrices as uniforms, it isn't enabled)
 		shadow_camera->lookAt(camera_position, camera_front, camera_up);
 
-		//Enable camera
-		shadow_camera->enable();
+		//Static casters: the cached shadow map is redrawn only if the light or one of its casters changed
+		uint64_t signature = cullShadowCasters(light, false);
+		if (signature != light->shadow_signature)
+		{
+			light->shadow_signature = signature;
+			light->shadow_dirty = true;
+		}
+
+		//Activate flags on the shadow region
+		gl_state.setViewport(shadow_region.x, shadow_region.y, shadow_region.z, shadow_region.w);
+		gl_state.setScissor(shadow_region.x, shadow_region.y, shadow_region.z, shadow_region.w);
+		gl_state.setScissorTest(true);
 
-		for (int i = 0; i < render_calls.size(); ++i)
+		if (light->shadow_dirty)
 		{
-			RenderCall* rc = render_calls[i];
-			if (rc->material->alpha_mode == AlphaMode::BLEND)
-				continue;
-			if (shadow_camera->testBoxInFrustum(rc->world_bounding_box->center, rc->world_bounding_box->halfsize))
-			{
-				renderDepthMap(rc, shadow_camera);
-			}
+			//Render the static casters into the cache
+			backend->bindFramebuffer(static_shadow_fbo);
+			backend->clear(GL_DEPTH_BUFFER_BIT);
+			createDrawBatches(true);
+
+			for (int j = 0; j < instance_groups.size(); ++j)
+				renderDepthMapInstanced(&instance_groups[j], shadow_camera);
+
+			for (int j = 0; j < single_calls.size(); ++j)
+				renderDepthMap(single_calls[j], shadow_camera);
+
+			backend->bindFramebuffer(scene->fbo);
+			num_shadow_updates++;
 		}
 
+		//Dynamic casters
+		cullShadowCasters(light, true);
+		bool has_dynamic = !visible_calls.empty();
+
+		//Nothing changed since the last frame: the atlas region already has the right shadow map
+		if (!light->shadow_dirty && !has_dynamic && !light->shadow_has_dynamic)
+		{
+			num_shadow_cached++;
+			continue;
+		}
+
+		//Copy the cached static casters into the atlas region
+		backend->blitDepth(static_shadow_fbo, scene->fbo, shadow_region.x, shadow_region.y, shadow_region.z, shadow_region.w);
+
+		//Render the dynamic casters over them
+		if (has_dynamic)
+		{
+			createDrawBatches(true);
+
+			for (int j = 0; j < instance_groups.size(); ++j)
+				renderDepthMapInstanced(&instance_groups[j], shadow_camera);
+
+			for (int j = 0; j < single_calls.size(); ++j)
+				renderDepthMap(single_calls[j], shadow_camera);
+		}
+
+		light->shadow_dirty = false;
+		light->shadow_has_dynamic = has_dynamic;
 	}
 
 	//Unbind the fbo
 	scene->fbo->unbind();
 
 	//Reset
-	Game* game = Game::instance;
-	glViewport(0, 0, game->window_width, game->window_height);
-	glColorMask(true, true, true, true);
-	glDisable(GL_SCISSOR_TEST);
+	gl_state.setViewport(0, 0, backend->screen_width, backend->screen_height);
+	backend->setColorMask(true);
+	gl_state.setScissorTest(false);
 
+	backend->endTimer();
 }
 
 //Print shadow map in the screen
@@ -797,21 +1448,20 @@ void Renderer::showShadowAtlas()
 	{
 		//Current light
 		LightEntity* light = scene->lights[i];
-		if (light->cast_shadows)
+		if (light->cast_shadows && light->shadow_index >= 0 && light->shadow_camera)
 		{
 			//Only render if lights are in the right scope
 			if (starting_shadow <= light->shadow_index && light->shadow_index < final_shadow)
 			{
 
 				//Map shadow map into screen coordinates
-				glViewport((light->shadow_index - starting_shadow) * SHOW_ATLAS_RESOLUTION + shadow_offset, 0, SHOW_ATLAS_RESOLUTION, SHOW_ATLAS_RESOLUTION);
+				RenderBackend::current->setViewport((light->shadow_index - starting_shadow) * SHOW_ATLAS_RESOLUTION + shadow_offset, 0, SHOW_ATLAS_RESOLUTION, SHOW_ATLAS_RESOLUTION);
 
 				//Render the shadow map with the linearized shader
 				Shader* shader = Shader::Get("quad.vs", "linearize.fs");
 				shader->enable();
 				shader->setUniform("u_camera_nearfar", Vector2(light->shadow_camera->near_plane, light->shadow_camera->far_plane));
-				shader->setUniform("u_shadow_index", (float)light->shadow_index);
-				shader->setUniform("u_num_shadows", (float)num_shadows);
+				shader->setUniform("u_shadow_tile", light->shadow_tile * (1.0f / SHADOW_ATLAS_RESOLUTION));
 				scene->shadow_atlas->toViewport(shader);
 				shader->disable();
 			}
@@ -822,7 +1472,7 @@ void Renderer::showShadowAtlas()
 	scene->atlas_scope = shadow_scope;
 
 	//Reset
-	glViewport(0, 0, window_width, window_height);
+	RenderBackend::current->setViewport(0, 0, window_width, window_height);
 
 }
 
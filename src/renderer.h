@@ -6,6 +6,8 @@
 #include "scene.h"
 #include "fbo.h"
 #include <algorithm>
+#include <iostream>
+#include <cstdint>
 
 
 struct RenderCall {
@@ -14,18 +16,104 @@ struct RenderCall {
 	Matrix44 model;
 	BoundingBox* world_bounding_box;
 	float distance_to_camera;
+	bool is_dynamic; //Moves every frame, so it is never kept in the cached shadow maps
+	int lod; //Level of detail of the mesh for the main camera
 
-	RenderCall() { distance_to_camera = 10.0f;}
-	RenderCall(Mesh* mesh, Material* material, Matrix44 model, BoundingBox* world_bounding_box, Camera* camera) 
+	RenderCall() { distance_to_camera = 10.0f; is_dynamic = false; lod = 0; }
+	RenderCall(Mesh* mesh, Material* material, Matrix44 model, BoundingBox* world_bounding_box, Camera* camera, bool is_dynamic = false, int lod = 0) 
 	{
 			this->mesh = mesh;
 			this->material = material;
 			this->model = model;
 			this->world_bounding_box = world_bounding_box;
 			this->distance_to_camera = world_bounding_box->center.distance(camera->center);
+			this->is_dynamic = is_dynamic;
+			this->lod = lod;
 	}
 };
 
+//Frame arena: linear storage that keeps the render calls of the current frame by value in a contiguous array.
+//It is reset once per frame but keeps its capacity, so once it has grown enough no more memory is allocated.
+struct RenderCallArena {
+	std::vector<RenderCall> calls;
+	size_t high_water_mark = 0; //Highest number of render calls stored in a single frame
+	int frame_allocations = 0; //Number of times the storage had to grow during the current frame
+	size_t max_calls = SIZE_MAX; //Calls past it are dropped, the renderer limits them to the indices that fit in a sort key
+	bool overflowed = false; //Some calls were dropped, it is only reported the first time
+
+	//Forget the calls of the previous frame without releasing memory
+	void reset() { calls.clear(); frame_allocations = 0; }
+
+	//Get a new slot at the end of the arena, NULL if it is full
+	RenderCall* allocate()
+	{
+		if (calls.size() >= max_calls)
+		{
+			if (!overflowed)
+				std::cout << "[WARN] more than " << max_calls << " render calls in a frame, the rest are not drawn" << std::endl;
+			overflowed = true;
+			return NULL;
+		}
+		if (calls.size() == calls.capacity())
+		{
+			calls.reserve(std::max((size_t)64, calls.capacity() * 2));
+			frame_allocations++;
+		}
+		calls.emplace_back();
+		high_water_mark = std::max(high_water_mark, calls.size());
+		return &calls.back();
+	}
+
+	size_t size() const { return calls.size(); }
+	RenderCall& operator[](size_t index) { return calls[index]; }
+};
+
+//Light as stored in the lights buffer texture, one RGBA32F texel per Vector4 (see getLight in single.fs)
+struct sLightData {
+	Vector4 position; //xyz: position, w: intensity
+	Vector4 color; //xyz: color, w: max distance
+	Vector4 direction; //xyz: spot direction or directional front, w: light type
+	Vector4 cone; //x: cone exponent, y: cosine of the cone angle, z: cast shadows
+	Vector4 shadow; //x: shadow bias
+	Vector4 shadow_tile; //Region of the shadow atlas in uv coordinates: x, y, width, height
+	Matrix44 shadow_vp;
+};
+
+//Render calls that share mesh and material, drawn with a single instanced draw call
+struct InstanceGroup {
+	Mesh* mesh;
+	Material* material;
+	int lod;
+	int first_instance; //Offset of the first model in the instances buffer
+	int num_instances;
+};
+
+//Tracked GL state: remembers the last value sent to the RenderBackend and skips the calls that wouldn't change it.
+//Code that changes this state directly must call invalidate() before using the cache again.
+struct GLStateCache {
+	int blend;
+	GLenum blend_src, blend_dst;
+	int cull_face;
+	GLenum depth_func;
+	int scissor_test;
+	int scissor[4];
+	int viewport[4];
+	long num_skipped_calls = 0; //Calls skipped since the last reset of the counter
+
+	GLStateCache() { invalidate(); }
+
+	//Forget the tracked state, the next call of each kind always reaches OpenGL
+	void invalidate();
+
+	void setBlend(bool enabled);
+	void setBlendFunc(GLenum src, GLenum dst);
+	void setCullFace(bool enabled);
+	void setDepthFunc(GLenum func);
+	void setScissorTest(bool enabled);
+	void setScissor(int x, int y, int width, int height);
+	void setViewport(int x, int y, int width, int height);
+};
+
 // This class is in charge of rendering anything in our system.
 // Separating the render from anything else makes the code cleaner
 class Renderer
@@ -39,7 +127,68 @@ public:
 	Shader* shaderGUI;
 
 	//Render variables
-	std::vector<RenderCall*> render_calls; // Here we store each RenderCall to be sent to the GPU.
+	RenderCallArena render_calls; // Here we store each RenderCall to be sent to the GPU.
+	std::vector<uint64_t> render_keys; // Sort key of each RenderCall, the lower 16 bits are the index in render_calls.
+	std::vector<uint64_t> render_keys_temp; // Scratch buffer for the radix sort.
+
+	//GL state cache
+	GLStateCache gl_state;
+
+	//Lights buffer texture: light and shadow data packed once per frame
+	std::vector<sLightData> lights_data;
+	unsigned int lights_tbo = 0;
+	unsigned int lights_texture = 0;
+	int max_lights; // Limited by GL_MAX_TEXTURE_BUFFER_SIZE and the 16 bit indices of the cluster lists
+	bool lights_overflowed = false; // Some visible lights didn't fit, it is only reported once
+	int max_lights_per_pass; // Lights evaluated by each draw call, if there are more the mesh is drawn again with additive blending
+
+	//Clustered lighting: the view frustum is split in a grid of clusters and each fragment only evaluates the lights of its cluster
+	bool clustered_lighting = true;
+	bool clusters_ready = false; // Clusters were built for the current camera (perspective cameras only)
+	std::vector<Vector4> lights_spheres; // Bounding sphere of each light in lights_data (radius < 0 reaches every cluster)
+	std::vector<int> lights_clusters; // Cluster range of each light: min x, max x, min y, max y, min z, max z
+	std::vector<unsigned int> cluster_grid; // Offset and count in cluster_lights of each cluster
+	std::vector<unsigned short> cluster_lights; // Light indices of every cluster, one list after another
+	unsigned int cluster_grid_tbo = 0, cluster_grid_texture = 0;
+	unsigned int cluster_lights_tbo = 0, cluster_lights_texture = 0;
+	Vector2 cluster_depth; // Scale and bias from log(view depth) to cluster slice
+
+	//Instancing: the draw batches of the current pass
+	Shader* instanced_shader;
+	Shader* depth_instanced_shader;
+	unsigned int instances_vbo_id = 0; // Per-pass buffer with the models of every instance group
+	std::vector<RenderCall*> visible_calls; // Render calls that passed the culling, in sort order
+	std::vector<InstanceGroup> instance_groups;
+	std::vector<Matrix44> instance_models;
+	std::vector<RenderCall*> single_calls; // Render calls drawn one by one
+
+	//Shadow atlas: square texture where every shadow casting light gets a tile sized by its screen coverage
+	std::vector<LightEntity*> shadow_lights; // Lights with a tile, in scene order
+	std::vector<LightEntity*> shadow_requests; // Scratch list for the packer
+	bool shadow_atlas_full = false; // Some lights didn't fit in the last packing, so it is only reported once
+
+	//Shadow cache: static casters of every light, copied into the shadow atlas before drawing the dynamic ones
+	FBO* static_shadow_fbo = NULL;
+	int num_shadow_updates = 0; // Static shadow maps redrawn in the current frame
+	int num_shadow_cached = 0; // Shadow maps reused as they were in the current frame
+
+	//Shadow pass GPU time, measured with timer queries read one frame later
+	unsigned int shadow_queries[2] = { 0, 0 };
+	int shadow_query_frame = 0;
+	float shadow_pass_ms = 0.0f;
+
+	//Levels of detail: the coarsest level whose error on screen stays under lod_max_error is drawn
+	bool use_lods = true;
+	float lod_max_error = 0.5f; // In the units of Camera::getProjectedScale
+	int shadow_lod_bias = 1; // The shadow maps use levels this much coarser than the main pass
+
+	//Bound state: used to skip redundant binds between consecutive render calls
+	Material* bound_material = NULL;
+	Mesh* bound_mesh = NULL;
+
+	//State changes (blend, cull, textures and vertex buffers) issued in the current frame, and the ones that would have been issued binding everything on every draw
+	int num_state_changes = 0;
+	int num_state_changes_unsorted = 0;
 
 	//GUIs
 	Texture* collectItem;
@@ -94,23 +243,52 @@ public:
 	//Intialize the render calls vector
 	void createRenderCalls();
 
+	//Level of detail of a mesh for the camera, it updates the level kept by the entity
+	int selectLod(Mesh* mesh, const Matrix44& model, BoundingBox* world_bounding_box, int& entity_lod);
+
+	//Level of detail of a render call in the shadow maps
+	int getShadowLod(RenderCall* rc);
+
 	//Set scene uniforms
 	void setSceneUniforms(Shader* shader);
 
+	//Pack the light and shadow data of the frame into the lights buffer texture
+	void uploadLights();
+
+	//Assign the visible lights to the clusters of the camera frustum and upload the lists
+	void buildLightClusters(Camera* camera);
+
+	//Cull the render calls with a camera
+	void cullRenderCalls(Camera* camera);
+
+	//Cull the static or dynamic shadow casters of a light, returns a hash of the casters that passed
+	uint64_t cullShadowCasters(LightEntity* light, bool dynamic_casters);
+
+	//Split the visible render calls in instance groups and single draw calls
+	void createDrawBatches(bool shadow_pass);
+
 	//Render a draw call
 	void renderDrawCall(Shader* shader, RenderCall* rc, Camera* camera);
 
+	//Render all the instances of a group with one draw call
+	void renderInstancedDrawCall(Shader* shader, InstanceGroup* group);
+
+	//Bind the material state of a draw call
+	void bindMaterial(Shader* shader, Material* material);
+
 	//Render a basic draw call
 	void renderDepthMap(RenderCall* rc, Camera* light_camera);
+	void renderDepthMapInstanced(InstanceGroup* group, Camera* light_camera);
 
-	//Singlepass lighting
-	void SinglePassLoop(Shader* shader, Mesh* mesh);
+	//Singlepass lighting (the mesh buffers must be already enabled)
+	void SinglePassLoop(Shader* shader, Mesh* mesh, int num_instances = 0, int lod = 0);
 
 	//Multipass lighting
 	void MultiPassLoop(Shader* shader, Mesh* mesh);
 
 	//Shadow Atlas
 	void createShadowAtlas();
+	void packShadowAtlas();
 	void computeShadowMap();
 	void showShadowAtlas();
 
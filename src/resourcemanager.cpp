@@ -0,0 +1,272 @@
+#include "resourcemanager.h"
+#include "mesh.h"
+#include "texture.h"
+#include "material.h"
+#include "utils.h"
+#include <algorithm>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+
+#define MB (1024 * 1024)
+
+ResourceManager::sPool ResourceManager::pools[NUM_POOLS] = {
+	{ 256 * MB, 0, 0, 0 },	//meshes RAM
+	{ 512 * MB, 0, 0, 0 },	//meshes VRAM
+	{ 256 * MB, 0, 0, 0 },	//textures RAM
+	{ 1024 * MB, 0, 0, 0 }	//textures VRAM
+};
+long ResourceManager::frame = 1;
+int ResourceManager::keep_frames = 2;
+int ResourceManager::num_evictions = 0;
+int ResourceManager::num_reloads = 0;
+int ResourceManager::num_dropped_copies = 0;
+
+//References
+
+void ResourceManager::addReference(Mesh* mesh)
+{
+	if (!mesh)
+		return;
+	mesh->residency.references++;
+	mesh->residency.managed = true;
+}
+
+void ResourceManager::releaseReference(Mesh* mesh)
+{
+	if (mesh && mesh->residency.references > 0)
+		mesh->residency.references--;
+}
+
+void ResourceManager::addReference(Texture* texture)
+{
+	if (!texture)
+		return;
+	texture->residency.references++;
+	texture->residency.managed = true;
+}
+
+void ResourceManager::releaseReference(Texture* texture)
+{
+	if (texture && texture->residency.references > 0)
+		texture->residency.references--;
+}
+
+//The samplers of a material, in the same order as in bindMaterial
+static Sampler* getSampler(Material* material, int index)
+{
+	Sampler* samplers[] = { &material->albedo_texture, &material->specular_texture, &material->normal_texture, &material->occlusion_texture,
+		&material->metalness_texture, &material->roughness_texture, &material->omr_texture, &material->emissive_texture };
+	return samplers[index];
+}
+
+void ResourceManager::addReference(Material* material)
+{
+	if (!material)
+		return;
+	for (int i = 0; i < 8; ++i)
+		addReference(getSampler(material, i)->texture);
+}
+
+void ResourceManager::releaseReference(Material* material)
+{
+	if (!material)
+		return;
+	for (int i = 0; i < 8; ++i)
+		releaseReference(getSampler(material, i)->texture);
+}
+
+//Use
+
+bool ResourceManager::use(Mesh* mesh, bool cpu_copies)
+{
+	sResidency& residency = mesh->residency;
+	residency.last_used = frame;
+	residency.managed = true;
+
+	//the streams can't be loaded alone, so the mesh is evicted and loaded whole
+	if (cpu_copies && residency.cpu_copies_dropped && !residency.evicted)
+	{
+		mesh->evict();
+		residency.evicted = true;
+	}
+	if (!residency.evicted)
+		return true;
+
+	//the mesh is loaded again from its binary in the asset cache, it was written the first time
+	residency.evicted = false;
+	residency.cpu_copies_dropped = false;
+	num_reloads++;
+	if (!mesh->load(mesh->filename.c_str()))
+		return false;
+	if (Mesh::auto_upload_to_vram)
+	{
+		mesh->uploadToVRAM();
+		if (!cpu_copies && !Mesh::keep_cpu_copies)
+			mesh->releaseCPUCopies();
+	}
+	return true;
+}
+
+bool ResourceManager::use(Texture* texture)
+{
+	sResidency& residency = texture->residency;
+	residency.last_used = frame;
+	residency.managed = true;
+	if (!residency.evicted)
+		return true;
+
+	residency.evicted = false;
+	num_reloads++;
+	return texture->load(texture->filename.c_str(), texture->mipmaps);
+}
+
+void ResourceManager::use(Material* material)
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		Texture* texture = getSampler(material, i)->texture;
+		if (texture)
+			use(texture);
+	}
+}
+
+//Memory
+
+size_t ResourceManager::getVRAMBytes(Texture* texture)
+{
+	if (!texture->texture_id)
+		return 0;
+	size_t channels = texture->format == GL_RGBA ? 4 : (texture->format == GL_RGB ? 3 : 1);
+	size_t channel_bytes = texture->type == GL_FLOAT ? 4 : (texture->type == GL_HALF_FLOAT ? 2 : 1);
+	size_t bytes = (size_t)texture->width * (size_t)texture->height * channels * channel_bytes;
+	return texture->mipmaps ? bytes * 4 / 3 : bytes;
+}
+
+size_t ResourceManager::getRAMBytes(Texture* texture)
+{
+	return texture->image.data ? texture->image.width * texture->image.height * texture->image.num_channels : 0;
+}
+
+struct sEvictionCandidate
+{
+	Mesh* mesh;
+	Texture* texture;
+	sResidency* residency;
+	size_t ram;
+	size_t vram;
+};
+
+void ResourceManager::update()
+{
+	frame++;
+	for (int i = 0; i < NUM_POOLS; ++i)
+	{
+		pools[i].usage = 0;
+		pools[i].num_resident = 0;
+		pools[i].num_evicted = 0;
+	}
+
+	//measure the resident assets, the managed ones not drawn recently can be evicted
+	vector<sEvictionCandidate> candidates;
+	for (auto it = Mesh::sMeshesLoaded.begin(); it != Mesh::sMeshesLoaded.end(); ++it)
+	{
+		Mesh* mesh = it->second;
+		if (mesh->residency.evicted)
+		{
+			pools[MESHES_RAM].num_evicted++;
+			continue;
+		}
+		sEvictionCandidate candidate = { mesh, NULL, &mesh->residency, mesh->getRAMBytes(), mesh->vram_bytes };
+		pools[MESHES_RAM].usage += candidate.ram;
+		pools[MESHES_VRAM].usage += candidate.vram;
+		pools[MESHES_RAM].num_resident++;
+		if (mesh->residency.managed && frame - mesh->residency.last_used > keep_frames && mesh->filename.size())
+			candidates.push_back(candidate);
+	}
+	pools[MESHES_VRAM].num_resident = pools[MESHES_RAM].num_resident;
+	pools[MESHES_VRAM].num_evicted = pools[MESHES_RAM].num_evicted;
+
+	for (auto it = Texture::sTexturesLoaded.begin(); it != Texture::sTexturesLoaded.end(); ++it)
+	{
+		Texture* texture = it->second;
+		if (texture->residency.evicted)
+		{
+			pools[TEXTURES_RAM].num_evicted++;
+			continue;
+		}
+		sEvictionCandidate candidate = { NULL, texture, &texture->residency, getRAMBytes(texture), getVRAMBytes(texture) };
+		pools[TEXTURES_RAM].usage += candidate.ram;
+		pools[TEXTURES_VRAM].usage += candidate.vram;
+		pools[TEXTURES_RAM].num_resident++;
+		if (texture->residency.managed && frame - texture->residency.last_used > keep_frames && texture->filename.size())
+			candidates.push_back(candidate);
+	}
+	pools[TEXTURES_VRAM].num_resident = pools[TEXTURES_RAM].num_resident;
+	pools[TEXTURES_VRAM].num_evicted = pools[TEXTURES_RAM].num_evicted;
+
+	auto overBudget = [](int pool) { return pools[pool].budget && pools[pool].usage > pools[pool].budget; };
+	if (!overBudget(MESHES_RAM) && !overBudget(MESHES_VRAM) && !overBudget(TEXTURES_RAM) && !overBudget(TEXTURES_VRAM))
+		return;
+
+	//the ones no entity references first, then the least recently drawn
+	sort(candidates.begin(), candidates.end(), [](const sEvictionCandidate& a, const sEvictionCandidate& b) {
+		if ((a.residency->references == 0) != (b.residency->references == 0))
+			return a.residency->references == 0;
+		return a.residency->last_used < b.residency->last_used;
+	});
+
+	//the CPU copies of the meshes in the VRAM are not needed to draw them, so they go before evicting anything
+	for (size_t i = 0; i < candidates.size() && overBudget(MESHES_RAM); ++i)
+	{
+		sEvictionCandidate& candidate = candidates[i];
+		if (!candidate.mesh)
+			continue;
+		size_t bytes = candidate.mesh->releaseCPUCopies();
+		if (!bytes)
+			continue;
+		candidate.ram -= min(bytes, candidate.ram);
+		pools[MESHES_RAM].usage -= min(bytes, pools[MESHES_RAM].usage);
+		num_dropped_copies++;
+	}
+
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		sEvictionCandidate& candidate = candidates[i];
+		int ram_pool = candidate.mesh ? MESHES_RAM : TEXTURES_RAM;
+		int vram_pool = candidate.mesh ? MESHES_VRAM : TEXTURES_VRAM;
+		if (!(overBudget(ram_pool) && candidate.ram) && !(overBudget(vram_pool) && candidate.vram))
+			continue;
+
+		if (candidate.mesh)
+			candidate.mesh->evict();
+		else
+			candidate.texture->releaseVRAM();
+		candidate.residency->evicted = true;
+		pools[ram_pool].usage -= min(candidate.ram, pools[ram_pool].usage);
+		pools[vram_pool].usage -= min(candidate.vram, pools[vram_pool].usage);
+		pools[ram_pool].num_resident--;
+		pools[ram_pool].num_evicted++;
+		pools[vram_pool].num_resident--;
+		pools[vram_pool].num_evicted++;
+		num_evictions++;
+	}
+}
+
+std::string ResourceManager::getStats()
+{
+	const char* names[NUM_POOLS] = { "Meshes RAM", "Meshes VRAM", "Textures RAM", "Textures VRAM" };
+	std::string str;
+	for (int i = 0; i < NUM_POOLS; ++i)
+	{
+		sPool& pool = pools[i];
+		str += std::string(i ? " " : "") + names[i] + ": " + to_string(pool.usage / MB) + "/" + (pool.budget ? to_string(pool.budget / MB) : std::string("-")) + "MBs";
+	}
+	str += "\nResident meshes: " + to_string(pools[MESHES_RAM].num_resident) + " (evicted " + to_string(pools[MESHES_RAM].num_evicted) + ") textures: " + to_string(pools[TEXTURES_RAM].num_resident) +
+		" (evicted " + to_string(pools[TEXTURES_RAM].num_evicted) + ") Evictions: " + to_string(num_evictions) + " Reloads: " + to_string(num_reloads) + " Dropped copies: " + to_string(num_dropped_copies);
+	num_evictions = 0;
+	num_reloads = 0;
+	num_dropped_copies = 0;
+	return str;
+}
@@ -0,0 +1,72 @@
+#ifndef RESOURCEMANAGER_H
+#define RESOURCEMANAGER_H
+
+#pragma once
+#include <string>
+#include <cstddef>
+
+class Mesh;
+class Texture;
+class Material;
+
+//Residency state that every managed asset carries
+struct sResidency
+{
+	int references = 0; //entities using it
+	long last_used = 0; //frame in which it was last drawn
+	bool managed = false; //it was referenced or drawn through the manager, so it can be evicted
+	bool evicted = false; //its data was released, it is loaded again on the next use
+	bool cpu_copies_dropped = false; //meshes: the streams only the CPU reads were released, they are loaded again on the next use that needs them
+};
+
+//Keeps the memory of the meshes and textures of the managers under a budget per pool.
+//Every frame the pools are measured and, if one is over its budget, the CPU copies of the meshes already in the VRAM are dropped
+//(they are loaded again if a CPU consumer uses the mesh) and then the least recently drawn assets are evicted, the ones no entity references first.
+//An evicted asset keeps its object, since the entities point to it, and is loaded again from its file the next time it is used.
+class ResourceManager
+{
+public:
+
+	enum ePool { MESHES_RAM, MESHES_VRAM, TEXTURES_RAM, TEXTURES_VRAM, NUM_POOLS };
+
+	struct sPool {
+		size_t budget; //bytes, 0 for no limit
+		size_t usage; //bytes of the resident assets, measured by update
+		int num_resident;
+		int num_evicted;
+	};
+
+	static sPool pools[NUM_POOLS];
+	static long frame;
+	static int keep_frames; //assets drawn in the last frames are never evicted
+
+	//Stats since the last call to getStats
+	static int num_evictions;
+	static int num_reloads;
+	static int num_dropped_copies;
+
+	//References of the entities, the textures of a material are referenced with it
+	static void addReference(Mesh* mesh);
+	static void releaseReference(Mesh* mesh);
+	static void addReference(Texture* texture);
+	static void releaseReference(Texture* texture);
+	static void addReference(Material* material);
+	static void releaseReference(Material* material);
+
+	//Call before drawing an asset, it is loaded again if it was evicted. Returns false if it couldn't be loaded
+	//The CPU consumers of a mesh (normals, uvs or levels of detail) pass cpu_copies so the streams dropped from the RAM are loaded again too
+	static bool use(Mesh* mesh, bool cpu_copies = false);
+	static bool use(Texture* texture);
+	static void use(Material* material);
+
+	//Once per frame, before rendering: measures the pools and evicts what is over budget
+	static void update();
+
+	//Usage of every pool, for the stats overlay
+	static std::string getStats();
+
+	static size_t getVRAMBytes(Texture* texture);
+	static size_t getRAMBytes(Texture* texture);
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "scene.h"
 #include "game.h"
+#include "assetloader.h"
 #include <fstream> 
 
 Scene* Scene::instance = NULL;
@@ -12,8 +13,8 @@ Scene::Scene()
 	//General features
 	filename = "";
 	ambient_light = Vector3(1.f, 1.f, 1.f);
-	main_camera = Game::instance->main_camera;
-	shader = Shader::Get("data/shaders/pixel.vs", "data/shaders/single.fs"); //Select shader to render the render calls
+	main_camera = NULL; //set by the owner before loading
+	shader = NULL; //set by the owner, headless scenes have none
 
 	//Shadow Atlas
 	fbo = NULL;
@@ -29,6 +30,10 @@ Scene::Scene()
 	show_atlas = false;
 	atlas_scope = 0;
 
+	//Interaction ray
+	interaction_valid = false;
+	interaction.max_distance = 500.f;
+
 	//Scene triggers: We set them true just for the first iteration
 
 
@@ -69,6 +74,9 @@ void Scene::clear()
 	}
 
 	//Resize vectors
+	bvh.clear();
+	grid.clear();
+	interaction_valid = false;
 	objects.resize(0);
 	lights.resize(0);
 	sounds.resize(0);
@@ -86,6 +94,7 @@ void Scene::addEntity(Entity* entity)
 		break;
 	case(Entity::EntityType::OBJECT):
 		objects.push_back((ObjectEntity*)entity);
+		updateBVH((ObjectEntity*)entity);
 		num_objects++;
 		break;
 	case(Entity::EntityType::LIGHT):
@@ -97,6 +106,7 @@ void Scene::addEntity(Entity* entity)
 		num_sounds++;
 		break;
 	}
+	updateGrid(entity);
 }
 
 void Scene::removeEntity(Entity* entity)
@@ -104,6 +114,10 @@ void Scene::removeEntity(Entity* entity)
 	if (entity == NULL)
 		return;
 
+	//The cached interaction may point to it
+	interaction_valid = false;
+	removeFromGrid(entity);
+
 	//Only for entity vectors
 	switch (entity->entity_type)
 	{
@@ -121,6 +135,8 @@ void Scene::removeEntity(Entity* entity)
 			//Children
 			for (auto it = object->children.begin(); it != object->children.end(); ++it) {
 				auto result = find(objects.begin(), objects.end(), *it);
+				removeFromBVH(*it);
+				removeFromGrid(*it);
 				if (result != objects.end())
 				{
 					objects.erase(result);
@@ -134,6 +150,7 @@ void Scene::removeEntity(Entity* entity)
 
 			//Parent
 			auto result = find(objects.begin(), objects.end(), object);
+			removeFromBVH(object);
 			if (result != objects.end())
 			{
 				objects.erase(result);
@@ -311,120 +328,145 @@ void Scene::assignRelation(ObjectEntity* parent_object, vector<ObjectEntity*> ch
 	}
 }
 
-Vector3 Scene::testCollisions(Vector3 currPos, Vector3 deltaPos, float elapsed_time)
-{
-	Vector3 coll;
-	Vector3 collnorm;
-	Vector3 nextPos = currPos + deltaPos;
-
-	if (hasCollision(nextPos, coll, collnorm)) {
-		Vector3 push_away = normalize(coll - nextPos) * elapsed_time;
-		nextPos = currPos - push_away;
-		//Vector3 velocity = reflect(Vector3(1,0,1), collnorm) * 0.95;
-	};
-
-	return Vector3(nextPos.x, currPos.y, nextPos.z);
+//BVH methods
 
+//Box of what the queries test: the mesh and the collision proxy with the model of the object
+static BoundingBox getQueryBox(ObjectEntity* object)
+{
+	BoundingBox box = transformBoundingBox(object->model, object->mesh->box);
+	if (object->collision_mesh)
+	{
+		BoundingBox proxy_box = transformBoundingBox(object->model, object->collision_mesh->box);
+		Vector3 box_min = box.center - box.halfsize;
+		Vector3 box_max = box.center + box.halfsize;
+		box_min.setMin(proxy_box.center - proxy_box.halfsize);
+		box_max.setMax(proxy_box.center + proxy_box.halfsize);
+		box = BoundingBox((box_min + box_max) * 0.5f, (box_max - box_min) * 0.5f);
+	}
+	return box;
 }
 
-bool Scene::hasCollision(Vector3 pos, Vector3& coll, Vector3& collnorm) {
+void Scene::buildBVH()
+{
+	bvh.clear();
 	for (size_t i = 0; i < objects.size(); i++)
 	{
-		ObjectEntity* object = objects[i];
-		if (objects[i]->mesh->testSphereCollision(object->model, pos, 20.0f, coll, collnorm)) {
-			return true;
-		}
-			
+		objects[i]->bvh_proxy = -1;
+		updateBVH(objects[i]);
 	}
-	return false;
 }
 
-//Given a current camera position, returns the object type of the object entity that has in front
-ObjectEntity::ObjectType Scene::getCollectable() { 
-	//Selected entity and maximum distance of selection
-	ObjectEntity::ObjectType type = ObjectEntity::ObjectType::RENDER_OBJECT;
-	ObjectEntity* collectable = NULL;
-	float max_distance = 500.f;
+void Scene::updateBVH(ObjectEntity* object)
+{
+	if (!object->mesh)
+		return;
+	BoundingBox box = getQueryBox(object);
+	interaction_valid = false;
 
-	//Get global variables
-	Camera* camera = main_character->camera;
-	Game* game = Game::instance;
-	Vector2 mouse_pos = Vector2(game->window_width / 2, game->window_height / 2);
-	
-	//Compute the direction form mouse to window
-	Vector3 ray_direction = camera->getRayDirection(mouse_pos.x, mouse_pos.y, game->window_width, game->window_height);
-	Vector3 ray_origin = camera->eye;
+	//the model changed, the collision queries take it to object space with this
+	object->inverse_model = object->model;
+	object->inverse_model.inverse();
 
-	//Search for the object with a Ray Collision in the scene and then return it
-	for (size_t i = 0; i < objects.size(); i++)
-	{
-		//Current object entity
-		ObjectEntity* entity = objects[i];
+	if (object->bvh_proxy == -1)
+		object->bvh_proxy = bvh.insert(box, object);
+	else
+		bvh.update(object->bvh_proxy, box);
+}
 
-		//Entity properties
-		Vector3 entity_position;
-		Vector3 entity_normal;
+void Scene::removeFromBVH(ObjectEntity* object)
+{
+	if (object->bvh_proxy == -1)
+		return;
+	bvh.remove(object->bvh_proxy);
+	object->bvh_proxy = -1;
+}
 
-		//Ray collision test
-		if (entity->type != ObjectEntity::ObjectType::RENDER_OBJECT && entity->mesh->testRayCollision(entity->model, ray_origin, ray_direction, entity_position, entity_normal, max_distance)) {
-			float entity_distance = (entity_position - ray_origin).length();
-			if (entity_distance < max_distance)
-			{
-				//cout << entity->name << " removed succesfully." << endl;
-				type = entity->type;
-				collectable = entity;
-			}
-		}
-		
+//Spatial grid methods
 
+void Scene::buildGrid()
+{
+	grid.clear();
+	if (main_character)
+	{
+		main_character->grid_proxy = -1;
+		updateGrid(main_character);
+	}
+	if (monster)
+	{
+		monster->grid_proxy = -1;
+		updateGrid(monster);
+	}
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		objects[i]->grid_proxy = -1;
+		updateGrid(objects[i]);
 	}
-	if (collectable && type != ObjectEntity::ObjectType::RENDER_OBJECT)
-		removeEntity(collectable);
-	
-	return type;
 }
 
-//True if a collectable can be grabbed
-bool Scene::collectableInRange() {
-	//Selected entity and maximum distance of selection
-	float max_distance = 500.f;
+//The characters are points at their position and the objects the sphere of their query box
+void Scene::updateGrid(Entity* entity)
+{
+	Vector3 center;
+	float radius = 0.0f;
+	switch (entity->entity_type)
+	{
+	case(Entity::EntityType::MAIN):
+		center = ((MainCharacterEntity*)entity)->camera->eye;
+		break;
+	case(Entity::EntityType::MONSTER):
+		center = entity->model.getTranslation();
+		break;
+	case(Entity::EntityType::OBJECT):
+		{
+			ObjectEntity* object = (ObjectEntity*)entity;
+			if (!object->mesh)
+				return;
+			BoundingBox box = getQueryBox(object);
+			center = box.center;
+			radius = (float)box.halfsize.length();
+		}
+		break;
+	default:
+		return;
+	}
 
-	//Get global variables
-	Camera* camera = main_character->camera;
-	Game* game = Game::instance;
-	Vector2 mouse_pos = Vector2(game->window_width / 2, game->window_height / 2);
+	if (entity->grid_proxy == -1)
+		entity->grid_proxy = grid.insert(entity, center, radius);
+	else
+		grid.move(entity->grid_proxy, center, radius);
+}
 
-	//Compute the direction form mouse to window
-	Vector3 ray_direction = camera->getRayDirection(mouse_pos.x, mouse_pos.y, game->window_width, game->window_height);
-	Vector3 ray_origin = camera->eye;
+void Scene::removeFromGrid(Entity* entity)
+{
+	if (entity->grid_proxy == -1)
+		return;
+	grid.remove(entity->grid_proxy);
+	entity->grid_proxy = -1;
+}
 
-	//Search for the object with a Ray Collision in the scene and then return it
-	for (size_t i = 0; i < objects.size(); i++)
-	{
-		//Current object entity
-		ObjectEntity* entity = objects[i];
+//Queries: the BVH gives the objects whose box is reached and only those are tested against their collision model
 
-		//Entity properties
-		Vector3 entity_position;
-		Vector3 entity_normal;
+bool Scene::hasCollision(Vector3 pos, Vector3& coll, Vector3& collnorm) {
+	float radius = 20.0f;
+	vector<void*> candidates;
+	bvh.queryBox(pos - Vector3(radius), pos + Vector3(radius), candidates);
 
-		//Ray collision test
-		if (entity->type != ObjectEntity::ObjectType::RENDER_OBJECT && entity->mesh->testRayCollision(entity->model, ray_origin, ray_direction, entity_position, entity_normal, max_distance))
-		{
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		ObjectEntity* object = (ObjectEntity*)candidates[i];
+		Mesh* collision_mesh = object->getCollisionMesh();
+		if (collision_mesh && collision_mesh->testSphereCollision(object->model, pos, radius, coll, collnorm, &object->inverse_model)) {
 			return true;
-
 		}
-
+			
 	}
 	return false;
-
 }
 
-//True if a collectable can be grabbed
-bool Scene::hasDoorInRange() {
-	//Selected entity and maximum distance of selection
-	float max_distance = 500.f;
-
+//Interaction ray: the center of the screen from the eye of the main character camera, cast once and cached until the camera
+//moves or the objects change
+const Scene::sInteraction& Scene::getInteraction()
+{
 	//Get global variables
 	Camera* camera = main_character->camera;
 	Game* game = Game::instance;
@@ -434,26 +476,84 @@ bool Scene::hasDoorInRange() {
 	Vector3 ray_direction = camera->getRayDirection(mouse_pos.x, mouse_pos.y, game->window_width, game->window_height);
 	Vector3 ray_origin = camera->eye;
 
-	//Search for the object with a Ray Collision in the scene and then return it
-	for (size_t i = 0; i < objects.size(); i++)
+	//Cached result
+	bool same_ray = ray_origin.x == interaction.ray_origin.x && ray_origin.y == interaction.ray_origin.y && ray_origin.z == interaction.ray_origin.z &&
+		ray_direction.x == interaction.ray_direction.x && ray_direction.y == interaction.ray_direction.y && ray_direction.z == interaction.ray_direction.z;
+	if (interaction_valid && same_ray)
+		return interaction;
+
+	interaction.ray_origin = ray_origin;
+	interaction.ray_direction = ray_direction;
+	interaction.entity = NULL;
+	interaction.type = ObjectEntity::ObjectType::RENDER_OBJECT;
+	interaction.distance = interaction.max_distance;
+	interaction_valid = true;
+
+	//The ray is only cast if a collectable or a door is close enough to be reached
+	vector<Entity*> nearby;
+	grid.queryRadius(ray_origin, interaction.max_distance, nearby, Entity::EntityType::OBJECT);
+	bool reachable = false;
+	for (size_t i = 0; i < nearby.size() && !reachable; i++)
 	{
+		ObjectEntity* object = (ObjectEntity*)nearby[i];
+		reachable = object->type != ObjectEntity::ObjectType::RENDER_OBJECT || object->name == "door";
+	}
+	if (!reachable)
+		return interaction;
+
+	//Search for the nearest collectable or door with a Ray Collision in the scene
+	bvh.raycast(ray_origin, ray_direction, interaction.max_distance, [&](void* data, float max_dist) {
 		//Current object entity
-		ObjectEntity* entity = objects[i];
+		ObjectEntity* entity = (ObjectEntity*)data;
+		if (entity->type == ObjectEntity::ObjectType::RENDER_OBJECT && entity->name != "door")
+			return max_dist;
 
 		//Entity properties
 		Vector3 entity_position;
 		Vector3 entity_normal;
 
 		//Ray collision test
-		if (entity->name == "door" && entity->mesh->testRayCollision(entity->model, ray_origin, ray_direction, entity_position, entity_normal, max_distance))
+		Mesh* collision_mesh = entity->getCollisionMesh();
+		if (collision_mesh && collision_mesh->testRayCollision(entity->model, ray_origin, ray_direction, entity_position, entity_normal, max_dist, false, &entity->inverse_model))
 		{
-			return true;
-
+			float entity_distance = (entity_position - ray_origin).length();
+			if (entity_distance < max_dist)
+			{
+				interaction.entity = entity;
+				interaction.type = entity->type;
+				interaction.distance = entity_distance;
+				interaction.position = entity_position;
+				interaction.normal = entity_normal;
+				return entity_distance;
+			}
 		}
+		return max_dist;
+	});
 
-	}
-	return false;
+	return interaction;
+}
+
+//Given a current camera position, returns the object type of the object entity that has in front
+ObjectEntity::ObjectType Scene::getCollectable() { 
+	const sInteraction& result = getInteraction();
+	ObjectEntity::ObjectType type = result.type;
 
+	//Removing it invalidates the interaction
+	if (result.entity && type != ObjectEntity::ObjectType::RENDER_OBJECT)
+		removeEntity(result.entity);
+	
+	return type;
+}
+
+//True if a collectable can be grabbed
+bool Scene::collectableInRange() {
+	return getInteraction().type != ObjectEntity::ObjectType::RENDER_OBJECT;
+}
+
+//True if a door can be opened
+bool Scene::hasDoorInRange() {
+	const sInteraction& result = getInteraction();
+	return result.entity && result.entity->name == "door";
 }
 
 //JSON Methods
@@ -489,10 +589,14 @@ bool Scene::load(const char* scene_filepath)
 	float camera_near = readJSONNumber(scene_json, "camera_near", main_camera->near_plane);
 	float camera_far = readJSONNumber(scene_json, "camera_far", main_camera->far_plane);
 
-	//Set the parameters of the main camera
-	Game* game = Game::instance;
+	//Set the parameters of the main camera, its aspect comes from the owner
 	main_camera->lookAt(eye, center, Vector3(0.f, 1.f, 0.f));
-	main_camera->setPerspective(fov, game->window_width / (float)game->window_height, camera_near, camera_far);
+	main_camera->setPerspective(fov, main_camera->aspect, camera_near, camera_far);
+
+	//Decode the meshes and textures in parallel, the entities will find them already loaded
+	AssetLoader loader;
+	loader.addSceneAssets(scene_json);
+	loader.load();
 
 	//Main character JSON
 	cJSON* main_json = cJSON_GetObjectItemCaseSensitive(scene_json, "main_character");
@@ -548,6 +652,14 @@ bool Scene::load(const char* scene_filepath)
 		}
 	}
 
+	//Collision models of the solid objects are built in the background, the rest only if a query ever needs them
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		Mesh* collision_mesh = objects[i]->getCollisionMesh();
+		if (collision_mesh)
+			collision_mesh->createCollisionModelAsync();
+	}
+
 	//Lights JSON
 	cJSON* lights_json = cJSON_GetObjectItemCaseSensitive(scene_json, "lights");
 	if (!lights_json)
@@ -616,6 +728,10 @@ bool Scene::load(const char* scene_filepath)
 			}
 	}
 
+	//Scene BVH and spatial grid
+	buildBVH();
+	buildGrid();
+
 	//free memory
 	cJSON_Delete(scene_json);
 
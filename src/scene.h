@@ -10,6 +10,8 @@
 #include "camera.h"
 #include "shader.h"
 #include "path.h"
+#include "bvh.h"
+#include "spatialgrid.h"
 
 //Forward declaration
 class FBO;
@@ -45,6 +47,26 @@ public:
 	vector<LightEntity*> lights;
 	vector<SoundEntity*> sounds;
 
+	//Broad phase of the queries over the objects
+	DynamicBVH bvh;
+
+	//Proximity queries between the entities: vision of the monster, collectables near the character
+	SpatialGrid grid;
+
+	//Nearest collectable or door in front of the camera, shared by the GUI, the stage and the character
+	struct sInteraction {
+		ObjectEntity* entity; //NULL if there is none in range
+		ObjectEntity::ObjectType type; //RENDER_OBJECT if it isn't a collectable
+		float distance;
+		Vector3 position;
+		Vector3 normal;
+		float max_distance;
+		Vector3 ray_origin;
+		Vector3 ray_direction;
+	};
+	sInteraction interaction;
+	bool interaction_valid; //cleared when the objects change, the camera moving is detected by getInteraction
+
 	//Path for monster
 	vector<Route*> route;
 
@@ -70,9 +92,19 @@ public:
 	void removeEntity(Entity* entity);
 	void assignID(Entity* entity);
 	void assignRelation(ObjectEntity* parent, vector<ObjectEntity*> children);
-	Vector3 testCollisions(Vector3 currPos, Vector3 nexPos, float elapsed_time);
+
+	//BVH methods
+	void buildBVH();
+	void updateBVH(ObjectEntity* object); //call when its model changes, it is inserted if it wasn't in the BVH
+	void removeFromBVH(ObjectEntity* object);
+
+	//Spatial grid methods
+	void buildGrid();
+	void updateGrid(Entity* entity); //call when its model changes, it is inserted if it wasn't in the grid
+	void removeFromGrid(Entity* entity);
 
 	bool hasCollision(Vector3 pos, Vector3& coll, Vector3& collnorm);
+	const sInteraction& getInteraction();
 	bool hasDoorInRange();
 	ObjectEntity::ObjectType getCollectable();
 	bool collectableInRange();
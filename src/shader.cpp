@@ -8,6 +8,7 @@
 #include <locale>
 
 #include "texture.h"
+#include "renderbackend.h"
 
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
@@ -56,6 +57,8 @@ std::map<std::string, std::string> Shader::s_shaders_atlas;
 std::map<std::string,Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
+long Shader::num_skipped_calls = 0;
+unsigned int Shader::last_revision = 0;
 
 Shader::Shader()
 {
@@ -63,6 +66,8 @@ Shader::Shader()
 		Shader::init();
 	compiled = false;
 	from_atlas = false;
+	revision = 0;
+	vs = fs = program = 0;
 }
 
 Shader::~Shader()
@@ -79,7 +84,7 @@ void Shader::setFilenames(const std::string& vsf, const std::string& psf)
 bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros)
 {
 	assert(	compiled == false );
-	assert (glGetError() == GL_NO_ERROR);
+	assert(RenderBackend::current->checkErrors());
 
 	vs_filename = vsf;
 	ps_filename = psf;
@@ -104,7 +109,7 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	if (!compileFromMemory(vsm,psm))
 		return false;
 
-	assert (glGetError() == GL_NO_ERROR);
+	assert(RenderBackend::current->checkErrors());
 
 	return true;
 }
@@ -296,142 +301,22 @@ bool Shader::hasInfoLog() const
 
 bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 {
-	if (glCreateProgram == 0)
-	{
-		std::cout << "Error: your graphics cards dont support shaders. Sorry." << std::endl;
-		exit(0);
-	}
-
-	program = glCreateProgram();
-	assert (glGetError() == GL_NO_ERROR);
-
-	if (!createVertexShaderObject(vsm))
-	{
-		printf("Vertex shader compilation failed\n");
+	if (!RenderBackend::current->compileShader(this, vsm, psm))
 		return false;
-	}
-
-	if (!createFragmentShaderObject(psm))
-	{
-		printf("Fragment shader compilation failed\n");
-		return false;
-	}
-
-	glLinkProgram(program);
-	assert (glGetError() == GL_NO_ERROR);
-
-	GLint linked=0;
-    
-	glGetProgramiv(program,GL_LINK_STATUS,&linked);
-	assert(glGetError() == GL_NO_ERROR);
-
-	if (!linked)
-	{
-		saveProgramInfoLog(program);
-		release();
-		return false;
-	}
-
-#ifdef _DEBUG
-	validate();
-#endif
 
 	compiled = true;
+	revision = ++last_revision;
 
 	return true;
 }
 
-bool Shader::validate()
-{
-	glValidateProgram(program);
-	assert ( glGetError() == GL_NO_ERROR );
-
-	GLint validated = 0;
-	glGetProgramiv(program,GL_LINK_STATUS,&validated);
-	assert(glGetError() == GL_NO_ERROR);
-	
-	if (!validated)
-	{
-		printf("Shader validation failed\n");
-		saveProgramInfoLog(program);
-		return false;
-	}
-
-	return true;
-}
-
-bool Shader::createVertexShaderObject(const std::string& shader)
-{
-	return createShaderObject(GL_VERTEX_SHADER,vs,shader);
-}
-
-bool Shader::createFragmentShaderObject(const std::string& shader)
-{
-	return createShaderObject(GL_FRAGMENT_SHADER,fs,shader);
-}
-
-bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::string& code)
-{
-	handle = glCreateShader(type);
-	assert( glGetError() == GL_NO_ERROR );
-    
-	std::string prefix = "";//"#define DESKTOP\n";
-
-    std::string fullcode = prefix + code;
-	const char* ptr = fullcode.c_str();
-	glShaderSource(handle, 1, &ptr, NULL);
-	assert( glGetError() == GL_NO_ERROR );
-	
-	glCompileShader(handle);
-	assert( glGetError() == GL_NO_ERROR );
-
-	GLint compile=0;
-	glGetShaderiv(handle,GL_COMPILE_STATUS,&compile);
-	assert( glGetError() == GL_NO_ERROR );
-
-	//we want to see the compile log if we are in debug (to check warnings)
-	if (!compile)
-	{
-		saveShaderInfoLog(handle);
-        std::cout << "Shader code:\n " << std::endl;
-		std::vector<std::string> lines = split( fullcode, '\n' );
-		for( size_t i = 0; i < lines.size(); ++i)
-			std::cout << i << "  " << lines[i] << std::endl;
-
-		return false;
-	}
-
-	glAttachShader(program,handle);
-	assert( glGetError() == GL_NO_ERROR );
-
-	return true;
-}
-
-
 void Shader::release()
 {
-	if (vs)
-	{
-		glDeleteShader(vs);
-		assert (glGetError() == GL_NO_ERROR);
-		vs = 0;
-	}
-
-	if (fs)
-	{
-		glDeleteShader(fs);
-		assert (glGetError() == GL_NO_ERROR);
-		fs = 0;
-	}
-
-	if (program)
-	{
-		glDeleteProgram(program);
-		assert (glGetError() == GL_NO_ERROR);
-		program = 0;
-	}
+	RenderBackend::current->releaseShader(this);
 
 	locations.clear();
+	attrib_locations.clear();
+	uniform_values.clear();
 
 	compiled = false;
 }
@@ -444,11 +329,12 @@ void Shader::enable()
 
 	current = this;
 
-	glUseProgram(program);
-    GLuint err = glGetError();
-	assert (err == GL_NO_ERROR);
+	RenderBackend::current->useShader(this);
 
 	last_slot = 0;
+
+	//other code may have bound textures since the last time this shader was enabled
+	memset(bound_textures, 0, sizeof(bound_textures));
 }
 
 
@@ -456,58 +342,12 @@ void Shader::disable()
 {
 	current = NULL;
 
-	glUseProgram(0);
-	//glActiveTexture(GL_TEXTURE0);
-	assert (glGetError() == GL_NO_ERROR);
+	RenderBackend::current->useShader(NULL);
 }
 
 void Shader::disableShaders()
 {
-	glUseProgram(0);
-	assert (glGetError() == GL_NO_ERROR);
-}
-
-void Shader::saveShaderInfoLog(GLuint obj)
-{
-	int len = 0;
-	assert(glGetError() == GL_NO_ERROR);
-	glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &len);
-	assert(glGetError() == GL_NO_ERROR);
-    
-	if (len > 0)
-	{
-		char* ptr = new char[len+1];
-		GLsizei written=0;
-		glGetShaderInfoLog(obj, len, &written, ptr);
-		ptr[written-1]='\0';
-		assert(glGetError() == GL_NO_ERROR);
-		log.append(ptr);
-		delete[] ptr;
-        
-		printf("LOG **********************************************\n%s\n",log.c_str());
-	}
-}
-
-
-void Shader::saveProgramInfoLog(GLuint obj)
-{
-	int len = 0;
-	assert(glGetError() == GL_NO_ERROR);
-	glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &len);
-	assert(glGetError() == GL_NO_ERROR);
-
-	if (len > 0)
-	{
-		char* ptr = new char[len+1];
-		GLsizei written=0;
-		glGetProgramInfoLog(obj, len, &written, ptr);
-		ptr[written-1]='\0';
-		assert(glGetError() == GL_NO_ERROR);
-		log.append(ptr);
-		delete[] ptr;
-
-		printf("LOG **********************************************\n%s\n",log.c_str());
-	}
+	RenderBackend::current->useShader(NULL);
 }
 
 GLint Shader::getLocation(const char* varname,loctable* table)
@@ -522,7 +362,7 @@ GLint Shader::getLocation(const char* varname,loctable* table)
 	
 	if(cur == locs->end()) //not found in the locations table
 	{
-		loc = glGetUniformLocation(program, varname);
+		loc = RenderBackend::current->getUniformLocation(this, varname);
 		if (loc == -1)
 		{
 			return -1;
@@ -540,12 +380,12 @@ GLint Shader::getLocation(const char* varname,loctable* table)
 
 int Shader::getAttribLocation(const char* varname)
 {
-	int loc = glGetAttribLocation(program, varname);
-	if (loc == -1)
-	{
-		return loc;
-	}
-	assert(glGetError() == GL_NO_ERROR);
+	loctable::iterator cur = attrib_locations.find(varname);
+	if (cur != attrib_locations.end())
+		return cur->second;
+
+	int loc = RenderBackend::current->getAttribLocation(this, varname);
+	attrib_locations.insert(loctable::value_type(varname, loc));
 
 	return loc;
 }
@@ -557,16 +397,50 @@ int Shader::getUniformLocation(const char* varname)
 	{
 		return loc;
 	}
-	assert(glGetError() == GL_NO_ERROR);
 	return loc;
 }
 
+bool Shader::uniformChanged(GLint loc, const void* data, size_t size)
+{
+	if (loc < 0 || loc >= (GLint)uniform_values.size() || size > sizeof(sUniformValue::data))
+		return true;
+
+	sUniformValue& value = uniform_values[loc];
+	if (value.size == (short)size && memcmp(value.data, data, size) == 0)
+	{
+		num_skipped_calls++;
+		return false;
+	}
+	if (value.size != -1)
+	{
+		value.size = (short)size;
+		memcpy(value.data, data, size);
+	}
+	return true;
+}
+
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
-	glActiveTexture(GL_TEXTURE0 + slot);
-	glBindTexture(tex->texture_type, tex->texture_id);
+	setTexture(varname, tex->texture_id, tex->texture_type, slot);
+}
+
+void Shader::setTexture(const char* varname, unsigned int texture_id, unsigned int texture_type, int slot)
+{
+	assert(slot < 16);
+	if (current != this || bound_textures[slot] != texture_id)
+	{
+		RenderBackend::current->bindTexture(slot, texture_type, texture_id);
+		if (current == this)
+			bound_textures[slot] = texture_id;
+	}
+	else
+		num_skipped_calls++;
 	setUniform1(varname, slot);
-	glActiveTexture(GL_TEXTURE0 + slot);
+}
+
+void Shader::setUniformBlock(const char* varname, int binding)
+{
+	RenderBackend::current->setUniformBlock(this, varname, binding);
 }
 
 /*
@@ -584,160 +458,188 @@ void Shader::setUniform1(const char* varname, bool input1)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
-	glUniform1i(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	GLint value = input1;
+	if (!uniformChanged(loc, &value, sizeof(value)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT, 1, &value);
 }
 
 void Shader::setUniform1(const char* varname, int input1)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform1i(loc, input1);
-	assert (glGetError() == GL_NO_ERROR);
+	GLint value = input1;
+	if (!uniformChanged(loc, &value, sizeof(value)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT, 1, &value);
 }
 
 void Shader::setUniform2(const char* varname, int input1, int input2)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform2i(loc, input1, input2);
-	assert (glGetError() == GL_NO_ERROR);
+	GLint values[2] = { input1, input2 };
+	if (!uniformChanged(loc, values, sizeof(values)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT_VEC2, 1, values);
 }
 
 void Shader::setUniform3(const char* varname, int input1, int input2, int input3)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform3i(loc, input1, input2, input3);
-	assert (glGetError() == GL_NO_ERROR);
+	GLint values[3] = { input1, input2, input3 };
+	if (!uniformChanged(loc, values, sizeof(values)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT_VEC3, 1, values);
 }
 
 void Shader::setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform4i(loc, input1, input2, input3, input4);
-	assert (glGetError() == GL_NO_ERROR);
+	GLint values[4] = { input1, input2, input3, input4 };
+	if (!uniformChanged(loc, values, sizeof(values)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT_VEC4, 1, values);
 }
 
 void Shader::setUniform1Array(const char* varname, const int* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform1iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, input, count * sizeof(int)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT, count, input);
 }
 
 void Shader::setUniform2Array(const char* varname, const int* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform2iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, input, count * 2 * sizeof(int)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT_VEC2, count, input);
 }
 
 void Shader::setUniform3Array(const char* varname, const int* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform3iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, input, count * 3 * sizeof(int)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT_VEC3, count, input);
 }
 
 void Shader::setUniform4Array(const char* varname, const int* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform4iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, input, count * 4 * sizeof(int)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_INT_VEC4, count, input);
 }
 
 void Shader::setUniform1(const char* varname, const float input1)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform1f(loc, input1);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, &input1, sizeof(input1)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT, 1, &input1);
 }
 
 void Shader::setUniform2(const char* varname, const float input1, const float input2)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform2f(loc, input1, input2);
-	assert (glGetError() == GL_NO_ERROR);
+	float values[2] = { input1, input2 };
+	if (!uniformChanged(loc, values, sizeof(values)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_VEC2, 1, values);
 }
 
 void Shader::setUniform3(const char* varname, const float input1, const float input2, const float input3)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform3f(loc, input1, input2, input3);
-	assert (glGetError() == GL_NO_ERROR);
+	float values[3] = { input1, input2, input3 };
+	if (!uniformChanged(loc, values, sizeof(values)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_VEC3, 1, values);
 }
 
 void Shader::setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform4f(loc, input1, input2, input3, input4);
-	checkGLErrors();
+	float values[4] = { input1, input2, input3, input4 };
+	if (!uniformChanged(loc, values, sizeof(values)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_VEC4, 1, values);
 }
 
 void Shader::setUniform1Array(const char* varname, const float* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform1fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, input, count * sizeof(float)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT, count, input);
 }
 
 void Shader::setUniform2Array(const char* varname, const float* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform2fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, input, count * 2 * sizeof(float)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_VEC2, count, input);
 }
 
 void Shader::setUniform3Array(const char* varname, const float* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform3fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, input, count * 3 * sizeof(float)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_VEC3, count, input);
 }
 
 void Shader::setUniform4Array(const char* varname, const float* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform4fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, input, count * 4 * sizeof(float)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_VEC4, count, input);
 }
 
 void Shader::setMatrix44(const char* varname, const float* m)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniformMatrix4fv(loc, 1, GL_FALSE, m);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, m, 16 * sizeof(float)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_MAT4, 1, m);
 }
 
 void Shader::setMatrix44( const char* varname, const Matrix44 &m )
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniformMatrix4fv(loc, 1, GL_FALSE, m.m);
-	assert (glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, m.m, sizeof(m.m)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_MAT4, 1, m.m);
 }
 
 void Shader::setMatrix44Array( const char* varname, Matrix44* m_array, int num )
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
-	glUniformMatrix4fv(loc, num, GL_FALSE, (GLfloat*)m_array);
-	assert(glGetError() == GL_NO_ERROR);
+	if (!uniformChanged(loc, m_array, num * sizeof(Matrix44)))
+		return;
+	RenderBackend::current->setUniform(loc, GL_FLOAT_MAT4, num, m_array);
 }
 
 void Shader::init()
@@ -22,12 +22,19 @@ class Texture;
 
 class Shader
 {
+	friend class GLBackend; //compiles the program and sizes the uniform_values
+
 	int last_slot;
+	GLuint bound_textures[16]; //texture bound to each unit while this shader is enabled
 
 	static bool s_ready; //used to initialize shader vars
 
 public:
 	static Shader* current;
+	static long num_skipped_calls; //uniform uploads and texture binds skipped because nothing changed
+	static unsigned int last_revision;
+
+	unsigned int revision; //changes on every compilation, so objects built for this shader (like VAOs) know when to rebuild
 
 	Shader();
 	virtual ~Shader();
@@ -98,6 +105,10 @@ public:
 
 	//virtual void setTexture(const char* varname, const unsigned int tex) ;
 	virtual void setTexture(const char* varname, Texture* texture, int slot);
+	virtual void setTexture(const char* varname, unsigned int texture_id, unsigned int texture_type, int slot);
+
+	//uniform blocks are read from the buffer bound to the given binding point
+	virtual void setUniformBlock(const char* varname, int binding);
 
 	virtual int getAttribLocation(const char* varname);
 	virtual int getUniformLocation(const char* varname);
@@ -128,14 +139,7 @@ protected:
 	std::string macros;
 	bool from_atlas;
 
-	bool createVertexShaderObject(const std::string& shader);
-	bool createFragmentShaderObject(const std::string& shader);
-	bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader);
-	void saveShaderInfoLog(GLuint obj);
-	void saveProgramInfoLog(GLuint obj);
-
-	bool validate();
-
+	//handles of the backend
 	GLuint vs;
 	GLuint fs;
 	GLuint program;
@@ -153,9 +157,18 @@ private:
 	};	
 	typedef std::map<const char*, int, ltstr> loctable;
 
+	//shadow copy of the value uploaded to a uniform location, used to skip uploads that wouldn't change anything
+	struct sUniformValue {
+		short size; //bytes of the last upload, 0 if there was none, -1 if it is never shadowed (arrays)
+		char data[64]; //up to a matrix, bigger values are always uploaded
+	};
+	std::vector<sUniformValue> uniform_values; //indexed by location, sized when the program is linked
+	bool uniformChanged(GLint loc, const void* data, size_t size);
+
 public:
 	GLint getLocation( const char* varname, loctable* table );
 	loctable locations;	
+	loctable attrib_locations; //attribute locations, including the ones not found (-1)
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1193 @@
+#include "softrasterizer.h"
+#include "shader.h"
+#include "mesh.h"
+#include "texture.h"
+#include "fbo.h"
+#include "scene.h"
+#include "camera.h"
+#include "renderer.h"
+#include "assetcache.h"
+#include "utils.h"
+#include <iostream>
+#include <sstream>
+#include <regex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+
+//names of the eUniform, in the same order
+static const char* uniform_names[SoftRasterizer::NUM_UNIFORMS] = {
+	"u_model", "u_viewprojection", "u_color", "u_alpha_cutoff", "u_texture", "u_tex_range",
+	"u_albedo_factor", "u_specular_factor", "u_occlusion_factor", "u_emissive_factor",
+	"u_albedo_texture", "u_specular_texture", "u_normal_texture", "u_occlusion_texture", "u_metalness_texture", "u_roughness_texture", "u_omr_texture", "u_emissive_texture",
+	"u_shadow_atlas", "u_textures", "u_camera_position", "u_ambient_light", "u_last_iteration",
+	"u_lights", "u_lights_offset", "u_num_lights", "u_clustered", "u_cluster_grid", "u_cluster_lights", "u_cluster_dims", "u_cluster_depth", "u_cluster_viewport", "u_camera_front"
+};
+
+static uint64_t getNanoseconds()
+{
+	return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//m is column major, like the GL matrices
+static inline Vector4 transform(const float* m, const Vector4& v)
+{
+	return Vector4(m[0] * v.x + m[4] * v.y + m[8] * v.z + m[12] * v.w,
+		m[1] * v.x + m[5] * v.y + m[9] * v.z + m[13] * v.w,
+		m[2] * v.x + m[6] * v.y + m[10] * v.z + m[14] * v.w,
+		m[3] * v.x + m[7] * v.y + m[11] * v.z + m[15] * v.w);
+}
+
+SoftRasterizer::SoftRasterizer(int num_threads, int tile_size)
+{
+	this->tile_size = tile_size;
+	this->num_threads = num_threads > 0 ? num_threads : max(1, (int)thread::hardware_concurrency());
+	num_draw_calls = 0;
+	num_triangles = 0;
+	raster_ms = 0.0;
+	last_id = 0;
+
+	//the initial state of a GL context
+	program = NULL;
+	memset(texture_units, 0, sizeof(texture_units));
+	framebuffer_id = 0;
+	memset(viewport, 0, sizeof(viewport));
+	memset(scissor, 0, sizeof(scissor));
+	blend = cull_face = depth_test = scissor_test = false;
+	color_mask = true;
+	blend_src = GL_ONE;
+	blend_dst = GL_ZERO;
+	depth_func = GL_LESS;
+	instance_buffer_id = 0;
+	first_instance = 0;
+	timer_query = 0;
+	timer_start = 0;
+	tiles_x = tiles_y = 0;
+}
+
+void SoftRasterizer::setScreenSize(int width, int height)
+{
+	RenderBackend::setScreenSize(width, height);
+	screen_color.assign(width * height * 4, 0);
+	screen_depth.assign(width * height, 1.0f);
+	setViewport(0, 0, width, height);
+	setScissor(0, 0, width, height);
+}
+
+bool SoftRasterizer::saveScreen(const char* filename)
+{
+	//opaque, and the rows from the bottom like the ones read from a GL framebuffer
+	Image image;
+	image.resize(screen_width, screen_height, 4);
+	memcpy(image.data, &screen_color[0], screen_color.size());
+	for (int i = 0; i < screen_width * screen_height; ++i)
+		image.data[i * 4 + 3] = 255;
+	return image.saveTGA(filename, true);
+}
+
+//Headless render: loads a scene without a window or an OpenGL context, renders the frame of its camera with the Renderer and saves it
+bool SoftRasterizer::renderScene(const char* scene_filename, const char* output_filename, int width, int height)
+{
+	//everything is created through the backend, it has to be set before loading anything and outlive the scene
+	SoftRasterizer rasterizer;
+	RenderBackend* previous_backend = RenderBackend::current;
+	RenderBackend::current = &rasterizer;
+	rasterizer.setScreenSize(width, height);
+	rasterizer.setCullFace(true);
+	rasterizer.setDepthTest(true);
+
+	//the frame is drawn from the cooked assets, the meshes imported without the cache aren't quantized yet and the golden image would depend on it
+	AssetCache::cook("data/assets");
+
+	bool saved = false;
+	{
+		Camera camera;
+		camera.aspect = width / (float)height;
+
+		Scene scene;
+		scene.main_camera = &camera;
+		scene.shader = Shader::Get("data/shaders/pixel.vs", "data/shaders/single.fs");
+		if (scene.load(scene_filename))
+		{
+			//the stage computes the bounding boxes on the first update, which a headless frame never runs
+			scene.main_character->updateBoundingBox();
+			scene.monster->updateBoundingBox();
+			for (size_t i = 0; i < scene.objects.size(); ++i)
+				scene.objects[i]->updateBoundingBox();
+
+			Renderer renderer(&scene, &camera);
+			uint64_t start_time = getNanoseconds();
+			renderer.renderScene(&scene, &camera);
+			double frame_ms = (getNanoseconds() - start_time) / 1000000.0;
+
+			saved = rasterizer.saveScreen(output_filename);
+			if (saved)
+				cout << "Software frame saved at " << output_filename << ": " << rasterizer.num_draw_calls << " draw calls, " << rasterizer.num_triangles << " triangles, " << frame_ms << " ms (raster " << rasterizer.raster_ms << " ms, " << rasterizer.num_threads << " threads)" << endl;
+			else
+				cout << "ERROR: The frame couldn't be saved at: " << output_filename << endl;
+		}
+	}
+
+	RenderBackend::current = previous_backend;
+	return saved;
+}
+
+//Golden image check: a pixel differs when a channel is off by more than the tolerance, fails when more than max_different of them do
+bool SoftRasterizer::compareImages(const char* filename, const char* golden_filename, int tolerance, float max_different)
+{
+	Image image, golden;
+	if (!image.loadTGA(filename) || !golden.loadTGA(golden_filename))
+	{
+		cout << "ERROR: Golden image check, couldn't load " << filename << " or " << golden_filename << endl;
+		return false;
+	}
+	if (image.width != golden.width || image.height != golden.height)
+	{
+		cout << "ERROR: Golden image check, " << filename << " is " << image.width << "x" << image.height << " and " << golden_filename << " is " << golden.width << "x" << golden.height << endl;
+		return false;
+	}
+
+	int num_pixels = image.width * image.height;
+	int num_different = 0;
+	int max_difference = 0;
+	int num_channels = min(3, (int)min(image.num_channels, golden.num_channels));
+	for (int i = 0; i < num_pixels; ++i)
+	{
+		int difference = 0;
+		for (int j = 0; j < num_channels; ++j)
+			difference = max(difference, abs((int)image.data[i * image.num_channels + j] - (int)golden.data[i * golden.num_channels + j]));
+		max_difference = max(max_difference, difference);
+		if (difference > tolerance)
+			num_different++;
+	}
+
+	bool passed = num_different <= num_pixels * max_different;
+	cout << "Golden image check " << (passed ? "passed" : "FAILED") << ": " << num_different << " of " << num_pixels << " pixels differ (" << (100.0f * num_different / num_pixels) << "%, limit " << (100.0f * max_different) << "%), max channel difference " << max_difference << endl;
+	return passed;
+}
+
+// SHADERS ******************************************
+
+bool SoftRasterizer::compileShader(Shader* shader, const std::string& vs_code, const std::string& fs_code)
+{
+	sProgram& program = programs[shader];
+	program = sProgram();
+
+	//uniforms of both stages, each element of an array has its own location like in GL
+	static const regex uniform_regex("^\\s*uniform\\s+\\w+\\s+(\\w+)\\s*(\\[\\s*(\\d+)\\s*\\])?\\s*;");
+	static const regex attribute_regex("^\\s*(in|attribute)\\s+(\\w+)\\s+(\\w+)\\s*;");
+	int num_locations = 0;
+	int num_attributes = 0;
+	for (int stage = 0; stage < 2; ++stage)
+	{
+		stringstream code(stage == 0 ? vs_code : fs_code);
+		string line;
+		smatch match;
+		while (getline(code, line))
+		{
+			if (regex_search(line, match, uniform_regex))
+			{
+				string name = match[1];
+				if (program.uniform_locations.count(name))
+					continue;
+				int size = match[3].matched ? atoi(match[3].str().c_str()) : 1;
+				program.uniform_locations[name] = num_locations;
+				for (int i = 0; i < size && match[2].matched; ++i)
+					program.uniform_locations[name + "[" + to_string(i) + "]"] = num_locations + i;
+				num_locations += size;
+			}
+			else if (stage == 0 && regex_search(line, match, attribute_regex))
+			{
+				program.attribute_locations[match[3]] = num_attributes;
+				num_attributes += match[2] == "mat4" ? 4 : 1;
+			}
+		}
+	}
+
+	//one more location of zeros for the uniforms it doesn't have
+	program.values.assign((num_locations + 1) * 16, 0.0f);
+	for (int i = 0; i < NUM_UNIFORMS; ++i)
+	{
+		auto it = program.uniform_locations.find(uniform_names[i]);
+		program.locations[i] = it != program.uniform_locations.end() ? it->second : -1;
+	}
+
+	program.instanced = program.attribute_locations.count("u_model") != 0;
+	if (program.locations[U_LIGHTS] != -1)
+		program.type = PROGRAM_LIGHTS;
+	else if (program.locations[U_TEXTURE] != -1)
+		program.type = PROGRAM_TEXTURE;
+	else
+		program.type = PROGRAM_COLOR;
+	return true;
+}
+
+void SoftRasterizer::releaseShader(Shader* shader)
+{
+	if (program == &programs[shader])
+		program = NULL;
+	programs.erase(shader);
+}
+
+void SoftRasterizer::useShader(Shader* shader)
+{
+	auto it = shader ? programs.find(shader) : programs.end();
+	program = it != programs.end() ? &it->second : NULL;
+}
+
+int SoftRasterizer::getUniformLocation(Shader* shader, const char* varname)
+{
+	auto it = programs.find(shader);
+	if (it == programs.end())
+		return -1;
+	auto location = it->second.uniform_locations.find(varname);
+	return location != it->second.uniform_locations.end() ? location->second : -1;
+}
+
+int SoftRasterizer::getAttribLocation(Shader* shader, const char* varname)
+{
+	auto it = programs.find(shader);
+	if (it == programs.end())
+		return -1;
+	auto location = it->second.attribute_locations.find(varname);
+	return location != it->second.attribute_locations.end() ? location->second : -1;
+}
+
+void SoftRasterizer::setUniform(int location, unsigned int type, int count, const void* data)
+{
+	if (!program || location < 0)
+		return;
+
+	int components = 1;
+	bool is_int = false;
+	switch (type)
+	{
+		case GL_INT: is_int = true; break;
+		case GL_INT_VEC2: is_int = true; components = 2; break;
+		case GL_INT_VEC3: is_int = true; components = 3; break;
+		case GL_INT_VEC4: is_int = true; components = 4; break;
+		case GL_FLOAT_VEC2: components = 2; break;
+		case GL_FLOAT_VEC3: components = 3; break;
+		case GL_FLOAT_VEC4: components = 4; break;
+		case GL_FLOAT_MAT4: components = 16; break;
+	}
+
+	int num_locations = (int)program->values.size() / 16 - 1;
+	for (int i = 0; i < count && location + i < num_locations; ++i)
+	{
+		float* value = &program->values[(location + i) * 16];
+		for (int j = 0; j < components; ++j)
+			value[j] = is_int ? (float)((const int*)data)[i * components + j] : ((const float*)data)[i * components + j];
+	}
+}
+
+void SoftRasterizer::bindTexture(int slot, unsigned int texture_type, unsigned int texture_id)
+{
+	texture_units[slot] = texture_id;
+}
+
+float* SoftRasterizer::getUniform(int uniform, int element)
+{
+	int location = program->locations[uniform];
+	if (location == -1)
+		return &program->values[program->values.size() - 16];
+	return &program->values[(location + element) * 16];
+}
+
+SoftRasterizer::sTexture* SoftRasterizer::getTexture(int uniform)
+{
+	if (program->locations[uniform] == -1)
+		return NULL;
+	int slot = getInt(uniform);
+	if (slot < 0 || slot >= 16)
+		return NULL;
+	auto it = textures.find(texture_units[slot]);
+	return it != textures.end() ? &it->second : NULL;
+}
+
+// MESHES ******************************************
+
+bool SoftRasterizer::enableInstanceBuffer(Mesh* mesh, Shader* shader, unsigned int buffer_id, int first_instance)
+{
+	auto it = programs.find(shader);
+	if (it == programs.end() || !it->second.instanced)
+		return false;
+	instance_buffer_id = buffer_id;
+	this->first_instance = first_instance;
+	return true;
+}
+
+void SoftRasterizer::disableInstanceBuffer(Mesh* mesh, Shader* shader)
+{
+	instance_buffer_id = 0;
+	first_instance = 0;
+}
+
+//Vertex stage of pixel.vs and instanced.vs, the other vertex shaders only need the position and the uv
+void SoftRasterizer::transformVertex(Mesh* mesh, unsigned int index, const Matrix44& model, sVertex& vertex)
+{
+	Vector4 world = transform(model.m, Vector4(mesh->vertices[index], 1.0f));
+	Vector3 normal = index < mesh->normals.size() ? mesh->normals[index] : Vector3(0, 1, 0);
+	normal = transform(model.m, Vector4(normal, 0.0f)).xyz();
+	Vector2 uv = index < mesh->uvs.size() ? mesh->uvs[index] : Vector2();
+
+	//the tangents only exist in the interleaved buffer, (0,0,0,1) like the attribute of a mesh without them
+	Vector4 tangent(0, 0, 0, 1);
+	const sVertexLayout::sAttribute& format = mesh->vertex_layout.attributes[VERTEX_TANGENT];
+	if (format.components == 4 && mesh->interleaved.size())
+	{
+		const char* data = &mesh->interleaved[index * mesh->vertex_layout.stride + format.offset];
+		if (format.type == GL_BYTE)
+			tangent.set(max(data[0] / 127.0f, -1.0f), max(data[1] / 127.0f, -1.0f), max(data[2] / 127.0f, -1.0f), max(data[3] / 127.0f, -1.0f));
+		else if (format.type == GL_FLOAT)
+			memcpy(tangent.v, data, sizeof(float) * 4);
+	}
+	Vector3 world_tangent = transform(model.m, Vector4(tangent.xyz(), 0.0f)).xyz();
+
+	float* viewprojection = program->locations[U_VIEWPROJECTION] != -1 ? getUniform(U_VIEWPROJECTION) : (float*)Matrix44::IDENTITY.m;
+	vertex.clip = transform(viewprojection, Vector4(world.xyz(), 1.0f));
+	float varyings[NUM_VARYINGS] = { world.x, world.y, world.z, normal.x, normal.y, normal.z, uv.x, uv.y, world_tangent.x, world_tangent.y, world_tangent.z, tangent.w };
+	memcpy(vertex.varyings, varyings, sizeof(varyings));
+}
+
+void SoftRasterizer::drawMesh(Mesh* mesh, unsigned int primitive, int start, int size, int lod_offset, int num_instances)
+{
+	//only the triangles of the Renderer are drawn, the lines and points of the debug views aren't
+	if (!program || primitive != GL_TRIANGLES || size < 3 || !getTarget(framebuffer_id, target))
+		return;
+	num_draw_calls++;
+
+	//the levels of detail have their own vector, on the GPU they are after m_indices
+	const unsigned int* indices = NULL;
+	if (mesh->m_indices.size())
+		indices = (lod_offset ? &mesh->lod_indices[0] : &mesh->m_indices[0]) + start;
+
+	//models: the uniform, or the instances buffer when u_model is an attribute
+	vector<Matrix44> models;
+	if (program->instanced)
+	{
+		vector<char>& buffer = buffers[instance_buffer_id];
+		int num_models = (int)(buffer.size() / sizeof(Matrix44));
+		for (int i = first_instance; i < first_instance + max(num_instances, 1) && i < num_models; ++i)
+			models.push_back(((Matrix44*)&buffer[0])[i]);
+	}
+	else
+	{
+		Matrix44 model;
+		if (program->locations[U_MODEL] != -1)
+			memcpy(model.m, getUniform(U_MODEL), sizeof(model.m));
+		models.assign(max(num_instances, 1), model);
+	}
+
+	//vertex stage on demand and primitive assembly
+	triangles.clear();
+	unsigned int num_vertices = (unsigned int)mesh->vertices.size();
+	vertices.resize(num_vertices);
+	for (size_t instance = 0; instance < models.size(); ++instance)
+	{
+		vertex_stamps.assign(num_vertices, 0);
+		for (int i = 0; i + 2 < size; i += 3)
+		{
+			const sVertex* triangle[3];
+			bool valid = true;
+			for (int j = 0; j < 3 && valid; ++j)
+			{
+				unsigned int index = indices ? indices[i + j] : (unsigned int)(start + i + j);
+				valid = index < num_vertices;
+				if (!valid)
+					break;
+				if (!vertex_stamps[index])
+				{
+					transformVertex(mesh, index, models[instance], vertices[index]);
+					vertex_stamps[index] = 1;
+				}
+				triangle[j] = &vertices[index];
+			}
+			if (valid)
+				addTriangle(*triangle[0], *triangle[1], *triangle[2]);
+		}
+	}
+	num_triangles += (int)triangles.size();
+	if (triangles.empty())
+		return;
+
+	//binning: each triangle goes to every tile its bounding box overlaps
+	tiles_x = (target.width + tile_size - 1) / tile_size;
+	tiles_y = (target.height + tile_size - 1) / tile_size;
+	if ((int)tiles.size() < tiles_x * tiles_y)
+		tiles.resize(tiles_x * tiles_y);
+	for (size_t i = 0; i < triangles.size(); ++i)
+	{
+		sTriangle& t = triangles[i];
+		for (int y = t.min_y / tile_size; y <= t.max_y / tile_size; ++y)
+			for (int x = t.min_x / tile_size; x <= t.max_x / tile_size; ++x)
+			{
+				vector<int>& tile = tiles[x + y * tiles_x];
+				if (tile.empty())
+					used_tiles.push_back(x + y * tiles_x);
+				tile.push_back((int)i);
+			}
+	}
+
+	//raster stage: the threads take the tiles one by one, inside a tile the triangles keep their order
+	uint64_t raster_start = getNanoseconds();
+	int workers_count = min(num_threads, (int)used_tiles.size());
+	if (workers_count > 1)
+	{
+		atomic<int> next_tile(0);
+		vector<thread> workers;
+		for (int i = 0; i < workers_count; ++i)
+			workers.push_back(thread([this, &next_tile]() {
+				for (int tile = next_tile++; tile < (int)used_tiles.size(); tile = next_tile++)
+					rasterizeTile(used_tiles[tile]);
+			}));
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+	else
+		for (size_t i = 0; i < used_tiles.size(); ++i)
+			rasterizeTile(used_tiles[i]);
+	raster_ms += (getNanoseconds() - raster_start) / 1000000.0;
+
+	for (size_t i = 0; i < used_tiles.size(); ++i)
+		tiles[used_tiles[i]].clear();
+	used_tiles.clear();
+}
+
+//Linear interpolation of a clipped vertex
+static SoftRasterizer::sVertex lerpVertex(const SoftRasterizer::sVertex& a, const SoftRasterizer::sVertex& b, float t)
+{
+	SoftRasterizer::sVertex v;
+	v.clip = lerp(a.clip, b.clip, t);
+	for (int i = 0; i < SoftRasterizer::NUM_VARYINGS; ++i)
+		v.varyings[i] = a.varyings[i] * (1.0f - t) + b.varyings[i] * t;
+	return v;
+}
+
+//Signed area of the parallelogram of a triangle, positive if counterclockwise
+static inline float edgeFunction(const Vector3& a, const Vector3& b, float x, float y)
+{
+	return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+//Clip against the near plane (z >= -w), project to the viewport, cull and add the triangles
+void SoftRasterizer::addTriangle(const sVertex& a, const sVertex& b, const sVertex& c)
+{
+	const sVertex* triangle[3] = { &a, &b, &c };
+	sVertex polygon[4];
+	int num_polygon = 0;
+	for (int j = 0; j < 3; ++j)
+	{
+		const sVertex& v0 = *triangle[j];
+		const sVertex& v1 = *triangle[(j + 1) % 3];
+		float d0 = v0.clip.z + v0.clip.w;
+		float d1 = v1.clip.z + v1.clip.w;
+		if (d0 >= 0)
+			polygon[num_polygon++] = v0;
+		if ((d0 >= 0) != (d1 >= 0))
+			polygon[num_polygon++] = lerpVertex(v0, v1, d0 / (d0 - d1));
+	}
+
+	//pixels it can cover: the viewport, the scissor and the target
+	int region[4] = { max(viewport[0], 0), max(viewport[1], 0), min(viewport[0] + viewport[2], target.width) - 1, min(viewport[1] + viewport[3], target.height) - 1 };
+	if (scissor_test)
+	{
+		region[0] = max(region[0], scissor[0]);
+		region[1] = max(region[1], scissor[1]);
+		region[2] = min(region[2], scissor[0] + scissor[2] - 1);
+		region[3] = min(region[3], scissor[1] + scissor[3] - 1);
+	}
+
+	for (int i = 1; i + 1 < num_polygon; ++i)
+	{
+		const sVertex* v[3] = { &polygon[0], &polygon[i], &polygon[i + 1] };
+		sTriangle t;
+		for (int j = 0; j < 3; ++j)
+		{
+			float inv_w = 1.0f / v[j]->clip.w;
+			t.screen[j].set(viewport[0] + (v[j]->clip.x * inv_w * 0.5f + 0.5f) * viewport[2], viewport[1] + (v[j]->clip.y * inv_w * 0.5f + 0.5f) * viewport[3], v[j]->clip.z * inv_w * 0.5f + 0.5f);
+			t.inv_w[j] = inv_w;
+			for (int k = 0; k < NUM_VARYINGS; ++k)
+				t.varyings[j][k] = v[j]->varyings[k] * inv_w;
+		}
+
+		//back faces are the clockwise ones, the others are turned counterclockwise
+		t.area = edgeFunction(t.screen[0], t.screen[1], t.screen[2].x, t.screen[2].y);
+		if (t.area == 0 || (t.area < 0 && cull_face))
+			continue;
+		if (t.area < 0)
+		{
+			swap(v[1], v[2]);
+			swap(t.screen[1], t.screen[2]);
+			swap(t.inv_w[1], t.inv_w[2]);
+			swap(t.varyings[1], t.varyings[2]);
+			t.area = -t.area;
+		}
+
+		t.min_x = max(region[0], (int)floor(min(t.screen[0].x, min(t.screen[1].x, t.screen[2].x))));
+		t.max_x = min(region[2], (int)ceil(max(t.screen[0].x, max(t.screen[1].x, t.screen[2].x))));
+		t.min_y = max(region[1], (int)floor(min(t.screen[0].y, min(t.screen[1].y, t.screen[2].y))));
+		t.max_y = min(region[3], (int)ceil(max(t.screen[0].y, max(t.screen[1].y, t.screen[2].y))));
+		if (t.min_x > t.max_x || t.min_y > t.max_y)
+			continue;
+
+		//counterclockwise edges work as the screen derivatives of cotangent_frame, and the uvs per pixel pick the mipmap
+		const float* p[3] = { v[0]->varyings, v[1]->varyings, v[2]->varyings };
+		for (int j = 0; j < 2; ++j)
+		{
+			t.edge_world[j].set(p[j + 1][0] - p[0][0], p[j + 1][1] - p[0][1], p[j + 1][2] - p[0][2]);
+			t.edge_uv[j] = Vector2(p[j + 1][6] - p[0][6], p[j + 1][7] - p[0][7]);
+		}
+		float uv_area = fabs(t.edge_uv[0].x * t.edge_uv[1].y - t.edge_uv[0].y * t.edge_uv[1].x);
+		t.uv_density = uv_area > 0 ? 0.5f * log2(uv_area / t.area) : -100.0f;
+
+		triangles.push_back(t);
+	}
+}
+
+// RASTER ******************************************
+
+static inline bool depthTest(unsigned int func, float depth, float stored)
+{
+	switch (func)
+	{
+		case GL_NEVER: return false;
+		case GL_LESS: return depth < stored;
+		case GL_EQUAL: return depth == stored;
+		case GL_LEQUAL: return depth <= stored;
+		case GL_GREATER: return depth > stored;
+		case GL_NOTEQUAL: return depth != stored;
+		case GL_GEQUAL: return depth >= stored;
+	}
+	return true;
+}
+
+static inline Vector4 blendFactor(unsigned int factor, const Vector4& src, const Vector4& dst)
+{
+	switch (factor)
+	{
+		case GL_ZERO: return Vector4(0, 0, 0, 0);
+		case GL_SRC_COLOR: return src;
+		case GL_ONE_MINUS_SRC_COLOR: return Vector4(1 - src.x, 1 - src.y, 1 - src.z, 1 - src.w);
+		case GL_DST_COLOR: return dst;
+		case GL_ONE_MINUS_DST_COLOR: return Vector4(1 - dst.x, 1 - dst.y, 1 - dst.z, 1 - dst.w);
+		case GL_SRC_ALPHA: return Vector4(src.w, src.w, src.w, src.w);
+		case GL_ONE_MINUS_SRC_ALPHA: return Vector4(1 - src.w, 1 - src.w, 1 - src.w, 1 - src.w);
+		case GL_DST_ALPHA: return Vector4(dst.w, dst.w, dst.w, dst.w);
+		case GL_ONE_MINUS_DST_ALPHA: return Vector4(1 - dst.w, 1 - dst.w, 1 - dst.w, 1 - dst.w);
+	}
+	return Vector4(1, 1, 1, 1);
+}
+
+//Rasterize and shade the triangles of a tile, in the order they were drawn
+void SoftRasterizer::rasterizeTile(int tile_index)
+{
+	int tile_x = (tile_index % tiles_x) * tile_size;
+	int tile_y = (tile_index / tiles_x) * tile_size;
+	int tile_max_x = tile_x + tile_size - 1;
+	int tile_max_y = tile_y + tile_size - 1;
+	bool write_color = color_mask && target.color;
+
+	vector<int>& tile = tiles[tile_index];
+	for (size_t i = 0; i < tile.size(); ++i)
+	{
+		const sTriangle& t = triangles[tile[i]];
+		const Vector3* p = t.screen;
+		int min_x = max(tile_x, t.min_x);
+		int max_x = min(tile_max_x, t.max_x);
+		int min_y = max(tile_y, t.min_y);
+		int max_y = min(tile_max_y, t.max_y);
+
+		for (int y = min_y; y <= max_y; ++y)
+			for (int x = min_x; x <= max_x; ++x)
+			{
+				//barycentric coordinates of the pixel center
+				float px = x + 0.5f, py = y + 0.5f;
+				float b0 = edgeFunction(p[1], p[2], px, py);
+				float b1 = edgeFunction(p[2], p[0], px, py);
+				float b2 = edgeFunction(p[0], p[1], px, py);
+				if (b0 < 0 || b1 < 0 || b2 < 0)
+					continue;
+				b0 /= t.area; b1 /= t.area; b2 /= t.area;
+
+				//clipped by the far plane, then the depth test
+				float depth = b0 * p[0].z + b1 * p[1].z + b2 * p[2].z;
+				int pixel = x + y * target.width;
+				if (depth < 0.0f || depth > 1.0f)
+					continue;
+				if (depth_test && !depthTest(depth_func, depth, target.depth[pixel]))
+					continue;
+
+				//perspective correct varyings
+				float w = 1.0f / (b0 * t.inv_w[0] + b1 * t.inv_w[1] + b2 * t.inv_w[2]);
+				float varyings[NUM_VARYINGS];
+				for (int k = 0; k < NUM_VARYINGS; ++k)
+					varyings[k] = (t.varyings[0][k] * b0 + t.varyings[1][k] * b1 + t.varyings[2][k] * b2) * w;
+
+				Vector4 color;
+				if (!shadeFragment(t, varyings, px, py, color))
+					continue;
+
+				//without the depth test GL doesn't write the depth either
+				if (depth_test)
+					target.depth[pixel] = depth;
+				if (!write_color)
+					continue;
+
+				Uint8* out = target.color + pixel * target.num_channels;
+				if (blend)
+				{
+					Vector4 dst(out[0] / 255.0f, out[1] / 255.0f, out[2] / 255.0f, target.num_channels == 4 ? out[3] / 255.0f : 1.0f);
+					color = color * blendFactor(blend_src, color, dst) + dst * blendFactor(blend_dst, color, dst);
+				}
+				for (int k = 0; k < target.num_channels; ++k)
+					out[k] = (Uint8)(clamp(color.v[k]) * 255.0f + 0.5f);
+			}
+	}
+}
+
+//Bilinear, from the mipmap closer to the uvs per pixel. Depth maps are read from the nearest texel
+Vector4 SoftRasterizer::sampleTexture(sTexture* texture, Vector2 uv, float uv_density)
+{
+	if (!texture || !texture->width || !texture->height)
+		return Vector4(0, 0, 0, 1);
+
+	if (texture->depth.size())
+	{
+		int x = (int)clamp(uv.x * texture->width, 0.0f, texture->width - 1.0f);
+		int y = (int)clamp(uv.y * texture->height, 0.0f, texture->height - 1.0f);
+		float depth = texture->depth[x + y * texture->width];
+		return Vector4(depth, depth, depth, 1);
+	}
+	if (texture->levels.empty())
+		return Vector4(0, 0, 0, 1);
+
+	int level = (int)floor(uv_density + log2((float)max(texture->width, texture->height)) + 0.5f);
+	level = max(0, min(level, (int)texture->levels.size() - 1));
+	int width = max(texture->width >> level, 1);
+	int height = max(texture->height >> level, 1);
+	const Uint8* data = &texture->levels[level][0];
+	int num_channels = texture->num_channels;
+
+	float fx = uv.x * width - 0.5f;
+	float fy = uv.y * height - 0.5f;
+	int x0 = (int)floor(fx), y0 = (int)floor(fy);
+	float tx = fx - x0, ty = fy - y0;
+
+	Vector4 result;
+	for (int j = 0; j < 4; ++j)
+	{
+		int x = x0 + (j & 1);
+		int y = y0 + (j >> 1);
+		if (texture->wrap == GL_REPEAT)
+		{
+			x = ((x % width) + width) % width;
+			y = ((y % height) + height) % height;
+		}
+		else
+		{
+			x = max(0, min(x, width - 1));
+			y = max(0, min(y, height - 1));
+		}
+		const Uint8* texel = data + (x + y * width) * num_channels;
+		float weight = ((j & 1) ? tx : 1 - tx) * ((j >> 1) ? ty : 1 - ty);
+		Vector4 value(texel[0] / 255.0f, num_channels > 1 ? texel[1] / 255.0f : 0.0f, num_channels > 2 ? texel[2] / 255.0f : 0.0f, num_channels > 3 ? texel[3] / 255.0f : 1.0f);
+		result = result + value * weight;
+	}
+	return result;
+}
+
+//Fragment stage: color.fs, image.fs and single.fs. False if it is discarded
+bool SoftRasterizer::shadeFragment(const sTriangle& triangle, const float* varyings, float x, float y, Vector4& color)
+{
+	float* u_color = getUniform(U_COLOR);
+	Vector2 uv(varyings[6], varyings[7]);
+	if (program->type == PROGRAM_COLOR)
+	{
+		color.set(u_color[0], u_color[1], u_color[2], u_color[3]);
+		return true;
+	}
+	if (program->type == PROGRAM_TEXTURE)
+	{
+		if (program->locations[U_TEX_RANGE] != -1)
+		{
+			float* range = getUniform(U_TEX_RANGE);
+			uv.x = range[2] * uv.x + range[0];
+			uv.y = 1.0f - (-range[3] * uv.y + range[1] + range[3]);
+		}
+		color = Vector4(u_color[0], u_color[1], u_color[2], u_color[3]) * sampleTexture(getTexture(U_TEXTURE), uv, triangle.uv_density);
+		return true;
+	}
+
+	//single.fs, alpha mask
+	if (u_color[3] < getUniform(U_ALPHA_CUTOFF)[0])
+		return false;
+
+	bool has_texture[8];
+	for (int i = 0; i < 8; ++i)
+		has_texture[i] = (int)getUniform(U_TEXTURES, i)[0] == 1;
+
+	//albedo
+	if (has_texture[0])
+		color = sampleTexture(getTexture(U_ALBEDO_TEXTURE), uv, triangle.uv_density);
+	else
+		color = Vector4(Vector3(getUniform(U_ALBEDO_FACTOR)[0], getUniform(U_ALBEDO_FACTOR)[1], getUniform(U_ALBEDO_FACTOR)[2]), 1.0f);
+
+	//occlusion
+	Vector3 ambient_factor;
+	if (has_texture[3])
+		ambient_factor = sampleTexture(getTexture(U_OCCLUSION_TEXTURE), uv, triangle.uv_density).xyz();
+	else if (has_texture[6])
+		ambient_factor = Vector3(sampleTexture(getTexture(U_OMR_TEXTURE), uv, triangle.uv_density).x);
+	else
+		ambient_factor.set(getUniform(U_OCCLUSION_FACTOR)[0], getUniform(U_OCCLUSION_FACTOR)[1], getUniform(U_OCCLUSION_FACTOR)[2]);
+
+	//normal, perturbed by the normal map with the tangents of the mesh or the cotangent frame of the triangle
+	Vector3 world_position(varyings[0], varyings[1], varyings[2]);
+	Vector3 normal(varyings[3], varyings[4], varyings[5]);
+	if (normal.dot(normal) > 0)
+		normal.normalize();
+	if (has_texture[2])
+	{
+		Vector3 normal_pixel = sampleTexture(getTexture(U_NORMAL_TEXTURE), uv, triangle.uv_density).xyz() * (255.0f / 127.0f) - Vector3(128.0f / 127.0f);
+		Vector3 tangent(varyings[8], varyings[9], varyings[10]);
+		Vector3 T, B;
+		if (tangent.dot(tangent) > 0)
+		{
+			T = tangent - normal * normal.dot(tangent);
+			if (T.dot(T) > 0)
+				T.normalize();
+			B = normal.cross(T) * varyings[11];
+		}
+		else
+		{
+			Vector3 dp2perp = triangle.edge_world[1].cross(normal);
+			Vector3 dp1perp = normal.cross(triangle.edge_world[0]);
+			T = dp2perp * triangle.edge_uv[0].x + dp1perp * triangle.edge_uv[1].x;
+			B = dp2perp * triangle.edge_uv[0].y + dp1perp * triangle.edge_uv[1].y;
+			float max_length = max(T.dot(T), B.dot(B));
+			float invmax = max_length > 0 ? 1.0f / sqrt(max_length) : 0.0f;
+			T = T * invmax;
+			B = B * invmax;
+		}
+		Vector3 perturbed = T * normal_pixel.x + B * normal_pixel.y + normal * normal_pixel.z;
+		if (perturbed.dot(perturbed) > 0)
+			normal = perturbed.normalize();
+	}
+
+	//lights
+	float* ambient_light = getUniform(U_AMBIENT_LIGHT);
+	Vector3 phong_light = ambient_factor * Vector3(ambient_light[0], ambient_light[1], ambient_light[2]);
+	if (getInt(U_CLUSTERED))
+	{
+		float* camera_position = getUniform(U_CAMERA_POSITION);
+		float* camera_front = getUniform(U_CAMERA_FRONT);
+		float* cluster_depth = getUniform(U_CLUSTER_DEPTH);
+		float* cluster_viewport = getUniform(U_CLUSTER_VIEWPORT);
+		float* dims = getUniform(U_CLUSTER_DIMS);
+		float view_depth = (world_position - Vector3(camera_position[0], camera_position[1], camera_position[2])).dot(Vector3(camera_front[0], camera_front[1], camera_front[2]));
+		int cluster[3] = { (int)(x / cluster_viewport[0] * dims[0]), (int)(y / cluster_viewport[1] * dims[1]), (int)floor(log(max(view_depth, 0.0001f)) * cluster_depth[0] + cluster_depth[1]) };
+		for (int i = 0; i < 3; ++i)
+			cluster[i] = max(0, min(cluster[i], (int)dims[i] - 1));
+		int cluster_index = cluster[0] + (int)dims[0] * (cluster[1] + (int)dims[1] * cluster[2]);
+
+		sTexture* grid = getTexture(U_CLUSTER_GRID);
+		sTexture* lights = getTexture(U_CLUSTER_LIGHTS);
+		vector<char>& grid_buffer = buffers[grid ? grid->buffer_id : 0];
+		vector<char>& lights_buffer = buffers[lights ? lights->buffer_id : 0];
+		if ((size_t)(cluster_index + 1) * 2 * sizeof(unsigned int) <= grid_buffer.size())
+		{
+			const unsigned int* cluster_data = (const unsigned int*)&grid_buffer[0] + cluster_index * 2;
+			const unsigned short* indices = lights_buffer.size() ? (const unsigned short*)&lights_buffer[0] : NULL;
+			for (unsigned int i = 0; i < cluster_data[1] && (cluster_data[0] + i + 1) * sizeof(unsigned short) <= lights_buffer.size(); ++i)
+				phong_light = phong_light + computeLight(indices[cluster_data[0] + i], triangle, world_position, normal, uv);
+		}
+	}
+	else
+	{
+		int offset = getInt(U_LIGHTS_OFFSET);
+		int num_lights = getInt(U_NUM_LIGHTS);
+		for (int i = 0; i < num_lights; ++i)
+			phong_light = phong_light + computeLight(offset + i, triangle, world_position, normal, uv);
+	}
+
+	color.x *= phong_light.x;
+	color.y *= phong_light.y;
+	color.z *= phong_light.z;
+
+	if (getInt(U_LAST_ITERATION) && has_texture[7])
+	{
+		float* emissive_factor = getUniform(U_EMISSIVE_FACTOR);
+		Vector3 emissive_light = Vector3(emissive_factor[0], emissive_factor[1], emissive_factor[2]) * sampleTexture(getTexture(U_EMISSIVE_TEXTURE), uv, triangle.uv_density).xyz();
+		color.x += emissive_light.x;
+		color.y += emissive_light.y;
+		color.z += emissive_light.z;
+	}
+	return true;
+}
+
+//LightEquation and PhongEquation of single.fs, the light is read from the lights buffer laid out as sLightData
+Vector3 SoftRasterizer::computeLight(int index, const sTriangle& triangle, const Vector3& world_position, const Vector3& normal, const Vector2& uv)
+{
+	sTexture* lights = getTexture(U_LIGHTS);
+	vector<char>& buffer = buffers[lights ? lights->buffer_id : 0];
+	if (index < 0 || (size_t)(index + 1) * sizeof(sLightData) > buffer.size())
+		return Vector3();
+	const sLightData& light = ((const sLightData*)&buffer[0])[index];
+
+	float light_intensity = light.position.w;
+	Vector3 light_vector;
+	float light_distance;
+	int light_type = (int)light.direction.w;
+	if (light_type == 0 || light_type == 1)
+		light_vector = light.position.xyz() - world_position;
+	else if (light_type == 2)
+		light_vector = light.direction.xyz();
+	else
+		return Vector3();
+	light_distance = (float)light_vector.length();
+	light_vector = light_vector * (1.0f / light_distance);
+
+	if (light_type == 1)
+	{
+		float spot_cosine = light_vector.dot(light.direction.xyz() * -1.0f);
+		if (spot_cosine < light.cone.y)
+			return Vector3();
+		light_intensity *= pow(spot_cosine, max(light.cone.x, 0.0f));
+	}
+
+	//vectors
+	Vector3 R = normal * (2.0f * normal.dot(light_vector)) - light_vector;
+	Vector3 V = Vector3(getUniform(U_CAMERA_POSITION)[0], getUniform(U_CAMERA_POSITION)[1], getUniform(U_CAMERA_POSITION)[2]) - world_position;
+	if (R.dot(R) > 0)
+		R.normalize();
+	if (V.dot(V) > 0)
+		V.normalize();
+	float NdotL = clamp(normal.dot(light_vector));
+	float RdotV = clamp(R.dot(V));
+
+	//shadow, from the tile of the light in the atlas
+	float shadow_factor = 1.0f;
+	if (light.cone.z > 0.0f)
+	{
+		Vector4 proj_pos = transform(light.shadow_vp.m, Vector4(world_position, 1.0f));
+		Vector2 shadow_uv(proj_pos.x / proj_pos.w * 0.5f + 0.5f, proj_pos.y / proj_pos.w * 0.5f + 0.5f);
+		float real_depth = (proj_pos.z - light.shadow.x) / proj_pos.w * 0.5f + 0.5f;
+		if (shadow_uv.x >= 0.0f && shadow_uv.x <= 1.0f && shadow_uv.y >= 0.0f && shadow_uv.y <= 1.0f && real_depth >= 0.0f && real_depth <= 1.0f)
+		{
+			shadow_uv = Vector2(light.shadow_tile.x + shadow_uv.x * light.shadow_tile.z, light.shadow_tile.y + shadow_uv.y * light.shadow_tile.w);
+			if (sampleTexture(getTexture(U_SHADOW_ATLAS), shadow_uv, 0.0f).x < real_depth)
+				shadow_factor = 0.0f;
+		}
+	}
+
+	//attenuation, not for the directional lights
+	float attenuation_factor = 1.0f;
+	if (light_type != 2)
+		attenuation_factor = pow(max((light.color.w - light_distance) / light.color.w, 0.0f), 2.0f);
+
+	//specular
+	Vector3 specular_factor;
+	bool has_texture[7];
+	for (int i = 0; i < 7; ++i)
+		has_texture[i] = (int)getUniform(U_TEXTURES, i)[0] == 1;
+	if (has_texture[1])
+		specular_factor = sampleTexture(getTexture(U_SPECULAR_TEXTURE), uv, triangle.uv_density).xyz();
+	else if (has_texture[6])
+	{
+		Vector4 omr = sampleTexture(getTexture(U_OMR_TEXTURE), uv, triangle.uv_density);
+		specular_factor = Vector3(omr.z * pow(RdotV, omr.y * 20.0f));
+	}
+	else if (has_texture[4] && has_texture[5])
+	{
+		Vector4 metalness = sampleTexture(getTexture(U_METALNESS_TEXTURE), uv, triangle.uv_density);
+		Vector4 roughness = sampleTexture(getTexture(U_ROUGHNESS_TEXTURE), uv, triangle.uv_density);
+		specular_factor.set(roughness.x * pow(RdotV, metalness.x * 20.0f), roughness.y * pow(RdotV, metalness.y * 20.0f), roughness.z * pow(RdotV, metalness.z * 20.0f));
+	}
+	else
+		specular_factor.set(getUniform(U_SPECULAR_FACTOR)[0], getUniform(U_SPECULAR_FACTOR)[1], getUniform(U_SPECULAR_FACTOR)[2]);
+
+	return (Vector3(NdotL) + specular_factor) * light.color.xyz() * (attenuation_factor * light_intensity * shadow_factor);
+}
+
+// BUFFERS ******************************************
+
+void SoftRasterizer::uploadBuffer(unsigned int& buffer_id, const void* data, size_t size)
+{
+	if (!buffer_id)
+		buffer_id = ++last_id;
+	buffers[buffer_id].assign((const char*)data, (const char*)data + (data ? size : 0));
+}
+
+void SoftRasterizer::uploadTextureBuffer(unsigned int& buffer_id, unsigned int& texture_id, unsigned int internal_format, const void* data, size_t size, int slot)
+{
+	if (!buffer_id)
+	{
+		buffer_id = ++last_id;
+		texture_id = ++last_id;
+	}
+	buffers[buffer_id].assign((const char*)data, (const char*)data + (data ? size : 0));
+	sTexture& texture = textures[texture_id];
+	texture.buffer_id = buffer_id;
+	texture.internal_format = internal_format;
+	texture_units[slot] = texture_id;
+}
+
+// TEXTURES ******************************************
+
+void SoftRasterizer::createTexture(Texture* texture)
+{
+	texture->texture_id = ++last_id;
+	textures[texture->texture_id] = sTexture();
+}
+
+void SoftRasterizer::uploadTexture(Texture* texture, unsigned int format, unsigned int type, const Uint8* data, unsigned int internal_format)
+{
+	sTexture& t = textures[texture->texture_id];
+	t = sTexture();
+	t.width = (int)texture->width;
+	t.height = (int)texture->height;
+	t.internal_format = internal_format;
+	t.wrap = texture->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+	int num_pixels = t.width * t.height;
+
+	//depth maps start cleared, nothing uploads them
+	if (format == GL_DEPTH_COMPONENT)
+	{
+		t.depth.assign(num_pixels, 1.0f);
+		if (data && type == GL_FLOAT)
+			memcpy(&t.depth[0], data, num_pixels * sizeof(float));
+		return;
+	}
+
+	switch (format)
+	{
+		case GL_RED: case GL_ALPHA: case GL_LUMINANCE: t.num_channels = 1; break;
+		case GL_RG: case GL_LUMINANCE_ALPHA: t.num_channels = 2; break;
+		case GL_RGB: case GL_BGR: t.num_channels = 3; break;
+		default: t.num_channels = 4; break;
+	}
+	t.levels.resize(1);
+	vector<Uint8>& level = t.levels[0];
+	level.assign(num_pixels * t.num_channels, 0);
+	if (data && type == GL_UNSIGNED_BYTE)
+		memcpy(&level[0], data, level.size());
+	else if (data && type == GL_FLOAT)
+		for (size_t i = 0; i < level.size(); ++i)
+			level[i] = (Uint8)(clamp(((const float*)data)[i]) * 255.0f + 0.5f);
+
+	if (data && texture->mipmaps)
+		generateMipmaps(texture);
+}
+
+//Box filter of the previous level, down to 1x1
+void SoftRasterizer::generateMipmaps(Texture* texture)
+{
+	auto it = textures.find(texture->texture_id);
+	if (it == textures.end() || it->second.levels.empty())
+		return;
+	sTexture& t = it->second;
+	t.levels.resize(1);
+	int width = t.width, height = t.height, n = t.num_channels;
+	while (width > 1 || height > 1)
+	{
+		int next_width = max(width / 2, 1), next_height = max(height / 2, 1);
+		vector<Uint8> next(next_width * next_height * n);
+		const vector<Uint8>& previous = t.levels.back();
+		for (int y = 0; y < next_height; ++y)
+			for (int x = 0; x < next_width; ++x)
+				for (int c = 0; c < n; ++c)
+				{
+					int x0 = x * 2, y0 = y * 2;
+					int x1 = min(x0 + 1, width - 1), y1 = min(y0 + 1, height - 1);
+					int sum = previous[(x0 + y0 * width) * n + c] + previous[(x1 + y0 * width) * n + c] + previous[(x0 + y1 * width) * n + c] + previous[(x1 + y1 * width) * n + c];
+					next[(x + y * next_width) * n + c] = (Uint8)((sum + 2) / 4);
+				}
+		t.levels.push_back(next);
+		width = next_width;
+		height = next_height;
+	}
+}
+
+void SoftRasterizer::setTextureWrap(Texture* texture, int wrap)
+{
+	auto it = textures.find(texture->texture_id);
+	if (it != textures.end())
+		it->second.wrap = wrap;
+}
+
+void SoftRasterizer::releaseTexture(Texture* texture)
+{
+	textures.erase(texture->texture_id);
+}
+
+// FRAMEBUFFERS ******************************************
+
+bool SoftRasterizer::createFramebuffer(FBO* fbo, Texture* depth_texture, int cubemap_face)
+{
+	if (fbo->fbo_id == 0)
+		fbo->fbo_id = ++last_id;
+	sFramebuffer& framebuffer = framebuffers[fbo->fbo_id];
+	framebuffer = sFramebuffer();
+	framebuffer.width = fbo->width;
+	framebuffer.height = fbo->height;
+	framebuffer.color_texture_id = fbo->color_textures[0] ? fbo->color_textures[0]->texture_id : 0;
+	framebuffer.depth_texture_id = depth_texture ? depth_texture->texture_id : 0;
+	if (!depth_texture)
+		framebuffer.depth.assign(fbo->width * fbo->height, 1.0f);
+	return true;
+}
+
+bool SoftRasterizer::createDepthFramebuffer(FBO* fbo)
+{
+	fbo->fbo_id = ++last_id;
+	sFramebuffer& framebuffer = framebuffers[fbo->fbo_id];
+	framebuffer.width = (int)fbo->depth_texture->width;
+	framebuffer.height = (int)fbo->depth_texture->height;
+	framebuffer.depth_texture_id = fbo->depth_texture->texture_id;
+	return true;
+}
+
+void SoftRasterizer::releaseFramebuffer(FBO* fbo)
+{
+	framebuffers.erase(fbo->fbo_id);
+}
+
+void SoftRasterizer::enableFramebuffer(FBO* fbo)
+{
+	viewport_stack.push_back(vector<int>(viewport, viewport + 4));
+	framebuffer_id = fbo->fbo_id;
+	sFramebuffer& framebuffer = framebuffers[fbo->fbo_id];
+	setViewport(0, 0, framebuffer.width, framebuffer.height);
+}
+
+void SoftRasterizer::disableFramebuffer(FBO* fbo)
+{
+	if (viewport_stack.size())
+	{
+		vector<int>& previous = viewport_stack.back();
+		setViewport(previous[0], previous[1], previous[2], previous[3]);
+		viewport_stack.pop_back();
+	}
+	framebuffer_id = 0;
+}
+
+void SoftRasterizer::bindFramebuffer(FBO* fbo)
+{
+	framebuffer_id = fbo ? fbo->fbo_id : 0;
+}
+
+void SoftRasterizer::blitDepth(FBO* source, FBO* destination, int x, int y, int width, int height)
+{
+	sTarget src, dst;
+	framebuffer_id = destination->fbo_id;
+	if (!getTarget(source->fbo_id, src) || !getTarget(destination->fbo_id, dst) || !src.depth || !dst.depth)
+		return;
+	int min_x = max(x, 0), min_y = max(y, 0);
+	int max_x = min(x + width, min(src.width, dst.width)), max_y = min(y + height, min(src.height, dst.height));
+	for (int row = min_y; row < max_y; ++row)
+		if (max_x > min_x)
+			memcpy(dst.depth + row * dst.width + min_x, src.depth + row * src.width + min_x, (max_x - min_x) * sizeof(float));
+}
+
+//Color and depth the draw calls write to. Only byte color textures are drawn
+bool SoftRasterizer::getTarget(unsigned int id, sTarget& target)
+{
+	target = sTarget();
+	if (id == 0)
+	{
+		if (screen_color.empty())
+			return false;
+		target.width = screen_width;
+		target.height = screen_height;
+		target.color = &screen_color[0];
+		target.num_channels = 4;
+		target.depth = &screen_depth[0];
+		return true;
+	}
+
+	auto it = framebuffers.find(id);
+	if (it == framebuffers.end())
+		return false;
+	sFramebuffer& framebuffer = it->second;
+	target.width = framebuffer.width;
+	target.height = framebuffer.height;
+
+	auto color = textures.find(framebuffer.color_texture_id);
+	if (color != textures.end() && color->second.levels.size() && color->second.width == target.width && color->second.height == target.height)
+	{
+		target.color = &color->second.levels[0][0];
+		target.num_channels = color->second.num_channels;
+	}
+
+	auto depth = textures.find(framebuffer.depth_texture_id);
+	if (depth != textures.end() && (int)depth->second.depth.size() == target.width * target.height)
+		target.depth = &depth->second.depth[0];
+	else if (framebuffer.depth.size())
+		target.depth = &framebuffer.depth[0];
+	return target.depth != NULL;
+}
+
+// RENDER STATE ******************************************
+
+void SoftRasterizer::clear(unsigned int mask)
+{
+	sTarget cleared;
+	if (!getTarget(framebuffer_id, cleared))
+		return;
+
+	//like in GL the scissor limits it
+	int min_x = 0, min_y = 0, max_x = cleared.width, max_y = cleared.height;
+	if (scissor_test)
+	{
+		min_x = max(min_x, scissor[0]);
+		min_y = max(min_y, scissor[1]);
+		max_x = min(max_x, scissor[0] + scissor[2]);
+		max_y = min(max_y, scissor[1] + scissor[3]);
+	}
+	if (min_x >= max_x || min_y >= max_y)
+		return;
+
+	Uint8 color[4];
+	for (int i = 0; i < 4; ++i)
+		color[i] = (Uint8)(clamp(clear_color.v[i]) * 255.0f + 0.5f);
+	for (int y = min_y; y < max_y; ++y)
+	{
+		if ((mask & GL_DEPTH_BUFFER_BIT) && cleared.depth)
+			fill(cleared.depth + y * cleared.width + min_x, cleared.depth + y * cleared.width + max_x, 1.0f);
+		if ((mask & GL_COLOR_BUFFER_BIT) && cleared.color && color_mask)
+			for (int x = min_x; x < max_x; ++x)
+				memcpy(cleared.color + (x + y * cleared.width) * cleared.num_channels, color, cleared.num_channels);
+	}
+}
+
+// TIMER QUERIES ******************************************
+
+void SoftRasterizer::createQueries(int num, unsigned int* ids)
+{
+	for (int i = 0; i < num; ++i)
+	{
+		ids[i] = ++last_id;
+		queries[ids[i]] = 0;
+	}
+}
+
+void SoftRasterizer::beginTimer(unsigned int query)
+{
+	timer_query = query;
+	timer_start = getNanoseconds();
+}
+
+void SoftRasterizer::endTimer()
+{
+	queries[timer_query] = getNanoseconds() - timer_start;
+}
+
+bool SoftRasterizer::getTimerResult(unsigned int query, uint64_t& nanoseconds)
+{
+	nanoseconds = queries[query];
+	return true;
+}
@@ -0,0 +1,216 @@
+#ifndef SOFTRASTERIZER_H
+#define SOFTRASTERIZER_H
+
+#pragma once
+#include "renderbackend.h"
+#include <vector>
+#include <map>
+#include <string>
+
+//Software rasterizer: a RenderBackend that draws on the CPU what the Renderer sends, so the real render path runs without a window or an OpenGL context.
+//The shaders aren't compiled: their uniforms and attributes are parsed and the fragment stage ports the ones the Renderer uses (single.fs, color.fs, image.fs).
+//The triangles of every draw call are binned into tiles of the framebuffer and the tiles are rasterized by a pool of threads.
+class SoftRasterizer : public RenderBackend
+{
+public:
+
+	//How a program shades its fragments, guessed from its sources
+	enum eProgramType { PROGRAM_COLOR, PROGRAM_TEXTURE, PROGRAM_LIGHTS };
+
+	//Uniforms read by the stages
+	enum eUniform {
+		U_MODEL, U_VIEWPROJECTION, U_COLOR, U_ALPHA_CUTOFF, U_TEXTURE, U_TEX_RANGE,
+		U_ALBEDO_FACTOR, U_SPECULAR_FACTOR, U_OCCLUSION_FACTOR, U_EMISSIVE_FACTOR,
+		U_ALBEDO_TEXTURE, U_SPECULAR_TEXTURE, U_NORMAL_TEXTURE, U_OCCLUSION_TEXTURE, U_METALNESS_TEXTURE, U_ROUGHNESS_TEXTURE, U_OMR_TEXTURE, U_EMISSIVE_TEXTURE,
+		U_SHADOW_ATLAS, U_TEXTURES, U_CAMERA_POSITION, U_AMBIENT_LIGHT, U_LAST_ITERATION,
+		U_LIGHTS, U_LIGHTS_OFFSET, U_NUM_LIGHTS, U_CLUSTERED, U_CLUSTER_GRID, U_CLUSTER_LIGHTS, U_CLUSTER_DIMS, U_CLUSTER_DEPTH, U_CLUSTER_VIEWPORT, U_CAMERA_FRONT,
+		NUM_UNIFORMS
+	};
+
+	//Shader parsed from its sources, the values of the uniforms are stored by location (16 floats each, the ints are stored as floats)
+	struct sProgram {
+		eProgramType type = PROGRAM_COLOR;
+		bool instanced = false; //u_model is a vertex attribute
+		std::map<std::string, int> uniform_locations; //arrays have a location for each element
+		std::map<std::string, int> attribute_locations;
+		std::vector<float> values;
+		int locations[NUM_UNIFORMS];
+	};
+
+	//Texture in RAM: bytes with their mipmaps, or floats for the depth maps. Texture buffers point to a buffer instead
+	struct sTexture {
+		int width = 0;
+		int height = 0;
+		int num_channels = 4;
+		unsigned int wrap = GL_REPEAT;
+		std::vector< std::vector<Uint8> > levels; //level 0 first
+		std::vector<float> depth;
+		unsigned int buffer_id = 0;
+		unsigned int internal_format = 0;
+	};
+
+	struct sFramebuffer {
+		unsigned int color_texture_id = 0; //only the first color texture is drawn
+		unsigned int depth_texture_id = 0;
+		std::vector<float> depth; //renderbuffer when it doesn't have a depth texture
+		int width = 0;
+		int height = 0;
+	};
+
+	//Vertex after the vertex stage, the varyings of single.fs: world position, normal, uv and tangent
+	enum { NUM_VARYINGS = 12 };
+	struct sVertex {
+		Vector4 clip;
+		float varyings[NUM_VARYINGS];
+	};
+
+	//Triangle ready to be rasterized, the varyings are divided by w for perspective correct interpolation
+	struct sTriangle {
+		Vector3 screen[3]; //x, y in pixels and z in [0..1]
+		float inv_w[3];
+		float varyings[3][NUM_VARYINGS];
+		int min_x, min_y, max_x, max_y; //pixels it may cover, inside the viewport and the scissor
+		float area;
+		Vector3 edge_world[2]; //edges in world space and in uv space, for the cotangent frame of the normal maps
+		Vector2 edge_uv[2];
+		float uv_density; //log2 of the uv units per pixel, picks the mipmap
+	};
+
+	int tile_size;
+	int num_threads;
+
+	//Stats of the last frame
+	int num_draw_calls;
+	int num_triangles;
+	double raster_ms;
+
+	SoftRasterizer(int num_threads = 0, int tile_size = 32);
+
+	//The default framebuffer
+	void setScreenSize(int width, int height);
+	bool saveScreen(const char* filename); //TGA
+
+	//Headless render: loads a scene without a window or an OpenGL context, renders the frame of its camera with the Renderer and saves it
+	static bool renderScene(const char* scene_filename, const char* output_filename, int width, int height);
+
+	//Golden image check: a pixel differs when a channel is off by more than the tolerance, fails when more than max_different (0..1) of them do
+	static bool compareImages(const char* filename, const char* golden_filename, int tolerance = 8, float max_different = 0.005f);
+
+	//RenderBackend
+	bool checkErrors() { return true; }
+	int getMaxTextureBufferSize() { return 1 << 27; }
+
+	bool compileShader(Shader* shader, const std::string& vs_code, const std::string& fs_code);
+	void releaseShader(Shader* shader);
+	void useShader(Shader* shader);
+	int getUniformLocation(Shader* shader, const char* varname);
+	int getAttribLocation(Shader* shader, const char* varname);
+	void setUniform(int location, unsigned int type, int count, const void* data);
+	void setUniformBlock(Shader* shader, const char* varname, int binding) {}
+	void bindTexture(int slot, unsigned int texture_type, unsigned int texture_id);
+
+	void uploadMesh(Mesh* mesh) {} //it is drawn from its CPU streams
+	void releaseMesh(Mesh* mesh) {}
+	void enableMeshBuffers(Mesh* mesh, Shader* shader) {}
+	void disableMeshBuffers(Mesh* mesh, Shader* shader) {}
+	bool enableInstanceBuffer(Mesh* mesh, Shader* shader, unsigned int buffer_id, int first_instance);
+	void disableInstanceBuffer(Mesh* mesh, Shader* shader);
+	void drawMesh(Mesh* mesh, unsigned int primitive, int start, int size, int lod_offset, int num_instances);
+
+	void uploadBuffer(unsigned int& buffer_id, const void* data, size_t size);
+	void uploadTextureBuffer(unsigned int& buffer_id, unsigned int& texture_id, unsigned int internal_format, const void* data, size_t size, int slot);
+
+	void createTexture(Texture* texture);
+	void uploadTexture(Texture* texture, unsigned int format, unsigned int type, const Uint8* data, unsigned int internal_format);
+	void generateMipmaps(Texture* texture);
+	void setTextureFilter(Texture* texture, int min_filter, int mag_filter) {} //bilinear with mipmaps, nearest for the depth maps
+	void setTextureWrap(Texture* texture, int wrap);
+	void releaseTexture(Texture* texture);
+
+	bool createFramebuffer(FBO* fbo, Texture* depth_texture, int cubemap_face);
+	bool createDepthFramebuffer(FBO* fbo);
+	void releaseFramebuffer(FBO* fbo);
+	void releaseRenderbuffers(FBO* fbo) {}
+	void enableFramebuffer(FBO* fbo);
+	void disableFramebuffer(FBO* fbo);
+	void bindFramebuffer(FBO* fbo);
+	void setDrawBuffers(FBO* fbo, int num) {}
+	void blitDepth(FBO* source, FBO* destination, int x, int y, int width, int height);
+
+	void setClearColor(const Vector4& color) { clear_color = color; }
+	void clear(unsigned int mask);
+	void setBlend(bool enabled) { blend = enabled; }
+	void setBlendFunc(unsigned int src, unsigned int dst) { blend_src = src; blend_dst = dst; }
+	void setCullFace(bool enabled) { cull_face = enabled; }
+	void setDepthTest(bool enabled) { depth_test = enabled; }
+	void setDepthFunc(unsigned int func) { depth_func = func; }
+	void setColorMask(bool enabled) { color_mask = enabled; }
+	void setScissorTest(bool enabled) { scissor_test = enabled; }
+	void setScissor(int x, int y, int width, int height) { scissor[0] = x; scissor[1] = y; scissor[2] = width; scissor[3] = height; }
+	void setViewport(int x, int y, int width, int height) { viewport[0] = x; viewport[1] = y; viewport[2] = width; viewport[3] = height; }
+
+	void createQueries(int num, unsigned int* queries);
+	void beginTimer(unsigned int query);
+	void endTimer();
+	bool getTimerResult(unsigned int query, uint64_t& nanoseconds);
+
+private:
+	//Objects, by id
+	std::map<Shader*, sProgram> programs;
+	std::map<unsigned int, sTexture> textures;
+	std::map<unsigned int, std::vector<char> > buffers;
+	std::map<unsigned int, sFramebuffer> framebuffers;
+	std::map<unsigned int, uint64_t> queries;
+	unsigned int last_id;
+
+	//Default framebuffer, RGBA
+	std::vector<Uint8> screen_color;
+	std::vector<float> screen_depth;
+
+	//State
+	sProgram* program;
+	unsigned int texture_units[16];
+	unsigned int framebuffer_id; //0 for the screen
+	std::vector< std::vector<int> > viewport_stack; //enableFramebuffer pushes it
+	int viewport[4];
+	int scissor[4];
+	Vector4 clear_color;
+	bool blend, cull_face, depth_test, color_mask, scissor_test;
+	unsigned int blend_src, blend_dst, depth_func;
+	unsigned int instance_buffer_id;
+	int first_instance;
+	unsigned int timer_query;
+	uint64_t timer_start;
+
+	//Render target of the draw call
+	struct sTarget {
+		int width = 0;
+		int height = 0;
+		Uint8* color = NULL;
+		int num_channels = 0;
+		float* depth = NULL;
+	};
+	sTarget target;
+
+	//Triangles of the draw call and the tiles they overlap
+	std::vector<sVertex> vertices; //vertex stage output, computed on demand
+	std::vector<int> vertex_stamps;
+	std::vector<sTriangle> triangles;
+	std::vector< std::vector<int> > tiles;
+	std::vector<int> used_tiles;
+	int tiles_x;
+	int tiles_y;
+
+	float* getUniform(int uniform, int element = 0); //of the program in use, zeros if it doesn't have it
+	int getInt(int uniform) { return (int)getUniform(uniform)[0]; }
+	sTexture* getTexture(int uniform); //bound to the sampler
+	bool getTarget(unsigned int id, sTarget& target); //of a framebuffer, 0 for the screen
+	void transformVertex(Mesh* mesh, unsigned int index, const Matrix44& model, sVertex& vertex);
+	void addTriangle(const sVertex& a, const sVertex& b, const sVertex& c);
+	void rasterizeTile(int tile_index);
+	bool shadeFragment(const sTriangle& triangle, const float* varyings, float x, float y, Vector4& color);
+	Vector3 computeLight(int index, const sTriangle& triangle, const Vector3& world_position, const Vector3& normal, const Vector2& uv);
+	Vector4 sampleTexture(sTexture* texture, Vector2 uv, float uv_density);
+};
+
+#endif
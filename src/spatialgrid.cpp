@@ -0,0 +1,223 @@
+#include "spatialgrid.h"
+#include "entity.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+SpatialGrid::SpatialGrid(float cell_size)
+{
+	this->cell_size = cell_size;
+	max_cells = 64;
+	clear();
+}
+
+void SpatialGrid::clear()
+{
+	proxies.clear();
+	free_proxies.clear();
+	cells.clear();
+	large.clear();
+	stamp = 0;
+}
+
+int SpatialGrid::insert(Entity* entity, const Vector3& center, float radius)
+{
+	int proxy;
+	if (!free_proxies.empty())
+	{
+		proxy = free_proxies.back();
+		free_proxies.pop_back();
+	}
+	else
+	{
+		proxy = (int)proxies.size();
+		proxies.push_back(sProxy());
+	}
+
+	sProxy& p = proxies[proxy];
+	p.entity = entity;
+	p.center = center;
+	p.radius = max(radius, 0.0f);
+	p.stamp = 0;
+	addToCells(proxy);
+	return proxy;
+}
+
+void SpatialGrid::move(int proxy, const Vector3& center, float radius)
+{
+	if (proxy < 0 || proxy >= (int)proxies.size() || !proxies[proxy].entity)
+		return;
+
+	sProxy& p = proxies[proxy];
+	radius = max(radius, 0.0f);
+	p.center = center;
+	p.radius = radius;
+
+	//still in the same cells, nothing else changes
+	if (p.min_x <= p.max_x && getCell(center.x - radius) == p.min_x && getCell(center.x + radius) == p.max_x &&
+		getCell(center.z - radius) == p.min_z && getCell(center.z + radius) == p.max_z)
+		return;
+
+	removeFromCells(proxy);
+	addToCells(proxy);
+}
+
+void SpatialGrid::remove(int proxy)
+{
+	if (proxy < 0 || proxy >= (int)proxies.size() || !proxies[proxy].entity)
+		return;
+	removeFromCells(proxy);
+	proxies[proxy].entity = NULL;
+	free_proxies.push_back(proxy);
+}
+
+void SpatialGrid::addToCells(int proxy)
+{
+	sProxy& p = proxies[proxy];
+	int min_x = getCell(p.center.x - p.radius);
+	int max_x = getCell(p.center.x + p.radius);
+	int min_z = getCell(p.center.z - p.radius);
+	int max_z = getCell(p.center.z + p.radius);
+	if ((long long)(max_x - min_x + 1) * (max_z - min_z + 1) > max_cells)
+	{
+		p.min_x = p.min_z = 1;
+		p.max_x = p.max_z = 0;
+		large.push_back(proxy);
+		return;
+	}
+
+	p.min_x = min_x;
+	p.min_z = min_z;
+	p.max_x = max_x;
+	p.max_z = max_z;
+	for (int x = min_x; x <= max_x; ++x)
+		for (int z = min_z; z <= max_z; ++z)
+			cells[getKey(x, z)].push_back(proxy);
+}
+
+void SpatialGrid::removeFromCells(int proxy)
+{
+	sProxy& p = proxies[proxy];
+	if (p.min_x > p.max_x)
+	{
+		large.erase(find(large.begin(), large.end(), proxy));
+		return;
+	}
+
+	for (int x = p.min_x; x <= p.max_x; ++x)
+		for (int z = p.min_z; z <= p.max_z; ++z)
+		{
+			auto it = cells.find(getKey(x, z));
+			if (it == cells.end())
+				continue;
+			vector<int>& cell = it->second;
+			auto entry = find(cell.begin(), cell.end(), proxy);
+			if (entry != cell.end())
+			{
+				*entry = cell.back();
+				cell.pop_back();
+			}
+			if (cell.empty())
+				cells.erase(it);
+		}
+}
+
+void SpatialGrid::gather(const Vector3& min, const Vector3& max, int type, std::vector<int>& result)
+{
+	//new stamp, when it wraps the old ones are cleared so none of them matches by chance
+	if (++stamp == 0)
+	{
+		for (size_t i = 0; i < proxies.size(); ++i)
+			proxies[i].stamp = 0;
+		stamp = 1;
+	}
+
+	auto visit = [&](int proxy) {
+		sProxy& p = proxies[proxy];
+		if (p.stamp == stamp)
+			return;
+		p.stamp = stamp;
+		if (type == -1 || p.entity->entity_type == type)
+			result.push_back(proxy);
+	};
+
+	for (size_t i = 0; i < large.size(); ++i)
+		visit(large[i]);
+
+	int min_x = getCell(min.x);
+	int max_x = getCell(max.x);
+	int min_z = getCell(min.z);
+	int max_z = getCell(max.z);
+
+	//a query bigger than the occupied cells walks them instead
+	if ((long long)(max_x - min_x + 1) * (max_z - min_z + 1) > (long long)cells.size())
+	{
+		for (auto it = cells.begin(); it != cells.end(); ++it)
+		{
+			int x = (int)(it->first >> 32);
+			int z = (int)(unsigned int)it->first;
+			if (x < min_x || x > max_x || z < min_z || z > max_z)
+				continue;
+			for (size_t i = 0; i < it->second.size(); ++i)
+				visit(it->second[i]);
+		}
+		return;
+	}
+
+	for (int x = min_x; x <= max_x; ++x)
+		for (int z = min_z; z <= max_z; ++z)
+		{
+			auto it = cells.find(getKey(x, z));
+			if (it == cells.end())
+				continue;
+			for (size_t i = 0; i < it->second.size(); ++i)
+				visit(it->second[i]);
+		}
+}
+
+void SpatialGrid::queryRadius(const Vector3& center, float radius, std::vector<Entity*>& result, int type)
+{
+	vector<int> candidates;
+	gather(center - Vector3(radius, radius, radius), center + Vector3(radius, radius, radius), type, candidates);
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		const sProxy& p = proxies[candidates[i]];
+		Vector3 to_entity = p.center - center;
+		float reach = radius + p.radius;
+		if (to_entity.dot(to_entity) <= reach * reach)
+			result.push_back(p.entity);
+	}
+}
+
+void SpatialGrid::queryCone(const Vector3& origin, const Vector3& direction, float cos_angle, float range, std::vector<Entity*>& result, int type)
+{
+	vector<int> candidates;
+	gather(origin - Vector3(range, range, range), origin + Vector3(range, range, range), type, candidates);
+	float angle = acos(clamp(cos_angle, -1.0f, 1.0f));
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		const sProxy& p = proxies[candidates[i]];
+		Vector3 to_entity = p.center - origin;
+		float distance = (float)to_entity.length();
+		if (distance > range + p.radius)
+			continue;
+		if (distance <= p.radius)
+		{
+			result.push_back(p.entity);
+			continue;
+		}
+
+		//the sphere widens the cone by the angle it covers seen from the origin
+		float entity_cos = to_entity.dot(direction) / distance;
+		if (p.radius == 0.0f)
+		{
+			if (entity_cos >= cos_angle)
+				result.push_back(p.entity);
+			continue;
+		}
+		float entity_angle = acos(clamp(entity_cos, -1.0f, 1.0f));
+		if (entity_angle - asin(p.radius / distance) <= angle)
+			result.push_back(p.entity);
+	}
+}
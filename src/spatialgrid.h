@@ -0,0 +1,64 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#pragma once
+#include "framework.h"
+#include <vector>
+#include <unordered_map>
+
+class Entity;
+
+//Uniform grid over the XZ plane for the proximity queries between entities. Every entity is a sphere stored in the cells
+//it covers, only the cells that hold something exist (hashed by their coordinates). Moving inside the same cells only
+//updates the sphere, and the entities too big for the grid go to a list every query visits.
+class SpatialGrid
+{
+public:
+
+	struct sProxy {
+		Entity* entity; //NULL in the free proxies
+		Vector3 center;
+		float radius;
+		int min_x; //cells it covers, min_x > max_x if it is in the large list
+		int min_z;
+		int max_x;
+		int max_z;
+		unsigned int stamp; //last query that visited it, the ones in several cells are only tested once
+	};
+
+	float cell_size;
+	int max_cells; //cells an entity can cover before it goes to the large list
+
+	SpatialGrid(float cell_size = 400.0f);
+
+	//Returns the proxy of the entity, keep it to move or remove it
+	int insert(Entity* entity, const Vector3& center, float radius);
+	void move(int proxy, const Vector3& center, float radius);
+	void remove(int proxy);
+	void clear();
+
+	Entity* getEntity(int proxy) { return proxies[proxy].entity; }
+	int getNumEntities() { return (int)(proxies.size() - free_proxies.size()); }
+	int getNumCells() { return (int)cells.size(); }
+
+	//Entities whose sphere reaches the query sphere, type is an Entity::EntityType or -1 for all of them
+	void queryRadius(const Vector3& center, float radius, std::vector<Entity*>& result, int type = -1);
+	//Entities whose sphere reaches the cone, cos_angle is of the half angle and direction must be normalized
+	void queryCone(const Vector3& origin, const Vector3& direction, float cos_angle, float range, std::vector<Entity*>& result, int type = -1);
+
+private:
+	std::vector<sProxy> proxies;
+	std::vector<int> free_proxies;
+	std::unordered_map<long long, std::vector<int>> cells;
+	std::vector<int> large;
+	unsigned int stamp;
+
+	int getCell(float v) { return (int)floor(v / cell_size); }
+	static long long getKey(int x, int z) { return ((long long)x << 32) | (unsigned int)z; }
+	void addToCells(int proxy);
+	void removeFromCells(int proxy);
+	//Proxies of the given type in the cells the box covers and in the large list, each one once
+	void gather(const Vector3& min, const Vector3& max, int type, std::vector<int>& result);
+};
+
+#endif
@@ -114,6 +114,7 @@ STAGE_ID PlayStage::update(double seconds_elapsed) {
 		else {
 			monster->followPath(g->elapsed_time);
 		}
+		g->scene->updateGrid(monster);
 
 		//Update Objects
 		for (int i = 0; i < g->scene->objects.size(); ++i)
@@ -121,6 +122,8 @@ STAGE_ID PlayStage::update(double seconds_elapsed) {
 			ObjectEntity* object = g->scene->objects[i];
 			if (object->bounding_box_trigger) {
 				object->updateBoundingBox();
+				g->scene->updateBVH(object);
+				g->scene->updateGrid(object);
 				object->bounding_box_trigger = false;
 			}
 		}
@@ -1,5 +1,6 @@
 
 #include "texture.h"
+#include "renderbackend.h"
 #include "fbo.h"
 #include "utils.h"
 
@@ -84,11 +85,8 @@ Texture::~Texture()
 
 void Texture::clear()
 {
-	glBindTexture(this->texture_type, 0);
-
-	//external textures are handled by an outside system (like Android OS)
-	if( texture_type != GL_TEXTURE_EXTERNAL_OES)
-		glDeleteTextures(1, &texture_id);
+	if (texture_id)
+		RenderBackend::current->releaseTexture(this);
 
 	stdlog("Destroy texture: " + filename );
 	texture_id = 0;
@@ -101,6 +99,14 @@ void Texture::clear()
 	}
 }
 
+void Texture::releaseVRAM()
+{
+	if (texture_id)
+		RenderBackend::current->releaseTexture(this);
+	texture_id = 0;
+	image.clear();
+}
+
 void Texture::Release()
 {
 	std::vector<Texture *> texs;
@@ -147,9 +153,8 @@ void Texture::create(unsigned int width, unsigned int height, unsigned int forma
 	this->texture_type = GL_TEXTURE_2D;
 
 	if(texture_id == 0)
-		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
+		RenderBackend::current->createTexture(this); //we need to create an unique ID for the texture
 
-	assert(checkGLErrors() && "Error creating texture");
 	upload(format, type, mipmaps, data, internal_format);
 }
 
@@ -232,41 +237,29 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 
 bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
 {
-	std::string str = filename;
-	std::string ext = str.substr(str.size() - 4, 4);
-	Image* image = NULL;
 	double time = getTime();
 
 	std::cout << " + Texture loading: " << filename << " ... ";
 
-	image = new Image();
-	bool found = false;
-
-	if (ext == ".tga" || ext == ".TGA")
-		found = image->loadTGA(filename);
-	else if (ext == ".png" || ext == ".PNG")
-		found = image->loadPNG(filename);
-	else if (ext == ".jpg" || ext == ".JPG" || ext == "JPEG" || ext == "jpeg")
-		found = image->loadJPG(filename);
-	else
-	{
-		std::cout << "[ERROR]: unsupported format" << std::endl;
-		return false; //unsupported file type
-	}
-
-	if (!found) //file not found
+	Image image;
+	if (!image.load(filename))
 	{
-		std::cout << " [ERROR]: Texture not found " << std::endl;
+		std::cout << " [ERROR]: Texture not found or unsupported format" << std::endl;
 		return false;
 	}
 
+	load(filename, &image, mipmaps, wrap, type);
+
+	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+void Texture::load(const char* filename, Image* image, bool mipmaps, bool wrap, unsigned int type)
+{
 	loadFromImage(image,mipmaps,wrap,type);
 	this->filename = filename;
 	setName(filename);
-
-	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	this->image.clear();
-	return true;
 }
 
 void Texture::loadFromImage(Image* image, bool mipmaps, bool wrap, unsigned int type)
@@ -280,14 +273,9 @@ void Texture::loadFromImage(Image* image, bool mipmaps, bool wrap, unsigned int
 	// We have to synchronously upload for now because Image class is not ref-counted
 	create(image->width, image->height, (image->num_channels == 3 ? GL_RGB : GL_RGBA), type,  mipmaps, image->data, 0);
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	//glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	//glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	RenderBackend::current->setTextureWrap(this, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	//if (mipmaps)
 	//	generateMipmaps();
-	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void Texture::upload(Image* img)
@@ -309,8 +297,6 @@ void Texture::upload( unsigned int format, unsigned int type, bool mipmaps, Uint
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_2D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
-
 	if (internal_format == 0)
 	{
 		if (type == GL_FLOAT)
@@ -319,19 +305,7 @@ void Texture::upload( unsigned int format, unsigned int type, bool mipmaps, Uint
 			internal_format = format == GL_RGB ? GL_RGB16F : GL_RGBA16F;
 	}
 
-	glTexImage2D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data);
-
-	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
-	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	//glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4); //better quality but takes more resources
-
-	if (data && this->mipmaps)
-		generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D); 
-
-	glBindTexture(this->texture_type, 0);
-	assert(checkGLErrors() && "Error uploading texture");
+	RenderBackend::current->uploadTexture(this, format, type, data, internal_format);
 }
 
 /*
@@ -507,23 +481,7 @@ void Texture::UnbindAll()
 
 void Texture::generateMipmaps()
 {
-#ifdef OPENGL_ES3
-		if(!glGenerateMipmapEXT)
-			return;
-
-		glBindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
-		glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter ); //set the mag filter
-		if (this->texture_type == GL_TEXTURE_CUBE_MAP)
-		{
-			glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); //set the mag filter
-			glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); //set the mag filter
-		}
-		glGenerateMipmapEXT(this->texture_type);
-#else
-	glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
-	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter);
-	glGenerateMipmap(this->texture_type);
-    #endif
+	RenderBackend::current->generateMipmaps(this);
 }
 
 
@@ -624,6 +582,7 @@ void Image::fromScreen(int width, int height)
 		this->height = height;
 		data = new uint8[width * height * 4];
 	}
+	num_channels = 4;
 
 	glReadPixels(0,0,width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
 }
@@ -726,6 +685,22 @@ bool Image::loadTGA(const char* filename)
 #include <iostream>
 #include <fstream>
 
+bool Image::load(const char* filename)
+{
+	std::string str = filename;
+	if (str.size() < 4)
+		return false;
+	std::string ext = str.substr(str.size() - 4, 4);
+
+	if (ext == ".tga" || ext == ".TGA")
+		return loadTGA(filename);
+	else if (ext == ".png" || ext == ".PNG")
+		return loadPNG(filename);
+	else if (ext == ".jpg" || ext == ".JPG" || ext == "JPEG" || ext == "jpeg")
+		return loadJPG(filename);
+	return false; //unsupported file type
+}
+
 bool Image::loadPNG(const char* filename, bool flip_y)
 {
 	std::vector<unsigned char> buffer;
@@ -9,6 +9,7 @@
 #include <map>
 #include <string>
 #include <cassert>
+#include "resourcemanager.h"
 
 class Shader;
 class FBO;
@@ -65,6 +66,7 @@ public:
 	void fromTexture(Texture* texture);
 	void fromScreen(int width, int height);
 
+	bool load(const char* filename); //by extension, only CPU work so it can be called from any thread
 	bool loadTGA(const char* filename);
 	bool loadPNG(const char* filename, bool flip_y = true);
 	bool loadPNG(std::vector<unsigned char>& buffer, bool flip_y = false);
@@ -127,6 +129,8 @@ public:
 	//original data info
 	Image image;
 
+	sResidency residency; //handled by the ResourceManager
+
 	Texture();
 	Texture(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	Texture(Image* img);
@@ -136,6 +140,7 @@ public:
 
 
 	void clear();
+	void releaseVRAM(); //the texture stays registered, load brings it back
 
 	void create(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	//void create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
@@ -159,6 +164,7 @@ public:
 
 	//load without using the manager
 	bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
+	void load(const char* filename, Image* image, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE); //upload an image already decoded and register it
 	void loadFromImage(Image* image, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
 
 	//load using the manager (caching loaded ones to avoid reloading them)
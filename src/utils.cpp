@@ -4,6 +4,10 @@
 #include <windows.h>
 #else
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include "includes.h"
@@ -134,6 +138,225 @@ bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer
 	return true;
 }
 
+bool mapFile(const std::string& filename, sMappedFile& file)
+{
+	file = sMappedFile();
+#ifdef WIN32
+	HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!data)
+	{
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file.file_handle = handle;
+	file.mapping_handle = mapping;
+	file.size = (size_t)size.QuadPart;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) == -1 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); //the mapping keeps the file open
+	if (data == MAP_FAILED)
+		return false;
+	madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+	file.size = (size_t)info.st_size;
+#endif
+	file.data = (const char*)data;
+	return true;
+}
+
+void unmapFile(sMappedFile& file)
+{
+	if (!file.data)
+		return;
+#ifdef WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mapping_handle);
+	CloseHandle(file.file_handle);
+#else
+	munmap((void*)file.data, file.size);
+#endif
+	file = sMappedFile();
+}
+
+//LZ4 block: sequences of [token][literals][offset][match length], the last one only has literals
+static bool writeLZLength(unsigned char*& out, const unsigned char* out_end, int length)
+{
+	while (length >= 255)
+	{
+		if (out >= out_end)
+			return false;
+		*out++ = 255;
+		length -= 255;
+	}
+	if (out >= out_end)
+		return false;
+	*out++ = (unsigned char)length;
+	return true;
+}
+
+static bool writeLZSequence(unsigned char*& out, const unsigned char* out_end, const unsigned char* literals, int num_literals, int offset, int match_length)
+{
+	if (out >= out_end)
+		return false;
+	unsigned char* token = out++;
+	*token = (unsigned char)((num_literals < 15 ? num_literals : 15) << 4);
+	if (num_literals >= 15 && !writeLZLength(out, out_end, num_literals - 15))
+		return false;
+	if (out_end - out < num_literals)
+		return false;
+	memcpy(out, literals, num_literals);
+	out += num_literals;
+
+	if (!match_length) //last sequence
+		return true;
+
+	if (out_end - out < 2)
+		return false;
+	*out++ = (unsigned char)(offset & 0xFF);
+	*out++ = (unsigned char)(offset >> 8);
+	match_length -= 4;
+	*token |= (unsigned char)(match_length < 15 ? match_length : 15);
+	if (match_length >= 15 && !writeLZLength(out, out_end, match_length - 15))
+		return false;
+	return true;
+}
+
+int compressLZ(const char* src, int src_size, char* dst, int dst_capacity)
+{
+	const int HASH_BITS = 16;
+	const unsigned char* in = (const unsigned char*)src;
+	unsigned char* out = (unsigned char*)dst;
+	const unsigned char* out_end = out + dst_capacity;
+
+	//last position of every hashed 4 bytes sequence
+	std::vector<int> table(1 << HASH_BITS, -1);
+
+	int anchor = 0;
+	int pos = 0;
+	int match_limit = src_size - 12; //the format requires the last match to start 12 bytes before the end
+	while (pos < match_limit)
+	{
+		unsigned int sequence;
+		memcpy(&sequence, in + pos, 4);
+		unsigned int hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+		int ref = table[hash];
+		table[hash] = pos;
+
+		unsigned int ref_sequence = 0;
+		if (ref != -1)
+			memcpy(&ref_sequence, in + ref, 4);
+		if (ref == -1 || pos - ref > 65535 || ref_sequence != sequence)
+		{
+			pos++;
+			continue;
+		}
+
+		//extend the match, the last 5 bytes are always literals
+		int length = 4;
+		int max_length = src_size - 5 - pos;
+		while (length < max_length && in[ref + length] == in[pos + length])
+			length++;
+
+		if (!writeLZSequence(out, out_end, in + anchor, pos - anchor, pos - ref, length))
+			return 0;
+		pos += length;
+		anchor = pos;
+	}
+
+	if (!writeLZSequence(out, out_end, in + anchor, src_size - anchor, 0, 0))
+		return 0;
+	return (int)(out - (unsigned char*)dst);
+}
+
+bool decompressLZ(const char* src, int src_size, char* dst, int dst_size)
+{
+	const unsigned char* in = (const unsigned char*)src;
+	const unsigned char* in_end = in + src_size;
+	unsigned char* out = (unsigned char*)dst;
+	unsigned char* out_end = out + dst_size;
+
+	while (in < in_end)
+	{
+		unsigned char token = *in++;
+
+		//literals
+		int num_literals = token >> 4;
+		if (num_literals == 15)
+		{
+			unsigned char b;
+			do {
+				if (in >= in_end)
+					return false;
+				b = *in++;
+				num_literals += b;
+			} while (b == 255);
+		}
+		if (num_literals > in_end - in || num_literals > out_end - out)
+			return false;
+		memcpy(out, in, num_literals);
+		in += num_literals;
+		out += num_literals;
+
+		if (in == in_end) //last sequence
+			break;
+
+		//match
+		if (in_end - in < 2)
+			return false;
+		int offset = in[0] | (in[1] << 8);
+		in += 2;
+		if (offset == 0 || offset > out - (unsigned char*)dst)
+			return false;
+
+		int match_length = token & 15;
+		if (match_length == 15)
+		{
+			unsigned char b;
+			do {
+				if (in >= in_end)
+					return false;
+				b = *in++;
+				match_length += b;
+			} while (b == 255);
+		}
+		match_length += 4;
+		if (match_length > out_end - out)
+			return false;
+
+		//byte by byte because the match can overlap the bytes being written
+		const unsigned char* ref = out - offset;
+		for (int i = 0; i < match_length; ++i)
+			*out++ = *ref++;
+	}
+
+	return out == out_end;
+}
+
 void stdlog(std::string str)
 {
 	std::cout << str << std::endl;
@@ -302,6 +525,19 @@ std::string getGPUStats()
 	std::string str = "FPS: " + to_string(Game::instance->fps) + " DCS: " + to_string(Mesh::num_meshes_rendered) + " Tris: " + to_string(long(Mesh::num_triangles_rendered * 0.001)) + "Ks  VRAM: " + to_string(int((nTotalMemoryInKB - nCurAvailMemoryInKB) * 0.001)) + "MBs / " + to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
 	Mesh::num_meshes_rendered = 0;
 	Mesh::num_triangles_rendered = 0;
+
+	//Renderer stats
+	Renderer* renderer = Game::instance->renderer;
+	if (renderer)
+	{
+		str += "\nRCs: " + to_string(renderer->render_calls.size()) + " Arena HWM: " + to_string(renderer->render_calls.high_water_mark) + " Allocs: " + to_string(renderer->render_calls.frame_allocations);
+		str += "\nState changes: " + to_string(renderer->num_state_changes) + " (unsorted: " + to_string(renderer->num_state_changes_unsorted) + ") Skipped GL calls: " + to_string(renderer->gl_state.num_skipped_calls + Shader::num_skipped_calls);
+		str += "\nLights: " + to_string(renderer->lights_data.size()) + (renderer->clusters_ready ? " Clustered, indices: " + to_string(renderer->cluster_lights.size()) : " Per pass: " + to_string(renderer->max_lights_per_pass));
+		str += "\nShadow pass: " + to_string(renderer->shadow_pass_ms) + " ms Updated: " + to_string(renderer->num_shadow_updates) + " Cached: " + to_string(renderer->num_shadow_cached);
+		renderer->gl_state.num_skipped_calls = 0;
+	}
+	str += "\n" + ResourceManager::getStats();
+	Shader::num_skipped_calls = 0;
 	return str;
 }
 
@@ -17,6 +17,23 @@ long getTime();
 bool readFile(const std::string& filename, std::string& content);
 bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer);
 
+//Read-only memory mapping of a whole file, the pages are loaded by the OS when they are accessed
+struct sMappedFile {
+	const char* data = NULL;
+	size_t size = 0;
+#ifdef WIN32
+	void* file_handle = NULL;
+	void* mapping_handle = NULL;
+#endif
+};
+bool mapFile(const std::string& filename, sMappedFile& file);
+void unmapFile(sMappedFile& file);
+
+//LZ4 block format compression, returns the compressed size or 0 if it doesnt fit in dst_capacity
+int compressLZ(const char* src, int src_size, char* dst, int dst_capacity);
+//returns false if the data is corrupted or doesnt decompress to exactly dst_size bytes
+bool decompressLZ(const char* src, int src_size, char* dst, int dst_size);
+
 //generic purposes fuctions
 void drawGrid();
 bool drawText(float x, float y, std::string text, Vector3 c, float scale = 1);